@@ -0,0 +1,159 @@
+/*
+ * AdaptiveSampler.cpp
+ *
+ *  Importance sampling of the depth pixels for a point budget, with an ordered-dither selection.
+ */
+
+#include "AdaptiveSampler.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+const int ditherSize = 16;
+
+// 16x16 Bayer matrix: bit reversal of the interleaved bits of (i xor j, i), thresholds in ]0,1[
+struct DitherMatrix
+{
+    float t[ditherSize][ditherSize];
+
+    DitherMatrix()
+    {
+        for (int i = 0; i < ditherSize; i++)
+            for (int j = 0; j < ditherSize; j++)
+            {
+                int v = 0;
+                for (int bit = 0; bit < 4; bit++)
+                    v = (v << 2) | ((((i >> bit) ^ (j >> bit)) & 1) << 1) | ((i >> bit) & 1);
+                t[i][j] = (v + 0.5f)/(ditherSize*ditherSize);
+            }
+    }
+};
+
+const DitherMatrix dither;
+
+struct Importance
+{
+    const cv::Mat *depth, *mask, *dist;
+    cv::Mat *importance;
+    std::vector<double> *rowTotals;
+    const float *contourFactor;
+    float fx, fy, maxSlope2;
+
+    void operator()(int begin, int end) const
+    {
+        int height = depth->rows, width = depth->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const float *z = depth->ptr<float>(i);
+            const float *zu = depth->ptr<float>(std::max(i-1, 0));
+            const float *zd = depth->ptr<float>(std::min(i+1, height-1));
+            const unsigned char *m = mask->ptr<unsigned char>(i);
+            const unsigned char *d = dist->empty() ? NULL : dist->ptr<unsigned char>(i);
+            float *w = importance->ptr<float>(i);
+            double rowTotal = 0;
+
+            for (int j = 0; j < width; j++)
+            {
+                float zc = z[j];
+                if (!m[j] || !(zc > 0)) { w[j] = 0; continue; }
+
+                // slope from the central differences, in depth per metric pixel size (z/f)
+                float zl = z[std::max(j-1, 0)], zr = z[std::min(j+1, width-1)];
+                float gx = (zl > 0 && zr > 0) ? (zr - zl)*0.5f*fx/zc : 0;
+                float gy = (zu[j] > 0 && zd[j] > 0) ? (zd[j] - zu[j])*0.5f*fy/zc : 0;
+                float stretch2 = std::min(1 + gx*gx + gy*gy, maxSlope2);
+
+                float wj = zc*zc*sqrtf(stretch2);
+                if (d) wj *= contourFactor[d[j]];
+                w[j] = wj;
+                rowTotal += wj;
+            }
+            (*rowTotals)[i] = rowTotal;
+        }
+    }
+};
+
+struct Select
+{
+    const cv::Mat *importance;
+    std::vector< std::vector<cv::Point> > *rows;
+    float scale;
+
+    void operator()(int begin, int end) const
+    {
+        int width = importance->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const float *w = importance->ptr<float>(i);
+            const float *t = dither.t[i % ditherSize];
+            std::vector<cv::Point> &row = (*rows)[i];
+            row.clear();
+            for (int j = 0; j < width; j++)
+                if (w[j]*scale > t[j % ditherSize]) row.push_back(cv::Point(j, i));
+        }
+    }
+};
+
+}
+
+AdaptiveSampler::AdaptiveSampler() {
+budget = 2000;
+contourBand = 4;
+contourGain = 4;
+maxSlope = 4;
+}
+
+AdaptiveSampler::~AdaptiveSampler() {
+}
+
+int AdaptiveSampler::sample(const cv::Mat &depth, const cv::Mat &mask, const cv::Mat &dist, double fx, double fy, std::vector<cv::Point> &pixels)
+{
+    CV_Assert(depth.type() == CV_32FC1 && mask.type() == CV_8UC1 && mask.size() == depth.size());
+    CV_Assert(dist.empty() || (dist.type() == CV_8UC1 && dist.size() == depth.size()));
+
+    pixels.clear();
+    int height = depth.rows, width = depth.cols;
+    if (budget <= 0 || height == 0 || width == 0) return 0;
+
+    float contourFactor[256];
+    for (int d = 0; d < 256; d++)
+        contourFactor[d] = (float)(1 + (contourBand > 0 ? contourGain*exp(-d/contourBand) : 0));
+    float maxSlope2 = (float)(maxSlope*maxSlope);
+
+    importance.create(height, width, CV_32FC1);
+    rows.resize(height);
+    rowTotals.resize(height);
+
+    // importance: the 1/(fx fy) factor of the footprint is common to all pixels and left out
+    Importance weigh;
+    weigh.depth = &depth;
+    weigh.mask = &mask;
+    weigh.dist = &dist;
+    weigh.importance = &importance;
+    weigh.rowTotals = &rowTotals;
+    weigh.contourFactor = contourFactor;
+    weigh.fx = (float)fx;
+    weigh.fy = (float)fy;
+    weigh.maxSlope2 = maxSlope2;
+    TaskPool &pool = TaskPool::instance();
+    pool.parallelFor(0, height, weigh);
+
+    // summed in row order, the selection does not depend on the number of threads
+    double total = 0;
+    for (int i = 0; i < height; i++) total += rowTotals[i];
+    if (total <= 0) return 0;
+
+    Select select;
+    select.importance = &importance;
+    select.rows = &rows;
+    select.scale = (float)(budget/total);
+    pool.parallelFor(0, height, select);
+
+    for (int i = 0; i < height; i++)
+        pixels.insert(pixels.end(), rows[i].begin(), rows[i].end());
+    return (int)pixels.size();
+}
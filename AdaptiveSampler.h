@@ -0,0 +1,49 @@
+/*
+ * AdaptiveSampler.h
+ *
+ *  Selection of the depth pixels turned into target points, for a given number of points.
+ *  Each valid pixel gets an importance proportional to the surface it covers: its metric
+ *  footprint (z^2 / (fx fy)), stretched by the surface slope seen from the camera, and raised
+ *  near the silhouette contour (distance image). The pixels are then picked with probability
+ *  budget * importance / total importance against a tiled ordered-dither threshold, which keeps
+ *  the selection stratified (no clusters, no holes) without random numbers.
+ */
+
+#ifndef ADAPTIVESAMPLER_H_
+#define ADAPTIVESAMPLER_H_
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+class AdaptiveSampler {
+
+public :
+
+AdaptiveSampler();
+virtual ~AdaptiveSampler();
+
+void setBudget(int _budget){budget = _budget;}
+// pixels at distance d from the contour have their importance multiplied by 1 + contourGain*exp(-d/contourBand)
+void setContourBand(double _contourBand){contourBand = _contourBand;}
+void setContourGain(double _contourGain){contourGain = _contourGain;}
+// bound of the slope stretch, depth discontinuities would otherwise take the whole budget
+void setMaxSlope(double _maxSlope){maxSlope = _maxSlope;}
+
+// depth: CV_32FC1, mask: CV_8UC1 non zero where the depth may be sampled,
+// dist: CV_8UC1 distance to the contour in pixels or empty; fills pixels and returns their number
+int sample(const cv::Mat &depth, const cv::Mat &mask, const cv::Mat &dist, double fx, double fy, std::vector<cv::Point> &pixels);
+
+private :
+
+int budget;
+double contourBand;
+double contourGain;
+double maxSlope;
+
+cv::Mat importance;
+std::vector<double> rowTotals;
+std::vector< std::vector<cv::Point> > rows;
+};
+
+#endif /* ADAPTIVESAMPLER_H_ */
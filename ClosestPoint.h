@@ -41,6 +41,10 @@
 #include <sofa/helper/OptionsGroup.h>
 #include <sofa/helper/kdTree.inl>
 
+#include "FrameState.h"
+#include "SpatialHash.h"
+#include "TaskPool.h"
+
 #include <vector>
 #include <opencv/cv.h>
 #include <boost/thread.hpp>
@@ -86,6 +90,7 @@ public:
     typedef Data<typename DataTypes::VecDeriv> DataVecDeriv;
     typedef sofa::defaulttype::Vector4 Vector4;
     typedef sofa::defaulttype::Vector2 Vec2;
+    typedef sofa::defaulttype::Vector3 Vec3;
 
     typedef core::behavior::MechanicalState<DataTypes> MechanicalState;
     typename core::behavior::MechanicalState<DataTypes> *mstate;
@@ -111,12 +116,28 @@ public:
 
     void filterCorrespondences();
     void updateClosestPoints();
+    // closest[i]: nearest of the positions indexed by tree to queries[i], on the task pool
+    void findClosest(const KDT& tree, const VecCoord& queries, const VecCoord& positions, vector< distanceSet >& closest);
+    // same for the target points, searched in the spatial hash or in the k-d tree
+    void findClosestTarget(const VecCoord& queries, const VecCoord& tp, vector< distanceSet >& closest);
+    void findClosestTarget(const Coord& query, const VecCoord& tp, distanceSet& closest);
+    // times the construction and the queries of both indices on the current target
+    void benchmarkTargetIndex(const VecCoord& queries, const VecCoord& tp);
+    // projective association through the pixel index map of the frame state, returns the number of
+    // queries matched in their window, the others are searched in 3D
+    int findProjective(const VecCoord& queries, const VecCoord& tp, vector< distanceSet >& closest);
+    // times the projective association against the 3D search it replaces
+    void benchmarkProjective(const VecCoord& queries, const VecCoord& tp);
     void updateClosestPointsSoft();
     void updateClosestPointsPCL();
     void updateClosestPointsContours();
     void updateClosestPointsVisibleContours();
     void updateClosestPointsContoursNormals();
 
+    // correspondence scheduling: matches are recomputed once per frame (or every updatePeriod steps)
+    bool correspondencesOutdated(int frame, const VecCoord& x, unsigned int nbs, unsigned int nbt);
+    void recordCorrespondences(int frame, const VecCoord& x, unsigned int nbs, unsigned int nbt);
+
     Data<unsigned int> cacheSize;
     Data<Real> blendingFactor;
     Data<Real> outlierThreshold;
@@ -126,6 +147,40 @@ public:
     Data<bool> rejectOutsideBbox;
     defaulttype::BoundingBox targetBbox;
 
+    // nearest neighbour index of the target: shared with the other consumers of the frame state
+    Data<bool> useSpatialHash;
+    Data<bool> benchmarkIndex;
+    SpatialHash localTargetIndex;
+    const SpatialHash* targetIndex; // NULL when the k-d tree is used
+
+    // source to target matches searched in a pixel window around the projection of the source points
+    Data<bool> projectiveAssociation;
+    Data<int> projectiveWindow;
+
+    Data<int> updatePeriod;
+    Data<Real> reuseDisplacement;
+    Data<Vec3> correspondenceStats;
+    int matchFrame;
+    int nstepsSinceMatch;
+    int nupdates, nreuses;
+    unsigned int matchSourceSize, matchTargetSize;
+    VecCoord matchPositions; // positions of the mesh when the correspondences were computed
+    std::vector<int> previousMatches;
+
+    // shared per-frame data: when set, the visible source, contours and target are read from it
+    // instead of the local Data, and the target index is rebuilt when its version changes
+    FrameState<DataTypes>* frameState;
+    unsigned int targetTreeVersion;
+    bool targetOutdated() const { return frameState && frameState->targetVersion.getValue() != targetTreeVersion; }
+
+    const VecCoord& getSourceVisiblePositions() const { return frameState ? frameState->sourceVisiblePositions.getValue() : sourceVisiblePositions.getValue(); }
+    const VecCoord& getSourceContourPositions() const { return frameState ? frameState->sourceContourPositions.getValue() : sourceContourPositions.getValue(); }
+    const helper::vector< Vec2 >& getSourceContourNormals() const { return frameState ? frameState->sourceContourNormals.getValue() : sourceContourNormals.getValue(); }
+    const vector< bool >& getSourceBorder() const { return frameState ? frameState->sourceBorder.getValue() : sourceBorder; }
+    const VecCoord& getTargetPositions() const { return frameState ? frameState->targetPositions.getValue() : targetPositions.getValue(); }
+    const VecCoord& getTargetContourPositions() const { return frameState ? frameState->targetContourPositions.getValue() : targetContourPositions.getValue(); }
+    const vector< bool >& getTargetBorder() const { return frameState ? frameState->targetBorder.getValue() : targetBorder; }
+
 
     // source mesh data
     Data< VecCoord > sourcePositions;
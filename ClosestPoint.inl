@@ -32,10 +32,6 @@
 #include <iostream>
 #include <map>
 
-#ifdef USING_OMP_PRAGMAS
-    #include <omp.h>
-#endif
-
 #include <algorithm> 
 #include "ClosestPoint.h"
 
@@ -54,6 +50,97 @@ namespace objectmodel
 using namespace sofa::defaulttype;
 using namespace helper;
 
+// closest point in a k-d tree of each query of a range, the queries are independent
+template<class KDT, class VecCoord>
+struct ClosestPointRange
+{
+    const KDT *tree;
+    const VecCoord *queries, *positions;
+    vector< typename KDT::distanceSet > *closest;
+
+    void operator()(int begin, int end) const
+    {
+        for (int i = begin; i < end; i++)
+            tree->getNClosest((*closest)[i], (*queries)[i], *positions, 1);
+    }
+};
+
+// closest point in the spatial hash, with the squared distance as returned by the k-d tree
+template<class Coord, class distanceSet>
+inline void closestInIndex(const SpatialHash& index, const Coord& q, distanceSet& closest)
+{
+    closest.clear();
+    double d2;
+    int j = index.nearest(cv::Point3d(q[0], q[1], q[2]), d2);
+    if (j >= 0) closest.insert(typename distanceSet::value_type(d2, (unsigned int)j));
+}
+
+template<class VecCoord, class distanceSet>
+struct ClosestPointHashRange
+{
+    const SpatialHash *index;
+    const VecCoord *queries;
+    vector< distanceSet > *closest;
+
+    void operator()(int begin, int end) const
+    {
+        for (int i = begin; i < end; i++)
+            closestInIndex(*index, (*queries)[i], (*closest)[i]);
+    }
+};
+
+// projective association: the query is projected in the depth image and matched to the nearest, in 3D,
+// of the target points back-projected from the pixels of the window around its projection; the queries
+// behind the camera or without target point in their window fall back to the 3D search
+template<class KDT, class VecCoord>
+struct ProjectiveRange
+{
+    typedef typename KDT::distanceSet distanceSet;
+    const cv::Mat *pixelIndex;
+    const VecCoord *queries, *positions;
+    const SpatialHash *index; // NULL: k-d tree
+    const KDT *tree;
+    vector< distanceSet > *closest;
+    std::vector<char> *projected; // not vector<bool>, written concurrently
+    double fx, fy, cx, cy;
+    int window;
+
+    void operator()(int begin, int end) const
+    {
+        int height = pixelIndex->rows, width = pixelIndex->cols;
+        int nbt = (int)positions->size();
+        for (int i = begin; i < end; i++)
+        {
+            distanceSet &c = (*closest)[i];
+            c.clear();
+            const typename VecCoord::value_type &q = (*queries)[i];
+            int best = -1;
+            double best2 = 0;
+            if (q[2] > 0)
+            {
+                int u = cvRound(fx*q[0]/q[2] + cx), v = cvRound(fy*q[1]/q[2] + cy);
+                int u0 = std::max(u - window, 0), u1 = std::min(u + window, width - 1);
+                int v0 = std::max(v - window, 0), v1 = std::min(v + window, height - 1);
+                for (int y = v0; y <= v1; y++)
+                {
+                    const int *idx = pixelIndex->ptr<int>(y);
+                    for (int x = u0; x <= u1; x++)
+                    {
+                        int j = idx[x];
+                        if (j < 0 || j >= nbt) continue;
+                        double d2 = ((*positions)[j] - q).norm2();
+                        if (best < 0 || d2 < best2) { best = j; best2 = d2; }
+                    }
+                }
+            }
+            (*projected)[i] = best >= 0;
+            if (best >= 0) c.insert(typename distanceSet::value_type(best2, (unsigned int)best));
+            else if (index) closestInIndex(*index, q, c);
+            else tree->getNClosest(c, q, *positions, 1);
+        }
+    }
+};
+
 template <class DataTypes>
 ClosestPoint<DataTypes>::ClosestPoint()
     : Inherit()
@@ -63,8 +150,25 @@ ClosestPoint<DataTypes>::ClosestPoint()
     , useContour(initData(&useContour,false,"useContour","Emphasize forces close to the target contours"))
     , useVisible(initData(&useVisible,true,"useVisible","Use the vertices of the visible surface of the source mesh"))
     , useDistContourNormal(initData(&useDistContourNormal,false,"useVisible","Use the vertices of the visible surface of the source mesh"))
+    , useSpatialHash(initData(&useSpatialHash,true,"useSpatialHash","Search the target point cloud with a spatial hash (shared through the frame state) instead of a k-d tree."))
+    , benchmarkIndex(initData(&benchmarkIndex,false,"benchmarkIndex","Time the k-d tree and the spatial hash on the target point cloud at each correspondence update."))
+    , projectiveAssociation(initData(&projectiveAssociation,false,"projectiveAssociation","Match the source points to the target points back-projected from the pixels around their projection in the depth image, instead of searching the whole target cloud (needs a FrameState)."))
+    , projectiveWindow(initData(&projectiveWindow,4,"projectiveWindow","Half size in pixels of the window searched around the projection, at least the sampling step of the target points."))
+    , updatePeriod(initData(&updatePeriod,0,"updatePeriod","Recompute the correspondences every updatePeriod steps within a frame (0: once per frame)."))
+    , reuseDisplacement(initData(&reuseDisplacement,(Real)0,"reuseDisplacement","Recompute the correspondences when a vertex moved more than this distance since the last matching (0: disabled)."))
+    , correspondenceStats(initData(&correspondenceStats,Vec3(),"correspondenceStats","Number of correspondence updates, of reuses, and ratio of matches that changed at the last update."))
 {
     iter_im = 0;
+    matchFrame = -1;
+    nstepsSinceMatch = 0;
+    nupdates = 0;
+    nreuses = 0;
+    matchSourceSize = 0;
+    matchTargetSize = 0;
+    frameState = NULL;
+    targetTreeVersion = 0;
+    targetIndex = NULL;
+    correspondenceStats.setReadOnly(true);
 }
 
 template <class DataTypes>
@@ -186,7 +290,7 @@ void ClosestPoint<DataTypes>::initSourceVisible()
 {
     // build k-d tree
 	
-    const VecCoord&  p = sourceVisiblePositions.getValue();
+    const VecCoord&  p = getSourceVisiblePositions();
 	
     sourceKdTree.build(p);
     // detect border
@@ -201,9 +305,17 @@ void ClosestPoint<DataTypes>::initSourceVisible()
 template<class DataTypes>
 void ClosestPoint<DataTypes>::initTarget()
 {
-    const VecCoord&  p = targetPositions.getValue();
+    const VecCoord&  p = getTargetPositions();
 	
-    targetKdTree.build(p);
+    targetIndex = NULL;
+    if (!useSpatialHash.getValue()) targetKdTree.build(p);
+    else if (frameState) targetIndex = &frameState->getTargetIndex();
+    else
+    {
+        localTargetIndex.build(p);
+        targetIndex = &localTargetIndex;
+    }
+    if (frameState) targetTreeVersion = frameState->targetVersion.getValue();
 
     // updatebbox
     for(unsigned int i=0;i<p.size();++i)    targetBbox.include(p[i]);
@@ -217,7 +329,7 @@ template<class DataTypes>
 void ClosestPoint<DataTypes>::initTargetContour()
 {
 
-    const VecCoord&  p = targetContourPositions.getValue();
+    const VecCoord&  p = getTargetContourPositions();
     targetContourKdTree.build(p);
 
     // updatebbox
@@ -229,18 +341,222 @@ void ClosestPoint<DataTypes>::initTargetContour()
 }
 
 template<class DataTypes>
-void ClosestPoint<DataTypes>::updateClosestPoints()
+bool ClosestPoint<DataTypes>::correspondencesOutdated(int frame, const VecCoord& x, unsigned int nbs, unsigned int nbt)
 {
-    VecCoord x;
+    nstepsSinceMatch++;
 
-        if (!useVisible.getValue())
-            x = sourcePositions.getValue();
-        else
-            x = sourceVisiblePositions.getValue();
+    bool outdated = false;
+    if (frame != matchFrame) outdated = true;
+    else if (updatePeriod.getValue() > 0 && nstepsSinceMatch >= updatePeriod.getValue()) outdated = true;
+    else if (nbs != matchSourceSize || nbt != matchTargetSize || x.size() != matchPositions.size()) outdated = true;
+    else if (reuseDisplacement.getValue() > 0)
+    {
+        // cheap validity check: the cached matches hold as long as the mesh did not move too much
+        Real dmax2 = reuseDisplacement.getValue()*reuseDisplacement.getValue();
+        for (unsigned int i=0; i<x.size() && !outdated; i++)
+            if ((x[i]-matchPositions[i]).norm2() > dmax2) outdated = true;
+    }
+
+    if (!outdated)
+    {
+        nreuses++;
+        Vec3 stats = correspondenceStats.getValue();
+        stats[1] = nreuses;
+        correspondenceStats.setValue(stats);
+    }
+    return outdated;
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::recordCorrespondences(int frame, const VecCoord& x, unsigned int nbs, unsigned int nbt)
+{
+    matchFrame = frame;
+    nstepsSinceMatch = 0;
+    matchSourceSize = nbs;
+    matchTargetSize = nbt;
+    matchPositions.assign(x.begin(),x.end());
+    nupdates++;
+
+    std::vector<int> matches;
+    matches.reserve(closestSource.size()+closestTarget.size());
+    for (unsigned int i=0; i<closestSource.size(); i++)
+        matches.push_back(closestSource[i].size() ? (int)closestSource[i].begin()->second : -1);
+    for (unsigned int i=0; i<closestTarget.size(); i++)
+        matches.push_back(closestTarget[i].size() ? (int)closestTarget[i].begin()->second : -1);
+
+    int nchanged = matches.size();
+    if (matches.size() == previousMatches.size())
+    {
+        nchanged = 0;
+        for (unsigned int i=0; i<matches.size(); i++)
+            if (matches[i] != previousMatches[i]) nchanged++;
+    }
+    previousMatches.swap(matches);
+
+    Vec3 stats;
+    stats[0] = nupdates;
+    stats[1] = nreuses;
+    stats[2] = previousMatches.size() ? (double)nchanged/(double)previousMatches.size() : 0;
+    correspondenceStats.setValue(stats);
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::findClosest(const KDT& tree, const VecCoord& queries, const VecCoord& positions, vector< distanceSet >& closest)
+{
+    ClosestPointRange<KDT, VecCoord> range;
+    range.tree = &tree;
+    range.queries = &queries;
+    range.positions = &positions;
+    range.closest = &closest;
+    TaskPool::instance().parallelFor(0, (int)queries.size(), range);
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::findClosestTarget(const VecCoord& queries, const VecCoord& tp, vector< distanceSet >& closest)
+{
+    if (benchmarkIndex.getValue()) benchmarkTargetIndex(queries, tp);
+    if (projectiveAssociation.getValue() && frameState && !frameState->targetPixelIndex.empty())
+    {
+        if (benchmarkIndex.getValue()) benchmarkProjective(queries, tp);
+        findProjective(queries, tp, closest);
+        return;
+    }
+    if (!targetIndex)
+    {
+        findClosest(targetKdTree, queries, tp, closest);
+        return;
+    }
+
+    ClosestPointHashRange<VecCoord, distanceSet> range;
+    range.index = targetIndex;
+    range.queries = &queries;
+    range.closest = &closest;
+    TaskPool::instance().parallelFor(0, (int)queries.size(), range);
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::findClosestTarget(const Coord& query, const VecCoord& tp, distanceSet& closest)
+{
+    if (targetIndex) closestInIndex(*targetIndex, query, closest);
+    else targetKdTree.getNClosest(closest, query, tp, 1);
+}
+
+template<class DataTypes>
+int ClosestPoint<DataTypes>::findProjective(const VecCoord& queries, const VecCoord& tp, vector< distanceSet >& closest)
+{
+    std::vector<char> projected(queries.size());
+    ProjectiveRange<KDT, VecCoord> range;
+    range.pixelIndex = &frameState->targetPixelIndex;
+    range.queries = &queries;
+    range.positions = &tp;
+    range.index = targetIndex;
+    range.tree = &targetKdTree;
+    range.closest = &closest;
+    range.projected = &projected;
+    range.fx = rgbIntrinsicMatrix(0,0);
+    range.fy = rgbIntrinsicMatrix(1,1);
+    range.cx = rgbIntrinsicMatrix(0,2);
+    range.cy = rgbIntrinsicMatrix(1,2);
+    range.window = std::max(projectiveWindow.getValue(), 0);
+    TaskPool::instance().parallelFor(0, (int)queries.size(), range);
+
+    int nprojected = 0;
+    for (unsigned int i = 0; i < projected.size(); i++) if (projected[i]) nprojected++;
+    return nprojected;
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::benchmarkProjective(const VecCoord& queries, const VecCoord& tp)
+{
+    vector< distanceSet > fromSearch(queries.size()), fromProjection(queries.size());
+
+    double time = (double)getTickCount();
+    if (targetIndex)
+    {
+        ClosestPointHashRange<VecCoord, distanceSet> range;
+        range.index = targetIndex;
+        range.queries = &queries;
+        range.closest = &fromSearch;
+        TaskPool::instance().parallelFor(0, (int)queries.size(), range);
+    }
+    else findClosest(targetKdTree, queries, tp, fromSearch);
+    double searchTime = ((double)getTickCount() - time)/getTickFrequency();
+
+    time = (double)getTickCount();
+    int nprojected = findProjective(queries, tp, fromProjection);
+    double projectionTime = ((double)getTickCount() - time)/getTickFrequency();
+
+    // the projective match is never closer than the nearest point, compare the matches and the distances
+    int changed = 0, count = 0;
+    Real search = 0, projection = 0;
+    for (unsigned int i = 0; i < queries.size(); i++)
+    {
+        if (!fromSearch[i].size() || !fromProjection[i].size()) continue;
+        if (fromSearch[i].begin()->second != fromProjection[i].begin()->second) changed++;
+        search += sqrt(fromSearch[i].begin()->first);
+        projection += sqrt(fromProjection[i].begin()->first);
+        count++;
+    }
+    if (count) { search /= count; projection /= count; }
+
+    std::cout << "TIME CLOSESTPOINT PROJECTIVE points " << tp.size() << " queries " << queries.size()
+              << " projected " << nprojected << " search " << searchTime << " projective " << projectionTime
+              << " changed " << changed << " mean distance " << search << " " << projection << std::endl;
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::benchmarkTargetIndex(const VecCoord& queries, const VecCoord& tp)
+{
+    vector< distanceSet > fromTree(queries.size()), fromHash(queries.size());
+
+    double time = (double)getTickCount();
+    KDT tree;
+    tree.build(tp);
+    double treeBuild = ((double)getTickCount() - time)/getTickFrequency();
+    time = (double)getTickCount();
+    findClosest(tree, queries, tp, fromTree);
+    double treeQuery = ((double)getTickCount() - time)/getTickFrequency();
+
+    time = (double)getTickCount();
+    SpatialHash index;
+    index.build(tp);
+    double hashBuild = ((double)getTickCount() - time)/getTickFrequency();
+    time = (double)getTickCount();
+    ClosestPointHashRange<VecCoord, distanceSet> range;
+    range.index = &index;
+    range.queries = &queries;
+    range.closest = &fromHash;
+    TaskPool::instance().parallelFor(0, (int)queries.size(), range);
+    double hashQuery = ((double)getTickCount() - time)/getTickFrequency();
+
+    // the neighbours may differ on ties, not their distances
+    int mismatches = 0;
+    for (unsigned int i = 0; i < queries.size(); i++)
+    {
+        if (fromTree[i].size() != fromHash[i].size()) mismatches++;
+        else if (fromTree[i].size())
+        {
+            Real d = fromTree[i].begin()->first;
+            if (fabs(d - fromHash[i].begin()->first) > 1e-5*d) mismatches++;
+        }
+    }
+
+    std::cout << "TIME CLOSESTPOINT INDEX points " << tp.size() << " queries " << queries.size()
+              << " kdtree " << treeBuild << " " << treeQuery << " hash " << hashBuild << " " << hashQuery
+              << " mismatches " << mismatches << std::endl;
+}
+
+template<class DataTypes>
+void ClosestPoint<DataTypes>::updateClosestPoints()
+{
+    const VecCoord& x = useVisible.getValue() ? getSourceVisiblePositions() : sourcePositions.getValue();
 	
-    const VecCoord&  tp = targetPositions.getValue();
+    const VecCoord&  tp = getTargetPositions();
     unsigned int nbs=x.size(), nbt=tp.size();
 
+    const vector< bool >& sborder = getSourceBorder();
+    const vector< bool >& tborder = getTargetBorder();
+
     distanceSet emptyset;
 	
         if(nbs!=closestSource.size()) {if (!useVisible.getValue()) initSource(); else initSourceVisible();  closestSource.resize(nbs);	closestSource.fill(emptyset); cacheDist.resize(nbs); cacheDist.fill((Real)0.); cacheDist2.resize(nbs); cacheDist2.fill((Real)0.); previousX.assign(x.begin(),x.end());}
@@ -253,36 +569,13 @@ void ClosestPoint<DataTypes>::updateClosestPoints()
 	cacheDist2.fill((Real)0.); 
         previousX.assign(x.begin(),x.end());}*/
 
-        if(nbt!=closestTarget.size()) {initTarget();  closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
+        if(nbt!=closestTarget.size() || targetOutdated()) {initTarget();  closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
 	
         if(blendingFactor.getValue()<1 && nbt>0)
         {
 
         //unsigned int count=0;
-#ifdef USING_OMP_PRAGMAS
-#pragma omp parallel for
-#endif
-            for(int i=0;i<(int)nbs;i++)
-            {
-            /*Real dx=(previousX[i]-x[i]).norm();
-            //  closest point caching [cf. Simon96 thesis]
-            if(dx>=cacheDist[i] || closestSource[i].size()==0)
-            {
-                targetKdTree.getNClosest(closestSource[i],x[i],this->cacheSize.getValue() );
-                typename distanceSet::iterator it0=closestSource[i].begin(), it1=it0; it1++;
-                typename distanceSet::reverse_iterator itn=closestSource[i].rbegin();
-                cacheDist[i] =((itn->first)-(it0->first))*(Real)0.5;
-                cacheDist2[i]=((it1->first)-(it0->first))*(Real)0.5;
-                previousX[i]=x[i];
-            }
-            else if(dx>=cacheDist2[i]) // in the cache -> update N-1 distances 
-            {
-                targetKdTree.updateCachedDistances(closestSource[i],x[i]);
-                //count++;
-            }*/
-            targetKdTree.getNClosest(closestSource[i],x[i],targetPositions.getValue(),1);
-            //std::cout << " ok kdtree " << x[i][0] << " " << x[i][1] << std::endl;
-            }
+            findClosestTarget(x, tp, closestSource);
 
         //std::cout<<(Real)count*(Real)100./(Real)nbs<<" % cached"<<std::endl;
         }
@@ -293,29 +586,7 @@ void ClosestPoint<DataTypes>::updateClosestPoints()
             if (!useVisible.getValue()) initSource();
             else initSourceVisible();
 
-        /*#ifdef USING_OMP_PRAGMAS
-            #pragma omp parallel for
-        #endif*/
-            if (!useVisible.getValue())
-            {
-                for(int i=0;i<(int)nbt;i++)
-                {
-                    //if(!targetBackground[i])
-                    {
-                        sourceKdTree.getNClosest(closestTarget[i],tp[i],sourcePositions.getValue(),1);
-                    }
-                }
-            }
-            else
-            {
-                for(int i=0;i<(int)nbt;i++)
-                {
-                    //if(!targetBackground[i])
-                    {
-                        sourceKdTree.getNClosest(closestTarget[i],tp[i],sourceVisiblePositions.getValue(),1);
-                    }
-                }
-            }
+            findClosest(sourceKdTree, tp, useVisible.getValue() ? getSourceVisiblePositions() : sourcePositions.getValue(), closestTarget);
         }
     this->sourceIgnored.resize(nbs); sourceIgnored.fill(false);
     this->targetIgnored.resize(nbt); targetIgnored.fill(false);
@@ -385,8 +656,8 @@ void ClosestPoint<DataTypes>::updateClosestPoints()
 
         if(rejectBorders.getValue())
         {
-            for(unsigned int i=0;i<nbs;i++) if(closestSource[i].size()) if(targetBorder[closestSource[i].begin()->second]) sourceIgnored[i]=true;
-            for(unsigned int i=0;i<nbt;i++) if(closestTarget[i].size()) if(sourceBorder[closestTarget[i].begin()->second]) targetIgnored[i]=true;
+            for(unsigned int i=0;i<nbs;i++) if(closestSource[i].size()) if(tborder[closestSource[i].begin()->second]) sourceIgnored[i]=true;
+            for(unsigned int i=0;i<nbt;i++) if(closestTarget[i].size()) if(sborder[closestTarget[i].begin()->second]) targetIgnored[i]=true;
         }
     /*if(normalThreshold.getValue()>(Real)-1. && sourceNormals.getValue().size()!=0 && targetNormals.getValue().size()!=0) {
         ReadAccessor< Data< VecCoord > > sn(sourceNormals);
@@ -400,19 +671,18 @@ template<class DataTypes>
 void ClosestPoint<DataTypes>::updateClosestPointsContours()
 {
 	
-    VecCoord x,x0;
-    if (!useVisible.getValue())
-    x = sourcePositions.getValue();
-    else  x = sourceVisiblePositions.getValue();
-
-    x0 = sourcePositions.getValue();
+    const VecCoord& x = useVisible.getValue() ? getSourceVisiblePositions() : sourcePositions.getValue();
+    const VecCoord& x0 = sourcePositions.getValue();
 	
-    const VecCoord& tp = targetPositions.getValue();
-    const VecCoord& xcp = sourceContourPositions.getValue();
-    const VecCoord& tcp = targetContourPositions.getValue();
+    const VecCoord& tp = getTargetPositions();
+    const VecCoord& xcp = getSourceContourPositions();
+    const VecCoord& tcp = getTargetContourPositions();
 
     unsigned int nbs=x.size(), nbt=tp.size(), nbtc = tcp.size(), nbsc = xcp.size(), nbs0=x0.size();
 
+    const vector< bool >& sborder = getSourceBorder();
+    const vector< bool >& tborder = getTargetBorder();
+
     distanceSet emptyset;
 	
         if(nbs!=closestSource.size())
@@ -429,7 +699,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
             previousX.assign(x.begin(),x.end());
         }
 
-        if(nbt!=closestTarget.size()) {initTarget();  initTargetContour(); closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
+        if(nbt!=closestTarget.size() || targetOutdated()) {initTarget();  initTargetContour(); closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
 
     indicesTarget.resize(0);
 		
@@ -444,14 +714,14 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
 		for(int i=0;i<(int)nbt;i++)
                 {
                     //int id = indicesVisible[i];
-                    if(targetBorder[i])// && t%niterations.getValue() == 0)
+                    if(tborder[i])// && t%niterations.getValue() == 0)
                     {
                         double distmin = 10;
                         double dist;
                         int kmin;
                             for (int k = 0; k < x0.size(); k++)
                             {
-                                if (sourceBorder[k])
+                                if (sborder[k])
                                 {
                                     dist = (tp[i][0] - x0[k][0])*(tp[i][0] - x0[k][0]) + (tp[i][1] - x0[k][1])*(tp[i][1] - x0[k][1]) + (tp[i][2] - x0[k][2])*(tp[i][2] - x0[k][2]);
 					if (dist < distmin)
@@ -475,14 +745,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
         }*/
 
     //unsigned int count=0;
-#ifdef USING_OMP_PRAGMAS
-        #pragma omp parallel for
-#endif
-        for(int i=0;i<(int)nbs;i++)
-        {	
-            //if(sourceVisible[i])
-            targetKdTree.getNClosest(closestSource[i],x[i],targetPositions.getValue(),1);
-        }
+        findClosestTarget(x, tp, closestSource);
     //std::cout<<(Real)count*(Real)100./(Real)nbs<<" % cached"<<std::endl;
     }		
     indices.resize(0);
@@ -495,7 +758,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
     int kc = 0;
         for(int i=0;i<(int)nbs0;i++)
         {
-            if(sourceBorder[i])// && t%niterations.getValue() == 0)
+            if(sborder[i])// && t%niterations.getValue() == 0)
             {
 
                 double distmin = 1000;
@@ -524,7 +787,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
                         double x_u_2 = ((x0[i][0])*rgbIntrinsicMatrix(0,0)/x0[i][2] + rgbIntrinsicMatrix(0,2)) - ((tcp[k][0])*rgbIntrinsicMatrix(0,0)/tcp[k][2] + rgbIntrinsicMatrix(0,2));
                         double x_v_2 = ((x0[i][1])*rgbIntrinsicMatrix(1,1)/x0[i][2] + rgbIntrinsicMatrix(1,2)) - ((tcp[k][1])*rgbIntrinsicMatrix(1,1)/tcp[k][2] + rgbIntrinsicMatrix(1,2));
 
-                        dist2 = abs(sourceContourNormals.getValue()[kc][1]*x_u_2 - sourceContourNormals.getValue()[kc][0]*x_v_2);
+                        dist2 = abs(getSourceContourNormals()[kc][1]*x_u_2 - getSourceContourNormals()[kc][0]*x_v_2);
                         dist1 = x_u_2*x_u_1 + x_v_2*x_v_1;
 
                             //if (dist < distmin)
@@ -551,15 +814,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
             if (!useVisible.getValue())
                 initSource();
             else initSourceVisible();
-    #ifdef USING_OMP_PRAGMAS
-            #pragma omp parallel for
-    #endif
-            for(int i=0;i<(int)nbt;i++)
-                {
-                    //if(!targetBackground[i])
-                        sourceKdTree.getNClosest(closestTarget[i],tp[i],sourcePositions.getValue(),1);
-
-                }
+            findClosest(sourceKdTree, tp, sourcePositions.getValue(), closestTarget);
         }
 	
     this->sourceIgnored.resize(nbs); sourceIgnored.fill(false);
@@ -583,7 +838,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
 			if(closestSource[i].begin()->first>mean ) 
 				sourceIgnored[i]=true;
 				
-				if(sourceBorder[i])
+				if(sborder[i])
 				{
 					
 					double dists = (x[i][0] - tcp[indices[kkk]][0])*(x[i][0] - tcp[indices[kkk]][0]) + (x[i][1] - tcp[indices[kkk]][1])*(x[i][1] - tcp[indices[kkk]][1]) + (x[i][2] - tcp[indices[kkk]][2])*(x[i][2] - tcp[indices[kkk]][2]);
@@ -608,8 +863,8 @@ void ClosestPoint<DataTypes>::updateClosestPointsContours()
 
     }
     if(rejectBorders.getValue()) {
-        for(unsigned int i=0;i<nbs;i++) if(closestSource[i].size()) if(targetBorder[closestSource[i].begin()->second]) sourceIgnored[i]=true;
-        for(unsigned int i=0;i<nbt;i++) if(closestTarget[i].size()) if(sourceBorder[closestTarget[i].begin()->second]) targetIgnored[i]=true;
+        for(unsigned int i=0;i<nbs;i++) if(closestSource[i].size()) if(tborder[closestSource[i].begin()->second]) sourceIgnored[i]=true;
+        for(unsigned int i=0;i<nbt;i++) if(closestTarget[i].size()) if(sborder[closestTarget[i].begin()->second]) targetIgnored[i]=true;
     }
 }
 
@@ -617,17 +872,20 @@ template<class DataTypes>
 void ClosestPoint<DataTypes>::updateClosestPointsContoursNormals()
 {
     const VecCoord& x = sourcePositions.getValue();
-    const VecCoord& tp = targetPositions.getValue();
-    const VecCoord& xcp = sourceContourPositions.getValue();
-    const VecCoord& tcp = targetContourPositions.getValue();
+    const VecCoord& tp = getTargetPositions();
+    const VecCoord& xcp = getSourceContourPositions();
+    const VecCoord& tcp = getTargetContourPositions();
     const VecCoord& ssn = sourceSurfaceNormalsM.getValue();
 
     unsigned int nbs=x.size(), nbt=tp.size(), nbtc = tcp.size(), nssn = ssn.size();
 
+    const vector< bool >& sborder = getSourceBorder();
+    const vector< bool >& tborder = getTargetBorder();
+
     distanceSet emptyset;
     if(nbs!=closestSource.size()) {initSource();  closestSource.resize(nbs);	closestSource.fill(emptyset); cacheDist.resize(nbs); cacheDist.fill((Real)0.); cacheDist2.resize(nbs); cacheDist2.fill((Real)0.); previousX.assign(x.begin(),x.end());}
 
-	if(nbt!=closestTarget.size()) {initTarget();  /*initTargetContour();*/ closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
+	if(nbt!=closestTarget.size() || targetOutdated()) {initTarget();  /*initTargetContour();*/ closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
 					//std::cout << " tcp size () " << tcp.size() << std::endl;
 
     //if(nbt!=closestTarget.size()) {extractTargetPCD() ; closestTarget.resize(nbt);	closestTarget.fill(emptyset);}
@@ -646,7 +904,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContoursNormals()
 #endif
         for(int i=0;i<(int)nbs;i++)
         {
-				if(sourceBorder[i])
+				if(sborder[i])
 				{
 
 				//targetContourKdTree.getNClosest(closestSource[i],x[i],1);
@@ -677,7 +935,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContoursNormals()
 				//targetKdTree.getNClosest(closestSource[i],x[i],1);
 			}
 			
-			targetKdTree.getNClosest(closestSource[i],x[i],targetPositions.getValue(),1);
+			findClosestTarget(x[i], tp, closestSource[i]);
 			
         }
     //std::cout<<(Real)count*(Real)100./(Real)nbs<<" % cached"<<std::endl;
@@ -687,16 +945,7 @@ void ClosestPoint<DataTypes>::updateClosestPointsContoursNormals()
     if(blendingFactor.getValue()>0)
     {
         initSource();
-#ifdef USING_OMP_PRAGMAS
-        #pragma omp parallel for
-#endif
-        for(int i=0;i<(int)nbt;i++)
-		{
-			{
-            sourceKdTree.getNClosest(closestTarget[i],tp[i],sourcePositions.getValue(),1);
-			}
-			
-		}
+        findClosest(sourceKdTree, tp, sourcePositions.getValue(), closestTarget);
     }
 
     this->sourceIgnored.resize(nbs); sourceIgnored.fill(false);
@@ -728,8 +977,8 @@ void ClosestPoint<DataTypes>::updateClosestPointsContoursNormals()
 
     }
     if(rejectBorders.getValue()) {
-        for(unsigned int i=0;i<nbs;i++) if(closestSource[i].size()) if(targetBorder[closestSource[i].begin()->second]) sourceIgnored[i]=true;
-        for(unsigned int i=0;i<nbt;i++) if(closestTarget[i].size()) if(sourceBorder[closestTarget[i].begin()->second]) targetIgnored[i]=true;
+        for(unsigned int i=0;i<nbs;i++) if(closestSource[i].size()) if(tborder[closestSource[i].begin()->second]) sourceIgnored[i]=true;
+        for(unsigned int i=0;i<nbt;i++) if(closestTarget[i].size()) if(sborder[closestTarget[i].begin()->second]) targetIgnored[i]=true;
     }
     /*if(normalThreshold.getValue()>(Real)-1. && sourceNormals.getValue().size()!=0 && targetNormals.getValue().size()!=0) {
         ReadAccessor< Data< VecCoord > > sn(sourceNormals);
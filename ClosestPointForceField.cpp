@@ -131,14 +131,27 @@ ClosestPointForceField<DataTypes>::ClosestPointForceField(core::behavior::Mechan
     , niterations(initData(&niterations,3,"niterations","Number of iterations in the tracking process"))
     , dataPath(initData(&dataPath,"dataPath","Path for data writings",false))
     , windowKLT(initData(&windowKLT,5,"windowKLT","window for the KLT tracker"))
+    , useKLTThread(initData(&useKLTThread,true,"useKLTThread","Track the KLT features on a separate thread, the force uses the last tracked features"))
     , useKLTPoints(initData(&useKLTPoints, false,"useKLTPoints","Use KLT Points"))
+    , correspondenceUpdatePeriod(initData(&correspondenceUpdatePeriod,0,"correspondenceUpdatePeriod","Recompute the closest points every correspondenceUpdatePeriod steps within a frame (0: once per frame)"))
+    , correspondenceReuseDisplacement(initData(&correspondenceReuseDisplacement,(Real)0,"correspondenceReuseDisplacement","Recompute the closest points when a vertex moved more than this distance (0: disabled)"))
+    , useSpatialHash(initData(&useSpatialHash,true,"useSpatialHash","Search the target point cloud with a spatial hash (shared through the frame state) instead of a k-d tree"))
+    , benchmarkIndex(initData(&benchmarkIndex,false,"benchmarkIndex","Time the k-d tree and the spatial hash on the target point cloud at each correspondence update"))
+    , projectiveAssociation(initData(&projectiveAssociation,false,"projectiveAssociation","Match the source points in a pixel window around their projection in the depth image instead of searching the whole target cloud"))
+    , projectiveWindow(initData(&projectiveWindow,4,"projectiveWindow","Half size in pixels of the projective association window, at least the sampling step of the target points"))
 {
     iter_im = 0;
+    kltRunning = false;
+    kltFrameRequested = -1;
+    kltFrameDone = -1;
+    kltFrameConsumed = -1;
+    kltReinit = false;
 }
 
 template <class DataTypes>
 ClosestPointForceField<DataTypes>::~ClosestPointForceField()
 {
+    if (kltThread.joinable()) kltThread.join();
 }
 
 template <class DataTypes>
@@ -182,6 +195,12 @@ void ClosestPointForceField<DataTypes>::init()
     closestpoint->useContour.setValue(useContour.getValue());
     closestpoint->useVisible.setValue(useVisible.getValue());
     closestpoint->useDistContourNormal.setValue(useDistContourNormal.getValue());
+    closestpoint->updatePeriod.setValue(correspondenceUpdatePeriod.getValue());
+    closestpoint->reuseDisplacement.setValue(correspondenceReuseDisplacement.getValue());
+    closestpoint->useSpatialHash.setValue(useSpatialHash.getValue());
+    closestpoint->benchmarkIndex.setValue(benchmarkIndex.getValue());
+    closestpoint->projectiveAssociation.setValue(projectiveAssociation.getValue());
+    closestpoint->projectiveWindow.setValue(projectiveWindow.getValue());
     Vector4 camParam = cameraIntrinsicParameters.getValue();
 
     rgbIntrinsicMatrix(0,0) = camParam[0];
@@ -190,9 +209,12 @@ void ClosestPointForceField<DataTypes>::init()
     rgbIntrinsicMatrix(1,2) = camParam[3];
     closestpoint->rgbIntrinsicMatrix = rgbIntrinsicMatrix;
 
+    // when the scene provides a FrameState, the per-frame data is read from it by reference
+    sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(context);
+    root->get(framestate);
+    if (framestate) closestpoint->frameState = framestate.get();
+
     // Tracker parameters
-    tracker.setTrackerId(1);
-    //tracker.setOnMeasureFeature(&modifyFeature);
     tracker.setMaxFeatures(1000);
     tracker.setWindowSize(10);
     tracker.setQuality(0.02);
@@ -202,17 +224,6 @@ void ClosestPointForceField<DataTypes>::init()
     tracker.setUseHarris(1);
     tracker.setPyramidLevels(3);
 
-    tracker1.setTrackerId(1);
-    //tracker.setOnMeasureFeature(&modifyFeature);
-    tracker1.setMaxFeatures(1000);
-    tracker1.setWindowSize(10);
-    tracker1.setQuality(0.02);
-    tracker1.setMinDistance(10);
-    tracker1.setHarrisFreeParameter(0.04);
-    tracker1.setBlockSize(9);
-    tracker1.setUseHarris(1);
-    tracker1.setPyramidLevels(3);
-
 }
 
 template <class DataTypes>
@@ -224,246 +235,74 @@ void ClosestPointForceField<DataTypes>::resetSprings()
 }
 
 template <class DataTypes>
-void ClosestPointForceField<DataTypes>::mapKLTPointsTriangles ( sofa::helper::vector< tri > &triangles)
+void ClosestPointForceField<DataTypes>::mapKLTPointsTriangles(sofa::helper::vector<Vector3> &coef, sofa::helper::vector<int> &ind)
 {
-    int outside = 0;
-        const VecCoord& x = this->mstate->read(core::ConstVecCoordId::position())->getValue();
-    //const sofa::core::topology::BaseMeshTopology::SeqTriangles& triangles = this->fromTopology->getTriangles();
-    sofa::helper::vector<Mat3x3d> bases;
-    sofa::helper::vector<Vector3> centers;
-
-    helper::vector< bool > sourcevisible = sourceVisible.getValue();
-
-    {
-        {
-            int c0 = triangles.size();
-            bases.resize ( triangles.size());
-            centers.resize ( triangles.size());
-            for ( unsigned int t = 0; t < triangles.size(); t++ )
-            {
-                Mat3x3d m,mt;
-                                double xt, yt;
-                             Vector3 xim0,xim1,xim2;
-                                 bool visible = true;
-                        if (sourcevisible[triangles[t][2]] && sourcevisible[triangles[t][1]] && sourcevisible[triangles[t][0]])
-                                 {
-                        int x_u_2 = (int)(x[triangles[t][2]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[t][2]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_2 = (int)(x[triangles[t][2]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[t][2]][2] + rgbIntrinsicMatrix(1,2));
-                        int x_u_1 = (int)(x[triangles[t][1]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[t][1]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_1 = (int)(x[triangles[t][1]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[t][1]][2] + rgbIntrinsicMatrix(1,2));
-
-                        int x_u_0 = (int)(x[triangles[t][0]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[t][0]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_0 = (int)(x[triangles[t][0]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[t][0]][2] + rgbIntrinsicMatrix(1,2));
-
-                        //std::cout << " x_u_2 " << x_u_2 << " " << x_u_1 << " " << x_u_0 << std::endl;
-
-                        xim0[0] = x_u_0;
-                        xim0[1] = x_v_0;
-                        xim0[2] = 0;
-                        xim1[0] = x_u_1;
-                        xim1[1] = x_v_1;
-                        xim1[2] = 0;
-                        xim2[0] = x_u_2;
-                        xim2[1] = x_v_2;
-                        xim2[2] = 0;
-
-                                m[0] = xim1-xim0;
-                m[1] = xim2-xim0;
-                m[2] = cross ( m[0],m[1] );
-                mt.transpose ( m );
-                bases[t].invert ( mt );
-                centers[t] = ( xim0+xim1+xim2 ) /3;
-
-                        int index = -1;
-                        double distance = 1e10;
-
-                        Real tt,uu,vv;
-            /*for ( unsigned int t1 = 0; t1 < triangles.size(); t1++ )
-            {
-                Mat3x3d m,mt;
-                                double xt, yt;
-                             Vector3 xim0,xim1,xim2;
-
-                                 bool intersect = true;
-
-                                 {
-
-    tt = 0; uu = 0; vv = 0;
-    Vector3 edge1 = x[triangles[t1][1]] - x[triangles[t1][0]];
-    Vector3 edge2 = x[triangles[t1][2]] - x[triangles[t1][0]];
-    Vector3 tvec, pvec, qvec;
-    Real det, inv_det;
-                        //std::cout << " x_u_2 " << x_u_2 << " " << x_u_1 << " " << x_u_0 << std::endl;
-    pvec = centers[t].cross(edge2);
-    det = dot(edge1, pvec);
-                                //std::cout << " dot " << det << std::endl;
-    if(det<=1.0e-20 && det >=-1.0e-20)
+    // the visible triangles are projected at the beginning of the frame (kltProjectedTriangles, three image points per triangle),
+    // each feature is attached to the triangle with the nearest projected center, found through a grid over the centers
+    unsigned int ntri = kltTriangleIndices.size();
+    std::vector<cv::Point2f> centers(ntri);
+    for (unsigned int t = 0; t < ntri; t++)
     {
-        intersect = false;
+        Vector3 c = (kltProjectedTriangles[3*t] + kltProjectedTriangles[3*t+1] + kltProjectedTriangles[3*t+2])/3;
+        centers[t] = cv::Point2f(c[0],c[1]);
     }
-    inv_det = 1.0 / det;
-    tvec = - x[triangles[t1][0]];
-    uu = dot(tvec, pvec) * inv_det;
-    if (uu < -0.0000001 || uu > 1.0000001)
-        intersect = false;
-    qvec = tvec.cross(edge1);
-    vv = dot(centers[t], qvec) * inv_det;
-    if (vv < -0.0000001 || (uu + vv) > 1.0000001)
-        intersect = false;
-    tt = dot(edge2, qvec) * inv_det;
-
-        //std::cout << " dot " << tt << std::endl;
-    if (tt < 0.0000001 || tt!=tt || vv!=vv || uu!=uu)                   std::cout << " index 0 " <<  x[triangles[index][0]][0] << " x_v " << x[triangles[index][0]][1] << " x_v " << x[triangles[index][0]][2] << std::endl;
-
-        intersect = false;
-                        }
-
-                        if (intersect)
-                        {
-                                if (centers[t][2] < x[triangles[t1][0]][2] && centers[t][2] < x[triangles[t1][1]][2] && centers[t][2] < x[triangles[t1][2]][2])
-                                        visible = true;
-                                        else visible = false;
-                        }
-                        if (visible){
-                                sourceVisible[triangles[t][2]] = true;
-                                sourceVisible[triangles[t][1]] = true;
-                                sourceVisible[triangles[t][0]] = true;
-
-                        }
-                        else{
-                                sourceVisible[triangles[t][2]] = false;
-                                sourceVisible[triangles[t][1]] = false;
-                                sourceVisible[triangles[t][0]] = false;
-                        }
-
-                }*/
-
-
-                                 }
-                        }
 
+    KLTTriangleGrid grid;
+    grid.build(centers);
 
-float xp, yp;
-long id;
+    coef.resize(tracker.getMaxFeatures());
+    ind.resize(tracker.getMaxFeatures());
+    for (unsigned int k = 0; k < ind.size(); k++) ind[k] = -1;
 
-         for (unsigned int k = 0; k < static_cast<unsigned int>(tracker.getNbFeatures()); k++){
-                Mat3x3d m,mt;
-                                double xt, yt;
-                             Vector3 xim0,xim1,xim2;
-                                 const int kk = k;
-                                 tracker.getFeature(kk, id, xp, yp);
-                                int n0 = (int)yp;
-                                int m0 = (int)xp;
-                Vector3 pos;
-                                pos[0] = xp;
-                                pos[1] = yp;
-                                pos[2] = 0;
-                Vector3 coefs;
-
-                int index = -1;
-                double distance = 1e10;
-                                //std::cout << "  xp yp " << xp << " " << yp << std::endl;
-            for ( unsigned int t = 0; t < triangles.size(); t++ )
-            {
-                Mat3x3d m,mt;
-                                double xt, yt;
-                             Vector3 xim0,xim1,xim2;
-                        if (sourcevisible[triangles[t][2]] && sourcevisible[triangles[t][1]] && sourcevisible[triangles[t][0]])
-                                 {
-                           // std::cout << " ok visible " << std::endl;
-                        int x_u_2 = (int)(x[triangles[t][2]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[t][2]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_2 = (int)(x[triangles[t][2]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[t][2]][2] + rgbIntrinsicMatrix(1,2));
-                        int x_u_1 = (int)(x[triangles[t][1]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[t][1]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_1 = (int)(x[triangles[t][1]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[t][1]][2] + rgbIntrinsicMatrix(1,2));
-
-                        int x_u_0 = (int)(x[triangles[t][0]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[t][0]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_0 = (int)(x[triangles[t][0]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[t][0]][2] + rgbIntrinsicMatrix(1,2));
-
-                        xim0[0] = x_u_0;
-                        xim0[1] = x_v_0;
-                        xim0[2] = 0;
-                        xim1[0] = x_u_1;
-                        xim1[1] = x_v_1;
-                        xim1[2] = 0;
-                        xim2[0] = x_u_2;
-                        xim2[1] = x_v_2;
-                        xim2[2] = 0;
-                    Vec3d v = bases[t] * ( pos - xim0 );
-                                        v[0] = ( pos - xim0 ).norm2()/(( pos - xim0 ).norm2() + ( pos - xim1 ).norm2() + ( pos - xim2 ).norm2());
-                                        v[1] = ( pos - xim1 ).norm2()/(( pos - xim0 ).norm2() + ( pos - xim1 ).norm2() + ( pos - xim2 ).norm2());
-                                        v[2] = ( pos - xim2 ).norm2()/(( pos - xim0 ).norm2() + ( pos - xim1 ).norm2() + ( pos - xim2 ).norm2());
-                    double d = std::max ( std::max ( -v[0],-v[1] ),std::max ( ( v[2]<0?-v[2]:v[2] )-0.01,v[0]+v[1]-1 ) );
-                    /*if ( d>0 )*/ d = ( pos-centers[t] ).norm2();
-                    if ( d<distance ) { coefs = v; distance = d; index = t; }
-                        }
-                }
-                if ( distance>0 )
-                {
-                    ++outside;
-                }
-                //if ( index < c0 )
-                                {
-                                        /*mapping map;
-                                        map.coef = coefs;
-                                        map.triangle = index;*/
-                                        //std::cout << " mapping " << kk << " id " << id << " index " << index << " coefs " << coefs[0] << " " << coefs[1] << " " << coefs[2] << std::endl;
-                                        mappingkltcoef[id] = coefs;
-                                        mappingkltind[id] = index;
-                        int x_u_0 = (int)(x[triangles[index][0]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[index][0]][2] + rgbIntrinsicMatrix(0,2));
-                        int x_v_0 = (int)(x[triangles[index][0]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[index][0]][2] + rgbIntrinsicMatrix(1,2));
-                        //std::cout << " x_u_0 " << x_u_0 << " x_v_0 " << x_v_0 <<  "  xp yp " << xp << " " << yp << " coefs " << coefs[0] << " " << coefs[1] << " " << coefs[2] << std::endl;
-
-                                }
+    float xp, yp;
+    long id;
 
-            }
-        }
-        }
+    for (unsigned int k = 0; k < static_cast<unsigned int>(tracker.getNbFeatures()); k++)
+    {
+        tracker.getFeature(k, id, xp, yp);
+        int t = grid.nearest(cv::Point2f(xp,yp));
+        if (t < 0) continue;
+
+        Vector3 pos(xp,yp,0);
+        const Vector3& xim0 = kltProjectedTriangles[3*t];
+        const Vector3& xim1 = kltProjectedTriangles[3*t+1];
+        const Vector3& xim2 = kltProjectedTriangles[3*t+2];
+        double d0 = ( pos - xim0 ).norm2(), d1 = ( pos - xim1 ).norm2(), d2 = ( pos - xim2 ).norm2();
+        double sum = d0 + d1 + d2;
+        Vector3 coefs(1./3,1./3,1./3);
+        if (sum > 0) { coefs[0] = d0/sum; coefs[1] = d1/sum; coefs[2] = d2/sum; }
+
+        coef[id] = coefs;
+        ind[id] = kltTriangleIndices[t];
+    }
 }
 
 template <class DataTypes>
-void ClosestPointForceField<DataTypes>::KLTPointsTo3D()
+void ClosestPointForceField<DataTypes>::KLTPointsTo3D(VecCoord &targetpos)
 {
-
-    int outside = 0;
-
-        sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
-        sofa::component::visualmodel::BaseCamera::SPtr currentCamera;// = root->getNodeObject<sofa::component::visualmodel::InteractiveCamera>();
-        root->get(currentCamera);
-
         float rgbFocalInvertedX = 1/rgbIntrinsicMatrix(0,0);	// 1/fx
         float rgbFocalInvertedY = 1/rgbIntrinsicMatrix(1,1);	// 1/fy
 
-        const VecCoord& x = this->mstate->read(core::ConstVecCoordId::position())->getValue();
-
-        VecCoord targetpos;
         targetpos.resize(tracker.getMaxFeatures());
 
-        double znear = currentCamera->getZNear();
-        double zfar = currentCamera->getZFar();
+        double znear = kltZNear;
+        double zfar = kltZFar;
+        bool realdata = useRealData.getValue();
 
         Vector3 pos;
-        Vector3 col;
         float xp, yp;
         long id;
 
          for (unsigned int k = 0; k < static_cast<unsigned int>(tracker.getNbFeatures()); k++){
-                Mat3x3d m,mt;
-                double xt, yt;
-                Vector3 xim0,xim1,xim2;
-                const int kk = k;
-                tracker.getFeature(kk, id, xp, yp);
-        //std::cout << " id " << id << " xp " << xp << " yp " << yp << std::endl;
-                                int n0 = (int)yp;
-                                 int m0 = (int)xp;
+                tracker.getFeature(k, id, xp, yp);
                                  float depthValue;
-                                if (!useRealData.getValue())
-                                depthValue = (float)depth.at<float>(2*yp,2*xp);
-                                else depthValue = (float)depth.at<float>(yp,xp);
-                        int avalue = (int)color.at<Vec4b>(yp,xp)[3];
+                                if (!realdata)
+                                depthValue = (float)kltDepth.at<float>(2*yp,2*xp);
+                                else depthValue = (float)kltDepth.at<float>(yp,xp);
                         if ( depthValue>0 && depthValue < 1)                // if depthValue is not NaN
                         {
                                 double clip_z = (depthValue - 0.5) * 2.0;
-                                if (!useRealData.getValue()) pos[2] = -2*znear*zfar/(clip_z*(zfar-znear)-(zfar+znear));
+                                if (!realdata) pos[2] = -2*znear*zfar/(clip_z*(zfar-znear)-(zfar+znear));
                                 else pos[2] = depthValue;
                                 pos[0] = (xp - rgbIntrinsicMatrix(0,2)) * pos[2] * rgbFocalInvertedX;
                                 pos[1] = (yp - rgbIntrinsicMatrix(1,2)) * pos[2] * rgbFocalInvertedY;
@@ -472,9 +311,39 @@ void ClosestPointForceField<DataTypes>::KLTPointsTo3D()
                         }
 
             }
-    const VecCoord&  p = targetpos;
-        targetKLTPositions.setValue(p);
+}
 
+template <class DataTypes>
+void ClosestPointForceField<DataTypes>::trackKLT()
+{
+    double timeKLT = (double)getTickCount();
+
+    // the pyramid of the previous frame is kept by the tracker, only the current one is built
+    if (kltReinit) tracker.initTracking(kltGray);
+    else tracker.track(kltGray);
+
+    sofa::helper::vector<Vector3> coef;
+    sofa::helper::vector<int> ind;
+    if (kltReinit) mapKLTPointsTriangles(coef, ind);
+
+    VecCoord targetpos;
+    KLTPointsTo3D(targetpos);
+
+    {
+        boost::mutex::scoped_lock lock(kltMutex);
+        kltResultFeatures = tracker.getFeatures();
+        kltResultIds = tracker.getFeatureIds();
+        kltResultPositions.swap(targetpos);
+        if (kltReinit)
+        {
+            kltResultCoef.swap(coef);
+            kltResultInd.swap(ind);
+        }
+        kltFrameDone = kltFrameRequested;
+        kltRunning = false;
+    }
+
+    std::cout << "TIME KLT " << ((double)getTickCount() - timeKLT)/getTickFrequency() << std::endl;
 }
 
 
@@ -495,14 +364,13 @@ void ClosestPointForceField<DataTypes>::addForceMesh(const core::MechanicalParam
 {
     int t = (int)this->getContext()->getTime();
 
-    sofa::helper::vector< tri > triangles;
-    triangles = sourceTriangles.getValue();
+    const sofa::helper::vector< tri >& triangles = sourceTriangles.getValue();
 
     bool reinitv = false;
 
-    helper::vector< bool > sourcevisible = sourceVisible.getValue();
-    helper::vector< int > indicesvisible = indicesVisible.getValue();
-    helper::vector< bool > sourceborder = sourceBorder.getValue();
+    const helper::vector< bool >& sourcevisible = framestate ? framestate->sourceVisible.getValue() : sourceVisible.getValue();
+    const helper::vector< int >& indicesvisible = framestate ? framestate->indicesVisible.getValue() : indicesVisible.getValue();
+    const helper::vector< bool >& sourceborder = framestate ? framestate->sourceBorder.getValue() : sourceBorder.getValue();
 
         if (t%niterations.getValue() == 0)
         {
@@ -525,8 +393,10 @@ void ClosestPointForceField<DataTypes>::addForceMesh(const core::MechanicalParam
     const VecCoord& x = _x.getValue();			//RDataRefVecCoord x(_x);
     const VecDeriv& v = _v.getValue();			//RDataRefVecDeriv v(_v);
     ReadAccessor< Data< VecCoord > > tn(targetNormals);
-    ReadAccessor< Data< VecCoord > > tp(targetPositions);
-    ReadAccessor< Data< VecCoord > > tcp(targetContourPositions);
+    const VecCoord& tp = framestate ? framestate->targetPositions.getValue() : targetPositions.getValue();
+    const VecCoord& tcp = framestate ? framestate->targetContourPositions.getValue() : targetContourPositions.getValue();
+    const VecCoord& svp = framestate ? framestate->sourceVisiblePositions.getValue() : sourceVisiblePositions.getValue();
+    const VecCoord& scp = framestate ? framestate->sourceContourPositions.getValue() : sourceContourPositions.getValue();
 
         if (t%niterations.getValue() == 0)
         {
@@ -560,113 +430,115 @@ void ClosestPointForceField<DataTypes>::addForceMesh(const core::MechanicalParam
 
     if (useKLTPoints.getValue())
     {
+        // the KLT stage runs once per frame, on a separate thread if useKLTThread is set;
+        // the force evaluations use the last tracked features
+        int frame = t/niterations.getValue();
+        bool launch = false;
+        {
+            boost::mutex::scoped_lock lock(kltMutex);
+            if (frame != kltFrameRequested && !kltRunning)
+            {
+                kltReinit = (kltFrameRequested < 0 || frame%windowKLT.getValue() == 0);
+                kltRunning = true;
+                kltFrameRequested = frame;
+                launch = true;
+            }
+        }
 
-        sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
-        typename sofa::core::objectmodel::ImageConverter<DataTypes,DepthTypes>::SPtr imconv;
-        root->get(imconv);
+        if (launch)
+        {
+            if (kltThread.joinable()) kltThread.join();
 
-        typename sofa::core::objectmodel::DataIO<DataTypes>::SPtr dataio;
-        root->get(dataio);
+            typename sofa::core::objectmodel::DataIO<DataTypes>::SPtr dataio;
+            root->get(dataio);
+            color = dataio->color;
+            depth = dataio->depth;
+            color_1 = dataio->color_1;
 
-        bool okimages =false;
+            cvtColor(foreg,gray,CV_BGR2GRAY);
+            gray.copyTo(kltGray);
+            depth.copyTo(kltDepth);
 
-        //if (useRealData.getValue())
-        {
-        /*if (useSensor.getValue()){
-                //color_1 = color.clone();
-                //depth_1 = depth.clone();
-            if(!((imconv->depth).empty()) && !((imconv->color).empty()))
+            sofa::component::visualmodel::BaseCamera::SPtr currentCamera;
+            root->get(currentCamera);
+            kltZNear = currentCamera->getZNear();
+            kltZFar = currentCamera->getZFar();
+
+            // visible triangles projected with the current mesh, used to attach new features
+            if (kltReinit)
             {
-                if (scaleImages.getValue() > 1)
+                const VecCoord& xcur = this->mstate->read(core::ConstVecCoordId::position())->getValue();
+                kltProjectedTriangles.resize(0);
+                kltTriangleIndices.resize(0);
+                for (unsigned int i = 0; i < triangles.size(); i++)
                 {
-                cv::resize(imconv->depth, depth, cv::Size(imconv->depth.cols/scaleImages.getValue(), imconv->depth.rows/scaleImages.getValue()), 0, 0);
-                cv::resize(imconv->color, color, cv::Size(imconv->color.cols/scaleImages.getValue(), imconv->color.rows/scaleImages.getValue()), 0, 0);
+                    if (!(sourcevisible[triangles[i][2]] && sourcevisible[triangles[i][1]] && sourcevisible[triangles[i][0]])) continue;
+                    for (unsigned int j = 0; j < 3; j++)
+                    {
+                        const Coord& xj = xcur[triangles[i][j]];
+                        int x_u = (int)(xj[0]*rgbIntrinsicMatrix(0,0)/xj[2] + rgbIntrinsicMatrix(0,2));
+                        int x_v = (int)(xj[1]*rgbIntrinsicMatrix(1,1)/xj[2] + rgbIntrinsicMatrix(1,2));
+                        kltProjectedTriangles.push_back(Vector3(x_u,x_v,0));
+                    }
+                    kltTriangleIndices.push_back(i);
                 }
-                else
+            }
+
+            if (useKLTThread.getValue())
+                kltThread = boost::thread(boost::bind(&ClosestPointForceField<DataTypes>::trackKLT, this));
+            else trackKLT();
+        }
+
+        bool newfeatures = false;
+        {
+            boost::mutex::scoped_lock lock(kltMutex);
+            if (kltFrameDone != kltFrameConsumed)
+            {
+                kltFeatures = kltResultFeatures;
+                kltFeatureIds = kltResultIds;
+                targetKLTPositions.setValue(kltResultPositions);
+                if (kltResultInd.size() > 0)
                 {
-                color = imconv->color;
-                depth = imconv->depth;
+                    mappingkltcoef.swap(kltResultCoef);
+                    mappingkltind.swap(kltResultInd);
+                    kltResultCoef.resize(0);
+                    kltResultInd.resize(0);
                 }
-                okimages = true;
+                kltFrameConsumed = kltFrameDone;
+                newfeatures = true;
             }
-                //cv::imwrite("depth22.png", depth);
         }
-        else*/
-        {
-                color = dataio->color;
-                depth = dataio->depth;
-                color_1 = dataio->color_1;
-                okimages = true;
-         }
-
-        cvtColor(foreg,gray,CV_BGR2GRAY);
-        cv::Mat gray1;
-        cv::flip(gray,gray1,0);
-        vpImageConvert::convert(gray,vpI);
-
-        if (t == 0)
+
+        if (newfeatures)
         {
-            display.init(vpI, 100, 100,"Display...") ;
-            // Display the image
+            vpImageConvert::convert(gray,vpI);
+            if (!display.isInitialised()) display.init(vpI, 100, 100,"Display...") ;
             vpDisplay::display(vpI) ;
+            for (unsigned int k = 0; k < kltFeatures.size(); k++)
+                vpDisplay::displayCross(vpI, vpImagePoint(kltFeatures[k].y, kltFeatures[k].x), 5, vpColor::red);
             vpDisplay::flush(vpI) ;
-
-        // Point detection using Harris. In input we have an OpenCV image
-        tracker.initTracking(gray);
-        tracker1.initTracking(gray);
-        tracker.display(vpI, vpColor::red);
-        }
-        else if (t >= 3){
-            if (t == 3 || t%(windowKLT.getValue()*1) ==0 )
-            {
-    tracker.initTracking(gray);
-    tracker1.initTracking(gray);
-    mappingkltcoef.resize(tracker.getMaxFeatures());
-    mappingkltind.resize(tracker.getMaxFeatures());
-    mapKLTPointsTriangles(triangles);
-            }
-
-      cvtColor(foreg,gray,CV_BGR2GRAY);
-
-    cv::flip(gray,gray1,0);
-    vpImageConvert::convert(gray,vpI);
-// Display the image
-vpDisplay::display(vpI) ;
-// Tracking of the detected points
-tracker.track(gray);
-tracker1.track(gray);
-
-// Display the tracked points
-tracker.display(vpI, vpColor::red);
-vpDisplay::flush(vpI) ;
-vpImage<vpRGBa> Icol;
-cv::Mat icol;
-display.getImage(Icol);
-vpImageConvert::convert(Icol,icol);
-/*imgklt = new cv::Mat;
-//*imgl = color;
-*imgklt = icol;
-
-if (t%npasses == 0)
-dataio->listimgklt.push_back(imgklt);*/
-
-KLTPointsTo3D();
-
         }
-
-    }
     }
 
+    // correspondences are recomputed once per frame (or every correspondenceUpdatePeriod steps) and reused in between
+    unsigned int nbsource = useVisible.getValue() ? svp.size() : x.size();
+    bool updatematches = closestpoint->correspondencesOutdated(t/niterations.getValue(), x, nbsource, tp.size());
+
+    if (updatematches)
+    {
     closestpoint->sourcePositions.setValue(this->mstate->read(core::ConstVecCoordId::position())->getValue());
+    closestpoint->sourceSurfacePositions.setValue(sourceSurfacePositions.getValue());
 
+    if (!framestate)
+    {
     if (useVisible.getValue())
     closestpoint->sourceVisiblePositions.setValue(sourceVisiblePositions.getValue());
 
     closestpoint->targetPositions.setValue(targetPositions.getValue());
     closestpoint->targetBorder = targetBorder.getValue();
-    closestpoint->sourceSurfacePositions.setValue(sourceSurfacePositions.getValue());
     closestpoint->sourceBorder = sourceBorder.getValue();
-    helper::vector<double> sourceweights = sourceWeights.getValue();
+    }
+    }
 
     time = (double)getTickCount();
 
@@ -677,19 +549,26 @@ KLTPointsTo3D();
             for (unsigned int i=0; i<s.size(); i++) closestPos[i]=x[i];
         else
         {
+            if (updatematches)
+            {
             if (!useContour.getValue())
                 closestpoint->updateClosestPoints();
             else
             {
-                if ((targetContourPositions.getValue()).size() > 0 && (sourceContourPositions.getValue()).size()>0 )
+                if (tcp.size() > 0 && scp.size()>0 )
+                {
+                if (!framestate)
                 {
                 closestpoint->targetContourPositions.setValue(targetContourPositions.getValue());
                 closestpoint->sourceContourPositions.setValue(sourceContourPositions.getValue());
                 closestpoint->sourceContourNormals.setValue(sourceContourNormals.getValue());
+                }
                 closestpoint->updateClosestPointsContours();
                 }
                 else closestpoint->updateClosestPoints();
             }
+            closestpoint->recordCorrespondences(t/niterations.getValue(), x, nbsource, tp.size());
+            }
 
             double timeClosestPoint = ((double)getTickCount() - timef0)/getTickFrequency();
 
@@ -708,7 +587,7 @@ KLTPointsTo3D();
                     }
                     else
                     {
-                            if ((sourceVisiblePositions.getValue()).size()>0)
+                            if (svp.size()>0)
                             {
                                 for (unsigned int i=0; i<tp.size(); i++)
                                 {
@@ -743,7 +622,7 @@ KLTPointsTo3D();
                 {
                     if (useContour.getValue())
                     {
-                        if (targetContourPositions.getValue().size() > 0)
+                        if (tcp.size() > 0)
                         for (unsigned int i=0; i<s.size(); i++)
                         {
                             unsigned int id=closestpoint->closestSource[i].begin()->second;
@@ -805,7 +684,7 @@ KLTPointsTo3D();
                         {
                             if (useContour.getValue())
                             {
-                                if (targetContourPositions.getValue().size() > 0)
+                                if (tcp.size() > 0)
                                 for (unsigned int i=0; i<s.size(); i++)
                                 {
                                     std::cout << "ii " << i<< " " << sourcevisible.size() << std::endl;
@@ -900,7 +779,7 @@ KLTPointsTo3D();
                                                 closestPos[id]+=tp[i]*attrF/(Real)cnt[id];
                                         }
                                     }
-                                    else if (targetContourPositions.getValue().size() > 0)
+                                    else if (tcp.size() > 0)
                                     {
                                         if (useContour.getValue() && t > niterations.getValue() )//&& t%niterations.getValue() > 0)
                                             closestPos[id]+=tp[i]*attrF/(Real)cnt[id];
@@ -935,7 +814,7 @@ KLTPointsTo3D();
                                         }
                                     }
                                 }
-                                else if (targetContourPositions.getValue().size() > 0)
+                                else if (tcp.size() > 0)
                                 {
                                     for (unsigned int i=0; i<tp.size(); i++)
                                     {
@@ -1058,10 +937,7 @@ KLTPointsTo3D();
                 }
             }
 
-            VecCoord  targetKLTPos;
-            //if (useKLTPoints.getValue() && t%niterations.getValue() == 0 )
-            if (useKLTPoints.getValue())
-            targetKLTPos = targetKLTPositions.getValue();
+            const VecCoord& targetKLTPos = targetKLTPositions.getValue();
 
             Vector3 coefs;
             int index;
@@ -1080,17 +956,18 @@ KLTPointsTo3D();
 
             //if (useKLTPoints.getValue() && t >= startimageklt.getValue() && t%(niterations.getValue()) == 0){
             if (useKLTPoints.getValue() && t >= startimageklt.getValue()){
-            for (unsigned int k = 0; k < static_cast<unsigned int>(tracker.getNbFeatures()); k++){
+            for (unsigned int k = 0; k < kltFeatures.size(); k++){
                     //std::cout << " k " << k << std::endl;
                                           // std::cout << " index " << index << std::endl;
                                           // std::cout << " triangleindex " << triangles[index][0] << std::endl;
                                            //std::cout << " targetKLTPos " << triangles[index][0] << std::endl;
 
-                           int x_u = (int)(x[triangles[index][0]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[index][0]][2] + rgbIntrinsicMatrix(0,2));
-                           int x_v = (int)(x[triangles[index][0]][1]*rgbIntrinsicMatrix(1,1)/x[triangles[index][0]][2] + rgbIntrinsicMatrix(1,2));
-                       tracker.getFeature(k, id, xp0, yp0);
+                       id = kltFeatureIds[k];
+                       xp0 = kltFeatures[k].x;
+                       yp0 = kltFeatures[k].y;
                        x0 = (int)xp0;
                        y0 = (int)yp0;
+                       if (id >= (long)mappingkltind.size() || mappingkltind[id] < 0) continue;
                            coefs = mappingkltcoef[id];
                            index = mappingkltind[id];
                            float depthValue;
@@ -1221,10 +1098,8 @@ void ClosestPointForceField<DataTypes>::addSpringForceWeight(double& potentialEn
         u *= inverseLength;
         Real elongation = (Real)d;
         double stiffweight = 1;
-        helper::vector< bool > sourceborder = sourceBorder.getValue();
-        helper::vector< bool > sourcevisible = sourceVisible.getValue();
-        helper::vector< int > indicesvisible = indicesVisible.getValue();
-        helper::vector< double > sourceweights = sourceWeights.getValue();
+        const helper::vector< bool >& sourcevisible = framestate ? framestate->sourceVisible.getValue() : sourceVisible.getValue();
+        const helper::vector< double >& targetweights = framestate ? framestate->targetWeights.getValue() : targetWeights.getValue();
 
 
         /*for (int k = 0; k < targetPositions.getValue().size(); k++){
@@ -1247,7 +1122,7 @@ void ClosestPointForceField<DataTypes>::addSpringForceWeight(double& potentialEn
 
         int k = (int)closestpoint->closestSource[ivis].begin()->second;
 
-        if(!closestpoint->targetIgnored[k]) stiffweight = (double)targetWeights.getValue()[k];//*exp(-curvatures.getValue()[k]);
+        if(!closestpoint->targetIgnored[k]) stiffweight = (double)targetweights[k];//*exp(-curvatures.getValue()[k]);
         else stiffweight = 1;
 
         }
@@ -1474,12 +1349,15 @@ void ClosestPointForceField<DataTypes>::draw(const core::visual::VisualParams* v
     cv::Mat foreg = rgbddataprocessing->foreground;
 
     if (useKLTPoints.getValue() && t >= startimageklt.getValue() && t%(niterations.getValue()) == 0){
-    for (unsigned int k = 0; k < static_cast<unsigned int>(tracker.getNbFeatures()); k++){
+    for (unsigned int k = 0; k < kltFeatures.size(); k++){
             //std::cout << " k " << k << std::endl;
 
-               tracker.getFeature(k, id, xp0, yp0);
+               id = kltFeatureIds[k];
+               xp0 = kltFeatures[k].x;
+               yp0 = kltFeatures[k].y;
                x0 = (int)xp0;
                y0 = (int)yp0;
+               if (id >= (long)mappingkltind.size() || mappingkltind[id] < 0) continue;
                    coefs = mappingkltcoef[id];
                    index = mappingkltind[id];
                    int x_u = (int)(x[triangles[index][0]][0]*rgbIntrinsicMatrix(0,0)/x[triangles[index][0]][2] + rgbIntrinsicMatrix(0,2));
@@ -72,8 +72,10 @@
 
 #include <string>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include "ClosestPoint.h"
 #include "RGBDDataProcessing.h"
+#include "KLTTracker.h"
 
 
 using namespace std;
@@ -218,6 +220,7 @@ public:
     Data<sofa::helper::vector<Spring> > springs;
 
     typename sofa::core::objectmodel::ClosestPoint<DataTypes> *closestpoint;
+    typename sofa::core::objectmodel::FrameState<DataTypes>::SPtr framestate;
 
     Data<Vector4> cameraIntrinsicParameters;
     Eigen::Matrix3f rgbIntrinsicMatrix;
@@ -266,20 +269,49 @@ public:
     cv::Mat depthMap;
     cv::Mat silhouetteMap;
     cv::Mat distimage, dotimage;
-    vpKltOpencv tracker,tracker1;
     vpImage<unsigned char> vpI ;
     vpDisplayX display;
     Data<int> windowKLT;
     Data< VecCoord > targetKLTPositions;
 
-    void mapKLTPointsTriangles ( helper::vector< tri > &triangles);
-    void KLTPointsTo3D();
+    // KLT stage, run once per frame on its own thread if useKLTThread is set
+    Data<bool> useKLTThread;
+    KLTTracker tracker;
+
+    boost::thread kltThread;
+    boost::mutex kltMutex;
+    bool kltRunning;
+    int kltFrameRequested, kltFrameDone, kltFrameConsumed;
+
+    // inputs of the KLT stage, copied at the beginning of the frame
+    cv::Mat kltGray, kltDepth;
+    bool kltReinit;
+    double kltZNear, kltZFar;
+    helper::vector< Vector3 > kltProjectedTriangles;
+    helper::vector< int > kltTriangleIndices;
+
+    // outputs of the KLT stage, guarded by kltMutex
+    std::vector<cv::Point2f> kltFeatures, kltResultFeatures;
+    std::vector<long> kltFeatureIds, kltResultIds;
+    VecCoord kltResultPositions;
+    sofa::helper::vector<Vector3> kltResultCoef;
+    sofa::helper::vector<int> kltResultInd;
+
+    void mapKLTPointsTriangles(sofa::helper::vector<Vector3> &coef, sofa::helper::vector<int> &ind);
+    void KLTPointsTo3D(VecCoord &targetpos);
+    void trackKLT();
 
     sofa::helper::vector<Vector3> mappingkltcoef;
     sofa::helper::vector<int> mappingkltind;
 
     Data<Real> outlierThreshold;
     Data<bool> rejectBorders;
+    Data<int> correspondenceUpdatePeriod;
+    Data<Real> correspondenceReuseDisplacement;
+    Data<bool> useSpatialHash;
+    Data<bool> benchmarkIndex;
+    Data<bool> projectiveAssociation;
+    Data<int> projectiveWindow;
 
     Data<float> showArrowSize;
     Data<int> drawMode; //Draw Mode: 0=Line - 1=Cylinder - 2=Arrow
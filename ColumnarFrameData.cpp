@@ -0,0 +1,397 @@
+/*
+ * ColumnarFrameData.cpp
+ *
+ *  Binary per-frame storage of the mesh positions, visibility and stress/strain fields,
+ *  one chunk per frame with one column per field, written by DataIO::writeData and read back
+ *  as ground truth by DataIO::readData.
+ */
+
+#include "ColumnarFrameData.h"
+
+#include <cstring>
+
+namespace
+{
+
+enum { TYPE_FLOAT64 = 0, TYPE_BITS = 1 };
+enum { CODEC_RAW = 0, CODEC_SHUFFLE_RLE = 1 };
+
+const char fileMagic[8] = {'R','G','B','D','C','O','L','1'};
+const char indexMagic[8] = {'R','G','B','D','I','D','X','1'};
+const char chunkMagic[4] = {'F','R','A','M'};
+
+struct ColumnHeader
+{
+    char name[16];
+    uint32_t type;
+    uint32_t codec;
+    uint64_t count;
+    uint64_t rawBytes;
+    uint64_t storedBytes;
+};
+
+// byte k of every element is stored in the k-th plane
+void shuffle(const std::vector<unsigned char> &in, int elemSize, std::vector<unsigned char> &out)
+{
+    size_t n = in.size()/elemSize;
+    out.resize(in.size());
+    for (int b = 0; b < elemSize; b++)
+        for (size_t i = 0; i < n; i++)
+            out[b*n + i] = in[i*elemSize + b];
+}
+
+void unshuffle(const std::vector<unsigned char> &in, int elemSize, std::vector<unsigned char> &out)
+{
+    size_t n = in.size()/elemSize;
+    out.resize(in.size());
+    for (int b = 0; b < elemSize; b++)
+        for (size_t i = 0; i < n; i++)
+            out[i*elemSize + b] = in[b*n + i];
+}
+
+// control byte c < 128: c+1 literal bytes follow, c >= 128: the next byte is repeated c-128+3 times
+void encodeRLE(const std::vector<unsigned char> &in, std::vector<unsigned char> &out)
+{
+    out.clear();
+    out.reserve(in.size() + in.size()/128 + 1);
+    size_t i = 0, n = in.size();
+    while (i < n)
+    {
+        size_t r = 1;
+        while (i + r < n && r < 130 && in[i + r] == in[i]) r++;
+        if (r >= 3)
+        {
+            out.push_back((unsigned char)(128 + r - 3));
+            out.push_back(in[i]);
+            i += r;
+            continue;
+        }
+        // literal bytes up to the next run of 3 or more
+        size_t start = i, l = 0;
+        while (i < n && l < 128)
+        {
+            if (i + 2 < n && in[i] == in[i+1] && in[i] == in[i+2]) break;
+            i++;
+            l++;
+        }
+        out.push_back((unsigned char)(l - 1));
+        out.insert(out.end(), in.begin() + start, in.begin() + start + l);
+    }
+}
+
+bool decodeRLE(const std::vector<unsigned char> &in, size_t rawBytes, std::vector<unsigned char> &out)
+{
+    out.clear();
+    out.reserve(rawBytes);
+    size_t i = 0;
+    while (i < in.size())
+    {
+        unsigned char c = in[i++];
+        if (c < 128)
+        {
+            size_t l = (size_t)c + 1;
+            if (i + l > in.size()) return false;
+            out.insert(out.end(), in.begin() + i, in.begin() + i + l);
+            i += l;
+        }
+        else
+        {
+            if (i >= in.size()) return false;
+            out.insert(out.end(), (size_t)c - 128 + 3, in[i++]);
+        }
+    }
+    return out.size() == rawBytes;
+}
+
+}
+
+void FrameColumns::clear()
+{
+    frame = 0;
+    positions.clear();
+    visible.clear();
+    vonMisesStress.clear();
+    elasticStrains.clear();
+    plasticStrains.clear();
+    totalStrains.clear();
+    elasticStrainsPerNode.clear();
+    plasticStrainsPerNode.clear();
+    totalStrainsPerNode.clear();
+}
+
+ColumnarFrameWriter::ColumnarFrameWriter() {
+compress = false;
+}
+
+ColumnarFrameWriter::~ColumnarFrameWriter() {
+close();
+}
+
+bool ColumnarFrameWriter::open(const std::string &path, bool _compress)
+{
+    close();
+    compress = _compress;
+    offsets.clear();
+    frames.clear();
+    file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return false;
+    file.write(fileMagic, 8);
+    return true;
+}
+
+void ColumnarFrameWriter::write(const FrameColumns &columns)
+{
+    if (!file.is_open()) return;
+
+    offsets.push_back((uint64_t)file.tellp());
+    frames.push_back(columns.frame);
+
+    const std::vector<double>* fields[8] = {&columns.positions, &columns.vonMisesStress, &columns.elasticStrains, &columns.plasticStrains,
+                                            &columns.totalStrains, &columns.elasticStrainsPerNode, &columns.plasticStrainsPerNode, &columns.totalStrainsPerNode};
+    const char* names[8] = {"positions", "vonmises", "elastic", "plastic", "total", "elasticnode", "plasticnode", "totalnode"};
+
+    uint32_t ncolumns = columns.visible.empty() ? 0 : 1;
+    for (int c = 0; c < 8; c++)
+        if (!fields[c]->empty()) ncolumns++;
+
+    int32_t frame = columns.frame;
+    uint32_t zero = 0;
+    file.write(chunkMagic, 4);
+    file.write((const char*)&frame, sizeof(frame));
+    file.write((const char*)&ncolumns, sizeof(ncolumns));
+    file.write((const char*)&zero, sizeof(zero));
+
+    for (int c = 0; c < 8; c++)
+        if (!fields[c]->empty()) writeColumn(names[c], *fields[c]);
+    if (!columns.visible.empty()) writeColumn("visible", columns.visible);
+}
+
+void ColumnarFrameWriter::writeColumn(const char *name, const std::vector<double> &values)
+{
+    raw.resize(values.size()*sizeof(double));
+    memcpy(&raw[0], &values[0], raw.size());
+    writePayload(name, TYPE_FLOAT64, values.size(), sizeof(double));
+}
+
+void ColumnarFrameWriter::writeColumn(const char *name, const std::vector<bool> &values)
+{
+    raw.assign((values.size() + 7)/8, 0);
+    for (size_t i = 0; i < values.size(); i++)
+        if (values[i]) raw[i/8] |= (unsigned char)(1 << (i%8));
+    writePayload(name, TYPE_BITS, values.size(), 1);
+}
+
+void ColumnarFrameWriter::writePayload(const char *name, uint32_t type, uint64_t count, int elemSize)
+{
+    ColumnHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.name, name, sizeof(header.name) - 1);
+    header.type = type;
+    header.count = count;
+    header.rawBytes = raw.size();
+    header.codec = CODEC_RAW;
+
+    const std::vector<unsigned char>* payload = &raw;
+    if (compress && raw.size() > 0)
+    {
+        std::vector<unsigned char> shuffled;
+        if (elemSize > 1) shuffle(raw, elemSize, shuffled);
+        else shuffled = raw;
+        encodeRLE(shuffled, encoded);
+        // kept raw when the encoding does not pay off
+        if (encoded.size() < raw.size())
+        {
+            header.codec = CODEC_SHUFFLE_RLE;
+            payload = &encoded;
+        }
+    }
+    header.storedBytes = payload->size();
+
+    file.write((const char*)&header, sizeof(header));
+    if (payload->size() > 0) file.write((const char*)&(*payload)[0], payload->size());
+    static const char padding[8] = {0,0,0,0,0,0,0,0};
+    size_t pad = (8 - payload->size()%8)%8;
+    if (pad) file.write(padding, pad);
+}
+
+void ColumnarFrameWriter::close()
+{
+    if (!file.is_open()) return;
+
+    for (size_t k = 0; k < offsets.size(); k++)
+    {
+        file.write((const char*)&offsets[k], sizeof(uint64_t));
+        file.write((const char*)&frames[k], sizeof(int64_t));
+    }
+    uint64_t n = offsets.size();
+    file.write((const char*)&n, sizeof(n));
+    file.write(indexMagic, 8);
+    file.close();
+}
+
+ColumnarFrameReader::ColumnarFrameReader() {
+}
+
+ColumnarFrameReader::~ColumnarFrameReader() {
+close();
+}
+
+bool ColumnarFrameReader::open(const std::string &path)
+{
+    close();
+    file.open(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) return false;
+
+    char magic[8];
+    if (!file.read(magic, 8) || memcmp(magic, fileMagic, 8) != 0)
+    {
+        file.close();
+        return false;
+    }
+
+    if (!readIndex()) scanChunks();
+    return true;
+}
+
+void ColumnarFrameReader::close()
+{
+    if (file.is_open()) file.close();
+    offsets.clear();
+    frames.clear();
+}
+
+bool ColumnarFrameReader::readIndex()
+{
+    file.clear();
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    if (size < 8 + 16) return false;
+
+    file.seekg(size - 16);
+    uint64_t n;
+    char magic[8];
+    file.read((char*)&n, sizeof(n));
+    file.read(magic, 8);
+    if (!file || memcmp(magic, indexMagic, 8) != 0) return false;
+    if ((std::streamoff)(8 + 16 + n*16) > size) return false;
+
+    file.seekg(size - 16 - (std::streamoff)(n*16));
+    offsets.resize(n);
+    frames.resize(n);
+    for (uint64_t k = 0; k < n; k++)
+    {
+        file.read((char*)&offsets[k], sizeof(uint64_t));
+        file.read((char*)&frames[k], sizeof(int64_t));
+    }
+    return (bool)file;
+}
+
+void ColumnarFrameReader::scanChunks()
+{
+    // file not closed by its writer: the chunks are walked from the start
+    offsets.clear();
+    frames.clear();
+    file.clear();
+    file.seekg(8);
+    while (true)
+    {
+        std::streamoff offset = file.tellg();
+        char magic[4];
+        int32_t frame;
+        uint32_t ncolumns, zero;
+        file.read(magic, 4);
+        file.read((char*)&frame, sizeof(frame));
+        file.read((char*)&ncolumns, sizeof(ncolumns));
+        file.read((char*)&zero, sizeof(zero));
+        if (!file || memcmp(magic, chunkMagic, 4) != 0) break;
+
+        bool complete = true;
+        for (uint32_t c = 0; c < ncolumns && complete; c++)
+        {
+            ColumnHeader header;
+            file.read((char*)&header, sizeof(header));
+            uint64_t stored = header.storedBytes + (8 - header.storedBytes%8)%8;
+            complete = (bool)file && (bool)file.seekg((std::streamoff)stored, std::ios::cur);
+        }
+        if (!complete) break;
+        offsets.push_back((uint64_t)offset);
+        frames.push_back(frame);
+    }
+    file.clear();
+}
+
+bool ColumnarFrameReader::readFrame(int frame, FrameColumns &columns)
+{
+    for (size_t k = 0; k < frames.size(); k++)
+        if (frames[k] == frame) return readChunk((int)k, columns);
+    return false;
+}
+
+bool ColumnarFrameReader::readChunk(int k, FrameColumns &columns)
+{
+    columns.clear();
+    if (k < 0 || k >= (int)offsets.size()) return false;
+
+    file.clear();
+    file.seekg((std::streamoff)offsets[k]);
+    char magic[4];
+    int32_t frame;
+    uint32_t ncolumns, zero;
+    file.read(magic, 4);
+    file.read((char*)&frame, sizeof(frame));
+    file.read((char*)&ncolumns, sizeof(ncolumns));
+    file.read((char*)&zero, sizeof(zero));
+    if (!file || memcmp(magic, chunkMagic, 4) != 0) return false;
+    columns.frame = frame;
+
+    for (uint32_t c = 0; c < ncolumns; c++)
+    {
+        ColumnHeader header;
+        file.read((char*)&header, sizeof(header));
+        if (!file) return false;
+
+        encoded.resize(header.storedBytes);
+        if (header.storedBytes > 0) file.read((char*)&encoded[0], header.storedBytes);
+        file.seekg((std::streamoff)((8 - header.storedBytes%8)%8), std::ios::cur);
+        if (!file) return false;
+
+        int elemSize = header.type == TYPE_FLOAT64 ? (int)sizeof(double) : 1;
+        if (header.codec == CODEC_SHUFFLE_RLE)
+        {
+            std::vector<unsigned char> shuffled;
+            if (!decodeRLE(encoded, header.rawBytes, shuffled)) return false;
+            if (elemSize > 1) unshuffle(shuffled, elemSize, raw);
+            else raw.swap(shuffled);
+        }
+        else raw.swap(encoded);
+
+        std::string name(header.name, strnlen(header.name, sizeof(header.name)));
+        if (header.type == TYPE_BITS)
+        {
+            if (raw.size() < (header.count + 7)/8) return false;
+            if (name == "visible")
+            {
+                columns.visible.resize(header.count);
+                for (uint64_t i = 0; i < header.count; i++)
+                    columns.visible[i] = (raw[i/8] >> (i%8)) & 1;
+            }
+            continue;
+        }
+
+        if (raw.size() != header.count*sizeof(double)) return false;
+        std::vector<double>* field = NULL;
+        if (name == "positions") field = &columns.positions;
+        else if (name == "vonmises") field = &columns.vonMisesStress;
+        else if (name == "elastic") field = &columns.elasticStrains;
+        else if (name == "plastic") field = &columns.plasticStrains;
+        else if (name == "total") field = &columns.totalStrains;
+        else if (name == "elasticnode") field = &columns.elasticStrainsPerNode;
+        else if (name == "plasticnode") field = &columns.plasticStrainsPerNode;
+        else if (name == "totalnode") field = &columns.totalStrainsPerNode;
+        // unknown columns are skipped
+        if (!field) continue;
+        field->resize(header.count);
+        if (header.count > 0) memcpy(&(*field)[0], &raw[0], raw.size());
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+/*
+ * ColumnarFrameData.h
+ *
+ *  Binary per-frame storage of the mesh positions, visibility and stress/strain fields,
+ *  one chunk per frame with one column per field, written by DataIO::writeData and read back
+ *  as ground truth by DataIO::readData.
+ *
+ *  file   : "RGBDCOL1", chunks, index, uint64 nframes, "RGBDIDX1"
+ *  chunk  : "FRAM", int32 frame, uint32 ncolumns, uint32 0, columns
+ *  column : char name[16], uint32 type, uint32 codec, uint64 count, uint64 rawBytes, uint64 storedBytes,
+ *           payload of storedBytes padded to 8 bytes
+ *  index  : (uint64 offset, int64 frame) per chunk
+ *
+ *  Uncompressed payloads are little endian float64 arrays (visibility: one bit per point) starting
+ *  on 8 byte boundaries, so they can be memory-mapped directly. Compressed payloads are the bytes
+ *  of the column regrouped by significance (all first bytes, then all second bytes, ...) and
+ *  run-length encoded, which mostly collapses the sign and exponent bytes of smooth fields.
+ */
+
+#ifndef COLUMNARFRAMEDATA_H_
+#define COLUMNARFRAMEDATA_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+struct FrameColumns
+{
+    int frame;
+    std::vector<double> positions;  // x0 y0 z0 x1 y1 z1 ...
+    std::vector<bool> visible;
+    std::vector<double> vonMisesStress;
+    std::vector<double> elasticStrains;
+    std::vector<double> plasticStrains;
+    std::vector<double> totalStrains;
+    std::vector<double> elasticStrainsPerNode;
+    std::vector<double> plasticStrainsPerNode;
+    std::vector<double> totalStrainsPerNode;
+
+    FrameColumns() : frame(0) {}
+    void clear();
+};
+
+class ColumnarFrameWriter {
+
+public :
+
+ColumnarFrameWriter();
+virtual ~ColumnarFrameWriter();
+
+bool open(const std::string &path, bool compress);
+void write(const FrameColumns &columns);
+// writes the index, the file is readable without it but is then scanned chunk by chunk
+void close();
+
+bool isOpen() const {return file.is_open();}
+
+private :
+
+std::ofstream file;
+bool compress;
+std::vector<uint64_t> offsets;
+std::vector<int64_t> frames;
+std::vector<unsigned char> raw, encoded;
+
+void writeColumn(const char *name, const std::vector<double> &values);
+void writeColumn(const char *name, const std::vector<bool> &values);
+void writePayload(const char *name, uint32_t type, uint64_t count, int elemSize);
+};
+
+class ColumnarFrameReader {
+
+public :
+
+ColumnarFrameReader();
+virtual ~ColumnarFrameReader();
+
+bool open(const std::string &path);
+void close();
+
+bool isOpen() const {return file.is_open();}
+int getNbFrames() const {return (int)offsets.size();}
+// reads the k-th chunk of the file
+bool readChunk(int k, FrameColumns &columns);
+// reads the chunk written for the given frame number
+bool readFrame(int frame, FrameColumns &columns);
+
+private :
+
+std::ifstream file;
+std::vector<uint64_t> offsets;
+std::vector<int64_t> frames;
+std::vector<unsigned char> raw, encoded;
+
+bool readIndex();
+void scanChunks();
+};
+
+#endif /* COLUMNARFRAMEDATA_H_ */
@@ -65,6 +65,9 @@
 
 #include <boost/thread.hpp>
 
+#include "ColumnarFrameData.h"
+#include "DepthCodec.h"
+
 using namespace std;
 using namespace cv;
 
@@ -123,6 +126,11 @@ public:
     Data<bool> useSensor;
     Data<int> niterations;
     Data<bool> newImages;
+    Data<bool> binaryData;
+    Data<bool> compressData;
+    Data<bool> compressDepth;
+    Data<double> depthUnit;
+    Data<int> depthKeyframeInterval;
 	
     int ntargetcontours;
 	
@@ -174,6 +182,14 @@ public:
 	
     int iter_im;
     cv::Mat rtd;
+
+    // ground truth of readData when binaryData is set, opened on the first read
+    ColumnarFrameReader gtReader;
+    FrameColumns gtColumns;
+
+    // depth maps of writeImages / readImages when compressDepth is set
+    DepthCodec depthEncoder;
+    DepthCodec depthDecoder;
 	
     DataIO();
     virtual ~DataIO();
@@ -183,6 +199,9 @@ public:
 	
     void readData();
     void readImages();
+    // compressed depth map of frame index, decoded from its keyframe on when the previous one was not read
+    bool readCompressedDepth(int index, cv::Mat &depth16);
+    bool readDepthFile(int index, std::vector<unsigned char> &encoded);
 	
     void writeImages();
     void writeImagesSynth();
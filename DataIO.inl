@@ -64,6 +64,11 @@ DataIO<DataTypes>::DataIO()
     , nimages(initData(&nimages,"nimages","Number of images",false))
     , startimage(initData(&startimage,1,"startimage","Number of images"))
     , niterations(initData(&niterations,1,"niterations","Number of images"))
+    , binaryData(initData(&binaryData,false,"binaryData","Write and read the point clouds and stress/strain fields as binary frame chunks (data.bin) instead of text files"))
+    , compressData(initData(&compressData,false,"compressData","Run-length encode the byte-shuffled columns of data.bin"))
+    , compressDepth(initData(&compressDepth,false,"compressDepth","Write and read the depth maps losslessly compressed (depthfile%06d.dpc) instead of text files"))
+    , depthUnit(initData(&depthUnit,0.001,"depthUnit","Depth quantization of the compressed depth maps, in meters; lossless only for depth in whole units (sensor depth is in millimeters), other depth is rounded"))
+    , depthKeyframeInterval(initData(&depthKeyframeInterval,30,"depthKeyframeInterval","Compressed depth maps between two frames coded on their own"))
 {
 
     std::cout << " init data " << std::endl;
@@ -418,7 +423,7 @@ void DataIO<DataTypes>::readImages()
     std::string opath1 = inputPath.getValue() + "/imgseg1%06d.png";
     std::string opath2 = inputPath.getValue() + "/depth1%06d.png";
     std::string opath3 = inputPath.getValue() + "/rtt%06d.png";
-    std::string opath4 = inputPath.getValue() + "/depthfile%06d.txt";
+    std::string opath4 = inputPath.getValue() + (compressDepth.getValue() ? "/depthfile%06d.dpc" : "/depthfile%06d.txt");
 
     cv::Mat depth0,depth1;
 
@@ -457,7 +462,19 @@ void DataIO<DataTypes>::readImages()
         color_3 = color_2.clone();
         color_2 = color.clone();
 
-        readFileToMat0(depth,filename4);
+        if (compressDepth.getValue())
+        {
+            double timeDecode = (double)getTickCount();
+            if (!readCompressedDepth(iter_im - 1, depth1))
+            {
+                std::cerr << "(DataIO) cannot decode " << filename4 << std::endl;
+                depth1 = cv::Mat::zeros(hght, wdth, CV_16UC1);
+            }
+            DepthCodec::toMeters(depth1, depthUnit.getValue(), depth);
+            timeDecode = ((double)getTickCount() - timeDecode)/getTickFrequency();
+            std::cout << "TIME DEPTH DECODE " << timeDecode << std::endl;
+        }
+        else readFileToMat0(depth,filename4);
         cv::Mat color00;
         depth00 = depth.clone();
         resize(depth00, depth, Size(wdth, hght));
@@ -471,6 +488,42 @@ void DataIO<DataTypes>::readImages()
 }
 
 
+template<class DataTypes>
+bool DataIO<DataTypes>::readDepthFile(int index, std::vector<unsigned char> &encoded)
+{
+    char buf[FILENAME_MAX];
+    sprintf(buf, (inputPath.getValue() + "/depthfile%06d.dpc").c_str(), index);
+    std::ifstream file(buf, std::ios::in | std::ios::binary);
+    if (!file) return false;
+    encoded.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+template<class DataTypes>
+bool DataIO<DataTypes>::readCompressedDepth(int index, cv::Mat &depth16)
+{
+    std::vector<unsigned char> encoded;
+    if (!readDepthFile(index, encoded)) return false;
+    if (depthDecoder.decode(encoded, depth16)) return true;
+
+    // an inter frame whose previous frame was not decoded, e.g. from a startimage between two keyframes:
+    // seek back to its keyframe and decode the frames from there
+    int first = index;
+    while (!DepthCodec::isKeyframe(encoded))
+    {
+        if (--first < 0 || !readDepthFile(first, encoded)) return false;
+    }
+    if (first == index) return false;
+
+    for (int k = first; k <= index; k++)
+    {
+        if (k > first && !readDepthFile(k, encoded)) return false;
+        if (!depthDecoder.decode(encoded, depth16)) return false;
+    }
+    std::cout << "(DataIO) depth frame " << index << " decoded from keyframe " << first << std::endl;
+    return true;
+}
+
 template <class DataTypes>
 void DataIO<DataTypes>::init()
 {
@@ -618,8 +671,40 @@ void DataIO<DataTypes>::readData()
         
         iter_im++;
         
+        if (binaryData.getValue())
+        {
+            if (!gtReader.isOpen() && !gtReader.open(inputPath.getValue() + "/data.bin"))
+                std::cout << " cannot open " << inputPath.getValue() << "/data.bin" << std::endl;
+
+            // frames are stored under the index they were written with, iter_im was already incremented
+            if (gtReader.readFrame(iter_im - 1, gtColumns))
+            {
+                unsigned int npoints = gtColumns.positions.size()/3;
+                pcd0.resize(npoints);
+                visible0.assign(npoints, false);
+                for (unsigned int i = 0; i < npoints; i++)
+                {
+                    pcd0[i] = Vec3d(gtColumns.positions[3*i], gtColumns.positions[3*i+1], gtColumns.positions[3*i+2]);
+                    if (i < gtColumns.visible.size() && gtColumns.visible[i])
+                    {
+                        visible0[i] = true;
+                        nvisi++;
+                    }
+                }
+                vonmisesstressGt = gtColumns.vonMisesStress;
+                elasticstrainsGt = gtColumns.elasticStrains;
+                plasticstrainsGt = gtColumns.plasticStrains;
+                totalstrainsGt = gtColumns.totalStrains;
+                elasticstrainsnodeGt = gtColumns.elasticStrainsPerNode;
+                plasticstrainsnodeGt = gtColumns.plasticStrainsPerNode;
+                totalstrainsnodeGt = gtColumns.totalStrainsPerNode;
+            }
+        }
+        else
+        {
         nvisi = readFileToPCD0(filename1, pcd0, visible0);
         readFileToStressStrain0(filename3,filename5, vonmisesstressGt, elasticstrainsGt, plasticstrainsGt, totalstrainsGt, elasticstrainsnodeGt, plasticstrainsnodeGt, totalstrainsnodeGt);
+        }
 
         VecCoord targetpos;
         targetpos.resize(nvisi);
@@ -689,7 +774,7 @@ void DataIO<DataTypes>::writeImages()
     std::string opath2 = outputPath.getValue() + "/depth1%06d.png";
     std::string opath3 = outputPath.getValue() + "/rtt%06d.png";
     std::string opath4 = outputPath.getValue() + "/depth2%06d.png";
-    std::string opath5 = outputPath.getValue() + "/depthfile%06d.txt";
+    std::string opath5 = outputPath.getValue() + (compressDepth.getValue() ? "/depthfile%06d.dpc" : "/depthfile%06d.txt");
     std::string opath6 = outputPath.getValue() + "/rttstress%06d.png";
     std::string opath7 = outputPath.getValue() + "/rttstressplast%06d.png";
     std::string opath8 = outputPath.getValue() + "/imgklt%06d.png";
@@ -698,6 +783,12 @@ void DataIO<DataTypes>::writeImages()
     cv::Mat imgseg,imgseg1;
     cv::Mat deptht,deptht1;
     cv::Mat rtt,rtt1, rttstress, rttstressplast;
+    cv::Mat depth16;
+    std::vector<unsigned char> encoded;
+
+    depthEncoder.setKeyframeInterval(depthKeyframeInterval.getValue());
+    depthEncoder.reset();
+    bool quantizationWarned = false;
 
     for (int frame_count = 0 ;frame_count < listimgseg.size()-5; frame_count++)
     {
@@ -734,7 +825,24 @@ void DataIO<DataTypes>::writeImages()
         cv::imwrite(filename3,deptht1);
         cv::imwrite(filename4,deptht);
 
-        writeMatToFile0(deptht,filename5);
+        if (compressDepth.getValue())
+        {
+            double timeEncode = (double)getTickCount();
+            double quantizationError = DepthCodec::toUnits(deptht, depthUnit.getValue(), depth16);
+            depthEncoder.encode(depth16, encoded);
+            std::ofstream file(filename5.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write((const char*)&encoded[0], encoded.size());
+            timeEncode = ((double)getTickCount() - timeEncode)/getTickFrequency();
+            if (quantizationError > 1e-3*depthUnit.getValue() && !quantizationWarned)
+            {
+                std::cerr << "(DataIO) depth is not in whole depthUnit, the compressed depth maps are rounded by up to " << quantizationError << " m" << std::endl;
+                quantizationWarned = true;
+            }
+            // the depthfile%06d.txt of writeMatToFile0: type, width and height, then the raw values
+            size_t rawSize = deptht.total()*deptht.elemSize();
+            std::cout << "TIME DEPTH ENCODE " << timeEncode << " " << encoded.size() << " bytes (" << rawSize << " raw, " << rawSize + 3*sizeof(int) << " depthfile.txt)" << std::endl;
+        }
+        else writeMatToFile0(deptht,filename5);
 
         if (useKLTPoints.getValue()){
             char buf8[FILENAME_MAX];
@@ -860,6 +968,14 @@ void DataIO<DataTypes>::writeData()
 
 
     cv::Mat rtt,rtt1,rtt2,depthi, depthin;
+
+    // one binary file for the whole sequence, one chunk per frame
+    ColumnarFrameWriter datawriter;
+    FrameColumns columns;
+    if (binaryData.getValue() && !datawriter.open(outputPath.getValue() + "/data.bin", compressData.getValue()))
+        std::cout << " cannot open " << outputPath.getValue() << "/data.bin" << std::endl;
+
+    double timeWriteData = (double)getTickCount();
     for (int frame_count = 0 ;frame_count < listpcd.size(); frame_count++)
     {
 
@@ -893,8 +1009,28 @@ void DataIO<DataTypes>::writeData()
         sprintf(buf4, opath4.c_str(), frame_count);
         std::string filename4(buf4);
 
+        if (binaryData.getValue())
+        {
+            columns.frame = frame_count;
+            columns.positions.resize(3*pcd1.size());
+            for (unsigned int k = 0; k < pcd1.size(); k++)
+                for (unsigned int j = 0; j < 3; j++)
+                    columns.positions[3*k+j] = pcd1[k][j];
+            columns.visible = visible1;
+            columns.vonMisesStress = vmstress;
+            columns.plasticStrains = plsstrain;
+            columns.elasticStrainsPerNode = elsstrainnode;
+            columns.plasticStrainsPerNode = plsstrainnode;
+            if (frame_count < (int)listes.size()) columns.elasticStrains = *listes[frame_count];
+            if (frame_count < (int)listts.size()) columns.totalStrains = *listts[frame_count];
+            if (frame_count < (int)listtsnode.size()) columns.totalStrainsPerNode = *listtsnode[frame_count];
+            datawriter.write(columns);
+        }
+        else
+        {
         writePCDToFile0(filename1,pcd1,visible1);
         writeStressStrainToFile0(filename3, filename4, vmstress, plsstrain, elsstrainnode, plsstrainnode);
+        }
 
 
         /*delete listimg[frame_count];
@@ -902,6 +1038,9 @@ void DataIO<DataTypes>::writeData()
                 delete listdepth[frame_count];*/
     }
     extfile.close();
+    datawriter.close();
+    timeWriteData = ((double)getTickCount() - timeWriteData)/getTickFrequency();
+    std::cout << "TIME WRITE DATA " << timeWriteData << std::endl;
 
     for (int frame_count = 1 ;frame_count < listrtt.size(); frame_count++)
     {
@@ -0,0 +1,382 @@
+/*
+ * DepthCodec.cpp
+ *
+ *  Lossless codec for 16-bit depth maps: per band median edge or previous frame prediction,
+ *  adaptive Golomb-Rice coding of the residuals, bands coded in parallel.
+ */
+
+#include "DepthCodec.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+namespace
+{
+
+enum { MODE_INTRA = 0, MODE_INTER = 1 };
+
+// unary prefixes longer than this are escaped, the value then follows on 17 bits
+const int riceLimit = 24;
+const int escapeBits = 17;
+const int headerSize = 16;
+
+class BitWriter
+{
+public:
+    BitWriter(std::vector<unsigned char> &_out) : out(_out), acc(0), nbits(0) {}
+
+    void put(uint32_t bits, int n)
+    {
+        acc = (acc << n) | (bits & ((n < 32) ? ((1u << n) - 1) : 0xffffffffu));
+        nbits += n;
+        while (nbits >= 8)
+        {
+            nbits -= 8;
+            out.push_back((unsigned char)(acc >> nbits));
+        }
+    }
+
+    void ones(int n)
+    {
+        while (n > 16) { put(0xffff, 16); n -= 16; }
+        put((1u << n) - 1, n);
+    }
+
+    void flush()
+    {
+        if (nbits > 0) out.push_back((unsigned char)(acc << (8 - nbits)));
+        nbits = 0;
+    }
+
+private:
+    std::vector<unsigned char> &out;
+    uint64_t acc;
+    int nbits;
+};
+
+class BitReader
+{
+public:
+    BitReader(const unsigned char *_data, size_t _size) : data(_data), size(_size), pos(0), acc(0), nbits(0), overrun(false) {}
+
+    uint32_t bit()
+    {
+        if (nbits == 0) fill();
+        nbits--;
+        return (uint32_t)(acc >> nbits) & 1u;
+    }
+
+    uint32_t get(int n)
+    {
+        uint32_t v = 0;
+        for (int i = 0; i < n; i++) v = (v << 1) | bit();
+        return v;
+    }
+
+    bool failed() const { return overrun; }
+
+private:
+    const unsigned char *data;
+    size_t size, pos;
+    uint64_t acc;
+    int nbits;
+    bool overrun;
+
+    void fill()
+    {
+        if (pos < size) acc = (acc << 8) | data[pos++];
+        else { acc <<= 8; overrun = true; }
+        nbits += 8;
+    }
+};
+
+// running mean of the residual magnitudes, giving the Rice parameter
+struct RiceContext
+{
+    uint32_t A, N;
+    RiceContext() : A(4), N(1) {}
+
+    int k() const
+    {
+        int k = 0;
+        while ((N << k) < A && k < 16) k++;
+        return k;
+    }
+
+    void update(uint32_t m)
+    {
+        A += m;
+        N++;
+        if (N >= 64) { A >>= 1; N >>= 1; }
+    }
+};
+
+inline uint32_t zigzag(int r) { return r >= 0 ? (uint32_t)r << 1 : ((uint32_t)(-r) << 1) - 1; }
+inline int unzigzag(uint32_t m) { return (m & 1) ? -(int)((m + 1) >> 1) : (int)(m >> 1); }
+
+// median edge detector on the left (a), upper (b) and upper-left (c) neighbours within the band
+inline int predictIntra(const uint16_t *row, const uint16_t *up, int j)
+{
+    if (!up) return j > 0 ? row[j-1] : 0;
+    if (j == 0) return up[0];
+    int a = row[j-1], b = up[j], c = up[j-1];
+    int mx = a > b ? a : b, mn = a > b ? b : a;
+    if (c >= mx) return mn;
+    if (c <= mn) return mx;
+    return a + b - c;
+}
+
+void encodeValue(BitWriter &bw, RiceContext &ctx, int residual)
+{
+    uint32_t m = zigzag(residual);
+    int k = ctx.k();
+    uint32_t q = m >> k;
+    if ((int)q < riceLimit)
+    {
+        bw.ones((int)q);
+        bw.put(0, 1);
+        if (k) bw.put(m, k);
+    }
+    else
+    {
+        bw.ones(riceLimit);
+        bw.put(m, escapeBits);
+    }
+    ctx.update(m);
+}
+
+int decodeValue(BitReader &br, RiceContext &ctx)
+{
+    int k = ctx.k();
+    uint32_t q = 0;
+    while ((int)q < riceLimit && br.bit()) q++;
+    uint32_t m;
+    if ((int)q < riceLimit) m = (q << k) | (k ? br.get(k) : 0);
+    else m = br.get(escapeBits);
+    ctx.update(m);
+    return unzigzag(m);
+}
+
+void encodeBand(const cv::Mat &depth, const cv::Mat &previous, int r0, int r1, int mode, std::vector<unsigned char> &out)
+{
+    out.clear();
+    BitWriter bw(out);
+    RiceContext ctx;
+    for (int i = r0; i < r1; i++)
+    {
+        const uint16_t *row = depth.ptr<uint16_t>(i);
+        const uint16_t *up = i > r0 ? depth.ptr<uint16_t>(i-1) : NULL;
+        const uint16_t *prev = mode == MODE_INTER ? previous.ptr<uint16_t>(i) : NULL;
+        for (int j = 0; j < depth.cols; j++)
+        {
+            int p = prev ? prev[j] : predictIntra(row, up, j);
+            encodeValue(bw, ctx, (int)row[j] - p);
+        }
+    }
+    bw.flush();
+}
+
+bool decodeBand(const unsigned char *data, size_t size, const cv::Mat &previous, int r0, int r1, int mode, cv::Mat &depth)
+{
+    BitReader br(data, size);
+    RiceContext ctx;
+    for (int i = r0; i < r1; i++)
+    {
+        uint16_t *row = depth.ptr<uint16_t>(i);
+        const uint16_t *up = i > r0 ? depth.ptr<uint16_t>(i-1) : NULL;
+        const uint16_t *prev = mode == MODE_INTER ? previous.ptr<uint16_t>(i) : NULL;
+        for (int j = 0; j < depth.cols; j++)
+        {
+            int p = prev ? prev[j] : predictIntra(row, up, j);
+            row[j] = (uint16_t)(p + decodeValue(br, ctx));
+        }
+    }
+    return !br.failed();
+}
+
+// cost estimate of a band for the mode choice: sum of the residual magnitudes
+uint64_t bandCost(const cv::Mat &depth, const cv::Mat &previous, int r0, int r1, int mode)
+{
+    uint64_t cost = 0;
+    for (int i = r0; i < r1; i++)
+    {
+        const uint16_t *row = depth.ptr<uint16_t>(i);
+        const uint16_t *up = i > r0 ? depth.ptr<uint16_t>(i-1) : NULL;
+        const uint16_t *prev = mode == MODE_INTER ? previous.ptr<uint16_t>(i) : NULL;
+        for (int j = 0; j < depth.cols; j++)
+        {
+            int r = (int)row[j] - (prev ? prev[j] : predictIntra(row, up, j));
+            cost += r >= 0 ? r : -r;
+        }
+    }
+    return cost;
+}
+
+template<class T> void writeField(std::vector<unsigned char> &out, size_t pos, T v) { memcpy(&out[pos], &v, sizeof(T)); }
+template<class T> T readField(const std::vector<unsigned char> &in, size_t pos) { T v; memcpy(&v, &in[pos], sizeof(T)); return v; }
+
+// one band per task, the bands of the contour cost more than the empty ones
+struct EncodeBands
+{
+    const cv::Mat *depth, *previous;
+    int bandRows;
+    bool keyframe;
+    std::vector< std::vector<unsigned char> > *bands;
+    std::vector<unsigned char> *modes;
+
+    void operator()(int begin, int end) const
+    {
+        for (int b = begin; b < end; b++)
+        {
+            int r0 = b*bandRows, r1 = std::min(depth->rows, r0 + bandRows);
+            (*modes)[b] = MODE_INTRA;
+            if (!keyframe && bandCost(*depth, *previous, r0, r1, MODE_INTER) < bandCost(*depth, *previous, r0, r1, MODE_INTRA))
+                (*modes)[b] = MODE_INTER;
+            encodeBand(*depth, *previous, r0, r1, (*modes)[b], (*bands)[b]);
+        }
+    }
+};
+
+struct DecodeBands
+{
+    const std::vector<unsigned char> *in;
+    const std::vector<size_t> *offsets;
+    const cv::Mat *previous;
+    cv::Mat *decoded;
+    int bandRows;
+    bool keyframe;
+    std::vector<unsigned char> *valid;
+
+    void operator()(int begin, int end) const
+    {
+        for (int b = begin; b < end; b++)
+        {
+            int r0 = b*bandRows, r1 = std::min(decoded->rows, r0 + bandRows);
+            int mode = (*in)[headerSize + 5*b];
+            (*valid)[b] = !(mode == MODE_INTER && keyframe)
+                    && decodeBand(&(*in)[(*offsets)[b]], (*offsets)[b+1] - (*offsets)[b], *previous, r0, r1, mode, *decoded);
+        }
+    }
+};
+
+}
+
+DepthCodec::DepthCodec() {
+bandRows = 16;
+keyframeInterval = 30;
+frameCount = 0;
+}
+
+DepthCodec::~DepthCodec() {
+}
+
+void DepthCodec::reset()
+{
+    previous.release();
+    frameCount = 0;
+}
+
+void DepthCodec::encode(const cv::Mat &depth, std::vector<unsigned char> &out)
+{
+    CV_Assert(depth.type() == CV_16UC1);
+
+    bool keyframe = keyframeInterval <= 1 || frameCount%keyframeInterval == 0
+            || previous.size() != depth.size();
+    int nbands = (depth.rows + bandRows - 1)/bandRows;
+    bands.resize(nbands);
+    modes.resize(nbands);
+
+    EncodeBands encodeBands;
+    encodeBands.depth = &depth;
+    encodeBands.previous = &previous;
+    encodeBands.bandRows = bandRows;
+    encodeBands.keyframe = keyframe;
+    encodeBands.bands = &bands;
+    encodeBands.modes = &modes;
+    TaskPool::instance().parallelFor(0, nbands, encodeBands, 1);
+
+    size_t size = headerSize + nbands*5;
+    for (int b = 0; b < nbands; b++) size += bands[b].size();
+    out.assign(size, 0);
+
+    memcpy(&out[0], "DPC1", 4);
+    writeField<uint16_t>(out, 4, (uint16_t)depth.cols);
+    writeField<uint16_t>(out, 6, (uint16_t)depth.rows);
+    writeField<uint16_t>(out, 8, (uint16_t)bandRows);
+    out[10] = keyframe ? 1 : 0;
+    writeField<uint32_t>(out, 12, (uint32_t)nbands);
+
+    size_t pos = headerSize + nbands*5;
+    for (int b = 0; b < nbands; b++)
+    {
+        out[headerSize + 5*b] = modes[b];
+        writeField<uint32_t>(out, headerSize + 5*b + 1, (uint32_t)bands[b].size());
+        if (bands[b].size()) memcpy(&out[pos], &bands[b][0], bands[b].size());
+        pos += bands[b].size();
+    }
+
+    previous = depth.clone();
+    frameCount++;
+}
+
+bool DepthCodec::decode(const std::vector<unsigned char> &in, cv::Mat &depth)
+{
+    if (in.size() < (size_t)headerSize || memcmp(&in[0], "DPC1", 4) != 0) return false;
+
+    int width = readField<uint16_t>(in, 4);
+    int height = readField<uint16_t>(in, 6);
+    int rows = readField<uint16_t>(in, 8);
+    bool keyframe = in[10] != 0;
+    int nbands = (int)readField<uint32_t>(in, 12);
+    if (rows <= 0 || nbands != (height + rows - 1)/rows || in.size() < (size_t)(headerSize + nbands*5)) return false;
+    if (!keyframe && (previous.rows != height || previous.cols != width)) return false;
+
+    std::vector<size_t> offsets(nbands + 1);
+    offsets[0] = headerSize + nbands*5;
+    for (int b = 0; b < nbands; b++)
+        offsets[b+1] = offsets[b] + readField<uint32_t>(in, headerSize + 5*b + 1);
+    if (offsets[nbands] > in.size()) return false;
+
+    // previous may be the caller's last depth, the frame is decoded in a buffer of its own
+    cv::Mat decoded(height, width, CV_16UC1);
+    std::vector<unsigned char> valid(nbands);
+    DecodeBands decodeBands;
+    decodeBands.in = &in;
+    decodeBands.offsets = &offsets;
+    decodeBands.previous = &previous;
+    decodeBands.decoded = &decoded;
+    decodeBands.bandRows = rows;
+    decodeBands.keyframe = keyframe;
+    decodeBands.valid = &valid;
+    TaskPool::instance().parallelFor(0, nbands, decodeBands, 1);
+    if (std::find(valid.begin(), valid.end(), 0) != valid.end()) return false;
+
+    previous = decoded;
+    decoded.copyTo(depth);
+    return true;
+}
+
+bool DepthCodec::isKeyframe(const std::vector<unsigned char> &in)
+{
+    return in.size() >= (size_t)headerSize && memcmp(&in[0], "DPC1", 4) == 0 && in[10] != 0;
+}
+
+double DepthCodec::toUnits(const cv::Mat &depthMeters, double unit, cv::Mat &depth16)
+{
+    // convertTo rounds and saturates to the 16-bit range
+    depthMeters.convertTo(depth16, CV_16U, 1.0/unit);
+
+    cv::Mat quantized, error;
+    depth16.convertTo(quantized, depthMeters.type(), unit);
+    cv::absdiff(depthMeters, quantized, error);
+    double maxError = 0;
+    cv::minMaxLoc(error.reshape(1), NULL, &maxError);
+    return maxError;
+}
+
+void DepthCodec::toMeters(const cv::Mat &depth16, double unit, cv::Mat &depthMeters)
+{
+    depth16.convertTo(depthMeters, CV_32F, unit);
+}
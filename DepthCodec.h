@@ -0,0 +1,60 @@
+/*
+ * DepthCodec.h
+ *
+ *  Lossless codec for 16-bit depth maps. The image is cut into bands of rows coded independently,
+ *  so bands are encoded and decoded in parallel. Each band predicts its pixels either from their
+ *  left, upper and upper-left neighbours (median edge detector) or, between two keyframes, from the
+ *  same pixel in the previous frame, which suits the static background; the residuals are
+ *  Golomb-Rice coded with a parameter adapted to their running mean.
+ *  The coding of the 16-bit codes is lossless; metric depth is quantized to them by toUnits, which
+ *  is exact only for depth given in whole units (sensor millimeters with a 1 mm unit).
+ *  An inter frame only decodes after the frames back to its keyframe, see isKeyframe.
+ *
+ *  frame : "DPC1", uint16 width, uint16 height, uint16 bandRows, uint8 keyframe, uint8 0, uint32 nbands,
+ *          per band (uint8 mode, uint32 bytes), band payloads
+ */
+
+#ifndef DEPTHCODEC_H_
+#define DEPTHCODEC_H_
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+class DepthCodec {
+
+public :
+
+DepthCodec();
+virtual ~DepthCodec();
+
+void setBandRows(int _bandRows){bandRows = _bandRows;}
+// 1 codes every frame on its own
+void setKeyframeInterval(int _keyframeInterval){keyframeInterval = _keyframeInterval;}
+
+// depth is CV_16UC1; frames between keyframes are predicted from the previous frame given to encode
+void encode(const cv::Mat &depth, std::vector<unsigned char> &out);
+// depth is CV_16UC1; frames between keyframes need the previous frame decoded by this codec
+bool decode(const std::vector<unsigned char> &in, cv::Mat &depth);
+// whether an encoded frame decodes on its own, the first one to decode when seeking to an inter frame
+static bool isKeyframe(const std::vector<unsigned char> &in);
+// forgets the previous frame, the next encoded frame is a keyframe
+void reset();
+
+// metric depth (CV_32F) to codes of unit meters, rounded and clamped to 16 bits, and back;
+// toUnits returns the largest error of the quantization, 0 when the depth is in whole units
+static double toUnits(const cv::Mat &depthMeters, double unit, cv::Mat &depth16);
+static void toMeters(const cv::Mat &depth16, double unit, cv::Mat &depthMeters);
+
+private :
+
+int bandRows;
+int keyframeInterval;
+int frameCount;
+
+cv::Mat previous;
+std::vector< std::vector<unsigned char> > bands;
+std::vector<unsigned char> modes;
+};
+
+#endif /* DEPTHCODEC_H_ */
@@ -0,0 +1,269 @@
+/*
+ * DepthNormals.cpp
+ *
+ *  Image-space normal and curvature estimation on an organized depth map.
+ */
+
+#include "DepthNormals.h"
+#include "TaskPool.h"
+
+#include <cmath>
+
+namespace
+{
+
+// difference b - a of the neighbours of pixel c at -r and +r along one axis, one-sided across
+// a discontinuity; false when neither side can be used
+inline bool tangent(const cv::Vec3f *a, const cv::Vec3f *c, const cv::Vec3f *b, float thr, cv::Vec3f &t)
+{
+    float zc = (*c)[2];
+    bool okA = a && (*a)[2] > 0 && fabsf((*a)[2] - zc) <= thr*zc;
+    bool okB = b && (*b)[2] > 0 && fabsf((*b)[2] - zc) <= thr*zc;
+    if (okA && okB) t = *b - *a;
+    else if (okB) t = *b - *c;
+    else if (okA) t = *c - *a;
+    else return false;
+    return true;
+}
+
+inline float rateOfChange(const cv::Vec3f *pa, const cv::Vec3f *pc, const cv::Vec3f *pb,
+                          const cv::Vec3f *na, const cv::Vec3f *nc, const cv::Vec3f *nb, float thr)
+{
+    // a neighbour without normal is treated as missing
+    const cv::Vec3f *a = (na && (*na)[2] != 0) ? pa : NULL;
+    const cv::Vec3f *b = (nb && (*nb)[2] != 0) ? pb : NULL;
+    cv::Vec3f dp;
+    if (!tangent(a, pc, b, thr, dp)) return 0;
+    float len2 = dp.dot(dp);
+    if (len2 <= 0) return 0;
+
+    float zc = (*pc)[2];
+    bool okA = a && fabsf((*a)[2] - zc) <= thr*zc;
+    bool okB = b && fabsf((*b)[2] - zc) <= thr*zc;
+    cv::Vec3f dn = (okA && okB) ? *nb - *na : (okB ? *nb - *nc : *nc - *na);
+    return sqrtf(dn.dot(dn)/len2);
+}
+
+// back-projection, missing depths give z = 0
+struct BackProject
+{
+    const cv::Mat *depth;
+    cv::Mat *points;
+    float ifx, ify, fcx, fcy;
+
+    void operator()(int begin, int end) const
+    {
+        int width = depth->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const float *z = depth->ptr<float>(i);
+            cv::Vec3f *p = points->ptr<cv::Vec3f>(i);
+            float y = (i - fcy)*ify;
+            for (int j = 0; j < width; j++)
+            {
+                float zj = z[j] > 0 ? z[j] : 0;
+                p[j] = cv::Vec3f((j - fcx)*ifx*zj, y*zj, zj);
+            }
+        }
+    }
+};
+
+// cross products of the tangents, turned towards the camera
+struct CrossNormals
+{
+    const cv::Mat *points;
+    cv::Mat *raw;
+    int r;
+    float thr;
+
+    void operator()(int begin, int end) const
+    {
+        int height = points->rows, width = points->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const cv::Vec3f *p = points->ptr<cv::Vec3f>(i);
+            const cv::Vec3f *pu = i - r >= 0 ? points->ptr<cv::Vec3f>(i - r) : NULL;
+            const cv::Vec3f *pd = i + r < height ? points->ptr<cv::Vec3f>(i + r) : NULL;
+            cv::Vec3f *n = raw->ptr<cv::Vec3f>(i);
+            for (int j = 0; j < width; j++)
+            {
+                n[j] = cv::Vec3f(0, 0, 0);
+                if (!(p[j][2] > 0)) continue;
+                cv::Vec3f du, dv;
+                if (!tangent(j - r >= 0 ? p + j - r : NULL, p + j, j + r < width ? p + j + r : NULL, thr, du)) continue;
+                if (!tangent(pu ? pu + j : NULL, p + j, pd ? pd + j : NULL, thr, dv)) continue;
+                cv::Vec3f c = du.cross(dv);
+                float len = sqrtf(c.dot(c));
+                if (len <= 0) continue;
+                if (c.dot(p[j]) > 0) len = -len;
+                n[j] = c*(1/len);
+            }
+        }
+    }
+};
+
+// average of the cross products over a window, restricted to the neighbours on the same side of
+// the depth discontinuities as the pixel, so that the normals of an occluding surface and of the
+// surface behind it are not mixed at their silhouette
+struct SmoothNormals
+{
+    const cv::Mat *points;
+    const cv::Mat *raw;
+    cv::Mat *normals;
+    int s;
+    float thr;
+
+    void operator()(int begin, int end) const
+    {
+        int height = points->rows, width = points->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const cv::Vec3f *p = points->ptr<cv::Vec3f>(i);
+            const cv::Vec3f *n0 = raw->ptr<cv::Vec3f>(i);
+            cv::Vec3f *n = normals->ptr<cv::Vec3f>(i);
+            int i0 = i - s > 0 ? i - s : 0, i1 = i + s < height - 1 ? i + s : height - 1;
+            for (int j = 0; j < width; j++)
+            {
+                n[j] = cv::Vec3f(0, 0, 0);
+                if (n0[j][2] == 0) continue;
+                float zc = p[j][2], dz = thr*zc;
+                int j0 = j - s > 0 ? j - s : 0, j1 = j + s < width - 1 ? j + s : width - 1;
+                cv::Vec3f sum(0, 0, 0);
+                for (int k = i0; k <= i1; k++)
+                {
+                    const cv::Vec3f *pk = points->ptr<cv::Vec3f>(k);
+                    const cv::Vec3f *nk = raw->ptr<cv::Vec3f>(k);
+                    for (int l = j0; l <= j1; l++)
+                        if (nk[l][2] != 0 && fabsf(pk[l][2] - zc) <= dz) sum += nk[l];
+                }
+                n[j] = sum;
+            }
+        }
+    }
+};
+
+// unit length after the average
+struct Normalize
+{
+    const cv::Mat *raw;
+    cv::Mat *normals;
+
+    void operator()(int begin, int end) const
+    {
+        int width = raw->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const cv::Vec3f *n0 = raw->ptr<cv::Vec3f>(i);
+            cv::Vec3f *n = normals->ptr<cv::Vec3f>(i);
+            for (int j = 0; j < width; j++)
+            {
+                float len = sqrtf(n[j].dot(n[j]));
+                n[j] = (n0[j][2] != 0 && len > 0) ? n[j]*(1/len) : cv::Vec3f(0, 0, 0);
+            }
+        }
+    }
+};
+
+struct Curvature
+{
+    const cv::Mat *points;
+    const cv::Mat *normals;
+    cv::Mat *curvature;
+    int r;
+    float thr;
+
+    void operator()(int begin, int end) const
+    {
+        int height = points->rows, width = points->cols;
+        for (int i = begin; i < end; i++)
+        {
+            const cv::Vec3f *p = points->ptr<cv::Vec3f>(i);
+            const cv::Vec3f *pu = i - r >= 0 ? points->ptr<cv::Vec3f>(i - r) : NULL;
+            const cv::Vec3f *pd = i + r < height ? points->ptr<cv::Vec3f>(i + r) : NULL;
+            const cv::Vec3f *n = normals->ptr<cv::Vec3f>(i);
+            const cv::Vec3f *nu = i - r >= 0 ? normals->ptr<cv::Vec3f>(i - r) : NULL;
+            const cv::Vec3f *nd = i + r < height ? normals->ptr<cv::Vec3f>(i + r) : NULL;
+            float *k = curvature->ptr<float>(i);
+            for (int j = 0; j < width; j++)
+            {
+                k[j] = 0;
+                if (n[j][2] == 0) continue;
+                bool left = j - r >= 0, right = j + r < width;
+                float ku = rateOfChange(left ? p + j - r : NULL, p + j, right ? p + j + r : NULL,
+                                        left ? n + j - r : NULL, n + j, right ? n + j + r : NULL, thr);
+                float kv = rateOfChange(pu ? pu + j : NULL, p + j, pd ? pd + j : NULL,
+                                        nu ? nu + j : NULL, n + j, nd ? nd + j : NULL, thr);
+                k[j] = ku > kv ? ku : kv;
+            }
+        }
+    }
+};
+
+}
+
+DepthNormals::DepthNormals() {
+fx = fy = 1;
+cx = cy = 0;
+radius = 2;
+smoothing = 3;
+maxDepthChange = 0.02;
+}
+
+DepthNormals::~DepthNormals() {
+}
+
+void DepthNormals::compute(const cv::Mat &depth, cv::Mat &normals, cv::Mat &curvature)
+{
+    CV_Assert(depth.type() == CV_32FC1);
+
+    int height = depth.rows, width = depth.cols;
+    int r = radius > 0 ? radius : 1;
+    float thr = (float)(maxDepthChange*r);
+    float ifx = (float)(1/fx), ify = (float)(1/fy), fcx = (float)cx, fcy = (float)cy;
+
+    points.create(height, width, CV_32FC3);
+    raw.create(height, width, CV_32FC3);
+    curvature.create(height, width, CV_32FC1);
+
+    TaskPool &pool = TaskPool::instance();
+
+    BackProject backProject;
+    backProject.depth = &depth;
+    backProject.points = &points;
+    backProject.ifx = ifx; backProject.ify = ify; backProject.fcx = fcx; backProject.fcy = fcy;
+    pool.parallelFor(0, height, backProject);
+
+    CrossNormals crossNormals;
+    crossNormals.points = &points;
+    crossNormals.raw = &raw;
+    crossNormals.r = r;
+    crossNormals.thr = thr;
+    pool.parallelFor(0, height, crossNormals);
+
+    // average of the unit normals masked at the discontinuities, the pixels without depth stay without normal
+    normals.create(height, width, CV_32FC3);
+    if (smoothing > 0)
+    {
+        SmoothNormals smoothNormals;
+        smoothNormals.points = &points;
+        smoothNormals.raw = &raw;
+        smoothNormals.normals = &normals;
+        smoothNormals.s = smoothing;
+        smoothNormals.thr = thr;
+        pool.parallelFor(0, height, smoothNormals);
+    }
+    else raw.copyTo(normals);
+
+    Normalize normalize;
+    normalize.raw = &raw;
+    normalize.normals = &normals;
+    pool.parallelFor(0, height, normalize);
+
+    Curvature curvatures;
+    curvatures.points = &points;
+    curvatures.normals = &normals;
+    curvatures.curvature = &curvature;
+    curvatures.r = r;
+    curvatures.thr = thr;
+    pool.parallelFor(0, height, curvatures);
+}
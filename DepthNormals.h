@@ -0,0 +1,45 @@
+/*
+ * DepthNormals.h
+ *
+ *  Normals and curvatures of an organized depth map computed in image space, in O(pixels) and
+ *  without any spatial index. The tangents are central differences of the back-projected points
+ *  over a pixel radius, one-sided where a depth jump larger than maxDepthChange*z (discontinuity)
+ *  or a missing depth breaks the neighbourhood; their cross products are averaged over a window,
+ *  leaving out the neighbours across a discontinuity, and normalized. The curvature is the largest rate of change of the
+ *  normal along the image axes, an estimate of the first principal curvature (1/m).
+ */
+
+#ifndef DEPTHNORMALS_H_
+#define DEPTHNORMALS_H_
+
+#include <opencv2/core.hpp>
+
+class DepthNormals {
+
+public :
+
+DepthNormals();
+virtual ~DepthNormals();
+
+void setIntrinsics(double _fx, double _fy, double _cx, double _cy){fx = _fx; fy = _fy; cx = _cx; cy = _cy;}
+void setRadius(int _radius){radius = _radius;}
+// half size of the averaging window, 0 keeps the raw cross products
+void setSmoothing(int _smoothing){smoothing = _smoothing;}
+void setMaxDepthChange(double _maxDepthChange){maxDepthChange = _maxDepthChange;}
+
+// depth: CV_32FC1 in meters; normals: CV_32FC3 unit vectors facing the camera,
+// curvature: CV_32FC1; both are 0 where the depth is missing or the surface undefined
+void compute(const cv::Mat &depth, cv::Mat &normals, cv::Mat &curvature);
+
+private :
+
+double fx, fy, cx, cy;
+int radius;
+int smoothing;
+double maxDepthChange;
+
+cv::Mat points;
+cv::Mat raw;
+};
+
+#endif /* DEPTHNORMALS_H_ */
@@ -35,9 +35,6 @@
 #include <sofa/gui/BaseViewer.h>
 #include <sofa/gui/GUIManager.h>
 
-#ifdef USING_OMP_PRAGMAS
-#include <omp.h>
-#endif
 
 #include <SofaLoader/MeshObjLoader.h>
 #include <limits>
@@ -51,6 +48,7 @@
 #include <pcl/keypoints/harris_3d.h>
 
 #include <pcl/features/fpfh_omp.h>
+#include <pcl/features/normal_3d_omp.h>
 #include <pcl/features/pfh.h>
 #include <pcl/features/pfhrgb.h>
 #include <pcl/features/3dsc.h>
@@ -62,16 +60,86 @@
 #include <pcl/registration/correspondence_rejection.h>
 #include <pcl/registration/correspondence_rejection_sample_consensus.h>
 
+#include <Eigen/Geometry>
+
 #ifdef Success
   #undef Success
 #endif
 
 #include "FeatureMatchingForceField.h"
+#include "SpatialHashSearch.h"
+#include "TaskPool.h"
 
 
 using std::cerr;
 using std::endl;
 
+namespace
+{
+
+// nearest descriptor of the other cloud for each descriptor of a range
+struct NearestDescriptors
+{
+    const pcl::KdTreeFLANN<pcl::FPFHSignature33> *tree;
+    const pcl::PointCloud<pcl::FPFHSignature33> *descriptors;
+    std::vector<int> *nearest;
+    std::vector<float> *distances;
+
+    void operator()(int begin, int end) const
+    {
+        std::vector<int> nn(1);
+        std::vector<float> nndist(1);
+        for (int i = begin; i < end; i++)
+        {
+            if (!pcl_isfinite(descriptors->points[i].histogram[0])) continue;
+            if (tree->nearestKSearch(descriptors->points[i],1,nn,nndist) > 0)
+            {
+                (*nearest)[i] = nn[0];
+                if (distances) (*distances)[i] = nndist[0];
+            }
+        }
+    }
+};
+
+typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > RansacTransforms;
+
+// the random triplet of a hypothesis only depends on its index, not on the thread scoring it
+struct RansacHypotheses
+{
+    const Eigen::Matrix3Xf *src, *tgt;
+    float thr2;
+    int first;
+    std::vector<int> *counts;
+    RansacTransforms *transforms;
+
+    void operator()(int begin, int end) const
+    {
+        int nc = src->cols();
+        for (int it = begin; it < end; it++)
+        {
+            int &count = (*counts)[it - first];
+            count = -1;
+            unsigned int seed = 12345u + 7919u*it;
+            int i0 = rand_r(&seed)%nc, i1 = rand_r(&seed)%nc, i2 = rand_r(&seed)%nc;
+            if (i0 == i1 || i0 == i2 || i1 == i2) continue;
+
+            Eigen::Matrix3f a, b;
+            a << src->col(i0), src->col(i1), src->col(i2);
+            b << tgt->col(i0), tgt->col(i1), tgt->col(i2);
+            Eigen::Matrix4f T = Eigen::umeyama(a,b,false);
+            Eigen::Matrix3f R = T.topLeftCorner<3,3>();
+            Eigen::Vector3f tr = T.topRightCorner<3,1>();
+
+            count = 0;
+            for (int k = 0; k < nc; k++)
+                if ((R*src->col(k) + tr - tgt->col(k)).squaredNorm() < thr2) count++;
+            (*transforms)[it - first] = T;
+        }
+    }
+};
+
+}
+
 namespace sofa
 {
 
@@ -124,6 +192,7 @@ FeatureMatchingForceField<DataTypes>::FeatureMatchingForceField(core::behavior::
     , sourceNormals(initData(&sourceNormals,"sourceNormals","Normals of the source mesh."))
     , sourceSurfaceNormals(initData(&sourceSurfaceNormals,"sourceSurfaceNormals","Normals of the surface of the source mesh."))
     , targetPositions(initData(&targetPositions,"targetPositions","Points of the target point cloud."))
+    , targetNormals(initData(&targetNormals,"targetNormals","Normals of the target point cloud, estimated here with a k-d tree when not given."))
     , descriptor_type(initData(&descriptor_type,0,"descriptor","Descriptor type"))
     , keypoint_type(initData(&keypoint_type,0,"keypoint","Keypoint type"))
     , drawMode(initData(&drawMode,0,"drawMode","The way springs will be drawn:\n- 0: Line\n- 1:Cylinder\n- 2: Arrow."))
@@ -132,13 +201,28 @@ FeatureMatchingForceField<DataTypes>::FeatureMatchingForceField(core::behavior::
     , showArrowSize(initData(&showArrowSize,0.01f,"showArrowSize","size of the axis."))
     , drawColorMap(initData(&drawColorMap,true,"drawColorMap","Hue mapping of distances to closest point"))
     , theCloserTheStiffer(initData(&theCloserTheStiffer,false,"theCloserTheStiffer","Modify stiffness according to distance"))
+    , niterations(initData(&niterations,1,"niterations","Number of iterations in the tracking process"))
+    , useFeatureThread(initData(&useFeatureThread,true,"useFeatureThread","Compute keypoints, descriptors and matches on a worker thread, once per frame"))
+    , featureCacheDisplacement(initData(&featureCacheDisplacement,(Real)0.005,"featureCacheDisplacement","Recompute the descriptor of a source keypoint when its non-rigid displacement exceeds this distance"))
+    , featureMatchEpsilon(initData(&featureMatchEpsilon,(float)0.5,"featureMatchEpsilon","Error bound of the approximate nearest neighbour search in descriptor space (0: exact)"))
+    , ransacInlierThreshold(initData(&ransacInlierThreshold,(Real)0.01,"ransacInlierThreshold","Maximum distance between a transformed source keypoint and its matched target keypoint for an inlier"))
+    , ransacMaxIterations(initData(&ransacMaxIterations,2000,"ransacMaxIterations","Maximum number of RANSAC hypotheses"))
+    , ransacConfidence(initData(&ransacConfidence,(Real)0.99,"ransacConfidence","Probability of drawing at least one outlier-free hypothesis, used to stop RANSAC early"))
+    , featureInlierRatio(initData(&featureInlierRatio,(Real)0,"featureInlierRatio","Ratio of feature matches kept as inliers at the last frame"))
 {
     iter_im = 0;
+    featureRunning = false;
+    featureFrameRequested = -1;
+    featureFrameDone = -1;
+    featureFramePublished = -1;
+    featureRatio = 0;
+    featureInlierRatio.setReadOnly(true);
 }
 
 template <class DataTypes>
 FeatureMatchingForceField<DataTypes>::~FeatureMatchingForceField()
 {
+    if (featureThread.joinable()) featureThread.join();
 }
 
 template <class DataTypes>
@@ -197,258 +281,447 @@ void FeatureMatchingForceField<DataTypes>::addForce(const core::MechanicalParams
 }
 
 template <class DataTypes>
-void FeatureMatchingForceField<DataTypes>::addForceMesh(const core::MechanicalParams* mparams,DataVecDeriv& _f , const DataVecCoord& _x , const DataVecDeriv& _v )
+void FeatureMatchingForceField<DataTypes>::estimateNormals(const VecCoord& p, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::Normal>::Ptr normals)
 {
-    sofa::helper::vector< tri > triangles;
-    triangles = sourceTriangles.getValue();
+    cloud->points.resize(p.size());
+    for (unsigned int i=0; i<p.size(); i++)
+    {
+        cloud->points[i].x = p[i][0];
+        cloud->points[i].y = p[i][1];
+        cloud->points[i].z = p[i][2];
+    }
+    cloud->width = cloud->points.size();
+    cloud->height = 1;
+
+    pcl::search::KdTree<pcl::PointXYZ>::Ptr tree(new SpatialHashSearch());
+    pcl::NormalEstimationOMP<pcl::PointXYZ, pcl::PointNormal> ne;
+    ne.setInputCloud(cloud);
+    ne.setSearchSurface(cloud);
+    ne.setSearchMethod(tree);
+    ne.setRadiusSearch(0.04);
+    ne.compute(*pointnormals);
+
+    // Copy the xyz info from cloud_xyz and add it to cloud_normals as the xyz field in PointNormals estimation is zero
+    normals->points.resize(pointnormals->points.size());
+    for(size_t i = 0; i<pointnormals->points.size(); ++i)
+    {
+        pointnormals->points[i].x = cloud->points[i].x;
+        pointnormals->points[i].y = cloud->points[i].y;
+        pointnormals->points[i].z = cloud->points[i].z;
+        normals->points[i].normal_x = pointnormals->points[i].normal_x;
+        normals->points[i].normal_y = pointnormals->points[i].normal_y;
+        normals->points[i].normal_z = pointnormals->points[i].normal_z;
+    }
+    normals->width = normals->points.size();
+    normals->height = 1;
+}
 
-    bool reinitv = false;
+// normals already computed for the points, e.g. from the depth image by RGBDDataProcessing
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::copyNormals(const VecCoord& p, const VecCoord& n, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::Normal>::Ptr normals)
+{
+    cloud->points.resize(p.size());
+    pointnormals->points.resize(p.size());
+    normals->points.resize(p.size());
+    for (unsigned int i=0; i<p.size(); i++)
+    {
+        cloud->points[i].x = pointnormals->points[i].x = p[i][0];
+        cloud->points[i].y = pointnormals->points[i].y = p[i][1];
+        cloud->points[i].z = pointnormals->points[i].z = p[i][2];
+        pointnormals->points[i].normal_x = normals->points[i].normal_x = n[i][0];
+        pointnormals->points[i].normal_y = normals->points[i].normal_y = n[i][1];
+        pointnormals->points[i].normal_z = normals->points[i].normal_z = n[i][2];
+    }
+    cloud->width = pointnormals->width = normals->width = p.size();
+    cloud->height = pointnormals->height = normals->height = 1;
+}
 
-    helper::vector< bool > sourcevisible = sourceVisible.getValue();
-    helper::vector< int > indicesvisible = indicesVisible.getValue();
-    helper::vector< bool > sourceborder = sourceBorder.getValue();
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::detectKeypoints(pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints)
+{
+    const float min_scale = 0.01;
+    const int nr_octaves = 3;
+    const int nr_scales_per_octave = 4;
+    const float min_contrast = 0.001;
+    const float radius = 0.05;
+
+    // Compute the SIFT keypoints
+    pcl::SIFTKeypoint<pcl::PointNormal,pcl:: PointWithScale> sift_detector;
+    pcl::search::KdTree<pcl::PointNormal>::Ptr tree (new pcl::search::KdTree<pcl::PointNormal>);
+    pcl::PointCloud<pcl::PointWithScale> keypoints_temp;
+
+    sift_detector.setInputCloud(pointnormals);
+    sift_detector.setSearchMethod (tree);
+    sift_detector.setScales (min_scale, nr_octaves, nr_scales_per_octave);
+    sift_detector.setMinimumContrast (min_contrast);
+    sift_detector.setRadiusSearch (radius);
+    sift_detector.compute(keypoints_temp);
+
+    copyPointCloud (keypoints_temp , *keypoints);
+}
 
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::computeDescriptors(pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::Normal>::Ptr normals, pcl::PointCloud<pcl::FPFHSignature33>::Ptr descriptors)
+{
+    pcl::FPFHEstimationOMP<pcl::PointXYZ, pcl::Normal, pcl::FPFHSignature33> pfh;
+    pcl::search::KdTree<pcl::PointXYZ>::Ptr tree_pfh(new SpatialHashSearch());
+    pfh.setInputCloud(keypoints);
+    pfh.setSearchSurface(cloud);
+    pfh.setInputNormals(normals);
+    pfh.setRadiusSearch (0.05);
+    pfh.setSearchMethod(tree_pfh);
+    pfh.compute (*descriptors);
+}
 
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_1 (new pcl::PointCloud<pcl::PointXYZ>);
-            pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_2 (new pcl::PointCloud<pcl::PointXYZ>);
-            pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_temp(new pcl::PointCloud<pcl::PointXYZ>);
-            pcl::PointCloud<pcl::PointXYZ>::Ptr filter_cloud_1 (new pcl::PointCloud<pcl::PointXYZ>);
-            pcl::PointCloud<pcl::PointXYZ>::Ptr filter_cloud_2 (new pcl::PointCloud<pcl::PointXYZ>);
-            pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints (new pcl::PointCloud<pcl::PointXYZ>);
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::updateSourceDescriptors(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::Normal>::Ptr normals)
+{
+    unsigned int nbs = cloud->points.size();
+    int nrecomputed = 0;
 
-            pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_1n (new pcl::PointCloud<pcl::PointXYZ>);
-                    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_2n (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints (new pcl::PointCloud<pcl::PointXYZ>);
 
-    const VecCoord& xv = sourceVisiblePositions.getValue();
-    const VecCoord&  tp = targetPositions.getValue();
+    if (sourceKeypointIndices.size() == 0 || featureSourceIndices != sourceCacheIndices)
+    {
+        // the visible part of the mesh changed: detect the keypoints again and snap them to
+        // visible vertices, so that the cached descriptors can follow the mesh in the next frames
+        pcl::PointCloud<pcl::PointXYZ>::Ptr detected (new pcl::PointCloud<pcl::PointXYZ>);
+        detectKeypoints(pointnormals, detected);
 
-    unsigned int nbs=xv.size(),nbt=tp.size();
+        SpatialHash vertexIndex;
+        vertexIndex.buildCloud(*cloud);
+        std::vector<bool> used(nbs,false);
 
-        pcl::PointXYZ newPoint;
-        for (unsigned int i=0; i<nbs; i++)
+        sourceKeypointIndices.clear();
+        for (size_t i = 0; i < detected->points.size(); i++)
         {
-        newPoint.z = xv[i][2];
-        newPoint.x = xv[i][0];
-        newPoint.y = xv[i][1];
-        /*newPoint.r = 0;
-        newPoint.g = 0;
-        newPoint.b = 0;*/
-        cloud_1->points.push_back(newPoint);
+            double dist2;
+            const pcl::PointXYZ &p = detected->points[i];
+            int nn = vertexIndex.nearest(cv::Point3d(p.x, p.y, p.z), dist2);
+            if (nn >= 0 && !used[nn])
+            {
+                used[nn] = true;
+                sourceKeypointIndices.push_back(nn);
+            }
+        }
+
+        for (size_t i = 0; i < sourceKeypointIndices.size(); i++)
+            keypoints->points.push_back(cloud->points[sourceKeypointIndices[i]]);
 
+        sourceDescriptors.reset(new pcl::PointCloud<pcl::FPFHSignature33>);
+        computeDescriptors(keypoints, cloud, normals, sourceDescriptors);
+
+        sourceKeypointRef.resize(sourceKeypointIndices.size());
+        for (size_t i = 0; i < sourceKeypointIndices.size(); i++)
+            sourceKeypointRef[i] = featureSourcePositions[sourceKeypointIndices[i]];
+        sourceCacheIndices = featureSourceIndices;
+        nrecomputed = sourceKeypointIndices.size();
+    }
+    else
+    {
+        // FPFH is invariant to rigid motions: only the keypoints whose displacement departs from
+        // the mean displacement of the keypoints (local deformation) get a new descriptor
+        unsigned int nkp = sourceKeypointIndices.size();
+        Coord meandisp;
+        for (unsigned int i = 0; i < nkp; i++)
+            meandisp += featureSourcePositions[sourceKeypointIndices[i]] - sourceKeypointRef[i];
+        meandisp /= (Real)nkp;
+
+        std::vector<int> moved;
+        Real thr2 = featureCacheDisplacement.getValue()*featureCacheDisplacement.getValue();
+        for (unsigned int i = 0; i < nkp; i++)
+        {
+            const Coord& xi = featureSourcePositions[sourceKeypointIndices[i]];
+            if ((xi - sourceKeypointRef[i] - meandisp).norm2() > thr2)
+            {
+                moved.push_back(i);
+                keypoints->points.push_back(cloud->points[sourceKeypointIndices[i]]);
+            }
         }
 
-        for (unsigned int i=0; i<nbt; i++)
+        if (moved.size() > 0)
         {
-        newPoint.z = tp[i][2];
-        newPoint.x = tp[i][0];
-        newPoint.y = tp[i][1];
-        /*newPoint.r = 0;
-        newPoint.g = 0;
-        newPoint.b = 0;*/
-        cloud_2->points.push_back(newPoint);
+            pcl::PointCloud<pcl::FPFHSignature33>::Ptr descriptors (new pcl::PointCloud<pcl::FPFHSignature33>);
+            computeDescriptors(keypoints, cloud, normals, descriptors);
+            for (size_t i = 0; i < moved.size(); i++)
+            {
+                sourceDescriptors->points[moved[i]] = descriptors->points[i];
+                sourceKeypointRef[moved[i]] = featureSourcePositions[sourceKeypointIndices[moved[i]]];
+            }
         }
+        nrecomputed = moved.size();
+    }
 
+    if (this->f_printLog.getValue()) std::cout << "FEATURES SOURCE KEYPOINTS " << sourceKeypointIndices.size() << " RECOMPUTED " << nrecomputed << std::endl;
+}
 
-                std::cout << "\n remove NAN-Points" << std::endl;
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::matchDescriptors(pcl::PointCloud<pcl::FPFHSignature33>::Ptr source, pcl::PointCloud<pcl::FPFHSignature33>::Ptr target, pcl::Correspondences& correspondences)
+{
+    correspondences.clear();
+    if (source->points.size() == 0 || target->points.size() == 0) return;
+
+    // approximate nearest neighbours in descriptor space, kept only when reciprocal
+    pcl::KdTreeFLANN<pcl::FPFHSignature33> sourcetree, targettree;
+    sourcetree.setEpsilon(featureMatchEpsilon.getValue());
+    targettree.setEpsilon(featureMatchEpsilon.getValue());
+    sourcetree.setInputCloud(source);
+    targettree.setInputCloud(target);
+
+    int nbs = source->points.size(), nbt = target->points.size();
+    std::vector<int> forward(nbs,-1), backward(nbt,-1);
+    std::vector<float> forwarddist(nbs,0);
+
+    TaskPool &pool = TaskPool::instance();
+    NearestDescriptors forwardSearch;
+    forwardSearch.tree = &targettree;
+    forwardSearch.descriptors = source.get();
+    forwardSearch.nearest = &forward;
+    forwardSearch.distances = &forwarddist;
+    pool.parallelFor(0, nbs, forwardSearch);
+
+    NearestDescriptors backwardSearch;
+    backwardSearch.tree = &sourcetree;
+    backwardSearch.descriptors = target.get();
+    backwardSearch.nearest = &backward;
+    backwardSearch.distances = NULL;
+    pool.parallelFor(0, nbt, backwardSearch);
+
+    for (int i = 0; i < nbs; i++)
+        if (forward[i] >= 0 && backward[forward[i]] == i)
+            correspondences.push_back(pcl::Correspondence(i,forward[i],forwarddist[i]));
+}
 
-                //remove NAN-Points
-                std::vector<int> indices1, indices2;
-                /*pcl::removeNaNFromPointCloud(*cloud_1, *cloud_1, indices1);
-                pcl::removeNaNFromPointCloud(*cloud_2, *cloud_2, indices2);*/
+template <class DataTypes>
+double FeatureMatchingForceField<DataTypes>::rejectCorrespondences(const pcl::PointCloud<pcl::PointXYZ>& source, const pcl::PointCloud<pcl::PointXYZ>& target, const pcl::Correspondences& correspondences, pcl::Correspondences& inliers)
+{
+    double timeRansac = (double)getTickCount();
 
-                std::cout << "\n Filter PCD Files" << std::endl;
+    inliers.clear();
+    int nc = correspondences.size();
+    if (nc < 3) return 0;
 
-                //	Filter
-                /*pcl::VoxelGrid<pcl::PointXYZRGB> vg;
-                vg.setLeafSize(0.01f,0.01f,0.01f);
-                vg.setInputCloud(cloud_1);
-                vg.filter(*filter_cloud_1);
-                vg.setInputCloud(cloud_2);
-                vg.filter(*filter_cloud_2);*/
+    Eigen::Matrix3Xf src(3,nc), tgt(3,nc);
+    for (int i = 0; i < nc; i++)
+    {
+        src.col(i) = source.points[correspondences[i].index_query].getVector3fMap();
+        tgt.col(i) = target.points[correspondences[i].index_match].getVector3fMap();
+    }
 
-                std::cout << "\n Estimate Normals" << std::endl;
+    const float thr2 = ransacInlierThreshold.getValue()*ransacInlierThreshold.getValue();
+    const int maxiterations = ransacMaxIterations.getValue();
+    const double confidence = ransacConfidence.getValue();
+
+    // hypotheses are scored in parallel by batches; between two batches, the best consensus so far
+    // lowers the number of hypotheses needed to reach the requested confidence. The best one is the
+    // first of the highest count, so the result does not depend on the number of threads
+    const int batch = 64;
+    int required = maxiterations, bestcount = 0, nhypotheses = 0;
+    Eigen::Matrix4f best = Eigen::Matrix4f::Identity();
+    std::vector<int> counts(batch);
+    RansacTransforms transforms(batch);
+
+    RansacHypotheses hypotheses;
+    hypotheses.src = &src;
+    hypotheses.tgt = &tgt;
+    hypotheses.thr2 = thr2;
+    hypotheses.counts = &counts;
+    hypotheses.transforms = &transforms;
+    for (int first = 0; first < required; first += batch)
+    {
+        int last = std::min(first + batch, required);
+        hypotheses.first = first;
+        TaskPool::instance().parallelFor(first, last, hypotheses, 8);
 
-                // Normal-Estimation
-                pcl::PointCloud<pcl::PointNormal>::Ptr norm_in(new pcl::PointCloud<pcl::PointNormal>);
-                pcl::PointCloud<pcl::PointNormal>::Ptr norm_out(new pcl::PointCloud<pcl::PointNormal>);
+        for (int it = first; it < last; it++)
+        {
+            int count = counts[it - first];
+            if (count < 0) continue;
+            nhypotheses++;
+            if (count > bestcount)
+            {
+                bestcount = count;
+                best = transforms[it - first];
+                double w3 = pow((double)count/(double)nc,3);
+                double n = (w3 >= 1) ? 1 : ceil(log(1-confidence)/log(1-w3));
+                if (n < (double)required) required = (int)n;
+            }
+        }
+    }
 
-                pcl::search::KdTree<pcl::PointXYZ>::Ptr tree_in(new pcl::search::KdTree<pcl::PointXYZ>());
-                pcl::search::KdTree<pcl::PointXYZ>::Ptr tree_out(new pcl::search::KdTree<pcl::PointXYZ>());
+    Eigen::Matrix3f R = best.topLeftCorner<3,3>();
+    Eigen::Vector3f tr = best.topRightCorner<3,1>();
+    for (int k = 0; k < nc; k++)
+        if ((R*src.col(k) + tr - tgt.col(k)).squaredNorm() < thr2) inliers.push_back(correspondences[k]);
 
-                pcl::PointCloud<pcl::Normal>::Ptr norm_in1(new pcl::PointCloud<pcl::Normal>);
-                pcl::PointCloud<pcl::Normal>::Ptr norm_out1(new pcl::PointCloud<pcl::Normal>);
+    double ratio = (double)inliers.size()/(double)nc;
 
-                pcl::NormalEstimation<pcl::PointXYZ, pcl::PointNormal> ne;
+    if (this->f_printLog.getValue()) std::cout << "FEATURES RANSAC HYPOTHESES " << nhypotheses << " INLIERS " << inliers.size() << " / " << nc << " RATIO " << ratio << std::endl;
+    std::cout << "TIME RANSAC " << ((double)getTickCount() - timeRansac)/getTickFrequency() << std::endl;
+    return ratio;
+}
 
-                //Source-Cloud
-                ne.setInputCloud(cloud_1);
-                ne.setSearchSurface(cloud_1);
-                ne.setSearchMethod(tree_in);
-                ne.setRadiusSearch(0.04);
-                ne.compute(*norm_in);
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::computeFeatures()
+{
+    double timeFeatures = (double)getTickCount();
 
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_1 (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_2 (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointNormal>::Ptr norm_in(new pcl::PointCloud<pcl::PointNormal>);
+    pcl::PointCloud<pcl::PointNormal>::Ptr norm_out(new pcl::PointCloud<pcl::PointNormal>);
+    pcl::PointCloud<pcl::Normal>::Ptr norm_in1(new pcl::PointCloud<pcl::Normal>);
+    pcl::PointCloud<pcl::Normal>::Ptr norm_out1(new pcl::PointCloud<pcl::Normal>);
 
-                //Target-Cloud
-                ne.setInputCloud(cloud_2);
-                ne.setSearchSurface(cloud_2);
-                ne.setSearchMethod(tree_out);
-                ne.setRadiusSearch(0.04);
-                ne.compute(*norm_out);
+    estimateNormals(featureSourcePositions, cloud_1, norm_in, norm_in1);
+    if (featureTargetNormals.size() == featureTargetPositions.size())
+        copyNormals(featureTargetPositions, featureTargetNormals, cloud_2, norm_out, norm_out1);
+    else estimateNormals(featureTargetPositions, cloud_2, norm_out, norm_out1);
 
-            const float min_scale = 0.01;
-            const int nr_octaves = 3;
-            const int nr_scales_per_octave = 4;
-            const float min_contrast = 0.001;
-            const float radius = 0.05;
+    // source descriptors are cached across frames, the target ones are recomputed
+    updateSourceDescriptors(cloud_1, norm_in, norm_in1);
 
-            // Copy the xyz info from cloud_xyz and add it to cloud_normals as the xyz field in PointNormals estimation is zero
-            for(size_t i = 0; i<norm_in->points.size(); ++i)
-            {
-              norm_in->points[i].x = cloud_1->points[i].x;
-              norm_in->points[i].y = cloud_1->points[i].y;
-              norm_in->points[i].z = cloud_1->points[i].z;
-
-              pcl::Normal norm;
-
-              norm.normal_x = norm_in->points[i].normal_x;
-              norm.normal_y = norm_in->points[i].normal_y;
-              norm.normal_z = norm_in->points[i].normal_z;
-              //if (!(norm.normal_x!=norm.normal_x || norm.normal_y!=norm.normal_y || norm.normal_z!=norm.normal_z))
-              {
-              norm_in1->points.push_back(norm);
-              cloud_1n->points.push_back(cloud_1->points[i]);
-              }
-            }
+    pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints_ptr_in(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints_ptr_out(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::FPFHSignature33>::Ptr pfhs_out (new pcl::PointCloud<pcl::FPFHSignature33> ());
 
-            for(size_t i = 0; i<norm_out->points.size(); ++i)
-            {
-              norm_out->points[i].x = cloud_2->points[i].x;
-              norm_out->points[i].y = cloud_2->points[i].y;
-              norm_out->points[i].z = cloud_2->points[i].z;
-
-              pcl::Normal norm;
-              norm.normal_x = norm_out->points[i].normal_x;
-              norm.normal_y = norm_out->points[i].normal_y;
-              norm.normal_z = norm_out->points[i].normal_z;
-
-              //std::cout << "norm " << norm.normal_x << " " << norm.normal_y << " " << norm.normal_z << std::endl;
-              //if (!(norm.normal_x!=norm.normal_x || norm.normal_y!=norm.normal_y || norm.normal_z!=norm.normal_z))
-              {
-              norm_out1->points.push_back(norm);
-              cloud_2n->points.push_back(cloud_2->points[i]);
-              }
-            }
-
-            std::cout << "size " << cloud_2n->points.size() << " " << norm_out1->points.size() << std::endl;
-            std::cout << "size " << cloud_1n->points.size() << " " << norm_in1->points.size() << std::endl;
-            /*pcl::removeNaNFromPointCloud(*norm_in1, *norm_in1, indices1);
-            pcl::removeNaNFromPointCloud(*norm_out1, *norm_out1, indices2);
-            pcl::removeNaNFromPointCloud(*cloud_2, *cloud_2, indices1);
-            pcl::removeNaNFromPointCloud(*cloud_1, *cloud_1, indices2);
-            pcl::removeNaNFromPointCloud(*norm_in, *norm_in, indices1);
-            pcl::removeNaNFromPointCloud(*norm_out, *norm_out, indices2);*/
+    for (size_t i = 0; i < sourceKeypointIndices.size(); i++)
+        keypoints_ptr_in->points.push_back(cloud_1->points[sourceKeypointIndices[i]]);
 
+    detectKeypoints(norm_out, keypoints_ptr_out);
+    computeDescriptors(keypoints_ptr_out, cloud_2, norm_out1, pfhs_out);
 
-            std::cout << "\n compute SIFT Keypoints" << std::endl;
+    pcl::CorrespondencesPtr corr (new pcl::Correspondences);
+    matchDescriptors(sourceDescriptors, pfhs_out, *corr);
 
-        // Compute the SIFT keypoints
-            pcl::SIFTKeypoint<pcl::PointNormal,pcl:: PointWithScale> sift_detector_1;
-            pcl::SIFTKeypoint<pcl::PointNormal,pcl:: PointWithScale> sift_detector_2;
-            pcl::search::KdTree<pcl::PointNormal>::Ptr tree (new pcl::search::KdTree<pcl::PointNormal>);
-            pcl::PointCloud<pcl::PointWithScale> keypoints_temp_in;
-            pcl::PointCloud<pcl::PointWithScale> keypoints_temp_out;
+    // only the correspondences consistent with a rigid motion of the keypoints are kept
+    pcl::CorrespondencesPtr corr_inliers(new pcl::Correspondences);
+    double ratio = rejectCorrespondences(*keypoints_ptr_in, *keypoints_ptr_out, *corr, *corr_inliers);
 
-            sift_detector_1.setInputCloud(norm_in);
-            sift_detector_2.setInputCloud(norm_out);
-            sift_detector_1.setSearchMethod (tree);
-            sift_detector_2.setSearchMethod (tree);
-            sift_detector_1.setScales (min_scale, nr_octaves, nr_scales_per_octave);
-            sift_detector_2.setScales (min_scale, nr_octaves, nr_scales_per_octave);
-            sift_detector_1.setMinimumContrast (min_contrast);
-            sift_detector_2.setMinimumContrast (min_contrast);
+    if (this->f_printLog.getValue()) std::cout << "FEATURES KEYPOINTS " << keypoints_ptr_in->size() << " " << keypoints_ptr_out->size() << " MATCHES " << corr->size() << " INLIERS " << corr_inliers->size() << std::endl;
 
-            /*sift_detector_1.setSearchSurface(norm_in);
-            sift_detector_2.setSearchSurface(norm_out);*/
-            sift_detector_1.setRadiusSearch (radius);
-            sift_detector_2.setRadiusSearch (radius);
+    VecCoord targetkeypoints(keypoints_ptr_out->size());
+    for (size_t i = 0; i < keypoints_ptr_out->size(); i++)
+    {
+        targetkeypoints[i][0] = keypoints_ptr_out->points[i].x;
+        targetkeypoints[i][1] = keypoints_ptr_out->points[i].y;
+        targetkeypoints[i][2] = keypoints_ptr_out->points[i].z;
+    }
+    std::vector<int> sourcekeypoints(sourceKeypointIndices.size());
+    for (size_t i = 0; i < sourceKeypointIndices.size(); i++)
+        sourcekeypoints[i] = featureSourceIndices[sourceKeypointIndices[i]];
 
-            sift_detector_1.compute(keypoints_temp_in);
-            sift_detector_2.compute(keypoints_temp_out);
+    {
+        boost::mutex::scoped_lock lock(featureMutex);
+        featureSourceKeypoints.swap(sourcekeypoints);
+        featureTargetKeypoints.swap(targetkeypoints);
+        featureMatches.swap(*corr_inliers);
+        featureRatio = ratio;
+        featureFrameDone = featureFrameRequested;
+        featureRunning = false;
+    }
 
-            std::cout << "No of SIFT points in the result are " << keypoints_temp_in.points.size () << std::endl;
-            std::cout << "No of SIFT points in the result are " << keypoints_temp_out.points.size () << std::endl;
+    std::cout << "TIME FEATURES " << ((double)getTickCount() - timeFeatures)/getTickFrequency() << std::endl;
+}
 
+template <class DataTypes>
+void FeatureMatchingForceField<DataTypes>::addForceMesh(const core::MechanicalParams* mparams,DataVecDeriv& _f , const DataVecCoord& _x , const DataVecDeriv& _v )
+{
+    const sofa::helper::vector< tri >& triangles = sourceTriangles.getValue();
 
-            std::vector<int> inliers_in;
-            std::vector<int> inliers_out;
+    bool reinitv = false;
 
+    const helper::vector< bool >& sourcevisible = sourceVisible.getValue();
+    const helper::vector< int >& indicesvisible = indicesVisible.getValue();
+    const helper::vector< bool >& sourceborder = sourceBorder.getValue();
 
-          pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints_ptr_in(new pcl::PointCloud<pcl::PointXYZ>);
-          pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints_ptr_out(new pcl::PointCloud<pcl::PointXYZ>);
-          pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints_ptr_inliers_in(new   pcl::PointCloud<pcl::PointXYZ>);
-          pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints_ptr_inliers_out(new pcl::PointCloud<pcl::PointXYZ>);
 
-          copyPointCloud (keypoints_temp_in , *keypoints_ptr_in);
-          copyPointCloud (keypoints_temp_out , *keypoints_ptr_out);
+    int t = (int)this->getContext()->getTime();
+    int frame = t/niterations.getValue();
 
-          /*pcl::io::savePCDFileASCII("Keypoints_in.pcd", *keypoints_ptr_in);
-          pcl::io::savePCDFileASCII("Keypoints_out.pcd",*keypoints_ptr_out);*/
+    // the feature stage runs once per frame, on a worker thread if useFeatureThread is set;
+    // the force evaluations of the frame use the last completed matches
+    bool launch = false;
+    {
+        boost::mutex::scoped_lock lock(featureMutex);
+        if (frame != featureFrameRequested && !featureRunning)
+        {
+            featureRunning = true;
+            featureFrameRequested = frame;
+            launch = true;
+        }
+    }
 
-          // Create the FPFH estimation class, and pass the input dataset+normals to it
-          pcl::FPFHEstimation<pcl::PointXYZ, pcl::Normal, pcl::FPFHSignature33> pfh;
-          pcl::FPFHEstimation<pcl::PointXYZ, pcl::Normal, pcl::FPFHSignature33> cloud_in_pfh;
-          pcl::FPFHEstimation<pcl::PointXYZ, pcl::Normal, pcl::FPFHSignature33> cloud_out_pfh;
-          pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>);
+    if (launch)
+    {
+        if (featureThread.joinable()) featureThread.join();
 
-          // Output datasets
-          pcl::PointCloud<pcl::FPFHSignature33>::Ptr pfhs_in (new pcl::PointCloud<pcl::FPFHSignature33> ());
-          pcl::PointCloud<pcl::FPFHSignature33>::Ptr pfhs_out (new pcl::PointCloud<pcl::FPFHSignature33> ());
-          pcl::search::KdTree<pcl::PointXYZ>::Ptr tree_pfh_in(new pcl::search::KdTree<pcl::PointXYZ>());
+        featureSourcePositions = sourceVisiblePositions.getValue();
+        featureSourceIndices = indicesvisible;
+        featureTargetPositions = targetPositions.getValue();
+        featureTargetNormals = targetNormals.getValue();
 
-          std::cout << "\n compute features" << std::endl;
+        if (useFeatureThread.getValue())
+            featureThread = boost::thread(boost::bind(&FeatureMatchingForceField<DataTypes>::computeFeatures, this));
+        else computeFeatures();
+    }
 
-          // Compute the features
-          pfh.setInputCloud(keypoints_ptr_in);
-          pfh.setSearchSurface(cloud_1n);
-          pfh.setInputNormals(norm_in1);
-          pfh.setRadiusSearch (0.05);
-          pfh.setSearchMethod(tree_pfh_in);
-          pfh.compute (*pfhs_in);
+    // the Data is only written here, on the simulation thread, once per completed feature stage
+    {
+        int done;
+        Real ratio;
+        {
+            boost::mutex::scoped_lock lock(featureMutex);
+            done = featureFrameDone;
+            ratio = featureRatio;
+        }
+        if (done != featureFramePublished)
+        {
+            featureInlierRatio.setValue(ratio);
+            featureFramePublished = done;
+        }
+    }
 
-          pfh.setInputCloud (keypoints_ptr_out);
-          pfh.setInputNormals(norm_out1);
-          pfh.setSearchSurface(cloud_2n);
-          pfh.setRadiusSearch (0.05);
-          pfh.compute (*pfhs_out);
+    if(ks.getValue()==0) return;
 
-          pcl::registration::CorrespondenceEstimation<pcl::FPFHSignature33,pcl::FPFHSignature33> est;
-          est.setInputCloud (pfhs_in);
-          est.setInputTarget (pfhs_out);
-          pcl::CorrespondencesPtr corr (new pcl::Correspondences);
-          est.determineReciprocalCorrespondences (*corr);
+    VecDeriv& f = *_f.beginEdit();       //WDataRefVecDeriv f(_f);
+    const VecCoord& x = _x.getValue();			//RDataRefVecCoord x(_x);
+    const VecDeriv& v = _v.getValue();			//RDataRefVecDeriv v(_v);
 
-          double inlierThreshold = 100;
+    const vector<Spring>& s = this->springs.getValue();
+    this->dfdx.resize(s.size());
+    this->closestPos.resize(s.size());
+    m_potentialEnergy = 0;
 
-          Eigen::Matrix4f transformation;
-          boost::shared_ptr<pcl::Correspondences> corr_inliers(new pcl::Correspondences);
-          pcl::registration::CorrespondenceRejectorSampleConsensus<pcl::PointXYZ> reg;
-          reg.setInputSource(keypoints_ptr_in);
-          reg.setInputTarget(keypoints_ptr_out);
-          reg.setInlierThreshold(inlierThreshold);
-          reg.setMaximumIterations(2000);
-          reg.setInputCorrespondences(corr);
-          reg.getCorrespondences(*corr_inliers);
-          transformation = reg.getBestTransformation();
-
-          std::cout << "\n compute Correspondences" << keypoints_ptr_in->size() << " " << keypoints_ptr_out->size() << std::endl;
-
-          for (size_t i = 0; i < corr->size(); ++i){
-                  std::cout << " \n Correspondences = " << corr_inliers->size() << (*corr)[i] << "\n" << std::endl;
-                  std::cout << "\n compute Correspondences" << keypoints_ptr_in->points[(*corr)[i].index_query] << " " << keypoints_ptr_out->points[(*corr)[i].index_match] << std::endl;
+    Mat zero;
+    zero.clear();
+    for (unsigned int i=0; i<s.size(); i++)
+    {
+        closestPos[i] = x[i];
+        dfdx[i] = zero;
+    }
 
-          }
+    // springs are only set on the inlier matches of the last completed feature stage
+    std::vector<int> sourcekeypoints;
+    VecCoord targetkeypoints;
+    pcl::Correspondences matches;
+    {
+        boost::mutex::scoped_lock lock(featureMutex);
+        sourcekeypoints = featureSourceKeypoints;
+        targetkeypoints = featureTargetKeypoints;
+        matches = featureMatches;
+    }
 
+    if (t%niterations.getValue() == 0)
+        for (size_t k = 0; k < matches.size(); k++)
+        {
+            int i = sourcekeypoints[matches[k].index_query];
+            if (i < 0 || i >= (int)s.size()) continue;
+            closestPos[i] = targetkeypoints[matches[k].index_match];
+            this->addSpringForce(m_potentialEnergy,f,x,v, i, s[i]);
+        }
 
+    _f.endEdit();
 
     /*detectKeypoints (source, source_keypoints_);
     detectKeypoints (target, target_keypoints_);
@@ -69,6 +69,11 @@
 
 #include <string>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/correspondence.h>
 
 using namespace std;
 using namespace cv;
@@ -272,6 +277,50 @@ public:
     Data<int> descriptor_type;
     Data<int> keypoint_type;
 
+    // feature stage, run once per frame
+    Data<bool> useFeatureThread;
+    Data<Real> featureCacheDisplacement;
+    Data<float> featureMatchEpsilon;
+    Data<Real> ransacInlierThreshold;
+    Data<int> ransacMaxIterations;
+    Data<Real> ransacConfidence;
+    Data<Real> featureInlierRatio;
+
+    boost::thread featureThread;
+    boost::mutex featureMutex;
+    bool featureRunning;
+    int featureFrameRequested, featureFrameDone;
+    // frame of the inlier ratio written into featureInlierRatio
+    int featureFramePublished;
+
+    // inputs of the feature stage, copied at the beginning of the frame
+    VecCoord featureSourcePositions;
+    helper::vector<int> featureSourceIndices;
+    VecCoord featureTargetPositions;
+    VecCoord featureTargetNormals;
+
+    // source descriptors cached across frames, keypoints are indices in the visible source points
+    std::vector<int> sourceKeypointIndices;
+    VecCoord sourceKeypointRef;
+    helper::vector<int> sourceCacheIndices;
+    pcl::PointCloud<pcl::FPFHSignature33>::Ptr sourceDescriptors;
+
+    // outputs of the feature stage (source keypoints as mesh indices), guarded by featureMutex
+    std::vector<int> featureSourceKeypoints;
+    VecCoord featureTargetKeypoints;
+    pcl::Correspondences featureMatches;
+    Real featureRatio;
+
+    void estimateNormals(const VecCoord& p, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::Normal>::Ptr normals);
+    void copyNormals(const VecCoord& p, const VecCoord& n, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::Normal>::Ptr normals);
+    void detectKeypoints(pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints);
+    void computeDescriptors(pcl::PointCloud<pcl::PointXYZ>::Ptr keypoints, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::Normal>::Ptr normals, pcl::PointCloud<pcl::FPFHSignature33>::Ptr descriptors);
+    void updateSourceDescriptors(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, pcl::PointCloud<pcl::PointNormal>::Ptr pointnormals, pcl::PointCloud<pcl::Normal>::Ptr normals);
+    void matchDescriptors(pcl::PointCloud<pcl::FPFHSignature33>::Ptr source, pcl::PointCloud<pcl::FPFHSignature33>::Ptr target, pcl::Correspondences& correspondences);
+    // returns the inlier ratio
+    double rejectCorrespondences(const pcl::PointCloud<pcl::PointXYZ>& source, const pcl::PointCloud<pcl::PointXYZ>& target, const pcl::Correspondences& correspondences, pcl::Correspondences& inliers);
+    void computeFeatures();
+
     void resetSprings();
     void addForceMesh(const core::MechanicalParams* mparams,DataVecDeriv& _f , const DataVecCoord& _x , const DataVecDeriv& _v );
 
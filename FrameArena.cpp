@@ -0,0 +1,60 @@
+/*
+ * FrameArena.cpp
+ *
+ *  Reused per-frame buffers and allocation counter.
+ */
+
+#include "FrameArena.h"
+
+FrameArena::FrameArena() {
+epochs = 0;
+allocations = 0;
+}
+
+FrameArena::~FrameArena() {
+}
+
+void FrameArena::probeMat(const void *object, const void *&data, size_t &bytes)
+{
+    const cv::Mat &m = *(const cv::Mat *)object;
+    data = m.datastart;
+    bytes = m.dataend - m.datastart;
+}
+
+void FrameArena::watch(const cv::Mat &m)
+{
+    Entry e;
+    e.object = &m;
+    e.probe = &probeMat;
+    e.probe(e.object, e.data, e.bytes);
+    entries.push_back(e);
+}
+
+cv::Mat &FrameArena::mat(int slot)
+{
+    while ((int)mats.size() <= slot)
+    {
+        mats.push_back(cv::Mat());
+        watch(mats.back());
+    }
+    return mats[slot];
+}
+
+int FrameArena::endFrame()
+{
+    int n = 0;
+    for (unsigned int i = 0; i < entries.size(); i++)
+    {
+        Entry &e = entries[i];
+        const void *data;
+        size_t bytes;
+        e.probe(e.object, data, bytes);
+        // released buffers are not allocations
+        if ((data != e.data && data != NULL) || (data == NULL && bytes != e.bytes && bytes > 0)) n++;
+        e.data = data;
+        e.bytes = bytes;
+    }
+    epochs++;
+    allocations += n;
+    return n;
+}
@@ -0,0 +1,77 @@
+/*
+ * FrameArena.h
+ *
+ *  Scratch buffers of a processing component, reused from one frame to the next, with a count of
+ *  the heap allocations they still make. The image slots keep their memory as long as the size and
+ *  type written into them do not change (cv::Mat::create), the watched containers (point buffers,
+ *  vectors of the component) keep their capacity when cleared. At the end of each frame (epoch)
+ *  the data pointers of the images and the capacities of the containers are compared with the ones
+ *  of the previous epoch, each change counting as one allocation: once the buffers have reached
+ *  their working size, the count stays at 0.
+ */
+
+#ifndef FRAMEARENA_H_
+#define FRAMEARENA_H_
+
+#include <opencv2/core.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+class FrameArena {
+
+public :
+
+FrameArena();
+virtual ~FrameArena();
+
+// scratch image of the slot, still holding the data of the previous frame; the OpenCV functions
+// writing into it reuse its memory, an assignment from another cv::Mat header would not
+cv::Mat &mat(int slot);
+
+// buffer owned by the component and checked at the end of each epoch, it must outlive the arena
+template <class Container> void watch(const Container &c)
+{
+    Entry e;
+    e.object = &c;
+    e.probe = &probeContainer<Container>;
+    e.probe(e.object, e.data, e.bytes);
+    entries.push_back(e);
+}
+void watch(const cv::Mat &m);
+
+// closes the epoch, returns the number of buffers (re)allocated during it
+int endFrame();
+
+unsigned int epoch() const {return epochs;}
+// since the arena was created
+unsigned int totalAllocations() const {return allocations;}
+
+private :
+
+struct Entry
+{
+    const void *object;
+    void (*probe)(const void *, const void *&, size_t &);
+    const void *data;
+    size_t bytes;
+};
+
+template <class Container> static void probeContainer(const void *object, const void *&data, size_t &bytes)
+{
+    // growing a container always changes its capacity
+    const Container &c = *(const Container *)object;
+    data = NULL;
+    bytes = c.capacity()*sizeof(typename Container::value_type);
+}
+static void probeMat(const void *object, const void *&data, size_t &bytes);
+
+// a deque keeps the slots at the same address when new ones are added
+std::deque<cv::Mat> mats;
+std::vector<Entry> entries;
+unsigned int epochs;
+unsigned int allocations;
+};
+
+#endif /* FRAMEARENA_H_ */
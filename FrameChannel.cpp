@@ -0,0 +1,57 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_FRAMECHANNEL_CPP
+
+#include "FrameChannel.inl"
+#include <sofa/core/ObjectFactory.h>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+    using namespace sofa::defaulttype;
+
+      SOFA_DECL_CLASS(FrameChannel)
+
+      // Register in the Factory
+      int FrameChannelClass = core::RegisterObject("Lock-free channel passing the latest RGB-D frame from a camera node to ImageConverter")
+        .add< FrameChannel<ImageF> >(true)
+        .add< FrameChannel<ImageUS> >()
+        .add< FrameChannel<ImageUC> >()
+    ;
+
+      template class SOFA_RGBDTRACKING_API FrameChannel<ImageUC>;
+      template class SOFA_RGBDTRACKING_API FrameChannel<ImageUS>;
+      template class SOFA_RGBDTRACKING_API FrameChannel<ImageF>;
+
+}
+}
+} // namespace sofa
@@ -0,0 +1,109 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_FRAMECHANNEL_H
+#define SOFA_RGBDTRACKING_FRAMECHANNEL_H
+
+#include <RGBDTracking/config.h>
+
+#include <image/ImageTypes.h>
+
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/core/objectmodel/Event.h>
+#include <sofa/simulation/AnimateEndEvent.h>
+#include <sofa/helper/accessor.h>
+
+#include "FrameRing.h"
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Frame channel between a camera node and a tracking node run by different animation loops
+ * (AnimationLoopParallelScheduler). At the end of each camera step the grabbed images are written
+ * into a preallocated slot of a lock-free ring; ImageConverter (useFrameChannel) takes the latest
+ * frame at the beginning of its own step, by reference, and frames it did not have time to take are skipped.
+ * It replaces the DataExchange of the image Data, which copies every frame and synchronizes both loops.
+ */
+template<class _ImageTypes>
+class FrameChannel : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(FrameChannel,_ImageTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+    typedef _ImageTypes DepthTypes;
+    typedef typename DepthTypes::T dT;
+    typedef helper::ReadAccessor<Data< DepthTypes > > raDepth;
+    Data< DepthTypes > depthImage;
+
+    typedef defaulttype::ImageUC ImageTypes;
+    typedef typename ImageTypes::T T;
+    typedef helper::ReadAccessor<Data< ImageTypes > > raImage;
+    Data< ImageTypes > image;
+
+    // the consumer keeps two frames at once, the current and the previous one of ImageConverter
+    FrameRing ring;
+
+    FrameChannel();
+    virtual ~FrameChannel();
+
+    static std::string templateName(const FrameChannel<DepthTypes>* = NULL) { return DepthTypes::Name(); }
+    virtual std::string getTemplateName() const { return templateName(this); }
+
+    void init();
+    void handleEvent(sofa::core::objectmodel::Event *event);
+
+    // camera side
+    void writeFrame();
+    // tracking side, see FrameRing::acquireLatest
+    const RGBDFrame *acquireLatest() { return ring.acquireLatest(); }
+
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(FrameChannel_CPP)
+extern template class SOFA_RGBDTRACKING_API FrameChannel<ImageUC>;
+extern template class SOFA_RGBDTRACKING_API FrameChannel<ImageUS>;
+extern template class SOFA_RGBDTRACKING_API FrameChannel<ImageF>;
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
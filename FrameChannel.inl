@@ -0,0 +1,116 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_FRAMECHANNEL_INL
+
+#include <limits>
+#include <string.h>
+
+#include <opencv2/core.hpp>
+
+#include "FrameChannel.h"
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using cimg_library::CImg;
+
+template <class DepthTypes>
+FrameChannel<DepthTypes>::FrameChannel()
+    : Inherit()
+    , depthImage(initData(&depthImage,DepthTypes(),"depthImage","depth map grabbed by the camera"))
+    , image(initData(&image,ImageTypes(),"image","color image grabbed by the camera"))
+    , ring(2)
+{
+    this->f_listening.setValue(true);
+}
+
+template <class DepthTypes>
+FrameChannel<DepthTypes>::~FrameChannel()
+{
+}
+
+template <class DepthTypes>
+void FrameChannel<DepthTypes>::init()
+{
+    this->Inherit::init();
+}
+
+template <class DepthTypes>
+void FrameChannel<DepthTypes>::writeFrame()
+{
+    raImage rimg(this->image);
+    raDepth rdepth(this->depthImage);
+    if (rimg->isEmpty() || rdepth->isEmpty()) return;
+
+    double timeWrite = (double)cv::getTickCount();
+
+    const CImg<dT>& depthimg = rdepth->getCImg(0);
+    const CImg<T>& img = rimg->getCImg(0);
+    int height = depthimg.height(), width = depthimg.width();
+
+    // the slot buffers are allocated once, then only overwritten
+    RGBDFrame &frame = ring.writeSlot();
+
+    frame.depth.create(height, width, CV_32FC1);
+    if (sizeof(dT) == sizeof(float) && std::numeric_limits<dT>::is_iec559)
+        memcpy(frame.depth.data, (const float*)depthimg.data(), height*width*sizeof(float));
+    else
+        cv::Mat(height, width, cv::DataType<dT>::type, (void*)depthimg.data()).convertTo(frame.depth, CV_32F);
+
+    frame.color.create(img.height(), img.width(), CV_8UC3);
+    if (img.spectrum() == 3)
+    {
+        cv::Mat planes[3] = {
+            cv::Mat(img.height(), img.width(), CV_8UC1, (void*)img.data(0,0,0,2)),
+            cv::Mat(img.height(), img.width(), CV_8UC1, (void*)img.data(0,0,0,1)),
+            cv::Mat(img.height(), img.width(), CV_8UC1, (void*)img.data(0,0,0,0)) };
+        cv::merge(planes, 3, frame.color);
+    }
+    else frame.color.setTo(cv::Scalar::all(0));
+
+    ring.publish((double)cv::getTickCount());
+
+    timeWrite = ((double)cv::getTickCount() - timeWrite)/cv::getTickFrequency();
+    std::cout << "TIME FRAME CHANNEL WRITE " << timeWrite << std::endl;
+}
+
+template <class DepthTypes>
+void FrameChannel<DepthTypes>::handleEvent(sofa::core::objectmodel::Event *event)
+{
+    // the camera grabs at the beginning of its step, its images are complete at the end
+    if (dynamic_cast<simulation::AnimateEndEvent*>(event))
+        writeFrame();
+}
+
+}
+}
+} // namespace sofa
@@ -0,0 +1,134 @@
+/*
+ * FramePipeline.cpp
+ *
+ *  Stage threads and job queues of the frame pipeline.
+ */
+
+#include "FramePipeline.h"
+
+#include <boost/bind.hpp>
+
+FramePipeline::FramePipeline() {
+depth = 0;
+submitted = 0;
+running = false;
+stopping = false;
+}
+
+FramePipeline::~FramePipeline() {
+stop();
+}
+
+void FramePipeline::addStage(const Stage &stage)
+{
+    if (running) return;
+    stages.push_back(stage);
+}
+
+void FramePipeline::start(int _depth)
+{
+    stop();
+
+    depth = _depth > 0 ? _depth : 1;
+    queues.assign(stages.size(), std::deque<int>());
+    done.clear();
+    freeSlots.clear();
+    for (int i = 0; i < depth; i++) freeSlots.push_back(i);
+    submitted = 0;
+    stopping = false;
+    running = true;
+
+    threads.reset(new boost::thread_group);
+    for (unsigned int k = 0; k < stages.size(); k++)
+        threads->create_thread(boost::bind(&FramePipeline::run, this, k));
+}
+
+void FramePipeline::stop()
+{
+    if (!running) return;
+
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        // the jobs in the stages are completed, they are not retrieved anymore
+        while (submitted - (int)done.size() > 0)
+            condition.wait(lock);
+        stopping = true;
+    }
+    condition.notify_all();
+    threads->join_all();
+    threads.reset();
+    running = false;
+}
+
+int FramePipeline::acquire()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (freeSlots.empty())
+        condition.wait(lock);
+    int job = freeSlots.front();
+    freeSlots.pop_front();
+    return job;
+}
+
+void FramePipeline::submit(int job)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (queues.empty()) done.push_back(job);
+        else queues[0].push_back(job);
+        submitted++;
+    }
+    condition.notify_all();
+}
+
+int FramePipeline::retrieve(bool wait)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (wait && done.empty() && submitted > 0)
+        condition.wait(lock);
+    if (done.empty()) return -1;
+    int job = done.front();
+    done.pop_front();
+    submitted--;
+    return job;
+}
+
+void FramePipeline::release(int job)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        freeSlots.push_back(job);
+    }
+    condition.notify_all();
+}
+
+int FramePipeline::inFlight()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return submitted;
+}
+
+void FramePipeline::run(int stage)
+{
+    while (true)
+    {
+        int job;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (queues[stage].empty() && !stopping)
+                condition.wait(lock);
+            if (queues[stage].empty()) break;
+            job = queues[stage].front();
+            queues[stage].pop_front();
+        }
+
+        stages[stage](job);
+
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (stage + 1 < (int)stages.size()) queues[stage+1].push_back(job);
+            else done.push_back(job);
+        }
+        condition.notify_all();
+    }
+}
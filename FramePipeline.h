@@ -0,0 +1,68 @@
+/*
+ * FramePipeline.h
+ *
+ *  Staged execution of the processing of successive frames. Each stage runs on its own thread
+ *  and takes the jobs from its queue in submission order, so that while a stage processes frame t
+ *  the previous one already processes frame t+1. The jobs are the indices of a fixed number of
+ *  slots (the depth), owned by the caller, which cycle between the states
+ *      free -> (acquire) filled by the caller -> (submit) stage queues -> done -> (retrieve)
+ *      published by the caller -> (release) free
+ *  so that at most depth frames are in flight and no buffer is shared between two frames.
+ */
+
+#ifndef FRAMEPIPELINE_H_
+#define FRAMEPIPELINE_H_
+
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+#include <vector>
+
+class FramePipeline {
+
+public :
+
+typedef boost::function<void (int)> Stage;
+
+FramePipeline();
+virtual ~FramePipeline();
+
+// the stages are run in the order they were added, before start
+void addStage(const Stage &stage);
+void start(int depth);
+// waits for the jobs in flight, then stops the threads
+void stop();
+
+bool isRunning() const {return running;}
+int getDepth() const {return depth;}
+
+// free slot for the next frame, waits while depth frames are in flight
+int acquire();
+void submit(int job);
+// oldest completed job, waiting for it if wait is set and a job is in flight; -1 if there is none
+int retrieve(bool wait);
+void release(int job);
+// submitted and not yet retrieved
+int inFlight();
+
+private :
+
+std::vector<Stage> stages;
+std::vector< std::deque<int> > queues;
+std::deque<int> done, freeSlots;
+int depth;
+int submitted;
+
+// a new group for each start, the threads of a stopped pipeline are joined
+boost::scoped_ptr<boost::thread_group> threads;
+boost::mutex mutex;
+boost::condition_variable condition;
+bool running, stopping;
+
+void run(int stage);
+};
+
+#endif /* FRAMEPIPELINE_H_ */
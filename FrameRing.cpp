@@ -0,0 +1,68 @@
+/*
+ * FrameRing.cpp
+ *
+ *  Single producer / single consumer channel of RGB-D frames, slots rotated through one atomic index.
+ */
+
+#include "FrameRing.h"
+
+namespace
+{
+
+const int FRESH = 1 << 30;
+
+// a buffer still referenced by a component downstream of the consumer is not overwritten but reallocated
+inline void detach(cv::Mat &m)
+{
+    if (m.u && m.u->refcount > 1) m.release();
+}
+
+}
+
+FrameRing::FrameRing(int consumerHeld) {
+if (consumerHeld < 1) consumerHeld = 1;
+slots.resize(consumerHeld + 2);
+back = 0;
+middle.store(1);
+for (int i = 0; i < consumerHeld; i++) held.push_back(2 + i);
+published = 0;
+acquired = 0;
+skipped = 0;
+lastSequence = 0;
+}
+
+FrameRing::~FrameRing() {
+}
+
+RGBDFrame &FrameRing::writeSlot()
+{
+    RGBDFrame &frame = slots[back];
+    detach(frame.color);
+    detach(frame.depth);
+    return frame;
+}
+
+void FrameRing::publish(double timestamp)
+{
+    slots[back].timestamp = timestamp;
+    slots[back].sequence = ++published;
+    // the slot handed back is either a frame the consumer never read or one it released
+    back = middle.exchange(back | FRESH, boost::memory_order_acq_rel) & ~FRESH;
+}
+
+const RGBDFrame *FrameRing::acquireLatest()
+{
+    if (!(middle.load(boost::memory_order_relaxed) & FRESH)) return NULL;
+
+    // only the producer sets FRESH, so the exchange below always returns a published slot
+    int oldest = held.back();
+    int latest = middle.exchange(oldest, boost::memory_order_acq_rel) & ~FRESH;
+    held.pop_back();
+    held.insert(held.begin(), latest);
+
+    const RGBDFrame &frame = slots[latest];
+    skipped += frame.sequence - lastSequence - 1;
+    lastSequence = frame.sequence;
+    acquired++;
+    return &frame;
+}
@@ -0,0 +1,67 @@
+/*
+ * FrameRing.h
+ *
+ *  Single producer / single consumer channel of RGB-D frames between the camera and the tracking
+ *  threads. The slots are preallocated and rotate by exchanging indices through one atomic,
+ *  so neither side locks or copies a frame: the producer fills its own slot and publishes it as
+ *  the latest one, the consumer takes the latest published slot and gives back its oldest one.
+ *  A frame published while a newer one arrives before the consumer reads it is skipped.
+ */
+
+#ifndef FRAMERING_H_
+#define FRAMERING_H_
+
+#include <opencv2/core.hpp>
+
+#include <boost/atomic.hpp>
+
+#include <vector>
+#include <stdint.h>
+
+struct RGBDFrame
+{
+    cv::Mat color;      // CV_8UC3
+    cv::Mat depth;      // CV_32FC1
+    double timestamp;   // cv::getTickCount() at publication
+    uint64_t sequence;  // 1 for the first published frame, 0 for a slot never written
+
+    RGBDFrame() : timestamp(0), sequence(0) {}
+};
+
+class FrameRing {
+
+public :
+
+// consumerHeld: number of frames the consumer keeps valid at once (the latest one and the previous ones)
+FrameRing(int consumerHeld = 2);
+virtual ~FrameRing();
+
+// producer side: the slot to fill, then publish it as the latest frame
+RGBDFrame &writeSlot();
+void publish(double timestamp);
+
+// consumer side: the latest frame if it is newer than the last acquired one, NULL otherwise;
+// it stays valid, as do the consumerHeld-1 frames acquired before it, until the next acquisitions
+const RGBDFrame *acquireLatest();
+
+uint64_t getPublished() const {return published;}
+uint64_t getAcquired() const {return acquired;}
+uint64_t getSkipped() const {return skipped;}
+
+private :
+
+std::vector<RGBDFrame> slots;
+
+// index of the slot exchanged between the two sides, FRESH when published and not yet acquired
+boost::atomic<int> middle;
+
+// producer
+int back;
+uint64_t published;
+
+// consumer, newest first
+std::vector<int> held;
+uint64_t acquired, skipped, lastSequence;
+};
+
+#endif /* FRAMERING_H_ */
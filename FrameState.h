@@ -0,0 +1,136 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_FRAMESTATE_H
+#define SOFA_RGBDTRACKING_FRAMESTATE_H
+
+#include <RGBDTracking/config.h>
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/defaulttype/VecTypes.h>
+#include <sofa/helper/vector.h>
+
+#include "SpatialHash.h"
+
+#include <opencv2/core.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Per-frame geometric state shared between the processing components and the force fields.
+ * MeshProcessing publishes the source side (visible vertices, contours, weights),
+ * RGBDDataProcessing the target side (point cloud, contours, weights).
+ * The buffers are owned here: the producers write into them and link their own Data to them,
+ * so a publication shares the values instead of copying them. The version counters only change
+ * when a buffer was written since the previous publication; consumers read the buffers by
+ * reference and compare the versions to know when their derived structures (k-d trees,
+ * correspondences) have to be rebuilt.
+ */
+template<class DataTypes>
+class FrameState : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(FrameState,DataTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+    typedef typename DataTypes::Real Real;
+    typedef typename DataTypes::VecCoord VecCoord;
+    typedef sofa::defaulttype::Vector2 Vec2;
+
+    FrameState();
+    virtual ~FrameState();
+
+    void init();
+
+    // source mesh data, published by MeshProcessing
+    Data< VecCoord > sourceVisiblePositions;
+    Data< helper::vector< bool > > sourceVisible;
+    Data< helper::vector< int > > indicesVisible;
+    Data< helper::vector< bool > > sourceBorder;
+    Data< VecCoord > sourceContourPositions;
+    Data< helper::vector< Vec2 > > sourceContourNormals;
+    Data< helper::vector< double > > sourceWeights;
+
+    // target point cloud data, published by RGBDDataProcessing
+    Data< VecCoord > targetPositions;
+    Data< VecCoord > targetContourPositions;
+    Data< helper::vector< bool > > targetBorder;
+    Data< helper::vector< double > > targetWeights;
+    // index in targetPositions of the point back-projected from each pixel of the depth image,
+    // -1 elsewhere (CV_32SC1), for the projective association; written with targetPositions,
+    // a new map for each cloud
+    cv::Mat targetPixelIndex;
+
+    // incremented at each publication changing the buffers, never reset
+    Data<unsigned int> sourceVersion;
+    Data<unsigned int> targetVersion;
+
+    void publishSource();
+    void publishTarget();
+
+    // nearest neighbour index of targetPositions shared by the consumers, built on the first
+    // request after a publication of the target
+    const SpatialHash& getTargetIndex();
+    Data<double> targetIndexCellSize;
+
+private:
+    // sums of the counters of the buffers at the last publication
+    int sourceCounter, targetCounter;
+
+    SpatialHash targetIndex;
+    unsigned int targetIndexVersion;
+    boost::mutex targetIndexMutex;
+
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(FrameState_CPP)
+#ifndef SOFA_FLOAT
+extern template class SOFA_RGBDTRACKING_API FrameState<defaulttype::Vec3dTypes>;
+#endif
+#ifndef SOFA_DOUBLE
+extern template class SOFA_RGBDTRACKING_API FrameState<defaulttype::Vec3fTypes>;
+#endif
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
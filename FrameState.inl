@@ -0,0 +1,118 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_FRAMESTATE_INL
+
+#include "FrameState.h"
+
+#include <iostream>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+template <class DataTypes>
+FrameState<DataTypes>::FrameState()
+    : Inherit()
+    , sourceVisiblePositions(initData(&sourceVisiblePositions,"sourceVisiblePositions","Visible points of the surface of the mesh."))
+    , sourceVisible(initData(&sourceVisible,"sourceVisible","Visibility of the points of the surface of the mesh."))
+    , indicesVisible(initData(&indicesVisible,"indicesVisible","Indices of the visible points of the mesh."))
+    , sourceBorder(initData(&sourceBorder,"sourceBorder","Points of the border of the mesh."))
+    , sourceContourPositions(initData(&sourceContourPositions,"sourceContourPositions","Contour points of the surface of the mesh."))
+    , sourceContourNormals(initData(&sourceContourNormals,"sourceContourNormals","Normals to the contour points of the visible surface of the mesh."))
+    , sourceWeights(initData(&sourceWeights,"sourceWeights","Weights of the surface of the mesh."))
+    , targetPositions(initData(&targetPositions,"targetPositions","Points of the target point cloud."))
+    , targetContourPositions(initData(&targetContourPositions,"targetContourPositions","Contour points of the target point cloud."))
+    , targetBorder(initData(&targetBorder,"targetBorder","Boolean for the points of the target point cloud that belong to the contour."))
+    , targetWeights(initData(&targetWeights,"targetWeights","Weights for the points of the target point cloud."))
+    , sourceVersion(initData(&sourceVersion,(unsigned int)0,"sourceVersion","Number of publications of the source mesh data."))
+    , targetVersion(initData(&targetVersion,(unsigned int)0,"targetVersion","Number of publications of the target point cloud data."))
+    , targetIndexCellSize(initData(&targetIndexCellSize,(double)0,"targetIndexCellSize","Cell size of the nearest neighbour index of the target point cloud (0: from its extent and number of points)."))
+{
+    sourceCounter = targetCounter = 0;
+    targetIndexVersion = (unsigned int)-1;
+    sourceVersion.setReadOnly(true);
+    targetVersion.setReadOnly(true);
+}
+
+template <class DataTypes>
+FrameState<DataTypes>::~FrameState()
+{
+}
+
+template <class DataTypes>
+void FrameState<DataTypes>::init()
+{
+    this->Inherit::init();
+}
+
+template <class DataTypes>
+void FrameState<DataTypes>::publishSource()
+{
+    // the counters of the Data only grow: their sum changes when one of the buffers was written
+    int counter = sourceVisiblePositions.getCounter() + sourceVisible.getCounter() + indicesVisible.getCounter()
+            + sourceBorder.getCounter() + sourceContourPositions.getCounter() + sourceContourNormals.getCounter()
+            + sourceWeights.getCounter();
+    if (counter == sourceCounter) return;
+    sourceCounter = counter;
+    sourceVersion.setValue(sourceVersion.getValue()+1);
+}
+
+template <class DataTypes>
+void FrameState<DataTypes>::publishTarget()
+{
+    int counter = targetPositions.getCounter() + targetContourPositions.getCounter()
+            + targetBorder.getCounter() + targetWeights.getCounter();
+    if (counter == targetCounter) return;
+    targetCounter = counter;
+    targetVersion.setValue(targetVersion.getValue()+1);
+}
+
+template <class DataTypes>
+const SpatialHash& FrameState<DataTypes>::getTargetIndex()
+{
+    boost::mutex::scoped_lock lock(targetIndexMutex);
+    if (targetIndexVersion != targetVersion.getValue())
+    {
+        double time = (double)cv::getTickCount();
+        targetIndex.setCellSize(targetIndexCellSize.getValue());
+        targetIndex.build(targetPositions.getValue());
+        targetIndexVersion = targetVersion.getValue();
+        time = ((double)cv::getTickCount() - time)/cv::getTickFrequency();
+        std::cout << "TIME TARGET INDEX " << time << " points " << targetIndex.size() << " cell " << targetIndex.getCell() << std::endl;
+    }
+    return targetIndex;
+}
+
+}
+}
+} // namespace sofa
+
+
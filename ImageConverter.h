@@ -46,6 +46,7 @@
 #include <visp/vpKltOpencv.h>
 //#include <sofa/helper/kdTree.inl>
 #include "KalmanFilter.h"
+#include "FrameChannel.h"
 #include <visp/vpDisplayX.h>
 #include <algorithm>    
 #ifdef WIN32
@@ -165,6 +166,11 @@ public:
 	Data<int> sensorType;
         Data<bool> newImages;
 
+	// frames taken from a FrameChannel of another node instead of the image Data
+	Data<bool> useFrameChannel;
+	typename FrameChannel<DepthTypes>::SPtr frameChannel;
+	bool getChannelImages();
+
 	Data<bool> displayImages;
 	Data< int > displayDownScale;
 
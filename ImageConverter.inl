@@ -70,6 +70,12 @@ namespace objectmodel
 using namespace sofa::defaulttype;
 using namespace helper;
 
+// true if another cv::Mat still references the buffer of m, which must not be overwritten then
+static inline bool sharedImageBuffer(const cv::Mat &m)
+{
+    return m.u && m.u->refcount > 1;
+}
+
 template <class DataTypes, class DepthTypes>
 ImageConverter<DataTypes, DepthTypes>::ImageConverter()
     : Inherit()
@@ -79,6 +85,7 @@ ImageConverter<DataTypes, DepthTypes>::ImageConverter()
     , useSensor(initData(&useSensor,false,"useSensor","Use the sensor"))
     , sensorType(initData(&sensorType, 0,"sensorType","Type of the sensor"))
     , niterations(initData(&niterations,1,"niterations","Number of iterations in the tracking process"))
+    , useFrameChannel(initData(&useFrameChannel,false,"useFrameChannel","Take the latest frame of the FrameChannel of the camera node instead of the image and depthImage Data"))
     , displayImages(initData(&displayImages,false,"displayimages","display the grabbed RGB images"))
     , displayDownScale(initData(&displayDownScale,1,"downscaledisplay","Down scaling factor for the RGB and Depth images to be displayed"))
 {
@@ -104,6 +111,12 @@ void ImageConverter<DataTypes, DepthTypes>::init()
     this->Inherit::init();
     core::objectmodel::BaseContext* context = this->getContext();
     mstate = dynamic_cast<sofa::core::behavior::MechanicalState<DataTypes> *>(context->getMechanicalState());
+    if (useFrameChannel.getValue())
+    {
+        // the channel lives in the camera node, a sibling of this one
+        context->getRootContext()->get(frameChannel, core::objectmodel::BaseContext::SearchDown);
+        if (!frameChannel) serr << "useFrameChannel is set but no FrameChannel was found" << sendl;
+    }
     if (displayImages.getValue())
     {
     cv::namedWindow("image_camera");
@@ -112,6 +125,23 @@ void ImageConverter<DataTypes, DepthTypes>::init()
 		
 }
 
+template<class DataTypes, class DepthTypes>
+bool ImageConverter<DataTypes, DepthTypes>::getChannelImages()
+{
+    const RGBDFrame *frame = frameChannel->acquireLatest();
+    if (!frame) return false;
+
+    // the frames are referenced in the channel slots, which stay untouched until two newer frames are taken
+    depth_1 = depth;
+    color_1 = color;
+    depth = frame->depth;
+    color = frame->color;
+
+    double latency = ((double)getTickCount() - frame->timestamp)/getTickFrequency();
+    cout << "TIME FRAME LATENCY " << latency << " frame " << frame->sequence << " skipped " << frameChannel->ring.getSkipped() << endl;
+    return true;
+}
+
 template<class DataTypes, class DepthTypes>
 void ImageConverter<DataTypes, DepthTypes>::getImages()
 {    
@@ -119,7 +149,12 @@ void ImageConverter<DataTypes, DepthTypes>::getImages()
     //cv::Rect ROI(160, 120, 320, 240);
     int niter = niterations.getValue();
 
-    if (t%niter == 0)
+    if (t%niter == 0 && frameChannel)
+    {
+        // no new frame since the last step: the tracking is not run again on the same images
+        newImages.setValue(getChannelImages());
+    }
+    else if (t%niter == 0)
     {
 
         raImage rimg(this->image);
@@ -135,11 +170,18 @@ void ImageConverter<DataTypes, DepthTypes>::getImages()
         //std::cout << " height0 " << height << std::endl;
         //std::cout << " width0 " << width << std::endl;
         double timeAcq0 = (double)getTickCount();
-        //cv::Mat depth_single = cv::Mat::zeros(height,width,CV_32FC1);
-        //memcpy(depth_single.data, (float*)depthimg.data(), height*width*sizeof(float));
-        depth_1 = depth.clone();
-        depth = cv::Mat::zeros(height,width,CV_32FC1);
-        memcpy(depth.data, (float*)depthimg.data(), height*width*sizeof(float));
+
+        // current and previous frames are two persistent buffers swapped every frame:
+        // the frame before the previous one is overwritten in place, unless a component still holds it
+        cv::swap(depth, depth_1);
+        if (sharedImageBuffer(depth)) depth.release();
+        depth.create(height,width,CV_32FC1);
+
+        // the CImg is wrapped without copy; the sensor may rewrite it, so the frame is still copied into depth
+        if (sizeof(dT) == sizeof(float) && std::numeric_limits<dT>::is_iec559)
+            memcpy(depth.data, (const float*)depthimg.data(), height*width*sizeof(float));
+        else
+            cv::Mat(height, width, cv::DataType<dT>::type, (void*)depthimg.data()).convertTo(depth, CV_32F);
         /*
         cv::Mat depth16 = cv::Mat::zeros(height,width,CV_16U);
         memcpy(depth16.data, (ushort*)depthimg.data(), height*width*sizeof(ushort));
@@ -148,17 +190,21 @@ void ImageConverter<DataTypes, DepthTypes>::getImages()
         double timeAcq1 = (double)getTickCount();
 
         const CImg<T>& img =rimg->getCImg(0);
-        color_1 = color.clone();
-
-        color = cv::Mat::zeros(img.height(),img.width(), CV_8UC3);
+        cv::swap(color, color_1);
+        if (sharedImageBuffer(color)) color.release();
+        color.create(img.height(),img.width(), CV_8UC3);
         timeAcq0 = (double)getTickCount();
 
         if(img.spectrum()==3)
         {
-            unsigned char* rgb = (unsigned char*)color.data;
-            const unsigned char *ptr_r = img.data(0,0,0,2), *ptr_g = img.data(0,0,0,1), *ptr_b = img.data(0,0,0,0);
-            for ( int siz = 0 ; siz<img.width()*img.height(); siz++)    {*(rgb++) = *(ptr_r++) ; *(rgb++) = *(ptr_g++); *(rgb++) = *(ptr_b++); }
+            // planar CImg to interleaved BGR: the planes are wrapped in place and merged by the vectorized cv::merge
+            cv::Mat planes[3] = {
+                cv::Mat(img.height(), img.width(), CV_8UC1, (void*)img.data(0,0,0,2)),
+                cv::Mat(img.height(), img.width(), CV_8UC1, (void*)img.data(0,0,0,1)),
+                cv::Mat(img.height(), img.width(), CV_8UC1, (void*)img.data(0,0,0,0)) };
+            cv::merge(planes, 3, color);
         }
+        else color.setTo(cv::Scalar::all(0));
         /*switch (sensorType.getValue())
         {
             case 0:
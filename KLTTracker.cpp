@@ -0,0 +1,171 @@
+/*
+ * KLTTracker.cpp
+ *
+ *  KLT feature tracker keeping the image pyramid of the previous frame,
+ *  and a 2D grid over projected triangle centers to attach features to the mesh.
+ */
+
+#include "KLTTracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+KLTTracker::KLTTracker() {
+maxFeatures = 1000;
+windowSize = 10;
+quality = 0.02;
+minDistance = 10;
+harrisK = 0.04;
+blockSize = 9;
+useHarris = true;
+pyramidLevels = 3;
+}
+
+KLTTracker::~KLTTracker() {
+}
+
+void KLTTracker::buildPyramid(const cv::Mat &gray, std::vector<cv::Mat> &pyramid)
+{
+    // the levels are allocated once and refilled in place as long as the image size does not change
+    cv::buildOpticalFlowPyramid(gray, pyramid, cv::Size(windowSize,windowSize), pyramidLevels, true);
+}
+
+void KLTTracker::initTracking(const cv::Mat &gray)
+{
+    cv::goodFeaturesToTrack(gray, points, maxFeatures, quality, minDistance, cv::noArray(), blockSize, useHarris, harrisK);
+
+    ids.resize(points.size());
+    for (unsigned int k = 0; k < ids.size(); k++)
+        ids[k] = k;
+
+    buildPyramid(gray, prevPyramid);
+}
+
+void KLTTracker::track(const cv::Mat &gray)
+{
+    if (prevPyramid.empty())
+    {
+        initTracking(gray);
+        return;
+    }
+
+    buildPyramid(gray, currPyramid);
+
+    if (points.size() > 0)
+    {
+        cv::calcOpticalFlowPyrLK(prevPyramid, currPyramid, points, nextPoints, status, err, cv::Size(windowSize,windowSize), pyramidLevels);
+
+        unsigned int n = 0;
+        for (unsigned int k = 0; k < nextPoints.size(); k++)
+        {
+            if (!status[k]) continue;
+            if (nextPoints[k].x < 0 || nextPoints[k].y < 0 || nextPoints[k].x >= gray.cols || nextPoints[k].y >= gray.rows) continue;
+            points[n] = nextPoints[k];
+            ids[n] = ids[k];
+            n++;
+        }
+        points.resize(n);
+        ids.resize(n);
+    }
+
+    std::swap(prevPyramid, currPyramid);
+}
+
+void KLTTracker::getFeature(int index, long &id, float &x, float &y) const
+{
+    id = ids[index];
+    x = points[index].x;
+    y = points[index].y;
+}
+
+KLTTriangleGrid::KLTTriangleGrid() {
+cellSize = 1;
+nx = 0;
+ny = 0;
+}
+
+int KLTTriangleGrid::cellX(float x) const
+{
+    int c = (int)std::floor((x - origin.x)/cellSize);
+    return std::min(std::max(c,0),nx-1);
+}
+
+int KLTTriangleGrid::cellY(float y) const
+{
+    int c = (int)std::floor((y - origin.y)/cellSize);
+    return std::min(std::max(c,0),ny-1);
+}
+
+void KLTTriangleGrid::build(const std::vector<cv::Point2f> &_centers)
+{
+    centers = _centers;
+    nx = 0;
+    ny = 0;
+    cellStart.clear();
+    cellItems.clear();
+    if (centers.size() == 0) return;
+
+    cv::Point2f pmin = centers[0], pmax = centers[0];
+    for (unsigned int i = 1; i < centers.size(); i++)
+    {
+        pmin.x = std::min(pmin.x,centers[i].x); pmin.y = std::min(pmin.y,centers[i].y);
+        pmax.x = std::max(pmax.x,centers[i].x); pmax.y = std::max(pmax.y,centers[i].y);
+    }
+
+    // about one center per cell
+    float w = std::max(pmax.x - pmin.x, 1.f), h = std::max(pmax.y - pmin.y, 1.f);
+    cellSize = std::max(std::sqrt(w*h/centers.size()), 1.f);
+    origin = pmin;
+    nx = (int)(w/cellSize) + 1;
+    ny = (int)(h/cellSize) + 1;
+
+    // counting sort of the centers by cell
+    cellStart.assign(nx*ny + 1, 0);
+    std::vector<int> cells(centers.size());
+    for (unsigned int i = 0; i < centers.size(); i++)
+    {
+        cells[i] = cellY(centers[i].y)*nx + cellX(centers[i].x);
+        cellStart[cells[i] + 1]++;
+    }
+    for (int c = 0; c < nx*ny; c++)
+        cellStart[c + 1] += cellStart[c];
+    cellItems.resize(centers.size());
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (unsigned int i = 0; i < centers.size(); i++)
+        cellItems[fill[cells[i]]++] = i;
+}
+
+int KLTTriangleGrid::nearest(const cv::Point2f &p) const
+{
+    if (centers.size() == 0) return -1;
+
+    int cx = cellX(p.x), cy = cellY(p.y);
+    int index = -1;
+    float distance = std::numeric_limits<float>::max();
+    int rmax = std::max(nx,ny);
+
+    // rings of cells around the cell of p, until no unvisited cell can hold a closer center
+    for (int r = 0; r <= rmax; r++)
+    {
+        for (int j = cy - r; j <= cy + r; j++)
+        {
+            if (j < 0 || j >= ny) continue;
+            int step = (j == cy - r || j == cy + r) ? 1 : 2*r;
+            for (int i = cx - r; i <= cx + r; i += std::max(step,1))
+            {
+                if (i < 0 || i >= nx) continue;
+                int c = j*nx + i;
+                for (int k = cellStart[c]; k < cellStart[c + 1]; k++)
+                {
+                    cv::Point2f d = centers[cellItems[k]] - p;
+                    float d2 = d.x*d.x + d.y*d.y;
+                    if (d2 < distance) { distance = d2; index = cellItems[k]; }
+                }
+            }
+        }
+        if (index >= 0 && distance <= (r*cellSize)*(r*cellSize)) break;
+    }
+
+    return index;
+}
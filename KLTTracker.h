@@ -0,0 +1,88 @@
+/*
+ * KLTTracker.h
+ *
+ *  KLT feature tracker keeping the image pyramid of the previous frame,
+ *  and a 2D grid over projected triangle centers to attach features to the mesh.
+ */
+
+#ifndef KLTTRACKER_H_
+#define KLTTRACKER_H_
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include <vector>
+
+class KLTTracker {
+
+public :
+
+KLTTracker();
+virtual ~KLTTracker();
+
+void setMaxFeatures(int _maxFeatures){maxFeatures = _maxFeatures;}
+void setWindowSize(int _windowSize){windowSize = _windowSize;}
+void setQuality(double _quality){quality = _quality;}
+void setMinDistance(double _minDistance){minDistance = _minDistance;}
+void setHarrisFreeParameter(double _harrisK){harrisK = _harrisK;}
+void setBlockSize(int _blockSize){blockSize = _blockSize;}
+void setUseHarris(int _useHarris){useHarris = (_useHarris != 0);}
+void setPyramidLevels(int _pyramidLevels){pyramidLevels = _pyramidLevels;}
+
+// detects new features on gray and stores its pyramid for the next call to track
+void initTracking(const cv::Mat &gray);
+// tracks the features from the stored pyramid to the pyramid of gray, which is kept for the next frame
+void track(const cv::Mat &gray);
+
+int getMaxFeatures() const {return maxFeatures;}
+int getNbFeatures() const {return (int)points.size();}
+void getFeature(int index, long &id, float &x, float &y) const;
+const std::vector<cv::Point2f>& getFeatures() const {return points;}
+const std::vector<long>& getFeatureIds() const {return ids;}
+
+private :
+
+int maxFeatures;
+int windowSize;
+double quality;
+double minDistance;
+double harrisK;
+int blockSize;
+bool useHarris;
+int pyramidLevels;
+
+// pyramids of the previous and current frames, swapped after each track so their buffers are reused
+std::vector<cv::Mat> prevPyramid, currPyramid;
+std::vector<cv::Point2f> points, nextPoints;
+std::vector<long> ids;
+std::vector<unsigned char> status;
+std::vector<float> err;
+
+void buildPyramid(const cv::Mat &gray, std::vector<cv::Mat> &pyramid);
+};
+
+// uniform grid over 2D points, for nearest point queries in image space
+class KLTTriangleGrid {
+
+public :
+
+KLTTriangleGrid();
+
+void build(const std::vector<cv::Point2f> &_centers);
+// index of the nearest center to p, -1 if the grid is empty
+int nearest(const cv::Point2f &p) const;
+
+private :
+
+std::vector<cv::Point2f> centers;
+cv::Point2f origin;
+float cellSize;
+int nx, ny;
+std::vector<int> cellStart, cellItems;
+
+int cellX(float x) const;
+int cellY(float y) const;
+};
+
+#endif /* KLTTRACKER_H_ */
@@ -20,114 +20,68 @@ using std::endl;
 
 Kalmanfilter::Kalmanfilter()
 {
- 
+velocityGain = 0.7;
+optimalGains = false;
+nbNodes = 0;
 }
 
 Kalmanfilter::~Kalmanfilter()
 {
 }
 
-void Kalmanfilter::init(vpColVector& f,vpColVector& p, vpHomogeneousMatrix &_cMo, vpMatrix& stiffnessMatrix)
+void Kalmanfilter::getNodeState(const vpColVector& p, const vpColVector& f, int n, Vec6& x) const
 {
+	x.setZero();
+	for (int d = 0; d < 3; d++)
+		if (3*n+d < (int)p.getRows())
+		{
+			x(d) = p[3*n+d];
+			x(d+3) = f[3*n+d];
+		}
+}
 
-H.resize(2*f.getRows(),2*f.getRows());
-H.setIdentity();
-
-H_0.resize(2*f.getRows(),2*f.getRows());
-
-J.resize(2*f.getRows(),2*f.getRows());
-J.setIdentity();
-
-Q.resize(2*f.getRows(),2*f.getRows());
-R.resize(2*f.getRows(),2*f.getRows());
-PEst.resize(2*f.getRows(),2*f.getRows());
-I.resize(2*f.getRows(),2*f.getRows());
-I.setIdentity();
+void Kalmanfilter::setNodeState(const Vec6& x, int n, vpColVector& p, vpColVector& f) const
+{
+	for (int d = 0; d < 3; d++)
+		if (3*n+d < (int)p.getRows())
+		{
+			p[3*n+d] = x(d);
+			f[3*n+d] = x(d+3);
+		}
+}
 
-KPose.resize(6,6);
-KPose.setIdentity();
+void Kalmanfilter::init(vpColVector& f,vpColVector& p, vpHomogeneousMatrix &_cMo, vpMatrix& stiffnessMatrix)
+{
 
 qT = 0.02;
 qR = 0.001;
 pT = 0.001;
 pR = 0.0001;
 
-std::cout << " init 1 " << std::endl;
-
 estimatedVelPose.resize(6);
-QPose.resize(12,12);
-RPose.resize(6,6);
-JPose.resize(12,12);
-HPose.resize(6,12);
-H_0Pose.resize(6,12);
-PEstPose.resize(12,12);
+
+// pose state (pose, velocity), the velocity is integrated into the pose
 JPose.setIdentity();
-QPose.setIdentity();	
-LPose.resize(6,12);
-QPose =qT*qT*QPose;
-PEstPose.setIdentity();
-PEstPose = pT*pT*PEstPose;
-
-	KPose.resize(12,6);
-
-	QVel.resize(6,6);
-	RVel.resize(6,6);
-	JVel.resize(6,6);
-	KVel.resize(6,6);
-	KVel.setIdentity();
-	PEstVel.resize(6,6);
-	JVel.setIdentity();
-	QVel.setIdentity();
-	RVel.setIdentity();
-	QVel =qR*qR*QVel;
-	PEstVel.setIdentity();
-	PEstVel = pR*pR*PEstVel;
-
-
-	for(int j = 0; j<12; j++)
-		for(int i = 0; i<12; i++)
-		{
-			//R[i][j] = 0.0001;
-			if(i>=6 && j<6)
-				{
-				if(j==i-6)
-					{
-					KPose[i][j] = 1;
-					}
-				}
-			if(i<6 && j>=6)
-				{
-				if(i==j-6)
-					{JPose[i][j] = 1;
-					H_0Pose[i][j] = 1;
-					}
-
-				LPose[i][j] = 1;
-				}
-			else if(j<6 && i<6)
-				{
-				QPose[i][j] = 0;
-				if(i == j)
-				{HPose[i][j] = 1;
-				RPose[i][j] = 0.02;
-				//RVel[i][j] = 0.00000001;
-				RVel[i][j] = 0.001;
-				}
-				if (j<3 && i<3){
-					if(i == j)
-						{QVel[i][j] = qT*qT;
-						PEstVel[i][j] = pT*pT;
-						//R[i][j] = 3e-09;
-						RPose[i][j] = 0.001;
-						//RVel[i][j] = 0.0000001;
-						RVel[i][j] = 0.0001;
-						}
-				}
-				}
-		}
-	QPose[9][9] = qR*qR;
-	QPose[10][10] = qR*qR;
-	QPose[11][11] = qR*qR;
+JPose.block<6,6>(0,6).setIdentity();
+HPose.setZero();
+HPose.block<6,6>(0,0).setIdentity();
+KPose.setZero();
+KPose.block<6,6>(6,0).setIdentity();
+QPose.setZero();
+QPose.diagonal().segment<6>(6).setConstant(qT*qT);
+QPose.diagonal().segment<3>(9).setConstant(qR*qR);
+RPose.setZero();
+RPose.diagonal() << 0.001, 0.001, 0.001, 0.02, 0.02, 0.02;
+PEstPose = pT*pT*Mat12::Identity();
+
+KVel.setIdentity();
+QVel.setZero();
+QVel.diagonal() << qT*qT, qT*qT, qT*qT, qR*qR, qR*qR, qR*qR;
+RVel.setZero();
+RVel.diagonal() << 0.0001, 0.0001, 0.0001, 0.001, 0.001, 0.001;
+PEstVel.setZero();
+PEstVel.diagonal() << pT*pT, pT*pT, pT*pT, pR*pR, pR*pR, pR*pR;
+
 	estimatedcMo = _cMo;
 	estimatedcMo_0 = _cMo;
 	estimatedVelPose[0] = 0;
@@ -138,23 +92,23 @@ PEstPose = pT*pT*PEstPose;
 	estimatedVelPose[5] = 0;
 	measuredVelPose = estimatedVelPose;
 
-std::cout << " init 3 " << std::endl;
-
-//PEst = R;
-
 qF = 0.001;
 rF = 0.0001;
 
 qX = 0.03;
 rX = 0.001;
 
-for (int k = 0; k < f.getRows(); k++)
-	{
-		Q[k][k] = (double)qX;
-		Q[k+f.getRows()][k+f.getRows()] = (double)qF;
-		R[k][k] = (double)rX;
-		R[k+f.getRows()][k+f.getRows()] = (double)rF;
-	}	
+// per node blocks of the point filter
+J.setIdentity();
+J.block<3,3>(0,3).setIdentity();
+Q.setZero();
+Q.diagonal() << qX, qX, qX, qF, qF, qF;
+R.setZero();
+R.diagonal() << rX, rX, rX, rF, rF, rF;
+
+nbNodes = (f.getRows() + 2)/3;
+PEst.assign(nbNodes, R);
+PPred.assign(nbNodes, R);
 	
 	estimatedForces = f;
 	estimatedPositions = p;
@@ -168,19 +122,9 @@ for (int k = 0; k < f.getRows(); k++)
 
 void Kalmanfilter::predictPose(vpMatrix& stiffnessMatrix)
 {
-	/*for (int k = 0; k < stiffnessMatrix.getCols(); k++)
-	for (int l = 0; l < stiffnessMatrix.getCols(); l++)
-	std::cout <<k<<" "<<l<<"   "<< stiffnessMatrix[k][l] << std::endl;*/
-	
 	predictedVelPose = estimatedVelPose;
-	vpMatrix Iv(6,6);
-	Iv.setIdentity();
-	vpMatrix I(12,12);
-	I.setIdentity();
 	predictedcMo = vpExponentialMap::direct(predictedVelPose).inverse() * estimatedcMo;
-	predictedcMo_0 = vpExponentialMap::direct((Iv)*predictedVelPose).inverse() * estimatedcMo;
-	//cMoPred_0 = vpExponentialMap::direct(vMes-vPred).inverse() * cMoEst;
-	//cMoPred_0 = cMoEst;
+	predictedcMo_0 = predictedcMo;
 	PPredPose = JPose*PEstPose*JPose.transpose() + QPose;
     PPredVel = PEstVel + QVel;
     estimatedcMo_0 = estimatedcMo;
@@ -190,15 +134,9 @@ void Kalmanfilter::predictPose(vpMatrix& stiffnessMatrix)
 		
 	predictedState = predictedPositions;
 	predictedState.stack(predictedForces);
-	
-	for (int k = 0; k < predictedForces.getRows(); k++)
-	for (int l = predictedForces.getRows(); l < 2*predictedForces.getRows(); l++)
-		J[k][l] = 1;//stiffnessMatrix[k][l-predictedForces.getRows()];
-		
-	//PPred = J*PEst*J.transpose() + Q;
-    //PfPred = PEst + Q;
-		
 
+	for (int n = 0; n < nbNodes; n++)
+		PPred[n] = J*PEst[n]*J.transpose() + Q;
 }
 
 void Kalmanfilter::predictPoints(vpColVector& p)
@@ -210,15 +148,12 @@ void Kalmanfilter::predictPoints(vpColVector& p)
 		
 	predictedState = predictedPositions;
 	predictedState.stack(predictedForces);
-	
-	for (int k = 0; k < predictedForces.getRows(); k++)
-	for (int l = predictedForces.getRows(); l < 2*predictedForces.getRows(); l++)
-		J[k][l] = 1;//stiffnessMatrix[k][l-predictedForces.getRows()];
-		
-	//PPred = J*PEst*J.transpose() + Q;
-    //PfPred = PEst + Q;
-		
 
+#ifdef USING_OMP_PRAGMAS
+#pragma omp parallel for
+#endif
+	for (int n = 0; n < nbNodes; n++)
+		PPred[n] = J*PEst[n]*J.transpose() + Q;
 }
 
 
@@ -226,54 +161,63 @@ void Kalmanfilter::estimatePose(vpHomogeneousMatrix &_cMo)
 {
 	
 innovationcMo = _cMo;//measuredcMo*(estimatedcMo.inverse());
-//K = PPred*((PPred + R).pseudoInverse());
-//KPose = PPredPose*HPose.transpose()*((HPose*PPredPose*HPose.transpose() + RPose).pseudoInverse());
-//Kv = PvPred*((PvPred + R).pseudoInverse());
-KVel = PPredVel*((PPredVel + RVel).pseudoInverse());
-vpMatrix Iv(6,6);
-Iv.setIdentity();
+
+// gains from Cholesky solves of the (symmetric positive definite) innovation covariances
+// K = P*S^-1 = (S^-1*P)^T
+if (optimalGains)
+{
+	Mat6 SVel = PPredVel + RVel;
+	KVel = SVel.llt().solve(PPredVel.transpose()).transpose();
+}
+else KVel = velocityGain*Mat6::Identity();
+PEstVel = (Mat6::Identity() - KVel)*PPredVel;
+
 measuredVelPose = vpExponentialMap::inverse((innovationcMo).inverse());
 
-std::cout << " Kv " << KVel << std::endl;
-KVel.setIdentity();
-KVel *= 0.7;
-estimatedVelPose = predictedVelPose + (KVel)*(measuredVelPose-predictedVelPose);
-//vEst = vPred + (H_0)*K*(vMes-vPred);
-estimatedcMo = vpExponentialMap::direct(KVel*(measuredVelPose-predictedVelPose)).inverse()*predictedcMo;
-//cMoEst = vpExponentialMap::direct(Kv*vpExponentialMap::inverse(cMoInnov.inverse())).inverse()*cMoPred;
-//cMoEst = cMoMes;
+vpColVector innovation = measuredVelPose-predictedVelPose;
+vpColVector correction(6);
+for (int i = 0; i < 6; i++)
+{
+	correction[i] = 0;
+	for (int j = 0; j < 6; j++)
+		correction[i] += KVel(i,j)*innovation[j];
+}
+
+estimatedVelPose = predictedVelPose + correction;
+estimatedcMo = vpExponentialMap::direct(correction).inverse()*predictedcMo;
 	
 }
 
 void Kalmanfilter::estimatePoints(vpColVector& f, vpColVector& p)
 {
-	
-//K = PPred*((PPred + R).pseudoInverse());
-
-//PEst = (I-K*H)*PPred;
-//PEstVel = (Iv-KVel)*PPredVel;	
 
 measuredState = p;
 measuredState.stack(f);
 
-//K.setIdentity();
-//K *= 0.7;
-
-estimatedState = predictedState + 1*(measuredState - predictedState);
-//PEst = (I-K)*PPred;
-
-for (int l = 0; l < predictedForces.getRows(); l++)
+// independent 6x6 updates, one per node
+#ifdef USING_OMP_PRAGMAS
+#pragma omp parallel for
+#endif
+for (int n = 0; n < nbNodes; n++)
 {
-estimatedPositions[l] = estimatedState[l];
-estimatedForces[l] = estimatedState[l+predictedForces.getRows()];
-}
-//estimatedForces = estimatedState.rows(f.getRows(), 2*f.getRows()-1);
+	Vec6 xpred, z;
+	getNodeState(predictedPositions, predictedForces, n, xpred);
+	getNodeState(p, f, n, z);
+
+	Mat6 K = Mat6::Identity();
+	if (optimalGains)
+	{
+		Mat6 S = PPred[n] + R;
+		K = S.llt().solve(PPred[n].transpose()).transpose();
+	}
+	Vec6 x = xpred + K*(z - xpred);
+	PEst[n] = (Mat6::Identity() - K)*PPred[n];
 
-for (int l = 0; l < predictedForces.getRows(); l++){
-	//std::cout <<l<<"   "<< predictedForces[l] << " " << estimatedForces[l] << std::endl;
+	setNodeState(x, n, estimatedPositions, estimatedForces);
 }
 
-//PvEst = (Iv-Kv)*PvPred;	
+estimatedState = estimatedPositions;
+estimatedState.stack(estimatedForces);
 	
 }
 
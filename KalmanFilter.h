@@ -35,12 +35,22 @@
 #include <boost/thread.hpp>
 #include <sys/times.h>
 
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
 using namespace std;
 
 class Kalmanfilter
 {
 	
 public:
+    // fixed-size blocks, unaligned so that the filter can be a member of any component
+    typedef Eigen::Matrix<double,6,6,Eigen::DontAlign> Mat6;
+    typedef Eigen::Matrix<double,12,12,Eigen::DontAlign> Mat12;
+    typedef Eigen::Matrix<double,6,12,Eigen::DontAlign> Mat6x12;
+    typedef Eigen::Matrix<double,12,6,Eigen::DontAlign> Mat12x6;
+    typedef Eigen::Matrix<double,6,1,Eigen::DontAlign> Vec6;
+
     Kalmanfilter();
     virtual ~Kalmanfilter();
 	
@@ -67,6 +77,11 @@ public:
     double rR;
 	double pT;
     double pR;
+
+	// gains applied to the innovations: by default the fixed velocity gain and a unit gain on the
+	// points, the covariances then follow these gains; with optimalGains the Kalman gains are used
+	double velocityGain;
+	bool optimalGains;
 	
     // kalman vectors
 	vpColVector estimatedState;
@@ -93,36 +108,33 @@ public:
 	vpHomogeneousMatrix innovationcMo;
 	vpHomogeneousMatrix measuredcMo;
 
-	vpMatrix PEst;
-	vpMatrix PPred;
-	vpMatrix PEstVel;
-	vpMatrix PPredVel;
-	vpMatrix PfEst;
-	vpMatrix PfPred;
-	vpMatrix Q;
-	vpMatrix R;
-	vpMatrix J;
-	vpMatrix K;
-	vpMatrix H;
-    vpMatrix I;
-	vpMatrix H_0;
-	vpMatrix LPose;
+	// point filter: the state of node n is (positions, forces) of its 3 dofs,
+	// positions are predicted from the forces of the same dofs only, so the covariance is block diagonal
+	// with one 6x6 block per node instead of a dense 2N x 2N matrix
+	int nbNodes;
+	std::vector< Mat6 > PEst;
+	std::vector< Mat6 > PPred;
+	Mat6 Q;
+	Mat6 R;
+	Mat6 J;
 	
-	vpMatrix PEstPose;
-	vpMatrix PPredPose;
-	vpMatrix PfEstPose;
-	vpMatrix PfPredPose;
-	vpMatrix QPose;
-	vpMatrix QVel;
-	vpMatrix RPose;
-	vpMatrix RVel;
-	vpMatrix JPose;
-	vpMatrix JVel;
-	vpMatrix KPose;
-	vpMatrix KVel;
-	vpMatrix HPose;
-    vpMatrix IPose;
-	vpMatrix H_0Pose;
+	// pose filter (pose and velocity twist) and velocity filter
+	Mat12 PEstPose;
+	Mat12 PPredPose;
+	Mat12 QPose;
+	Mat12 JPose;
+	Mat12x6 KPose;
+	Mat6x12 HPose;
+	Mat6 RPose;
+	Mat6 PEstVel;
+	Mat6 PPredVel;
+	Mat6 QVel;
+	Mat6 RVel;
+	Mat6 KVel;
+
+private:
+	void getNodeState(const vpColVector& p, const vpColVector& f, int n, Vec6& x) const;
+	void setNodeState(const Vec6& x, int n, vpColVector& p, vpColVector& f) const;
 	
 };
 
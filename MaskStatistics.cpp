@@ -0,0 +1,123 @@
+/*
+ * MaskStatistics.cpp
+ *
+ *  Single pass moments and bounding box of a binary mask.
+ */
+
+#include "MaskStatistics.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+struct NonZero
+{
+    inline int operator()(unsigned char p) const { return p != 0; }
+};
+
+struct Equal
+{
+    int value;
+    Equal(int _value) : value(_value) {}
+    inline int operator()(unsigned char p) const { return p == value; }
+};
+
+// s is -1 for a selected pixel and 0 otherwise, the selection is applied by masking
+template <class Select>
+inline void scanRow(const unsigned char *p, int width, Select select, int &n, int &sx, long long &sxx, int &minx, int &maxx)
+{
+    int rn = 0, rsx = 0, mn = width, mx = -1;
+    long long rsxx = 0;
+    for (int j = 0; j < width; j++)
+    {
+        int s = -select(p[j]);
+        rn -= s;
+        rsx += s & j;
+        rsxx += s & (j*j);
+        mn = std::min(mn, (s & j) | (~s & width));
+        mx = std::max(mx, (s & j) | ~s);
+    }
+    n = rn; sx = rsx; sxx = rsxx; minx = mn; maxx = mx;
+}
+
+template <class Row>
+struct ScanRows
+{
+    const cv::Mat *mask;
+    std::vector<Row> *rows;
+    int value;
+
+    void operator()(int begin, int end) const
+    {
+        int width = mask->cols;
+        for (int i = begin; i < end; i++)
+        {
+            Row &r = (*rows)[i];
+            if (value < 0) scanRow(mask->ptr<unsigned char>(i), width, NonZero(), r.n, r.sx, r.sxx, r.minx, r.maxx);
+            else scanRow(mask->ptr<unsigned char>(i), width, Equal(value), r.n, r.sx, r.sxx, r.minx, r.maxx);
+        }
+    }
+};
+
+}
+
+MaskStatistics::MaskStatistics() {
+area = 0;
+mu20 = mu02 = mu11 = 0;
+angle = 0;
+}
+
+MaskStatistics::~MaskStatistics() {
+}
+
+void MaskStatistics::compute(const cv::Mat &mask, int value)
+{
+    CV_Assert(mask.type() == CV_8UC1);
+
+    int height = mask.rows, width = mask.cols;
+    rows.resize(height);
+
+    ScanRows<RowMoments> scan;
+    scan.mask = &mask;
+    scan.rows = &rows;
+    scan.value = value;
+    TaskPool::instance().parallelFor(0, height, scan);
+
+    double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m02 = 0, m11 = 0;
+    int xmin = width, xmax = -1, ymin = height, ymax = -1;
+    for (int i = 0; i < height; i++)
+    {
+        const RowMoments &r = rows[i];
+        if (r.n == 0) continue;
+        m00 += r.n;
+        m10 += r.sx;
+        m20 += (double)r.sxx;
+        m01 += (double)r.n*i;
+        m02 += (double)r.n*i*i;
+        m11 += (double)r.sx*i;
+        xmin = std::min(xmin, r.minx);
+        xmax = std::max(xmax, r.maxx);
+        ymin = std::min(ymin, i);
+        ymax = i;
+    }
+
+    area = (int)m00;
+    if (area == 0)
+    {
+        centroid = cv::Point2d(0, 0);
+        mu20 = mu02 = mu11 = 0;
+        angle = 0;
+        boundingBox = cv::Rect();
+        return;
+    }
+
+    centroid = cv::Point2d(m10/m00, m01/m00);
+    mu20 = m20/m00 - centroid.x*centroid.x;
+    mu02 = m02/m00 - centroid.y*centroid.y;
+    mu11 = m11/m00 - centroid.x*centroid.y;
+    angle = 0.5*atan2(2*mu11, mu20 - mu02);
+    boundingBox = cv::Rect(xmin, ymin, xmax - xmin + 1, ymax - ymin + 1);
+}
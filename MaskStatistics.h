@@ -0,0 +1,48 @@
+/*
+ * MaskStatistics.h
+ *
+ *  Area, centroid, second moments, orientation and bounding box of the selected pixels of a
+ *  CV_8UC1 mask, in a single pass. Each row is reduced by a branch-free loop that the compiler
+ *  vectorizes (integer sums of 1, x and x^2, min and max of x), the rows are reduced in parallel
+ *  and combined with their index afterwards, so no list of pixels is built.
+ */
+
+#ifndef MASKSTATISTICS_H_
+#define MASKSTATISTICS_H_
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+class MaskStatistics {
+
+public :
+
+MaskStatistics();
+virtual ~MaskStatistics();
+
+// the selected pixels are the non zero ones, or the ones equal to value when value >= 0
+void compute(const cv::Mat &mask, int value = -1);
+
+int area;
+cv::Point2d centroid;
+// central second moments divided by the area
+double mu20, mu02, mu11;
+// angle of the main axis with the image x axis, in radians
+double angle;
+// empty when no pixel is selected
+cv::Rect boundingBox;
+
+private :
+
+struct RowMoments
+{
+    int n, sx;
+    long long sxx;
+    int minx, maxx;
+};
+
+std::vector<RowMoments> rows;
+};
+
+#endif /* MASKSTATISTICS_H_ */
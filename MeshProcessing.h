@@ -63,6 +63,10 @@
 
 #include <image/ImageTypes.h>
 #include "RenderingManager.h"
+#include "FrameState.h"
+#include "PosePrediction.h"
+#include "MeshVisibility.h"
+#include "FrameArena.h"
 
 using namespace std;
 using namespace cv;
@@ -111,6 +115,15 @@ public:
 	
     typename core::behavior::MechanicalState<DataTypes> *mstate;
     typename sofa::component::visualmodel::RenderingManager::SPtr renderingmanager;
+    typename FrameState<DataTypes>::SPtr framestate;
+    typedef FrameState<DataTypes> SharedState;
+    // the published buffers are owned by the frame state when there is one, the Data of this
+    // component are then linked to them and share their values
+    template<class T> Data<T>& published(Data<T>& local, Data<T> SharedState::*shared) { return framestate ? framestate.get()->*shared : local; }
+    // counter of the mesh positions when the visible positions were last updated
+    int positionsCounter;
+    typename PosePrediction<DataTypes>::SPtr poseprediction;
+    typename MeshVisibility<DataTypes>::SPtr meshvisibility;
 
     cv::Rect rectRtt;
     Data<Vector4> BBox;
@@ -121,6 +134,8 @@ public:
     int ind;
     //SoftKinetic softk;
     cv::Mat depth,depth_1, depthrend;
+    // allocation count of the rendered depth copy, the visibility buffers are counted by MeshVisibility
+    FrameArena arena;
     cv::Mat color, ir, ig, ib, gray;
     //cv::Mat color_1,color_2, color_3, color_4, color_5, color_init;
     cv::Mat depthMap;
@@ -164,6 +179,9 @@ public:
 
     Data<bool> useSIFT3D;
 
+    // output: buffers (re)allocated during the last frame, 0 once they have reached their working size
+    Data<int> frameAllocations;
+
     double timeMeshProcessing;
 
     MeshProcessing();
@@ -185,6 +203,7 @@ public:
     void getSourceVisible(double znear, double zfar);
     void updateSourceVisible();
     void updateSourceVisibleContour();
+    void linkFrameState();
     void draw(const core::visual::VisualParams* vparams);
 };
 
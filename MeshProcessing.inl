@@ -109,15 +109,18 @@ MeshProcessing<DataTypes>::MeshProcessing( )
         , BBox(initData(&BBox, "BBox", "Bounding box around the rendered scene for glreadpixels"))
         , drawVisibleMesh(initData(&drawVisibleMesh,false,"drawVisibleMesh"," "))
         , useSIFT3D(initData(&useSIFT3D,false,"useSIFT3D"," "))
+        , frameAllocations(initData(&frameAllocations,0,"frameAllocations","Scratch buffers (re)allocated during the last frame, visibility buffers included"))
 {
 
         this->f_listening.setValue(true);
+        frameAllocations.setReadOnly(true);
         iter_im = 0;
 
         hght = 0;
         wdth = 0;
 
         timeMeshProcessing = 0;
+        positionsCounter = -1;
 
 }
 
@@ -135,6 +138,12 @@ void MeshProcessing<DataTypes>::init()
     mstate = dynamic_cast<sofa::core::behavior::MechanicalState<DataTypes> *>(context->getMechanicalState());
     sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
     root->get(renderingmanager);
+    root->get(framestate);
+    root->get(poseprediction);
+    root->get(meshvisibility);
+    if (!meshvisibility) meshvisibility = sofa::core::objectmodel::New< MeshVisibility<DataTypes> >();
+    if (framestate) linkFrameState();
+    arena.watch(depthrend);
 
     Vector4 camParam = cameraIntrinsicParameters.getValue();
 
@@ -156,72 +165,25 @@ void MeshProcessing<DataTypes>::init()
 template<class DataTypes>
 void MeshProcessing<DataTypes>::getSourceVisible(double znear, double zfar)
 {
+    wdth = depthrend.cols;
+    hght = depthrend.rows;
 
-    int t = (int)this->getContext()->getTime();
-    //if (t%2 == 0)
-    {
-        cv::Mat _rtd0, depthr, depthu;
-        renderingmanager->getDepths(depthr);
-        depthrend = depthr.clone();
-
-        wdth = depthr.cols;
-        hght = depthr.rows;
-
-        _rtd0.create(hght,wdth, CV_8UC1);
-        double depthsN[hght * wdth ];
-
-        std::vector<cv::Point> ptfgd;
-        ptfgd.resize(0);
-        cv::Point pt;
-        double clip_z;
-        //double timef0 = (double)getTickCount();
-
-        for (int j = 0; j < wdth; j++)
-            for (int i = 0; i< hght; i++)
-            {
-                if ((double)depthr.at<float>(hght-i-1,j) < 1  && (double)depthr.at<float>(hght-i-1,j)	> 0.001)
-                {
-                    //if (j >= rectRtt.x && j < rectRtt.x + rectRtt.width && i >= rectRtt.y && i < rectRtt.y + rectRtt.height) {
-                    //if ((double)(float)depths1[j-rectRtt.x+(i-rectRtt.y)*(rectRtt.width)]	< 1){
-
-                    clip_z = (depthr.at<float>(hght-i-1,j) - 0.5) * 2.0;
-                    //double clip_z = (depths1[j-rectRtt.x+(i-rectRtt.y)*(rectRtt.width)] - 0.5) * 2.0;
-                    depthsN[j+i*wdth] = 2*znear*zfar/(clip_z*(zfar-znear)-(zfar+znear));
-
-                    //std::cout << " dpethsN " <<  depthsN[j+i*wdth] << std::endl;
-
-                    if ( depthsN[j+i*wdth] > -10 && depthsN[j+i*wdth] < -0.05)
-                    {
-                    pt.x = j;
-                    pt.y = i;
-                    ptfgd.push_back(pt);
-                    _rtd0.at<uchar>(hght-i-1,j) = 255;
-
-                    }
-                    else _rtd0.at<uchar>(hght-i-1,j) = 0;
-
-                }
-                else
-                {
-                    _rtd0.at<uchar>(hght-i-1,j) = 0;
-                    depthsN[j+i*wdth] = 0;
-                }
-
-            }
+    // computed once per mesh state and camera, shared with the other components querying the same MeshVisibility
+    const Data<VecCoord>* xdata = mstate->read(core::ConstVecCoordId::position());
+    const VecCoord& x = xdata->getValue();
+    meshvisibility->updateVisibility(mstate, xdata->getCounter(), x, depthrend, znear, zfar, cameraIntrinsicParameters.getValue(), visibilityThreshold.getValue());
 
         {
-            cv::Rect rectrtt = cv::boundingRect(ptfgd);
-
-            if (ptfgd.size()==0)
+            if (meshvisibility->nforeground == 0)
             {
                 rectRtt.x = 0;
                 rectRtt.y = 0;
                 rectRtt.height = hght;
                 rectRtt.width = wdth;
             }
-            else //if ((double)rectrtt.height/rectRtt.height - 1 < 0.2 && (double)rectrtt.width/rectRtt.width - 1 < 0.2)
+            else
             {
-                rectRtt = rectrtt;
+                rectRtt = meshvisibility->foregroundRect;
 
             if (rectRtt.x >=10)
             rectRtt.x -= 10;
@@ -235,13 +197,21 @@ void MeshProcessing<DataTypes>::getSourceVisible(double znear, double zfar)
             std::cout << " rect1 " << rectRtt.x << " " << rectRtt.y << " rect2 " << rectRtt.width << " " << rectRtt.height << std::endl;
                         }
 
-        depthMap = _rtd0.clone();
-        /*depthr.convertTo(depthu, CV_8UC1, 10);
-        cv::namedWindow("depth_map");
-        cv::imshow("depth_map",depthMap);
-        cv::waitKey(1);
-        cv::imwrite("depth000.png",depthMap);
-        //cv::imwrite("depth01.png", depthMap);*/
+            // under fast motion the mesh rendered at the next frame may leave the current box,
+            // the box is extended to the projection of the predicted mesh
+            if (poseprediction)
+            {
+                poseprediction->predict();
+                if (poseprediction->isValid() && meshvisibility->nforeground > 0)
+                {
+                    // image rows go downwards, the rendered rows upwards
+                    Vector4 roi = poseprediction->predictedROI.getValue();
+                    rectRtt |= cv::Rect(roi[0], hght - roi[1] - roi[3], roi[2], roi[3]);
+                    rectRtt &= cv::Rect(0, 0, wdth, hght);
+                }
+            }
+
+        depthMap = meshvisibility->depthMap;
 
             Vector4 bbox;
             bbox[0] = rectRtt.x;
@@ -250,52 +220,23 @@ void MeshProcessing<DataTypes>::getSourceVisible(double znear, double zfar)
             bbox[3] = rectRtt.height;
             BBox.setValue(bbox);
         }
-        const VecCoord& x = mstate->read(core::ConstVecCoordId::position())->getValue();
-
-        helper::vector<bool> sourcevisible;
-        sourcevisible.resize(x.size());
-        VecCoord sourceVis;
-        Vector3 pos;
-
-        helper::vector< int > indicesvisible;
-        indicesvisible.resize(0);
-
-        for (unsigned int k = 0; k < x.size(); k++)
-        {
-            int x_u = (int)(x[k][0]*rgbIntrinsicMatrix(0,0)/x[k][2] + rgbIntrinsicMatrix(0,2));
-            int x_v = (int)(x[k][1]*rgbIntrinsicMatrix(1,1)/x[k][2] + rgbIntrinsicMatrix(1,2));
 
-            if (x_u>=0 && x_u<wdth && x_v<hght && x_v >= 0){
-                if((float)abs(depthsN[x_u+(hght-x_v-1)*wdth]+(float)x[k][2]) < visibilityThreshold.getValue() || (float)depthsN[x_u+(hght-x_v-1)*wdth] == 0)
-                {
-                    sourcevisible[k] = true;
-                    pos = x[k];
-                    sourceVis.push_back(pos);
-                    indicesvisible.push_back(k);
-                }
-                else
-                {
-                    sourcevisible[k] = false;
-                }
-            }
-            else {sourcevisible[k] = false;}
-
-        }
-
-        //std::cout << " nvisible " << sourceVis.size() << " xsize " << sourcevisible.size() <<  std::endl;
-        sourceVisiblePositions.setValue(sourceVis);
-        sourceVisible.setValue(sourcevisible);
-        indicesVisible.setValue(indicesvisible);
-
-    }
+        published(sourceVisiblePositions, &SharedState::sourceVisiblePositions).setValue(meshvisibility->sourceVisiblePositions);
+        published(sourceVisible, &SharedState::sourceVisible).setValue(meshvisibility->sourceVisible);
+        published(indicesVisible, &SharedState::indicesVisible).setValue(meshvisibility->indicesVisible);
+        positionsCounter = xdata->getCounter();
 }
 
 template<class DataTypes>
 void MeshProcessing<DataTypes>::updateSourceVisible()
 {
-    const VecCoord&  x = mstate->read(core::ConstVecCoordId::position())->getValue();
-    VecCoord sourceVis;
-    helper::vector<bool> sourcevisible = sourceVisible.getValue();
+    const Data<VecCoord>* xdata = mstate->read(core::ConstVecCoordId::position());
+    const VecCoord&  x = xdata->getValue();
+    positionsCounter = xdata->getCounter();
+    // written in place, the buffer keeps its capacity from one step to the next
+    helper::WriteAccessor< Data< VecCoord > > sourceVis(published(sourceVisiblePositions, &SharedState::sourceVisiblePositions));
+    sourceVis.clear();
+    const helper::vector<bool>& sourcevisible = sourceVisible.getValue();
     Vector3 pos;
         for (unsigned int i=0; i< x.size(); i++)
         {
@@ -305,231 +246,31 @@ void MeshProcessing<DataTypes>::updateSourceVisible()
                 sourceVis.push_back(pos);
             }
         }
-    sourceVisiblePositions.setValue(sourceVis);
 
 }
 
 template<class DataTypes>
 void MeshProcessing<DataTypes>::extractSourceContour()
 {
-
-    double cannyTh1 = 350;
-    double cannyTh2 = 10;
-    cv::Mat contour,dist,dist0,depthmapS;
-    //cv::imwrite("depthmap.png", depthMap);
-    cv::Canny( depthMap, contour, cannyTh1, cannyTh2, 3);
-    contour = cv::Scalar::all(255) - contour;
-
-    cv::distanceTransform(contour, dist, CV_DIST_L2, 3);
-    dist.convertTo(dist0, CV_8U, 1, 0);
-    pcl::PointCloud<pcl::PointXYZRGB> sourceContour;
-
     const VecCoord& x = mstate->read(core::ConstVecCoordId::position())->getValue();
-    unsigned int nbs=x.size();
-    cv::Mat contourpoints = cv::Mat::zeros(hght,wdth, CV_8UC3);
-    contourpoints= cv::Mat(hght,wdth,CV_8UC3,cv::Scalar(255,255,255));
-        for (int j = 0; j < wdth; j++)
-            for (int i = 0; i< hght; i++)
-            {
-                contourpoints.at<Vec3b>(i,j)[0]= contour.at<uchar>(i,j);
-            }
-
-    pcl::PointXYZRGB newPoint;
-    helper::vector< bool > sourceborder;
-    sourceborder.resize(nbs);
-    //cv::imwrite("dist0.png", dist0);
-
-    int nsourcecontour = 0;
-
-    helper::vector< double > sourceweights;
-    sourceweights.resize(0);
-
-    cv::GaussianBlur(depthMap, depthmapS, Size(5, 5), 0, 0 );
-    double gradientx, gradienty;
-    helper::vector< Vec2 > normalscontour;
-    Vec2 normal;
-
-    double totalweights = 0;
-
-        for (unsigned int i=0; i<nbs; i++)
-        {
-            int x_u = (int)(x[i][0]*rgbIntrinsicMatrix(0,0)/x[i][2] + rgbIntrinsicMatrix(0,2));
-            int x_v = (int)(x[i][1]*rgbIntrinsicMatrix(1,1)/x[i][2] + rgbIntrinsicMatrix(1,2));
-            int thickness = 1;
-            int lineType = 2;
-
-            if (dist0.at<uchar>(x_v,x_u) < borderThdSource.getValue()/*7*/)
-            {
-                newPoint.z = x[i][2];
-                newPoint.x = x[i][0];
-                newPoint.y = x[i][1];
-                newPoint.r = 0;
-                newPoint.g = 0;
-                newPoint.b = 0;
-                sourceContour.push_back(newPoint);
-
-                sourceborder[i] = true;
-                nsourcecontour++;
-                circle( contourpoints,cv::Point(x_u,x_v),wdth/128.0,Scalar( 0, 0, 255 ),thickness,lineType );
-
-                gradientx = (2047.0 *(depthmapS.at<uchar>(x_v,x_u+1) - depthmapS.at<uchar>(x_v,x_u-1)) + 913.0*(depthmapS.at<uchar>(x_v,x_u+2) - depthmapS.at<uchar>(x_v,x_u-2))+112.0 *(depthmapS.at<uchar>(x_v,x_u+3) - depthmapS.at<uchar>(x_v,x_u-3)))/8418.0;
-                gradienty = (2047.0 *(depthmapS.at<uchar>(x_v+1,x_u) - depthmapS.at<uchar>(x_v-1,x_u)) + 913.0*(depthmapS.at<uchar>(x_v+2,x_u) - depthmapS.at<uchar>(x_v-2,x_u))+112.0 *(depthmapS.at<uchar>(x_v+3,x_u) - depthmapS.at<uchar>(x_v-3,x_u)))/8418.0;
-                if(gradientx == 0)
-                {
-                    normal[0] = cos(CV_PI/2.0);
-                    normal[1] = sin((CV_PI/2.0));
-                }
-                else{normal[0] = cos((atan(gradienty / gradientx)) );
-
-                normal[1] = sin((atan(gradienty / gradientx)));}
-                normalscontour.push_back(normal);
-            }
-            else sourceborder[i] = false;
-
-            //sourceWeights.push_back((double)1./(0.12*(1.0+sqrt(dist0.at<uchar>(x_v,x_u)))));
-            sourceweights.push_back((double)exp(-dist0.at<uchar>(x_v,x_u)/sigmaWeight.getValue()));
-            totalweights += sourceweights[i];
-        }
-
-        for (unsigned int i=0; i < sourceweights.size();i++)
-        {
-            sourceweights[i]*=((double)sourceweights.size()/totalweights);
-        }
-
-    //cv::imwrite("contourpoints.png", contourpoints);
-    //cv::imwrite("dist.png", dist);
-
-    std::cout << " n source " << nbs << " n source contour " << nsourcecontour << std::endl;
-
-    VecCoord sourcecontourpos;
-    sourcecontourpos.resize(sourceContour.size());
-    Vector3 pos;
-
-        for (unsigned int i=0; i<sourcecontourpos.size(); i++)
-        {
-            pos[0] = sourceContour[i].x;
-            pos[1] = sourceContour[i].y;
-            pos[2] = sourceContour[i].z;
-            sourcecontourpos[i]=pos;
-        }
-    const VecCoord&  p = sourcecontourpos;
-    sourceContourPositions.setValue(p);
-    sourceBorder.setValue(sourceborder);
-    sourceContourNormals.setValue(normalscontour);
-    sourceWeights.setValue(sourceweights);
+    meshvisibility->updateContour(x, false, borderThdSource.getValue(), sigmaWeight.getValue());
 
+    published(sourceContourPositions, &SharedState::sourceContourPositions).setValue(meshvisibility->sourceContourPositions);
+    published(sourceBorder, &SharedState::sourceBorder).setValue(meshvisibility->sourceBorder);
+    published(sourceContourNormals, &SharedState::sourceContourNormals).setValue(meshvisibility->sourceContourNormals);
+    published(sourceWeights, &SharedState::sourceWeights).setValue(meshvisibility->sourceWeights);
 }
 
 template<class DataTypes>
 void MeshProcessing<DataTypes>::extractSourceVisibleContour()
 {
+    const VecCoord& x = mstate->read(core::ConstVecCoordId::position())->getValue();
+    meshvisibility->updateContour(x, true, borderThdSource.getValue(), sigmaWeight.getValue());
 
-    double cannyTh1 = 350;
-    double cannyTh2 = 10;
-    cv::Mat contour,dist,dist0,depthmapS;
-
-    cv::Canny( depthMap, contour, cannyTh1, cannyTh2, 3);
-    contour = cv::Scalar::all(255) - contour;
-    cv::distanceTransform(contour, dist, CV_DIST_L2, 3);
-    dist.convertTo(dist0, CV_8U, 1, 0);
-    pcl::PointCloud<pcl::PointXYZRGB> sourceContour;
-
-    const VecCoord& x =  mstate->read(core::ConstVecCoordId::position())->getValue();
-
-    unsigned int nbs=x.size();
-    cv::Mat contourpoints = cv::Mat::zeros(hght,wdth, CV_8UC3);
-    contourpoints= cv::Mat(hght,wdth,CV_8UC3,cv::Scalar(255,255,255));
-        for (int j = 0; j < wdth; j++)
-          for (int i = 0; i< hght; i++)
-          {
-            contourpoints.at<Vec3b>(i,j)[0]= contour.at<uchar>(i,j);
-          }
-
-    pcl::PointXYZRGB newPoint;
-    helper::vector< bool > sourceborder;
-    sourceborder.resize(nbs);
-    //cv::imwrite("dist0.png", dist0);
-    int nsourcecontour = 0;
-    helper::vector< double > sourceweights;
-    sourceweights.resize(0);
-    double totalweights = 0;
-
-    cv::GaussianBlur(depthMap, depthmapS, Size(5, 5), 0, 0 );
-    double gradientx, gradienty;
-    helper::vector< Vec2 > normalscontour;
-    normalscontour.resize(0);
-    Vec2 normal;
-
-        for (unsigned int i=0; i<nbs; i++)
-        {
-            int x_u = (int)(x[i][0]*rgbIntrinsicMatrix(0,0)/x[i][2] + rgbIntrinsicMatrix(0,2));
-            int x_v = (int)(x[i][1]*rgbIntrinsicMatrix(1,1)/x[i][2] + rgbIntrinsicMatrix(1,2));
-            int thickness = 1;
-            int lineType = 2;
-
-            //std::cout << " source weight " << (int)dist0.at<uchar>(x_v,x_u) << " " << sigmaWeight.getValue() << std::endl;
-
-            if ((int)dist0.at<uchar>(x_v,x_u) < borderThdSource.getValue() /*6*/ && (sourceVisible.getValue())[i])
-            {
-                newPoint.z = x[i][2];
-                newPoint.x = x[i][0];
-                newPoint.y = x[i][1];
-                newPoint.r = 0;
-                newPoint.g = 0;
-                newPoint.b = 0;
-                sourceContour.push_back(newPoint);
-                sourceborder[i] = true;
-                nsourcecontour++;
-                circle( contourpoints,cv::Point(x_u,x_v),wdth/128.0,Scalar( 0, 0, 255 ),thickness,lineType );
-
-                gradientx = (2047.0 *(depthmapS.at<uchar>(x_v,x_u+1) - depthmapS.at<uchar>(x_v,x_u-1)) + 913.0*(depthmapS.at<uchar>(x_v,x_u+2) - depthmapS.at<uchar>(x_v,x_u-2))+112.0 *(depthmapS.at<uchar>(x_v,x_u+3) - depthmapS.at<uchar>(x_v,x_u-3)))/8418.0;
-                gradienty = (2047.0 *(depthmapS.at<uchar>(x_v+1,x_u) - depthmapS.at<uchar>(x_v-1,x_u)) + 913.0*(depthmapS.at<uchar>(x_v+2,x_u) - depthmapS.at<uchar>(x_v-2,x_u))+112.0 *(depthmapS.at<uchar>(x_v+3,x_u) - depthmapS.at<uchar>(x_v-3,x_u)))/8418.0;
-                if(gradientx == 0)
-                {
-                    normal[0] = cos(CV_PI/2.0);
-                    normal[1] = sin((CV_PI/2.0));
-                }
-                else{normal[0] = cos((atan(gradienty / gradientx)) );
-
-                normal[1] = sin((atan(gradienty / gradientx)));}
-                normalscontour.push_back(normal);
-            }
-            else sourceborder[i] = false;
-            //sourceWeights.push_back((double)1./(0.12*(1.0+sqrt(dist0.at<uchar>(x_v,x_u)))))
-            sourceweights.push_back((double)exp(-(int)dist0.at<uchar>(x_v,x_u)/sigmaWeight.getValue()));
-            totalweights += sourceweights[i];
-            //std::cout << " source weight " << sourceweights[i] << std::endl;
-
-        }
-
-        for (unsigned int i=0; i < sourceweights.size();i++)
-        {
-            sourceweights[i]*=((double)sourceweights.size()/totalweights);
-        }
-
-    //cv::imwrite("contourpoints.png", contourpoints);
-    //cv::imwrite("dist.png", dist);
-    //std::cout << " n source " << nbs << " n source contour " << nsourcecontour << " " << borderThdSource.getValue() << std::endl;
-
-    VecCoord sourcecontourpos;
-    sourcecontourpos.resize(sourceContour.size());
-    Vector3 pos;
-
-        for (unsigned int i=0; i<sourcecontourpos.size(); i++)
-        {
-            pos[0] = sourceContour[i].x;
-            pos[1] = sourceContour[i].y;
-            pos[2] = sourceContour[i].z;
-            sourcecontourpos[i]=pos;
-        }
-
-
-    const VecCoord&  p = sourcecontourpos;
-    sourceContourPositions.setValue(p);
-    sourceBorder.setValue(sourceborder);
-    sourceContourNormals.setValue(normalscontour);
-    sourceWeights.setValue(sourceweights);
-
+    published(sourceContourPositions, &SharedState::sourceContourPositions).setValue(meshvisibility->sourceContourPositions);
+    published(sourceBorder, &SharedState::sourceBorder).setValue(meshvisibility->sourceBorder);
+    published(sourceContourNormals, &SharedState::sourceContourNormals).setValue(meshvisibility->sourceContourNormals);
+    published(sourceWeights, &SharedState::sourceWeights).setValue(meshvisibility->sourceWeights);
 }
 
 template<class DataTypes>
@@ -594,13 +335,15 @@ template<class DataTypes>
 void MeshProcessing<DataTypes>::updateSourceVisibleContour()
 {
     // build k-d tree
-    const VecCoord&  x = mstate->read(core::ConstVecCoordId::position())->getValue();
+    const Data<VecCoord>* xdata = mstate->read(core::ConstVecCoordId::position());
+    const VecCoord&  x = xdata->getValue();
+    positionsCounter = xdata->getCounter();
     VecCoord sourcecontourpos;
     sourcecontourpos.resize(sourceContourPositions.getValue().size());
     Vector3 pos;
     int k = 0;
 
-    helper::vector< bool > sourceborder = sourceBorder.getValue();
+    const helper::vector< bool >& sourceborder = sourceBorder.getValue();
 
         for (unsigned int i=0; i<x.size(); i++)
         {
@@ -612,10 +355,23 @@ void MeshProcessing<DataTypes>::updateSourceVisibleContour()
             }
         }
     const VecCoord&  p = sourcecontourpos;
-    sourceContourPositions.setValue(p);
+    published(sourceContourPositions, &SharedState::sourceContourPositions).setValue(p);
 
 }
 
+template<class DataTypes>
+void MeshProcessing<DataTypes>::linkFrameState()
+{
+    // the values are shared with the frame state (copy on write), reading the Data does not copy them
+    sourceVisiblePositions.setParent(&framestate->sourceVisiblePositions);
+    sourceVisible.setParent(&framestate->sourceVisible);
+    indicesVisible.setParent(&framestate->indicesVisible);
+    sourceBorder.setParent(&framestate->sourceBorder);
+    sourceContourPositions.setParent(&framestate->sourceContourPositions);
+    sourceContourNormals.setParent(&framestate->sourceContourNormals);
+    sourceWeights.setParent(&framestate->sourceWeights);
+}
+
 template <class DataTypes>
 void MeshProcessing<DataTypes>::handleEvent(sofa::core::objectmodel::Event *event)
 {
@@ -634,7 +390,7 @@ void MeshProcessing<DataTypes>::handleEvent(sofa::core::objectmodel::Event *even
                 {
                     cv::Mat depthr;
                     renderingmanager->getDepths(depthr);
-                    depthrend = depthr.clone();
+                    depthr.copyTo(depthrend);
                     double znear = renderingmanager->getZNear();
                     double zfar = renderingmanager->getZFar();
                     if (!depthrend.empty()) //(t%(npasses + niterations.getValue() - 1) ==0 )
@@ -653,16 +409,21 @@ void MeshProcessing<DataTypes>::handleEvent(sofa::core::objectmodel::Event *even
                 }
             }
 
-            if (!depthrend.empty() && useVisible.getValue() && t%niterations.getValue()!= 0)
+            // between two renderings the visible positions follow the mesh, they are left as they are
+            // (and not published again) while it does not move
+            if (!depthrend.empty() && useVisible.getValue() && t%niterations.getValue()!= 0
+                    && mstate->read(core::ConstVecCoordId::position())->getCounter() != positionsCounter)
             {
                 if(useContour.getValue())
                     updateSourceVisibleContour();
                 else updateSourceVisible();
-
             }
+            // the version only changes when one of the buffers was written
+            if (framestate) framestate->publishSource();
             timeMeshProcessing = ((double)getTickCount() - timeMeshProcessing)/getTickFrequency();
 
             cout << "TIME MESHPROCESSING " << timeMeshProcessing << endl;
+            frameAllocations.setValue(arena.endFrame() + meshvisibility->endFrame());
 
     }
 }
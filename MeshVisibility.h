@@ -0,0 +1,151 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_MESHVISIBILITY_H
+#define SOFA_RGBDTRACKING_MESHVISIBILITY_H
+
+#include <opencv2/core.hpp>
+
+#include <RGBDTracking/config.h>
+#include "FrameArena.h"
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/defaulttype/VecTypes.h>
+#include <sofa/helper/vector.h>
+
+#include <vector>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Visibility and contour of the source mesh in the rendered depth, shared between
+ * MeshProcessing and ReinitializeMesh. Results are cached: a query with the same mesh state
+ * version and camera as the previous one returns the stored buffers without recomputing
+ * the visibility test, the Canny edges or the distance transform.
+ * Components not finding one in the scene use a private instance.
+ */
+template<class DataTypes>
+class MeshVisibility : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(MeshVisibility,DataTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+    typedef typename DataTypes::Real Real;
+    typedef typename DataTypes::Coord Coord;
+    typedef typename DataTypes::VecCoord VecCoord;
+    typedef sofa::defaulttype::Vector4 Vector4;
+    typedef sofa::defaulttype::Vector2 Vec2;
+
+    MeshVisibility();
+    virtual ~MeshVisibility();
+
+    void init();
+
+    // version of the mesh state and camera the buffers were computed for
+    struct Key
+    {
+        const void* state;
+        int counter;
+        Vector4 camera;
+        double znear, zfar;
+        int width, height;
+
+        bool operator==(const Key& k) const
+        {
+            return state == k.state && counter == k.counter && camera == k.camera
+                    && znear == k.znear && zfar == k.zfar && width == k.width && height == k.height;
+        }
+    };
+
+    // visibility of the vertices x of the state (state, counter) in the rendered OpenGL depth buffer depthr,
+    // returns false when the cached result was reused
+    bool updateVisibility(const void* state, int counter, const VecCoord& x, const cv::Mat& depthr, double znear, double zfar, const Vector4& camParam, Real threshold);
+    // contour of the rendered silhouette and border vertices, on the visible vertices only if visibleonly is set
+    bool updateContour(const VecCoord& x, bool visibleonly, int borderThd, Real sigmaWeight);
+
+    // visibility outputs
+    cv::Mat depthMap;              // silhouette of the rendered mesh
+    cv::Rect foregroundRect;       // bounding box of the silhouette, in rendered (bottom-up) rows
+    int nforeground;
+    helper::vector< bool > sourceVisible;
+    helper::vector< int > indicesVisible;
+    VecCoord sourceVisiblePositions;
+
+    // contour outputs
+    cv::Mat distanceMap;
+    helper::vector< bool > sourceBorder;
+    VecCoord sourceContourPositions;
+    helper::vector< Vec2 > sourceContourNormals;
+    helper::vector< double > sourceWeights;
+
+    Data<unsigned int> visibilityUpdates;
+    Data<unsigned int> contourUpdates;
+
+    // closes the allocation epoch of the buffers above and of the scratch images,
+    // returns the number of buffers reallocated since the previous call
+    int endFrame() { return arena.endFrame(); }
+
+protected:
+    Key visibilityKey;
+    bool hasVisibility;
+    Key contourKey;
+    bool contourVisibleOnly;
+    int contourThd;
+    Real contourSigma;
+    bool hasContour;
+    std::vector<double> depthsN;
+
+    enum { CONTOUR_EDGES, CONTOUR_DISTANCE, SILHOUETTE_BLURRED };
+    FrameArena arena;
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(MeshVisibility_CPP)
+#ifndef SOFA_FLOAT
+extern template class SOFA_RGBDTRACKING_API MeshVisibility<defaulttype::Vec3dTypes>;
+#endif
+#ifndef SOFA_DOUBLE
+extern template class SOFA_RGBDTRACKING_API MeshVisibility<defaulttype::Vec3fTypes>;
+#endif
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
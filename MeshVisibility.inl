@@ -0,0 +1,249 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_MESHVISIBILITY_INL
+
+#include "MeshVisibility.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <math.h>
+#include <iostream>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+template <class DataTypes>
+MeshVisibility<DataTypes>::MeshVisibility()
+    : Inherit()
+    , visibilityUpdates(initData(&visibilityUpdates,(unsigned int)0,"visibilityUpdates","Number of times the visibility was actually computed."))
+    , contourUpdates(initData(&contourUpdates,(unsigned int)0,"contourUpdates","Number of times the contour was actually computed."))
+{
+    visibilityUpdates.setReadOnly(true);
+    contourUpdates.setReadOnly(true);
+    hasVisibility = false;
+    hasContour = false;
+    nforeground = 0;
+    contourVisibleOnly = false;
+    contourThd = 0;
+    contourSigma = 0;
+
+    arena.watch(depthMap);
+    arena.watch(sourceVisible);
+    arena.watch(indicesVisible);
+    arena.watch(sourceVisiblePositions);
+    arena.watch(distanceMap);
+    arena.watch(sourceBorder);
+    arena.watch(sourceContourPositions);
+    arena.watch(sourceContourNormals);
+    arena.watch(sourceWeights);
+    arena.watch(depthsN);
+}
+
+template <class DataTypes>
+MeshVisibility<DataTypes>::~MeshVisibility()
+{
+}
+
+template <class DataTypes>
+void MeshVisibility<DataTypes>::init()
+{
+    this->Inherit::init();
+}
+
+template <class DataTypes>
+bool MeshVisibility<DataTypes>::updateVisibility(const void* state, int counter, const VecCoord& x, const cv::Mat& depthr, double znear, double zfar, const Vector4& camParam, Real threshold)
+{
+    Key key;
+    key.state = state;
+    key.counter = counter;
+    key.camera = camParam;
+    key.znear = znear;
+    key.zfar = zfar;
+    key.width = depthr.cols;
+    key.height = depthr.rows;
+
+    if (hasVisibility && key == visibilityKey) return false;
+
+    int wdth = depthr.cols;
+    int hght = depthr.rows;
+
+    // linearized depths and silhouette, the rows of the depth buffer go upwards
+    depthsN.assign(wdth*hght, 0);
+    depthMap.create(hght, wdth, CV_8UC1);
+    int umin = wdth, umax = -1, vmin = hght, vmax = -1;
+    nforeground = 0;
+
+    for (int i = 0; i < hght; i++)
+    {
+        int r = hght-i-1;
+        const float* depthrow = depthr.ptr<float>(r);
+        uchar* maprow = depthMap.ptr<uchar>(r);
+        for (int j = 0; j < wdth; j++)
+        {
+            maprow[j] = 0;
+            double d = (double)depthrow[j];
+            if (d < 1 && d > 0.001)
+            {
+                double clip_z = (d - 0.5) * 2.0;
+                double dn = 2*znear*zfar/(clip_z*(zfar-znear)-(zfar+znear));
+                depthsN[j+r*wdth] = dn;
+                if (dn > -10 && dn < -0.05)
+                {
+                    maprow[j] = 255;
+                    umin = std::min(umin,j); umax = std::max(umax,j);
+                    vmin = std::min(vmin,i); vmax = std::max(vmax,i);
+                    nforeground++;
+                }
+            }
+        }
+    }
+    if (nforeground > 0) foregroundRect = cv::Rect(umin, vmin, umax-umin+1, vmax-vmin+1);
+    else foregroundRect = cv::Rect(0, 0, wdth, hght);
+
+    sourceVisible.resize(x.size());
+    sourceVisiblePositions.resize(0);
+    indicesVisible.resize(0);
+
+    for (unsigned int k = 0; k < x.size(); k++)
+    {
+        int x_u = (int)(x[k][0]*camParam[0]/x[k][2] + camParam[2]);
+        int x_v = (int)(x[k][1]*camParam[1]/x[k][2] + camParam[3]);
+
+        sourceVisible[k] = false;
+        if (x_u>=0 && x_u<wdth && x_v<hght && x_v >= 0)
+        {
+            float dn = (float)depthsN[x_u+x_v*wdth];
+            if (fabs(dn+(float)x[k][2]) < threshold || dn == 0)
+            {
+                sourceVisible[k] = true;
+                sourceVisiblePositions.push_back(x[k]);
+                indicesVisible.push_back(k);
+            }
+        }
+    }
+
+    visibilityKey = key;
+    hasVisibility = true;
+    hasContour = false;
+    visibilityUpdates.setValue(visibilityUpdates.getValue()+1);
+    return true;
+}
+
+template <class DataTypes>
+bool MeshVisibility<DataTypes>::updateContour(const VecCoord& x, bool visibleonly, int borderThd, Real sigmaWeight)
+{
+    if (!hasVisibility || depthMap.empty()) return false;
+    if (hasContour && contourKey == visibilityKey && contourVisibleOnly == visibleonly
+            && contourThd == borderThd && contourSigma == sigmaWeight) return false;
+
+    const Vector4& camParam = visibilityKey.camera;
+    int wdth = depthMap.cols;
+    int hght = depthMap.rows;
+
+    double cannyTh1 = 350;
+    double cannyTh2 = 10;
+    cv::Mat &contour = arena.mat(CONTOUR_EDGES);
+    cv::Mat &dist = arena.mat(CONTOUR_DISTANCE);
+    cv::Mat &depthmapS = arena.mat(SILHOUETTE_BLURRED);
+    cv::Canny( depthMap, contour, cannyTh1, cannyTh2, 3);
+    cv::bitwise_not(contour, contour);
+    cv::distanceTransform(contour, dist, CV_DIST_L2, 3);
+    dist.convertTo(distanceMap, CV_8U, 1, 0);
+    cv::GaussianBlur(depthMap, depthmapS, cv::Size(5, 5), 0, 0 );
+
+    unsigned int nbs = x.size();
+    sourceBorder.resize(nbs);
+    sourceWeights.resize(nbs);
+    sourceContourPositions.resize(0);
+    sourceContourNormals.resize(0);
+
+    double totalweights = 0;
+    double gradientx, gradienty;
+    Vec2 normal;
+
+    for (unsigned int i=0; i<nbs; i++)
+    {
+        int x_u = (int)(x[i][0]*camParam[0]/x[i][2] + camParam[2]);
+        int x_v = (int)(x[i][1]*camParam[1]/x[i][2] + camParam[3]);
+        bool inside = (x_u >= 0 && x_u < wdth && x_v >= 0 && x_v < hght);
+        int d = inside ? (int)distanceMap.at<uchar>(x_v,x_u) : 255;
+
+        sourceBorder[i] = false;
+        if (inside && d < borderThd && (!visibleonly || sourceVisible[i]))
+        {
+            sourceContourPositions.push_back(x[i]);
+            sourceBorder[i] = true;
+
+            gradientx = 0;
+            gradienty = 0;
+            if (x_u >= 3 && x_u < wdth-3 && x_v >= 3 && x_v < hght-3)
+            {
+            gradientx = (2047.0 *(depthmapS.at<uchar>(x_v,x_u+1) - depthmapS.at<uchar>(x_v,x_u-1)) + 913.0*(depthmapS.at<uchar>(x_v,x_u+2) - depthmapS.at<uchar>(x_v,x_u-2))+112.0 *(depthmapS.at<uchar>(x_v,x_u+3) - depthmapS.at<uchar>(x_v,x_u-3)))/8418.0;
+            gradienty = (2047.0 *(depthmapS.at<uchar>(x_v+1,x_u) - depthmapS.at<uchar>(x_v-1,x_u)) + 913.0*(depthmapS.at<uchar>(x_v+2,x_u) - depthmapS.at<uchar>(x_v-2,x_u))+112.0 *(depthmapS.at<uchar>(x_v+3,x_u) - depthmapS.at<uchar>(x_v-3,x_u)))/8418.0;
+            }
+            if(gradientx == 0)
+            {
+                normal[0] = cos(CV_PI/2.0);
+                normal[1] = sin((CV_PI/2.0));
+            }
+            else
+            {
+                normal[0] = cos((atan(gradienty / gradientx)));
+                normal[1] = sin((atan(gradienty / gradientx)));
+            }
+            sourceContourNormals.push_back(normal);
+        }
+
+        sourceWeights[i] = (double)exp(-d/sigmaWeight);
+        totalweights += sourceWeights[i];
+    }
+
+    if (totalweights > 0)
+        for (unsigned int i=0; i < sourceWeights.size(); i++)
+            sourceWeights[i] *= ((double)sourceWeights.size()/totalweights);
+
+    std::cout << " n source " << nbs << " n source contour " << sourceContourPositions.size() << std::endl;
+
+    contourKey = visibilityKey;
+    contourVisibleOnly = visibleonly;
+    contourThd = borderThd;
+    contourSigma = sigmaWeight;
+    hasContour = true;
+    contourUpdates.setValue(contourUpdates.getValue()+1);
+    return true;
+}
+
+}
+}
+} // namespace sofa
+
+
@@ -0,0 +1,63 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_POSEPREDICTION_CPP
+
+#include "PosePrediction.inl"
+#include <sofa/core/ObjectFactory.h>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+    using namespace sofa::defaulttype;
+
+      SOFA_DECL_CLASS(PosePrediction)
+
+      // Register in the Factory
+      int PosePredictionClass = core::RegisterObject("Constant velocity prediction of the mesh pose and of its region of interest in the image")
+    #ifndef SOFA_FLOAT
+        .add< PosePrediction<Vec3dTypes> >()
+    #endif
+    #ifndef SOFA_DOUBLE
+        .add< PosePrediction<Vec3fTypes> >()
+    #endif
+    ;
+
+    #ifndef SOFA_FLOAT
+      template class SOFA_RGBDTRACKING_API PosePrediction<Vec3dTypes>;
+    #endif
+    #ifndef SOFA_DOUBLE
+      template class SOFA_RGBDTRACKING_API PosePrediction<Vec3fTypes>;
+    #endif
+
+}
+}
+} // namespace sofa
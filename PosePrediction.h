@@ -0,0 +1,136 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_POSEPREDICTION_H
+#define SOFA_RGBDTRACKING_POSEPREDICTION_H
+
+#include <RGBDTracking/config.h>
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/core/objectmodel/Event.h>
+#include <sofa/core/behavior/MechanicalState.h>
+#include <sofa/simulation/AnimateBeginEvent.h>
+#include <sofa/defaulttype/VecTypes.h>
+#include <sofa/helper/vector.h>
+
+#include <Eigen/Core>
+
+#include "KalmanFilter.h"
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Constant velocity prediction of the mesh pose, computed once at the beginning of each frame.
+ * The rigid motion between the mesh positions at the two last frames is measured and filtered
+ * by the pose filter of Kalmanfilter (or used as is without useKalman), and the filtered motion
+ * is applied again to the current positions. With predictDeformation the positions are
+ * predicted node by node by the point filter instead. The predicted mesh is projected into the image to give a predicted ROI,
+ * used to seed the segmentation rectangle (RGBDDataProcessing) and the rendering bounding box
+ * (MeshProcessing), and the predicted motion is used as initial guess by RegistrationRigid.
+ */
+template<class DataTypes>
+class PosePrediction : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(PosePrediction,DataTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+    typedef typename DataTypes::Real Real;
+    typedef typename DataTypes::Coord Coord;
+    typedef typename DataTypes::VecCoord VecCoord;
+    typedef typename DataTypes::VecReal VecReal;
+    typedef sofa::defaulttype::Vector4 Vector4;
+    typedef Eigen::Matrix<float,4,4,Eigen::DontAlign> Transform;
+
+    PosePrediction();
+    virtual ~PosePrediction();
+
+    void init();
+    void handleEvent(sofa::core::objectmodel::Event *event);
+
+    // computes the prediction if it has not been done yet for the current frame
+    void predict();
+    // forgets the previous positions, e.g. after the mesh was moved to a relocalized pose:
+    // the next prediction is the identity instead of the jump to the new pose
+    void resetHistory() { previousPositions.clear(); kalmanNodes = 0; }
+
+    bool isValid() const { return predictionValid.getValue(); }
+    // rigid motion from the current mesh positions to the predicted ones
+    const Transform& getPredictedMotion() const { return predictedMotion; }
+
+    Data<int> niterations;
+    Data<Vector4> cameraIntrinsicParameters;
+    Data<int> imagewidth;
+    Data<int> imageheight;
+    Data<int> roiMargin;
+    Data<bool> useKalman;
+    Data<bool> predictDeformation;
+
+    // outputs
+    Data<bool> predictionValid;
+    Data<Vector4> predictedROI;
+    Data<VecReal> predictedTranslation;
+    Data<VecReal> predictedRotation;
+    Data<VecCoord> predictedPositions;
+
+protected:
+    typename core::behavior::MechanicalState<DataTypes> *mstate;
+    VecCoord previousPositions;
+    Transform predictedMotion;
+    int lastFrame;
+
+    // the filters are (re)initialized with a zero velocity when the number of nodes changes
+    Kalmanfilter kalman;
+    int kalmanNodes;
+    void filterMotion(const VecCoord& x, bool measured);
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(PosePrediction_CPP)
+#ifndef SOFA_FLOAT
+extern template class SOFA_RGBDTRACKING_API PosePrediction<defaulttype::Vec3dTypes>;
+#endif
+#ifndef SOFA_DOUBLE
+extern template class SOFA_RGBDTRACKING_API PosePrediction<defaulttype::Vec3fTypes>;
+#endif
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
@@ -0,0 +1,226 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_POSEPREDICTION_INL
+
+#include "PosePrediction.h"
+#include <sofa/core/objectmodel/BaseContext.h>
+#include <sofa/helper/accessor.h>
+
+#include <Eigen/Geometry>
+
+#include <opencv2/core.hpp>
+
+#include <limits>
+#include <iostream>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+template <class DataTypes>
+PosePrediction<DataTypes>::PosePrediction()
+    : Inherit()
+    , niterations(initData(&niterations,1,"niterations","Number of iterations in the tracking process"))
+    , cameraIntrinsicParameters(initData(&cameraIntrinsicParameters,Vector4(1,1,1,1),"cameraIntrinsicParameters","camera parameters"))
+    , imagewidth(initData(&imagewidth,640,"imagewidth","Width of the RGB-D images"))
+    , imageheight(initData(&imageheight,480,"imageheight","Height of the RGB-D images"))
+    , roiMargin(initData(&roiMargin,10,"roiMargin","Margin in pixels around the projection of the predicted mesh"))
+    , useKalman(initData(&useKalman,true,"useKalman","Filter the measured frame to frame motion with the Kalman pose filter instead of repeating it as is"))
+    , predictDeformation(initData(&predictDeformation,false,"predictDeformation","Predict the positions node by node with the Kalman point filter (constant velocity of each node) instead of the rigid motion"))
+    , predictionValid(initData(&predictionValid,false,"predictionValid","True when the mesh positions of the two last frames were available for the prediction"))
+    , predictedROI(initData(&predictedROI,"predictedROI","Bounding box (x, y, width, height) of the projection of the predicted mesh"))
+    , predictedTranslation(initData(&predictedTranslation,"predictedTranslation","Translation of the predicted motion"))
+    , predictedRotation(initData(&predictedRotation,"predictedRotation","Rotation matrix (row major) of the predicted motion"))
+    , predictedPositions(initData(&predictedPositions,"predictedPositions","Predicted mesh positions"))
+{
+    this->f_listening.setValue(true);
+    predictionValid.setReadOnly(true);
+    predictedROI.setReadOnly(true);
+    predictedTranslation.setReadOnly(true);
+    predictedRotation.setReadOnly(true);
+    predictedPositions.setReadOnly(true);
+    predictedMotion.setIdentity();
+    lastFrame = -1;
+    kalmanNodes = 0;
+}
+
+template <class DataTypes>
+PosePrediction<DataTypes>::~PosePrediction()
+{
+}
+
+template <class DataTypes>
+void PosePrediction<DataTypes>::init()
+{
+    this->Inherit::init();
+    core::objectmodel::BaseContext* context = this->getContext();
+    mstate = dynamic_cast<sofa::core::behavior::MechanicalState<DataTypes> *>(context->getMechanicalState());
+}
+
+template <class DataTypes>
+void PosePrediction<DataTypes>::handleEvent(sofa::core::objectmodel::Event *event)
+{
+    if (dynamic_cast<simulation::AnimateBeginEvent*>(event)) predict();
+}
+
+template <class DataTypes>
+void PosePrediction<DataTypes>::predict()
+{
+    // the consumers may be reached before this component in the AnimateBegin traversal,
+    // they call predict() themselves and the prediction is only computed once per frame
+    int t = (int)this->getContext()->getTime();
+    int frame = t/niterations.getValue();
+    if (frame == lastFrame || !mstate) return;
+    lastFrame = frame;
+
+    double timePrediction = (double)cv::getTickCount();
+
+    const VecCoord& x = mstate->read(core::ConstVecCoordId::position())->getValue();
+    unsigned int n = x.size();
+
+    bool valid = false;
+    predictedMotion.setIdentity();
+    if (previousPositions.size() == n && n >= 3)
+    {
+        Eigen::Matrix<double,3,Eigen::Dynamic> src(3,n), dst(3,n);
+        for (unsigned int i = 0; i < n; i++)
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                src(j,i) = previousPositions[i][j];
+                dst(j,i) = x[i][j];
+            }
+        Eigen::Matrix4d motion = Eigen::umeyama(src, dst, false);
+        if (motion.allFinite())
+        {
+            predictedMotion = motion.cast<float>();
+            valid = true;
+        }
+    }
+    if (useKalman.getValue() && n >= 3) filterMotion(x, valid);
+    previousPositions = x;
+
+    // constant velocity: the (filtered) motion of the last frame is applied again to the current positions
+    VecCoord xpred(n);
+    if (useKalman.getValue() && predictDeformation.getValue() && valid)
+    {
+        for (unsigned int i = 0; i < n; i++)
+            for (unsigned int j = 0; j < 3; j++)
+                xpred[i][j] = kalman.estimatedPositions[3*i+j] + kalman.estimatedForces[3*i+j];
+    }
+    else
+    for (unsigned int i = 0; i < n; i++)
+        for (unsigned int j = 0; j < 3; j++)
+            xpred[i][j] = predictedMotion(j,0)*x[i][0] + predictedMotion(j,1)*x[i][1] + predictedMotion(j,2)*x[i][2] + predictedMotion(j,3);
+
+    Vector4 camParam = cameraIntrinsicParameters.getValue();
+    int wdth = imagewidth.getValue(), hght = imageheight.getValue();
+    double umin = std::numeric_limits<double>::max(), vmin = umin;
+    double umax = -umin, vmax = -umin;
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (xpred[i][2] <= 0) continue;
+        double u = xpred[i][0]*camParam[0]/xpred[i][2] + camParam[2];
+        double v = xpred[i][1]*camParam[1]/xpred[i][2] + camParam[3];
+        umin = std::min(umin,u); umax = std::max(umax,u);
+        vmin = std::min(vmin,v); vmax = std::max(vmax,v);
+    }
+
+    Vector4 roi(0,0,wdth,hght);
+    if (umax >= umin)
+    {
+        int m = roiMargin.getValue();
+        int x0 = std::max((int)umin - m, 0), y0 = std::max((int)vmin - m, 0);
+        int x1 = std::min((int)umax + m, wdth - 1), y1 = std::min((int)vmax + m, hght - 1);
+        if (x1 > x0 && y1 > y0) roi = Vector4(x0, y0, x1 - x0, y1 - y0);
+        else valid = false;
+    }
+    else valid = false;
+
+    VecReal trans(3), rot(9);
+    for (unsigned int j = 0; j < 3; j++)
+    {
+        trans[j] = predictedMotion(j,3);
+        for (unsigned int k = 0; k < 3; k++)
+            rot[3*j+k] = predictedMotion(j,k);
+    }
+
+    predictionValid.setValue(valid);
+    predictedROI.setValue(roi);
+    predictedTranslation.setValue(trans);
+    predictedRotation.setValue(rot);
+    predictedPositions.setValue(xpred);
+
+    std::cout << "TIME PREDICTION " << ((double)cv::getTickCount() - timePrediction)/cv::getTickFrequency() << std::endl;
+}
+
+template <class DataTypes>
+void PosePrediction<DataTypes>::filterMotion(const VecCoord& x, bool measured)
+{
+    unsigned int n = x.size();
+    // point state of the filter: positions and displacements over the last frame
+    vpColVector p(3*n), f(3*n);
+    for (unsigned int i = 0; i < n; i++)
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            p[3*i+j] = x[i][j];
+            f[3*i+j] = measured ? x[i][j] - previousPositions[i][j] : 0;
+        }
+
+    // the filter does not use the stiffness of the mesh
+    vpMatrix stiffness;
+    if (kalmanNodes != (int)n)
+    {
+        vpHomogeneousMatrix cMo;
+        kalman.init(f, p, cMo, stiffness);
+        kalmanNodes = n;
+    }
+    if (!measured) return;
+
+    // the filter moves the pose by exp(v)^-1 at each frame, the measured motion is its innovation
+    vpHomogeneousMatrix motion;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++)
+            motion[i][j] = predictedMotion(i,j);
+    kalman.predictPose(stiffness);
+    kalman.estimatePose(motion);
+    if (predictDeformation.getValue()) kalman.estimatePoints(f, p);
+
+    vpHomogeneousMatrix filtered = vpExponentialMap::direct(kalman.estimatedVelPose).inverse();
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++)
+            predictedMotion(i,j) = (float)filtered[i][j];
+}
+
+}
+}
+} // namespace sofa
+
+
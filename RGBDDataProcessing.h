@@ -28,6 +28,7 @@
 
 #include <RGBDTracking/config.h>
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include "DataIO.h"
 
 #include <sofa/core/core.h>
@@ -74,6 +75,13 @@
 #include <visp/vpKltOpencv.h>
 
 #include "segmentation.h"
+#include "FrameState.h"
+#include "PosePrediction.h"
+#include "AdaptiveSampler.h"
+#include "DepthNormals.h"
+#include "MaskStatistics.h"
+#include "FrameArena.h"
+#include "FramePipeline.h"
 
 //#include "ImageConverter.h"
 
@@ -119,6 +127,7 @@ public:
     typedef Data<typename DataTypes::VecCoord> DataVecCoord;
     typedef Data<typename DataTypes::VecDeriv> DataVecDeriv;
     typedef sofa::defaulttype::Vector4 Vector4;
+    typedef sofa::defaulttype::Vector2 Vector2;
     typedef sofa::defaulttype::Vector3 Vec3;
 	
     typedef defaulttype::ImageF DepthTypes;
@@ -171,6 +180,9 @@ public:
 
     Data<int> samplePCD;
     Data<int> borderThdPCD;
+    Data<int> pointBudget;
+    Data<double> contourBand;
+    Data<double> contourGain;
     Data<int> windowKLT;
     Data<bool> useDistContourNormal;
 
@@ -209,6 +221,9 @@ public:
     Data<bool> useCurvature;
     Data< helper::vector< double > > curvatures;
     Data<bool> useSIFT3D;
+    Data<bool> usePCLNormals;
+    Data<int> normalRadius;
+    Data<int> normalSmoothing;
 
     Data<Vector4> cameraIntrinsicParameters;
     Eigen::Matrix3f rgbIntrinsicMatrix;
@@ -217,8 +232,21 @@ public:
     Data<Quat> cameraOrientation;
 
     Data<bool> stopatinit;
+
+    // initialization of the segmentation: 0 rectangle drawn with the mouse, 1 initROI,
+    // 2 largest depth cluster at the depth of the mesh, around its projection (or initROI)
+    Data<int> initMode;
+    Data<Vector4> initROI;
+    Data<Vector2> initDepthRange;
+    Data<double> initDepthTolerance;
     Data<bool> safeModeSeg;
     Data<double> segTolerance;
+    // number of foreground pixels of the last segmentation, at the resolution of the color image
+    Data<int> segmentationArea;
+    // frames between the acquisition of the images and the publication of their target (0: serial)
+    Data<int> pipelineLatency;
+    // scratch buffers (re)allocated during the last serial frame, 0 once they have reached their working size
+    Data<int> frameAllocations;
 
 	
     int ntargetcontours;
@@ -228,6 +256,57 @@ public:
     double timeSegmentation;
     double timePCD;
 
+    // pixels turned into target points, on the samplePCD grid or picked by the sampler for pointBudget
+    AdaptiveSampler sampler;
+    std::vector<cv::Point> samplePixels;
+    cv::Mat sampleMask;
+    // pixels of the target points, where targetNormals and curvatures are read in the normal images
+    std::vector<cv::Point> targetPixels;
+
+    DepthNormals depthNormals;
+    cv::Mat normalImage, curvatureImage;
+    bool imageNormalsValid;
+
+    // target of one frame, written into the Data by publishTarget on the animation thread
+    struct TargetFrame
+    {
+        // images of a pipelined frame and rectangle predicted when they were acquired
+        int frame;
+        cv::Mat color, depth;
+        cv::Rect predictedRect;
+        cv::Mat foreground, distimage, dotimage;
+
+        // only the parts computed for the frame are published
+        VecCoord positions, contourPositions, normals;
+        helper::vector<bool> border;
+        helper::vector<double> weights, curvatures;
+        cv::Mat pixelIndex; // of the positions, CV_32SC1, shared with the frame state once published
+        bool hasPositions, hasContour, hasBorder, hasNormals, hasCurvatures;
+
+        TargetFrame() : frame(0) { clearTarget(); }
+        void clearTarget() { hasPositions = hasContour = hasBorder = hasNormals = hasCurvatures = false; }
+        // the vectors keep their capacity
+        void assignTarget(const TargetFrame &f)
+        {
+            positions = f.positions; contourPositions = f.contourPositions; normals = f.normals;
+            border = f.border; weights = f.weights; curvatures = f.curvatures;
+            pixelIndex = f.pixelIndex;
+            hasPositions = f.hasPositions; hasContour = f.hasContour; hasBorder = f.hasBorder;
+            hasNormals = f.hasNormals; hasCurvatures = f.hasCurvatures;
+        }
+    };
+
+    // scratch images and point buffers reused across frames, with their allocation count
+    enum { SEGMENTATION_INPUT, CONTOUR_EDGES, CONTOUR_DISTANCE };
+    FrameArena arena;
+    // the cloud of a frame is filled in the one not held by target, which keeps the last accepted cloud
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr targetClouds[2];
+    TargetFrame scratch;
+
+    // segmentation and point cloud stages, each on its own thread, over pipelineLatency+1 frames
+    std::vector<TargetFrame> pipelineFrames;
+    FramePipeline pipeline;
+
     bool initsegmentation;
 	
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr target;
@@ -260,14 +339,36 @@ public:
 
     void detectBorder(vector<bool> &border,const helper::vector< tri > &triangles);
     void computeCenter(vpImage<unsigned char> &Itemp, vpImagePoint &cog,double &angle, int &surface);
-    void extractTargetPCD();
-    void extractTargetPCDContour();
+    void extractTargetPCD(cv::Mat& depthImage, cv::Mat& foregroundImage);
+    void extractTargetPCDContour(cv::Mat& depthImage, cv::Mat& foregroundImage, cv::Mat& distImage, cv::Mat& dotImage);
+    void selectPixels(cv::Mat& depthImage, cv::Mat& mask, cv::Mat& distImage, int sample);
+    void computeImageNormals(cv::Mat& depthImage);
+    void sampleImageNormals();
+    void indexTargetPixels(const cv::Mat& depthImage, cv::Mat& pixelIndex);
+    void publishTarget(const TargetFrame& frame, int t);
+
+    typename FrameState<DataTypes>::SPtr framestate;
+    typedef FrameState<DataTypes> SharedState;
+    // the published buffers are owned by the frame state when there is one, the Data of this
+    // component are then linked to them and share their values
+    template<class T> Data<T>& published(Data<T>& local, Data<T> SharedState::*shared) { return framestate ? framestate.get()->*shared : local; }
+    void linkFrameState();
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr nextTargetCloud();
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr PCDFromRGBD(cv::Mat& depthImage, cv::Mat& rgbImage);
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr PCDContourFromRGBD(cv::Mat& depthImage, cv::Mat& rgbImage, cv::Mat& distImage, cv::Mat& dotImage);
     void setCameraPose();
 
     void initSegmentation();
+    cv::Rect initialRectangle();
+    // the segmentation and the target are initialized again on the next frame, e.g. after a tracking loss
+    void requestInitialization() { initsegmentation = true; }
+    cv::Rect predictedSegmentationRect();
     void segment();
+    void segmentImage(cv::Mat& colorImage, const cv::Rect& predictedrect, cv::Mat& foregroundImage, cv::Mat& distImage, cv::Mat& dotImage);
+    // stages of the pipeline, on the frame of the job
+    void segmentFrame(int job);
+    void extractFrame(int job);
+    void processPipelined(int t);
     void segmentSynth();
     void ContourFromRGBSynth(cv::Mat& rgbImage, cv::Mat& distImage, cv::Mat& dotImage);
     void draw(const core::visual::VisualParams* vparams) ;
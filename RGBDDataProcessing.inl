@@ -88,6 +88,9 @@ RGBDDataProcessing<DataTypes>::RGBDDataProcessing( )
 	, samplePCD(initData(&samplePCD,4,"samplePCD","Sample step for the point cloud"))
         , sigmaWeight(initData(&sigmaWeight,(Real)4,"sigmaWeight","sigma weights"))
 	, borderThdPCD(initData(&borderThdPCD,4,"borderThdPCD","border threshold on the target silhouette"))
+        , pointBudget(initData(&pointBudget,0,"pointBudget","Number of target points sampled according to the depth footprint, the slope and the contour distance (0: fixed samplePCD grid)"))
+        , contourBand(initData(&contourBand,4.0,"contourBand","Width in pixels of the contour band sampled more densely with pointBudget"))
+        , contourGain(initData(&contourGain,4.0,"contourGain","Extra sampling density on the contour with pointBudget"))
 	, inputPath(initData(&inputPath,"inputPath","Path for data readings",false))
 	, outputPath(initData(&outputPath,"outputPath","Path for data writings",false))
 	, useDistContourNormal(initData(&useDistContourNormal,false,"outputPath","Path for data writings"))
@@ -115,11 +118,24 @@ RGBDDataProcessing<DataTypes>::RGBDDataProcessing( )
         , cameraChanged(initData(&cameraChanged,false,"cameraChanged","If the camera has changed or not"))
         , curvatures(initData(&curvatures,"curvatures","curvatures."))
         , useSIFT3D(initData(&useSIFT3D,false,"useSIFT3D"," "))
+        , usePCLNormals(initData(&usePCLNormals,false,"usePCLNormals","Estimate the normals and curvatures with pcl::NormalEstimation and a k-d tree instead of the depth image gradients"))
+        , normalRadius(initData(&normalRadius,2,"normalRadius","Pixel distance of the depth differences for the image normals"))
+        , normalSmoothing(initData(&normalSmoothing,3,"normalSmoothing","Half size of the window averaging the image normals"))
+        , targetNormals(initData(&targetNormals,"targetNormals","Normals of the target point cloud."))
         , stopatinit(initData(&stopatinit,false,"stopatinit","stopatinit."))
+        , initMode(initData(&initMode,0,"initMode","Initialization of the segmentation: 0 rectangle drawn with the mouse, 1 initROI, 2 depth cluster at the expected mesh pose"))
+        , initROI(initData(&initROI,Vector4(0,0,0,0),"initROI","Rectangle (x, y, width, height) in image pixels initializing the segmentation, or bounding the depth cluster"))
+        , initDepthRange(initData(&initDepthRange,Vector2(0.2,1.5),"initDepthRange","Depth range of the object for the depth cluster when the mesh depth is not known"))
+        , initDepthTolerance(initData(&initDepthTolerance,0.05,"initDepthTolerance","Margin around the depth range of the mesh for the depth cluster"))
         , safeModeSeg(initData(&safeModeSeg,false,"safeModeSeg","safe mode when segmentation fails"))
         , segTolerance(initData(&segTolerance,0.5,"segTolerance","tolerance or segmentation"))
+        , segmentationArea(initData(&segmentationArea,0,"segmentationArea","Number of foreground pixels of the last segmentation"))
+        , pipelineLatency(initData(&pipelineLatency,0,"pipelineLatency","Frames between the images and their published target, the segmentation and the point cloud of the next frames running during the simulation of the current one (0: serial)"))
+        , frameAllocations(initData(&frameAllocations,0,"frameAllocations","Scratch buffers (re)allocated during the last frame, not updated while the frames are pipelined"))
 {
 	this->f_listening.setValue(true); 
+        segmentationArea.setReadOnly(true);
+        frameAllocations.setReadOnly(true);
 	iter_im = 0;
         timeSegmentation = 0;
         timePCD = 0;
@@ -129,6 +145,7 @@ RGBDDataProcessing<DataTypes>::RGBDDataProcessing( )
 template <class DataTypes>
 RGBDDataProcessing<DataTypes>::~RGBDDataProcessing()
 {
+    pipeline.stop();
 }
 
 template <class DataTypes>
@@ -146,6 +163,7 @@ void RGBDDataProcessing<DataTypes>::init()
 	cv::namedWindow("image_sensor");
         cv::namedWindow("depth_sensor");
 	}
+        if (displaySegmentation.getValue())
         cv::namedWindow("image_segmented");
 
         Vector4 camParam = cameraIntrinsicParameters.getValue();
@@ -155,8 +173,45 @@ void RGBDDataProcessing<DataTypes>::init()
         rgbIntrinsicMatrix(0,2) = camParam[2];
         rgbIntrinsicMatrix(1,2) = camParam[3];
 
-        initsegmentation = true;        
+        initsegmentation = true;
+        imageNormalsValid = false;
 
+        for (int k = 0; k < 2; k++)
+        {
+            targetClouds[k].reset(new pcl::PointCloud<pcl::PointXYZRGB>);
+            arena.watch(targetClouds[k]->points);
+        }
+        arena.watch(samplePixels);
+        arena.watch(targetPixels);
+        arena.watch(scratch.positions);
+        arena.watch(scratch.contourPositions);
+        arena.watch(scratch.border);
+        arena.watch(scratch.weights);
+        arena.watch(scratch.normals);
+        arena.watch(scratch.curvatures);
+        arena.watch(foreground);
+        arena.watch(distimage);
+        arena.watch(dotimage);
+        arena.watch(sampleMask);
+        // all the slots exist before the stages use them from their threads
+        arena.mat(CONTOUR_DISTANCE);
+
+        pipeline.addStage(boost::bind(&RGBDDataProcessing<DataTypes>::segmentFrame, this, _1));
+        pipeline.addStage(boost::bind(&RGBDDataProcessing<DataTypes>::extractFrame, this, _1));
+
+        sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
+        root->get(framestate);
+        if (framestate) linkFrameState();
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::linkFrameState()
+{
+    // the values are shared with the frame state (copy on write), reading the Data does not copy them
+    targetPositions.setParent(&framestate->targetPositions);
+    targetContourPositions.setParent(&framestate->targetContourPositions);
+    targetBorder.setParent(&framestate->targetBorder);
+    targetWeights.setParent(&framestate->targetWeights);
 }
 
 
@@ -230,9 +285,86 @@ void my_mouse_callback( int event, int x, int y, int flags, void* param )
 
 }
 
+template <class DataTypes>
+cv::Rect RGBDDataProcessing<DataTypes>::initialRectangle()
+{
+    cv::Rect image(0, 0, color.cols, color.rows);
+    Vector4 roi = initROI.getValue();
+    bool configured = roi[2] > 0 && roi[3] > 0;
+    cv::Rect prior = configured ? cv::Rect(roi[0], roi[1], roi[2], roi[3]) & image : image;
+    if (initMode.getValue() == 1 || depth.size() != color.size()) return prior;
+
+    // expected pose of the object: depth range and projection of the mesh, as given by PosePrediction
+    double zmin = initDepthRange.getValue()[0], zmax = initDepthRange.getValue()[1];
+    sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
+    typename sofa::core::objectmodel::PosePrediction<DataTypes>::SPtr poseprediction;
+    root->get(poseprediction);
+    if (poseprediction)
+    {
+        poseprediction->predict();
+        const VecCoord& x = poseprediction->predictedPositions.getValue();
+        double mn = std::numeric_limits<double>::max(), mx = -mn;
+        for (unsigned int i = 0; i < x.size(); i++)
+            if (x[i][2] > 0) { mn = std::min(mn, (double)x[i][2]); mx = std::max(mx, (double)x[i][2]); }
+        if (mx >= mn)
+        {
+            zmin = mn - initDepthTolerance.getValue();
+            zmax = mx + initDepthTolerance.getValue();
+            if (!configured)
+            {
+                // the object may have moved since the mesh was placed: the search area is twice the projection
+                Vector4 proj = poseprediction->predictedROI.getValue();
+                double scale = (double)color.cols/(double)poseprediction->imagewidth.getValue();
+                cv::Rect r(proj[0]*scale - proj[2]*scale/2, proj[1]*scale - proj[3]*scale/2, 2*proj[2]*scale, 2*proj[3]*scale);
+                if ((r & image).area() > 0) prior = r & image;
+            }
+        }
+    }
+
+    cv::Mat inrange, labels, stats, centroids;
+    cv::inRange(depth(prior), cv::Scalar(zmin), cv::Scalar(zmax), inrange);
+    cv::morphologyEx(inrange, inrange, cv::MORPH_OPEN, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5,5)));
+    int ncomponents = cv::connectedComponentsWithStats(inrange, labels, stats, centroids, 8, CV_32S);
+
+    int best = 0, bestArea = prior.area()/200;
+    for (int k = 1; k < ncomponents; k++)
+        if (stats.at<int>(k, cv::CC_STAT_AREA) > bestArea) { best = k; bestArea = stats.at<int>(k, cv::CC_STAT_AREA); }
+    if (best == 0) return prior;
+
+    cv::Rect rect(prior.x + stats.at<int>(best, cv::CC_STAT_LEFT), prior.y + stats.at<int>(best, cv::CC_STAT_TOP),
+                  stats.at<int>(best, cv::CC_STAT_WIDTH), stats.at<int>(best, cv::CC_STAT_HEIGHT));
+    // some background around the object for the color models of the segmentation
+    int marginx = rect.width/10 + 2, marginy = rect.height/10 + 2;
+    return cv::Rect(rect.x - marginx, rect.y - marginy, rect.width + 2*marginx, rect.height + 2*marginy) & image;
+}
+
 template <class DataTypes>
 void RGBDDataProcessing<DataTypes>::initSegmentation()
 {
+    if (initMode.getValue() > 0)
+    {
+        // headless initialization, no window and no user input
+        double timeInit = (double)getTickCount();
+        int scaleSeg = std::max(scaleSegmentation.getValue(), 1);
+        cv::Rect rect = initialRectangle();
+        seg.setRectangle(cv::Rect(rect.x/scaleSeg, rect.y/scaleSeg, rect.width/scaleSeg, rect.height/scaleSeg));
+
+        cv::Mat downsampled;
+        if (scaleSeg>1)
+        cv::resize(color, downsampled, cv::Size(color.cols/scaleSeg, color.rows/scaleSeg));
+        else downsampled = color.clone();
+
+        foregroundS = cv::Mat(downsampled.size(),CV_8UC3,cv::Scalar(255,255,255));
+        seg.segmentationFromRect(downsampled,foregroundS);
+        cv::resize(foregroundS, foreground, color.size());
+
+        if (displaySegmentation.getValue()){
+        cv::imshow("image_segmented",foregroundS);
+        cv::waitKey(1);
+        }
+        std::cout << "TIME INITIALIZATION " << ((double)getTickCount() - timeInit)/getTickFrequency() << " rectangle " << rect << std::endl;
+        return;
+    }
 	
     cv::Mat mask,maskimg,mask0,roimask,mask1; // segmentation result (4 possible values)
     cv::Mat bgModel,fgModel; // the models (internally used)
@@ -320,37 +452,101 @@ void RGBDDataProcessing<DataTypes>::initSegmentation()
    
 }
 
+template <class DataTypes>
+cv::Rect RGBDDataProcessing<DataTypes>::predictedSegmentationRect()
+{
+    // the predicted mesh ROI bounds the segmentation rectangle
+    sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
+    typename sofa::core::objectmodel::PosePrediction<DataTypes>::SPtr poseprediction;
+    root->get(poseprediction);
+    cv::Rect predictedrect;
+    if (poseprediction)
+    {
+        poseprediction->predict();
+        if (poseprediction->isValid())
+        {
+            Vector4 roi = poseprediction->predictedROI.getValue();
+            double scale = (double)color.cols/(double)poseprediction->imagewidth.getValue()/scaleSegmentation.getValue();
+            predictedrect = cv::Rect(roi[0]*scale, roi[1]*scale, roi[2]*scale, roi[3]*scale);
+        }
+    }
+    return predictedrect;
+}
+
 template <class DataTypes>
 void RGBDDataProcessing<DataTypes>::segment()
 {
-    cv::Mat downsampled,downsampled1;
+    segmentImage(color, predictedSegmentationRect(), foreground, distimage, dotimage);
+
+    // display result
+    if (displaySegmentation.getValue()){
+    cv::imshow("image_segmented",foregroundS);
+    cv::waitKey(1);
+    }
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::segmentImage(cv::Mat& colorImage, const cv::Rect& predictedrect, cv::Mat& foregroundImage, cv::Mat& distImage, cv::Mat& dotImage)
+{
+    cv::Mat &downsampled = arena.mat(SEGMENTATION_INPUT);
     double timef = (double)getTickCount();
     int scaleSeg = scaleSegmentation.getValue();
     if (scaleSeg>1)
-    cv::resize(color, downsampled, cv::Size(color.cols/scaleSeg, color.rows/scaleSeg));
-    else downsampled = color.clone();
+    cv::resize(colorImage, downsampled, cv::Size(colorImage.cols/scaleSeg, colorImage.rows/scaleSeg));
+    else colorImage.copyTo(downsampled);
+
+    seg.setPredictedRectangle(predictedrect);
 
     seg.updateMask(foregroundS);
     //cv::GaussianBlur( downsampled, downsampled1, cv::Size( 3, 3), 0, 0 );
     //cv::imwrite("downsampled.png", downsampled);
     seg.updateSegmentation(downsampled,foregroundS);
-    cv::resize(foregroundS, foreground, color.size(), INTER_NEAREST);
+    cv::resize(foregroundS, foregroundImage, colorImage.size(), INTER_NEAREST);
     if(useContour.getValue())
     {
-    cv::resize(seg.dotImage, dotimage, color.size(), INTER_NEAREST);
-    cv::resize(seg.distImage, distimage, color.size(), INTER_NEAREST);
+    cv::resize(seg.dotImage, dotImage, colorImage.size(), INTER_NEAREST);
+    cv::resize(seg.distImage, distImage, colorImage.size(), INTER_NEAREST);
+
+    // distance to the contour of this frame, for the segmentation of the next one; updated here,
+    // in the stage that owns seg, so that the pipelined and the serial runs compute the same
+    double cannyTh1 = 150;
+    double cannyTh2 = 80;
+    cv::Mat &contour = arena.mat(CONTOUR_EDGES);
+    cv::Mat &dist = arena.mat(CONTOUR_DISTANCE);
+
+    //cv::imwrite("depthmap.png", seg.distImage);
+    cv::Canny( dotImage, contour, cannyTh1, cannyTh2, 3);
+    cv::bitwise_not(contour, contour);
+    cv::distanceTransform(contour, dist, CV_DIST_L2, 3);
+    dist.convertTo(seg.distImage, CV_8U, 1, 0);
     }
     //foreground = foregroundS.clone();
     timeSegmentation = ((double)getTickCount() - timef)/getTickFrequency();
     std::cout << "TIME SEGMENTATION " << timeSegmentation << std::endl;
 
     //seg.updateSegmentationCrop(downsampled,foreground);
+}
 
-    // display result
-    if (displaySegmentation.getValue()){
-    cv::imshow("image_segmented",foregroundS);
-    cv::waitKey(1);
-    }
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::segmentFrame(int job)
+{
+    TargetFrame &frame = pipelineFrames[job];
+    segmentImage(frame.color, frame.predictedRect, frame.foreground, frame.distimage, frame.dotimage);
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::extractFrame(int job)
+{
+    TargetFrame &frame = pipelineFrames[job];
+    double timef = (double)getTickCount();
+
+    if(!useContour.getValue())
+    extractTargetPCD(frame.depth, frame.foreground);
+    else extractTargetPCDContour(frame.depth, frame.foreground, frame.distimage, frame.dotimage);
+    frame.assignTarget(scratch);
+
+    timePCD = ((double)getTickCount() - timef)/getTickFrequency();
+    std::cout << "TIME PCD " << timePCD << std::endl;
 }
 
 template<class DataTypes>
@@ -361,7 +557,8 @@ void RGBDDataProcessing<DataTypes>::segmentSynth()
 	//cv::resize(color, downsampled, cv::Size(color.cols/2, color.rows/2));
 	downsampled = color;
 	
-	foreground = cv::Mat(downsampled.size(),CV_8UC4,cv::Scalar(255,255,255,0));
+	// all the pixels are written below
+	foreground.create(downsampled.size(),CV_8UC4);
 	
 	//cv::imwrite("downsampled0.png",downsampled);
 	
@@ -405,12 +602,87 @@ void RGBDDataProcessing<DataTypes>::segmentSynth()
 
 }
 
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::selectPixels(cv::Mat& depthImage, cv::Mat& mask, cv::Mat& distImage, int sample)
+{
+    samplePixels.clear();
+
+    if (pointBudget.getValue() > 0)
+    {
+        double timeSampling = (double)getTickCount();
+        sampler.setBudget(pointBudget.getValue());
+        sampler.setContourBand(contourBand.getValue());
+        sampler.setContourGain(contourGain.getValue());
+        sampler.sample(depthImage, mask, distImage, rgbIntrinsicMatrix(0,0), rgbIntrinsicMatrix(1,1), samplePixels);
+        timeSampling = ((double)getTickCount() - timeSampling)/getTickFrequency();
+        cout << "TIME SAMPLING " << timeSampling << " points " << samplePixels.size() << endl;
+        return;
+    }
+
+    samplePixels.reserve((depthImage.rows/sample)*(depthImage.cols/sample));
+    for (int i=0;i<(int)depthImage.rows/sample;i++)
+        for (int j=0;j<(int)depthImage.cols/sample;j++)
+            samplePixels.push_back(cv::Point(sample*j, sample*i));
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::computeImageNormals(cv::Mat& depthImage)
+{
+    if (imageNormalsValid) return;
+
+    double timeNormals = (double)getTickCount();
+    depthNormals.setIntrinsics(rgbIntrinsicMatrix(0,0), rgbIntrinsicMatrix(1,1), rgbIntrinsicMatrix(0,2), rgbIntrinsicMatrix(1,2));
+    depthNormals.setRadius(normalRadius.getValue());
+    depthNormals.setSmoothing(normalSmoothing.getValue());
+    depthNormals.compute(depthImage, normalImage, curvatureImage);
+    imageNormalsValid = true;
+    timeNormals = ((double)getTickCount() - timeNormals)/getTickFrequency();
+    cout << "TIME NORMALS " << timeNormals << endl;
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::sampleImageNormals()
+{
+    VecCoord& normals = scratch.normals;
+    normals.resize(targetPixels.size());
+    helper::vector<double>& curvs = scratch.curvatures;
+    curvs.resize(targetPixels.size());
+
+    for (unsigned int k = 0; k < targetPixels.size(); k++)
+    {
+        const cv::Vec3f &n = normalImage.at<cv::Vec3f>(targetPixels[k].y, targetPixels[k].x);
+        normals[k] = Coord(n[0], n[1], n[2]);
+        // squared first principal curvature, as from the PCL principal curvatures
+        float c = curvatureImage.at<float>(targetPixels[k].y, targetPixels[k].x);
+        curvs[k] = c*c;
+    }
+    scratch.hasNormals = true;
+    scratch.hasCurvatures = true;
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::indexTargetPixels(const cv::Mat& depthImage, cv::Mat& pixelIndex)
+{
+    // read by the projective association of ClosestPoint: a new map for each cloud, the published
+    // one is shared with the frame state and must not be written again
+    pixelIndex = cv::Mat(depthImage.rows, depthImage.cols, CV_32SC1, cv::Scalar::all(-1));
+    for (unsigned int k = 0; k < targetPixels.size(); k++)
+        pixelIndex.at<int>(targetPixels[k].y, targetPixels[k].x) = (int)k;
+}
+
+template <class DataTypes>
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::nextTargetCloud()
+{
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud = (target == targetClouds[0]) ? targetClouds[1] : targetClouds[0];
+    cloud->points.clear();
+    return cloud;
+}
+
 template <class DataTypes>
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGBD(cv::Mat& depthImage, cv::Mat& rgbImage)
 {
-	pcl::PointCloud<pcl::PointXYZRGB>::Ptr outputPointcloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr outputPointcloud = nextTargetCloud();
 	//pcl::PointCloud<pcl::PointXYZRGB> pointcloud; 
-	outputPointcloud->points.resize(0);  
 		
 	int sample;
 	
@@ -430,27 +702,31 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
         float rgbFocalInvertedY = 1/rgbIntrinsicMatrix(1,1);	// 1/fy
 	pcl::PointXYZRGB newPoint;
 
-        for (int i=0;i<(int)depthImage.rows/sample;i++)
-	{
-                for (int j=0;j<(int)depthImage.cols/sample;j++)
-		{
+        // the foreground is the alpha channel of the segmented image
+        if (pointBudget.getValue() > 0) cv::extractChannel(rgbImage, sampleMask, 3);
+        cv::Mat nodist;
+        selectPixels(depthImage, sampleMask, nodist, sample);
+        targetPixels.clear();
+        imageNormalsValid = false;
 
-                        float depthValue = (float)depthImage.at<float>(sample*i,sample*j);//*0.819;
-			int avalue = (int)rgbImage.at<Vec4b>(sample*i,sample*j)[3];
+        for (unsigned int k=0;k<samplePixels.size();k++)
+	{
+                        int i = samplePixels[k].y, j = samplePixels[k].x;
+                        float depthValue = (float)depthImage.at<float>(i,j);//*0.819;
+			int avalue = (int)rgbImage.at<Vec4b>(i,j)[3];
 			if (avalue > 0 && depthValue>0)                // if depthValue is not NaN
 			{
 				// Find 3D position respect to rgb frame:
                                 newPoint.z = depthValue;
-				newPoint.x = (sample*j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
-				newPoint.y = (sample*i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
-				newPoint.r = rgbImage.at<cv::Vec4b>(sample*i,sample*j)[2];
-				newPoint.g = rgbImage.at<cv::Vec4b>(sample*i,sample*j)[1];
-				newPoint.b = rgbImage.at<cv::Vec4b>(sample*i,sample*j)[0];
+				newPoint.x = (j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
+				newPoint.y = (i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
+				newPoint.r = rgbImage.at<cv::Vec4b>(i,j)[2];
+				newPoint.g = rgbImage.at<cv::Vec4b>(i,j)[1];
+				newPoint.b = rgbImage.at<cv::Vec4b>(i,j)[0];
 				outputPointcloud->points.push_back(newPoint);
+				targetPixels.push_back(samplePixels[k]);
 				
 			}
-
-		}
 	}
 
 	if (useGroundTruth.getValue())
@@ -486,8 +762,14 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
 		
         }
 
-        if (useCurvature.getValue())
+        if (useCurvature.getValue() && !usePCLNormals.getValue())
         {
+            computeImageNormals(depthImage);
+            sampleImageNormals();
+        }
+        else if (useCurvature.getValue())
+        {
+        double timeNormals = (double)getTickCount();
         int sample1 = samplePCD.getValue();
         pcl::PointCloud<pcl::PointXYZ>::Ptr outputPointcloud1(new pcl::PointCloud<pcl::PointXYZ>);
         outputPointcloud1->points.resize(0);
@@ -504,8 +786,8 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
                         {
                                 // Find 3D position respect to rgb frame:
                                 newPoint1.z = depthValue;
-                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
-                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
+                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint1.z * rgbFocalInvertedX;
+                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint1.z * rgbFocalInvertedY;
                                 outputPointcloud1->points.push_back(newPoint1);
 
 
@@ -583,7 +865,9 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
               curvs.push_back(curv);
           }
 
-          curvatures.setValue(curvs);
+          scratch.curvatures.assign(curvs.begin(), curvs.end());
+          scratch.hasCurvatures = true;
+          cout << "TIME NORMALS PCL " << ((double)getTickCount() - timeNormals)/getTickFrequency() << endl;
 
 }
 
@@ -606,8 +890,8 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
                         {
                                 // Find 3D position respect to rgb frame:
                                 newPoint1.z = depthValue;
-                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
-                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
+                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint1.z * rgbFocalInvertedX;
+                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint1.z * rgbFocalInvertedY;
                                 outputPointcloud1->points.push_back(newPoint1);
 
 
@@ -616,14 +900,34 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
                 }
         }
 
-        // Compute the normals
+          pcl::PointCloud<pcl::PointNormal>::Ptr cloudWithNormals (new pcl::PointCloud<pcl::PointNormal>);
+          if (usePCLNormals.getValue())
+          {
+          // Compute the normals
           pcl::NormalEstimation<pcl::PointXYZ, pcl::PointNormal> normalEstimation;
           normalEstimation.setInputCloud (outputPointcloud1);
           pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
           normalEstimation.setSearchMethod (tree);
-          pcl::PointCloud<pcl::PointNormal>::Ptr cloudWithNormals (new pcl::PointCloud<pcl::PointNormal>);
           normalEstimation.setRadiusSearch (0.02);
           normalEstimation.compute (*cloudWithNormals);
+          }
+          else
+          {
+              // the grid points are projected back to their pixel to read their normal
+              computeImageNormals(depthImage);
+              cloudWithNormals->points.resize(outputPointcloud1->points.size());
+              for (size_t k = 0; k < outputPointcloud1->points.size(); k++)
+              {
+                  const pcl::PointXYZ &p = outputPointcloud1->points[k];
+                  int u = cvRound(p.x*rgbIntrinsicMatrix(0,0)/p.z + rgbIntrinsicMatrix(0,2));
+                  int v = cvRound(p.y*rgbIntrinsicMatrix(1,1)/p.z + rgbIntrinsicMatrix(1,2));
+                  const cv::Vec3f &n = normalImage.at<cv::Vec3f>(v,u);
+                  cloudWithNormals->points[k].normal_x = n[0];
+                  cloudWithNormals->points[k].normal_y = n[1];
+                  cloudWithNormals->points[k].normal_z = n[2];
+                  cloudWithNormals->points[k].curvature = curvatureImage.at<float>(v,u);
+              }
+          }
 
   // Parameters for sift computation
   const float min_scale = 0.01f;
@@ -679,76 +983,21 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDFromRGB
 template <class DataTypes>
 void RGBDDataProcessing<DataTypes>::computeCenter(vpImage<unsigned char> &Itemp, vpImagePoint &cog,double &angle, int &surface)
 {
-vpImagePoint ip;
-int it;
-it=0;
-/*for (int n=0; n < Itemp.getHeight() ; n++)
-{
-for (int m=0 ; m < Itemp.getWidth(); m++)
-  {
-//std::cout << "Dot : " << (int)Itemp[n][m] << std::endl;
-	if((int)Itemp[n][m]!=16)
-    {Itemp[n][m]=255;
-    if(it==1500){
-	ip.set_i(n);
-	ip.set_j(m);}
-    it++;
-    }
-	else{
-		Itemp[n][m]=0;
-	}
-  }
-}*/
-double mu11,mu20,mu02,mup11,mup20,mup02,m00,m01,m10,m11,m02,m20;
-surface = 0;
-angle = 0;
-m00=0;
-m01 = 0;
-m10 =0 ;
-m11 = 0;
-m20 = 0;
-m02 = 0;
-mu11 = 0;
-mu20=0;
-mu02=0;
-
-for (int n=0; n < Itemp.getHeight()-0 ; n++)
-{
-for (int m=0 ; m < Itemp.getWidth()-0; m++)
-  {
-	if(Itemp[n][m] == 255)
-	{
-m00 ++;
-m01 += n;
-m10 += m;
-m11 += m*n;
-m02 += n*n;
-m20 += m*m;
-	}
-  }
-}
-cog.set_u(m10/m00);
-cog.set_v(m01/m00);
-
-surface = m00;
-
-mu11 = m11-m10*m01/m00;
-mu20 = m20 - m10*m10/m00;
-mu02 = m02 - m01*m01/m00;
-
-mup11 = mu11/m00;
-mup02 = mu02/m00;
-mup20 = mu20/m00;
-
-angle =0.5*atan2(2*mup11,(mup20-mup02));
-
-std::cout << "Dot : " << " COG : " << cog.get_u() << " " << cog.get_v() << " Angle : " << angle << " Surface : " << surface << std::endl;
+    // the dot pixels are the ones at 255, the image buffer is used in place
+    cv::Mat dot(Itemp.getHeight(), Itemp.getWidth(), CV_8UC1, Itemp.bitmap);
+    MaskStatistics stats;
+    stats.compute(dot, 255);
+
+    cog.set_u(stats.centroid.x);
+    cog.set_v(stats.centroid.y);
+    angle = stats.angle;
+    surface = stats.area;
 }
 
 template <class DataTypes>
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContourFromRGBD(cv::Mat& depthImage, cv::Mat& rgbImage, cv::Mat& distImage, cv::Mat& dotImage)
 {
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr outputPointcloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr outputPointcloud = nextTargetCloud();
     //pcl::PointCloud<pcl::PointXYZRGB> pointcloud;
 	
     cv::Mat frgd;
@@ -756,10 +1005,10 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
     distimg = distImage;
     dotimg = dotImage;
 
-    helper::vector<bool> targetborder;
+    helper::vector<bool>& targetborder = scratch.border;
     targetborder.resize(0);
 
-    helper::vector<double> targetweights;
+    helper::vector<double>& targetweights = scratch.weights;
     targetweights.resize(0);
     int sample;
 
@@ -773,25 +1022,31 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
     int jj = 0;
     double totalweights = 0;
 
-        for (int i=0;i<(int)depthImage.rows/sample;i++)
+        // the contour cloud is sampled where the dot image is empty, more densely along the contour
+        if (pointBudget.getValue() > 0) cv::compare(dotimg, cv::Scalar::all(0), sampleMask, cv::CMP_EQ);
+        selectPixels(depthImage, sampleMask, distimg, sample);
+        targetPixels.clear();
+        imageNormalsValid = false;
+
+        for (unsigned int k=0;k<samplePixels.size();k++)
 	{
-            for (int j=0;j<(int)depthImage.cols/sample;j++)
-            {
-                float depthValue = (float)depthImage.at<float>(sample*i,sample*j);//*0.819;
-                int avalue = (int)frgd.at<Vec4b>(sample*i,sample*j)[3];
-                int bvalue = (int)distimg.at<uchar>(sample*i,sample*(j));
-                int dvalue = (int)dotimg.at<uchar>(sample*i,sample*(j));
+                int i = samplePixels[k].y, j = samplePixels[k].x;
+                float depthValue = (float)depthImage.at<float>(i,j);//*0.819;
+                int avalue = (int)frgd.at<Vec4b>(i,j)[3];
+                int bvalue = (int)distimg.at<uchar>(i,j);
+                int dvalue = (int)dotimg.at<uchar>(i,j);
 
                 if (dvalue == 0 && depthValue>0)                // if depthValue is not NaN
                 {
                     // Find 3D position respect to rgb frame:
                     newPoint.z = depthValue;
-                    newPoint.x = (sample*j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
-                    newPoint.y = (sample*i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
-                    newPoint.r = frgd.at<cv::Vec4b>(sample*i,sample*j)[2];
-                    newPoint.g = frgd.at<cv::Vec4b>(sample*i,sample*j)[1];
-                    newPoint.b = frgd.at<cv::Vec4b>(sample*i,sample*j)[0];
+                    newPoint.x = (j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
+                    newPoint.y = (i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
+                    newPoint.r = frgd.at<cv::Vec4b>(i,j)[2];
+                    newPoint.g = frgd.at<cv::Vec4b>(i,j)[1];
+                    newPoint.b = frgd.at<cv::Vec4b>(i,j)[0];
                     outputPointcloud->points.push_back(newPoint);
+                    targetPixels.push_back(samplePixels[k]);
 
                     targetweights.push_back((double)exp(-bvalue/sigmaWeight.getValue()));
                     totalweights += targetweights[jj];
@@ -815,7 +1070,6 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
                     newPoint.b = std::numeric_limits<unsigned char>::quiet_NaN();
                     //outputPointcloud.push_back(newPoint);
                 }*/
-            }
 	}
 	
         for (int i=0; i < targetweights.size();i++)
@@ -824,11 +1078,16 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
             //std::cout << " weights " << totalweights << " " << (double)targetweights[i] << std::endl;
 	}
 
-        targetWeights.setValue(targetweights);
-        targetBorder.setValue(targetborder);
+        scratch.hasBorder = true;
 
-        if (useCurvature.getValue())
+        if (useCurvature.getValue() && !usePCLNormals.getValue())
+        {
+            computeImageNormals(depthImage);
+            sampleImageNormals();
+        }
+        else if (useCurvature.getValue())
         {
+        double timeNormals = (double)getTickCount();
         int sample1 = samplePCD.getValue();
         pcl::PointCloud<pcl::PointXYZ>::Ptr outputPointcloud1(new pcl::PointCloud<pcl::PointXYZ>);
         outputPointcloud1->points.resize(0);
@@ -845,8 +1104,8 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
                         {
                                 // Find 3D position respect to rgb frame:
                                 newPoint1.z = depthValue;
-                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
-                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
+                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint1.z * rgbFocalInvertedX;
+                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint1.z * rgbFocalInvertedY;
                                 outputPointcloud1->points.push_back(newPoint1);
 
 
@@ -938,7 +1197,9 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
               curvs.push_back(curv);
           }
 
-          curvatures.setValue(curvs);
+          scratch.curvatures.assign(curvs.begin(), curvs.end());
+          scratch.hasCurvatures = true;
+          cout << "TIME NORMALS PCL " << ((double)getTickCount() - timeNormals)/getTickFrequency() << endl;
           std::cout << " curvature " << descriptor << std::endl;
 
         }
@@ -962,8 +1223,8 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
                         {
                                 // Find 3D position respect to rgb frame:
                                 newPoint1.z = depthValue;
-                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint.z * rgbFocalInvertedX;
-                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint.z * rgbFocalInvertedY;
+                                newPoint1.x = (sample1*j - rgbIntrinsicMatrix(0,2)) * newPoint1.z * rgbFocalInvertedX;
+                                newPoint1.y = (sample1*i - rgbIntrinsicMatrix(1,2)) * newPoint1.z * rgbFocalInvertedY;
                                 outputPointcloud1->points.push_back(newPoint1);
 
 
@@ -972,14 +1233,34 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr RGBDDataProcessing<DataTypes>::PCDContour
                 }
         }
 
-        // Compute the normals
+          pcl::PointCloud<pcl::PointNormal>::Ptr cloudWithNormals (new pcl::PointCloud<pcl::PointNormal>);
+          if (usePCLNormals.getValue())
+          {
+          // Compute the normals
           pcl::NormalEstimation<pcl::PointXYZ, pcl::PointNormal> normalEstimation;
           normalEstimation.setInputCloud (outputPointcloud1);
           pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
           normalEstimation.setSearchMethod (tree);
-          pcl::PointCloud<pcl::PointNormal>::Ptr cloudWithNormals (new pcl::PointCloud<pcl::PointNormal>);
           normalEstimation.setRadiusSearch (0.02);
           normalEstimation.compute (*cloudWithNormals);
+          }
+          else
+          {
+              // the grid points are projected back to their pixel to read their normal
+              computeImageNormals(depthImage);
+              cloudWithNormals->points.resize(outputPointcloud1->points.size());
+              for (size_t k = 0; k < outputPointcloud1->points.size(); k++)
+              {
+                  const pcl::PointXYZ &p = outputPointcloud1->points[k];
+                  int u = cvRound(p.x*rgbIntrinsicMatrix(0,0)/p.z + rgbIntrinsicMatrix(0,2));
+                  int v = cvRound(p.y*rgbIntrinsicMatrix(1,1)/p.z + rgbIntrinsicMatrix(1,2));
+                  const cv::Vec3f &n = normalImage.at<cv::Vec3f>(v,u);
+                  cloudWithNormals->points[k].normal_x = n[0];
+                  cloudWithNormals->points[k].normal_y = n[1];
+                  cloudWithNormals->points[k].normal_z = n[2];
+                  cloudWithNormals->points[k].curvature = curvatureImage.at<float>(v,u);
+              }
+          }
 
   // Parameters for sift computation
   const float min_scale = 0.01f;
@@ -1079,25 +1360,21 @@ for (int i = 0; i < targetborder.size(); i++)
 		}
 	}
     const VecCoord&  p1 = targetContourpos;
-    targetContourPositions.setValue(p1);
-    targetWeights.setValue(targetweights);
-    targetBorder.setValue(targetborder);
+    published(targetContourPositions, &SharedState::targetContourPositions).setValue(p1);
+    published(targetWeights, &SharedState::targetWeights).setValue(targetweights);
+    published(targetBorder, &SharedState::targetBorder).setValue(targetborder);
 		
 }
 
 template <class DataTypes>
-void RGBDDataProcessing<DataTypes>::extractTargetPCD()
+void RGBDDataProcessing<DataTypes>::extractTargetPCD(cv::Mat& depthImage, cv::Mat& foregroundImage)
 {
-
-        int t = (int)this->getContext()->getTime();
-
-        targetP.reset(new pcl::PointCloud<pcl::PointXYZRGB>); 
-	targetP = PCDFromRGBD(depth,foreground);
-	VecCoord targetpos;
+	scratch.clearTarget();
+	targetP = PCDFromRGBD(depthImage,foregroundImage);
+	VecCoord& targetpos = scratch.positions;
 	
 	if (targetP->size() > 10)
 	{
-	target.reset(new pcl::PointCloud<pcl::PointXYZRGB>);	
 	target = targetP;
 	targetpos.resize(target->size());
 
@@ -1112,52 +1389,24 @@ void RGBDDataProcessing<DataTypes>::extractTargetPCD()
             targetpos[i]=pos;
             //std::cout << " target " << pos[0] << " " << pos[1] << " " << pos[2] << std::endl;
 	} 
-    const VecCoord&  p = targetpos;
-
-    if (safeModeSeg.getValue())
-        {
-        if (t<20*niterations.getValue())
-        {sizeinit = p.size();
-         targetPositions.setValue(p);
-
-        }
-        else
-        {
-            if (abs((double)p.size() - (double)sizeinit)/(double)sizeinit<segTolerance.getValue())
-            {
-                targetPositions.setValue(p);
-            }
-        }
-        }
-        else targetPositions.setValue(p);
-	
-}
+	indexTargetPixels(depthImage, scratch.pixelIndex);
+	scratch.hasPositions = true;
+	}
 
 }
 
 
 template <class DataTypes>
-void RGBDDataProcessing<DataTypes>::extractTargetPCDContour()
+void RGBDDataProcessing<DataTypes>::extractTargetPCDContour(cv::Mat& depthImage, cv::Mat& foregroundImage, cv::Mat& distImage, cv::Mat& dotImage)
 {
 	
-    targetP.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
-		
-    double cannyTh1 = 150;
-    double cannyTh2 = 80;
-    cv::Mat contour,dist,dist0;
-	
-    //cv::imwrite("depthmap.png", seg.distImage);
-    cv::Canny( dotimage, contour, cannyTh1, cannyTh2, 3);
-    contour = cv::Scalar::all(255) - contour;
-    cv::distanceTransform(contour, dist, CV_DIST_L2, 3);
-    dist.convertTo(dist0, CV_8U, 1, 0);	
-    seg.distImage = dist0.clone();
-    targetP = PCDContourFromRGBD(depth,foreground, distimage, dotimage);
-    VecCoord targetpos;
+    scratch.clearTarget();
+
+    targetP = PCDContourFromRGBD(depthImage,foregroundImage, distImage, dotImage);
+    VecCoord& targetpos = scratch.positions;
 	
 	if (targetP->size() > 10)
 	{
-            target.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
             target = targetP;
             targetpos.resize(target->size());
 
@@ -1169,12 +1418,13 @@ void RGBDDataProcessing<DataTypes>::extractTargetPCDContour()
                     pos[2] = (double)target->points[i].z;
                     targetpos[i]=pos;
                 }
-            VecCoord targetContourpos;
+            indexTargetPixels(depthImage, scratch.pixelIndex);
+            VecCoord& targetContourpos = scratch.contourPositions;
             targetContourpos.resize(ntargetcontours);
             int kk = 0;
                 for (unsigned int i=0; i<target->size(); i++)
                 {
-                    if (targetBorder.getValue()[i])
+                    if (scratch.border[i])
                     {
                         pos[0] = (double)target->points[i].x;
                         pos[1] = (double)target->points[i].y;
@@ -1184,15 +1434,91 @@ void RGBDDataProcessing<DataTypes>::extractTargetPCDContour()
                     }
                 }
 
-            const VecCoord&  p0 = targetpos;
-            targetPositions.setValue(p0);
-            const VecCoord&  p1 = targetContourpos;
-            targetContourPositions.setValue(p1);
-            std::cout << " target contour " << p1.size() << std::endl;
+            scratch.hasPositions = true;
+            scratch.hasContour = true;
+            std::cout << " target contour " << targetContourpos.size() << std::endl;
 	}
 
 }
 
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::publishTarget(const TargetFrame& frame, int t)
+{
+    bool accepted = frame.hasPositions;
+    if (frame.hasPositions)
+    {
+    const VecCoord&  p = frame.positions;
+
+    // the contour clouds are not checked against the initial size
+    if (safeModeSeg.getValue() && !frame.hasContour)
+        {
+        if (t<20*niterations.getValue()) sizeinit = p.size();
+        else accepted = abs((double)p.size() - (double)sizeinit)/(double)sizeinit<segTolerance.getValue();
+        }
+    if (accepted)
+        {
+        published(targetPositions, &SharedState::targetPositions).setValue(p);
+        if (framestate) framestate->targetPixelIndex = frame.pixelIndex;
+        }
+    }
+
+    if (frame.hasContour) published(targetContourPositions, &SharedState::targetContourPositions).setValue(frame.contourPositions);
+    if (frame.hasBorder)
+    {
+        published(targetWeights, &SharedState::targetWeights).setValue(frame.weights);
+        published(targetBorder, &SharedState::targetBorder).setValue(frame.border);
+    }
+    // the normals and curvatures are those of the target positions, rejected with them
+    if (accepted && frame.hasNormals) targetNormals.setValue(frame.normals);
+    if (accepted && frame.hasCurvatures) curvatures.setValue(frame.curvatures);
+}
+
+template <class DataTypes>
+void RGBDDataProcessing<DataTypes>::processPipelined(int t)
+{
+    int depthPipeline = pipelineLatency.getValue() + 1;
+    if (!pipeline.isRunning() || pipeline.getDepth() != depthPipeline)
+    {
+        // the frames in flight are dropped with the previous pipeline
+        pipeline.stop();
+        pipelineFrames.resize(depthPipeline);
+        pipeline.start(depthPipeline);
+    }
+
+    // the images are copied, the converter and the display keep writing into color and depth
+    int job = pipeline.acquire();
+    TargetFrame &frame = pipelineFrames[job];
+    frame.frame = t;
+    color.copyTo(frame.color);
+    depth.copyTo(frame.depth);
+    frame.predictedRect = predictedSegmentationRect();
+    pipeline.submit(job);
+
+    if (pipeline.inFlight() > pipelineLatency.getValue())
+    {
+        double timeWait = (double)getTickCount();
+        int completed = pipeline.retrieve(true);
+        timeWait = ((double)getTickCount() - timeWait)/getTickFrequency();
+
+        // the components reading the segmentation see the images of the published target
+        TargetFrame &result = pipelineFrames[completed];
+        result.foreground.copyTo(foreground);
+        if(useContour.getValue())
+        {
+        result.distimage.copyTo(distimage);
+        result.dotimage.copyTo(dotimage);
+        }
+        publishTarget(result, result.frame);
+        std::cout << "TIME PIPELINE WAIT " << timeWait << " latency " << (t - result.frame)/niterations.getValue() << std::endl;
+        pipeline.release(completed);
+
+        if (displaySegmentation.getValue()){
+        cv::imshow("image_segmented",foreground);
+        cv::waitKey(1);
+        }
+    }
+}
+
 template<class DataTypes>
 void RGBDDataProcessing<DataTypes>::setCameraPose()
 {
@@ -1315,22 +1641,31 @@ void RGBDDataProcessing<DataTypes>::handleEvent(sofa::core::objectmodel::Event *
 
 	if (useRealData.getValue())
 	{
+                // the segmentation starts again from this frame, the pipelined ones are dropped
+                pipeline.stop();
 		initSegmentation();
-                extractTargetPCD();
+                extractTargetPCD(depth, foreground);
+                publishTarget(scratch, t);
         }
         setCameraPose();
         initsegmentation = false;
 	}
 	else
         {
-            if(useRealData.getValue() && !stopatinit.getValue())
+            if(useRealData.getValue() && !stopatinit.getValue() && pipelineLatency.getValue() > 0)
             {
+            processPipelined(t);
+            }
+            else if(useRealData.getValue() && !stopatinit.getValue())
+            {
+            pipeline.stop();
             segment() ;
             timePCD = (double)getTickCount();
 
             if(!useContour.getValue())
-            extractTargetPCD();
-            else extractTargetPCDContour();
+            extractTargetPCD(depth, foreground);
+            else extractTargetPCDContour(depth, foreground, distimage, dotimage);
+            publishTarget(scratch, t);
 
             timePCD = ((double)getTickCount() - timePCD)/getTickFrequency();
             std::cout << "TIME PCD " << timePCD << std::endl;
@@ -1350,9 +1685,22 @@ void RGBDDataProcessing<DataTypes>::handleEvent(sofa::core::objectmodel::Event *
             }
             cameraChanged.setValue(false);
         }
+
+        if (useRealData.getValue() && foreground.channels() == 4)
+        {
+            cv::Mat alpha;
+            cv::extractChannel(foreground, alpha, 3);
+            segmentationArea.setValue(cv::countNonZero(alpha));
+        }
+
+        // the version only changes when a target was published in this frame (none while the pipeline fills up)
+        if (framestate) framestate->publishTarget();
         }
 
         std::cout << "TIME RGBDDATAPROCESSING " << ((double)getTickCount() - timeT)/getTickFrequency() << std::endl;
+        // the stages own the scratch buffers while the pipeline runs
+        if (!pipeline.isRunning())
+        frameAllocations.setValue(arena.endFrame());
 
 
 }
@@ -206,14 +206,13 @@ void RegistrationForceFieldCam<DataTypes>::addForceMesh(const core::MechanicalPa
     int t = (int)this->getContext()->getTime();
 
 
-    sofa::helper::vector< tri > triangles;
-    triangles = sourceTriangles.getValue();
+    const sofa::helper::vector< tri >& triangles = sourceTriangles.getValue();
 
     bool reinitv = false;
 
-    helper::vector< bool > sourcevisible = sourceVisible.getValue();
-    helper::vector< int > indicesvisible = indicesVisible.getValue();
-    helper::vector< bool > sourceborder = sourceBorder.getValue();
+    const helper::vector< bool >& sourcevisible = sourceVisible.getValue();
+    const helper::vector< int >& indicesvisible = indicesVisible.getValue();
+    const helper::vector< bool >& sourceborder = sourceBorder.getValue();
 
                  if (t > 0 && t%niterations.getValue() == 0){
 
@@ -255,6 +254,12 @@ void RegistrationForceFieldCam<DataTypes>::addForceMesh(const core::MechanicalPa
 
     //closestpoint->updateClosestPointsGt();
 
+    // correspondences are recomputed once per frame (or every updatePeriod steps of closestpoint) and reused in between
+    unsigned int nbsource = useVisible.getValue() ? sourceVisiblePositions.getValue().size() : x.size();
+    bool updatematches = closestpoint->correspondencesOutdated(t/niterations.getValue(), x, nbsource, tp.size());
+
+    if (updatematches)
+    {
         if (useVisible.getValue())
         closestpoint->sourceVisiblePositions.setValue(sourceVisiblePositions.getValue());
 
@@ -278,6 +283,8 @@ void RegistrationForceFieldCam<DataTypes>::addForceMesh(const core::MechanicalPa
                 closestpoint->updateClosestPointsContours();
                 }
         }
+        closestpoint->recordCorrespondences(t/niterations.getValue(), x, nbsource, tp.size());
+    }
 
     double timeClosestPoint = ((double)getTickCount() - timef0)/getTickFrequency();
 
@@ -56,9 +56,11 @@
 #include <pcl/registration/icp.h>
 #include <pcl/common/transforms.h>
 #include <pcl/registration/icp.h>
+#include <pcl/kdtree/kdtree_flann.h>
 
 #include "RegistrationRigid.h"
 #include "ImageConverter.h"
+#include "SpatialHashSearch.h"
 
 using std::cerr;
 using std::endl;
@@ -115,6 +117,9 @@ RegistrationRigid<DataTypes>::RegistrationRigid()
         ,rigidState(initData(&rigidState,"rigidstate", "rigid state"))
         ,stopAfter(initData(&stopAfter,300000,"stopafter", "rigid state"))
         ,MeshToPointCloud(initData(&MeshToPointCloud,true,"meshToPointCloud", "rigid state"))
+        ,predictedMaxIterations(initData(&predictedMaxIterations,30,"predictedMaxIterations", "Maximum number of ICP iterations when the ICP is initialized with the predicted motion"))
+        ,useSpatialHash(initData(&useSpatialHash,true,"useSpatialHash", "Search the ICP correspondences in a spatial hash instead of a k-d tree"))
+        ,benchmarkIndex(initData(&benchmarkIndex,false,"benchmarkIndex", "Time the k-d tree and the spatial hash on the clouds of each registration"))
 {
 	this->f_listening.setValue(true); 
 
@@ -149,6 +154,22 @@ void RegistrationRigid<DataTypes>::init()
 	
     sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
     root->get(rgbddataprocessing);
+    root->get(poseprediction);
+}
+
+template <class DataTypes>
+int RegistrationRigid<DataTypes>::getInitialGuess(Eigen::Matrix4f& guess, bool inverse, int maxiterations)
+{
+    // the predicted motion of the mesh initializes the ICP, which then needs fewer iterations
+    guess.setIdentity();
+    if (!poseprediction) return maxiterations;
+    poseprediction->predict();
+    if (!poseprediction->isValid()) return maxiterations;
+
+    Eigen::Matrix4f motion = poseprediction->getPredictedMotion();
+    if (inverse) guess = motion.inverse();
+    else guess = motion;
+    return std::min(maxiterations, predictedMaxIterations.getValue());
 }
 
 template <class DataTypes>
@@ -195,12 +216,17 @@ void RegistrationRigid<DataTypes>::determineRigidTransformation ()
     registration.setInputSource(target);
     registration.setInputTarget(source);
     //registration->setInputCloud(source_segmented_);
+    if (useSpatialHash.getValue()) registration.setSearchMethodTarget(SpatialHashSearch::Ptr(new SpatialHashSearch));
+    if (benchmarkIndex.getValue()) benchmarkSearch(target, source);
     registration.setMaxCorrespondenceDistance(0.10);
     registration.setTransformationEpsilon (0.000001);
-    registration.setMaximumIterations (1000);
+
+    // the target is registered to the mesh: the guess is the inverse of the mesh motion
+    Eigen::Matrix4f guess;
+    registration.setMaximumIterations (getInitialGuess(guess, true, 1000));
 
   // Register
-  registration.align (*source_registered);
+  registration.align (*source_registered, guess);
 
   Eigen::Matrix4f transformation_matrix1 = registration.getFinalTransformation();
   transformation_matrix = transformation_matrix1.inverse();
@@ -219,7 +245,7 @@ for (int i = 0; i < 4; i++)
 	  for (int j = 0; j< 4;j ++)
 	  cMoin[i][j] = transformation_matrix(i,j);
 	  
-cMo = cMoin*(vpExponentialMap::direct(0*kalman.predictedVelPose).inverse());
+cMo = cMoin;
 	   	   
 Eigen::Vector3f ea = mat.eulerAngles(0,1,2);
 
@@ -353,13 +379,21 @@ void RegistrationRigid<DataTypes>::determineRigidTransformationVisible ()
       //registration->setInputCloud(source_segmented_);
       registration.setInputTarget (target);
   }
+  if (useSpatialHash.getValue()) registration.setSearchMethodTarget(SpatialHashSearch::Ptr(new SpatialHashSearch));
+  if (benchmarkIndex.getValue())
+  {
+      if (MeshToPointCloud.getValue()) benchmarkSearch(target, source);
+      else benchmarkSearch(source, target);
+  }
   registration.setMaxCorrespondenceDistance(0.05);
   //registration.setMaxCorrespondenceDistance(0.04);
   registration.setTransformationEpsilon (0.000001);
-  registration.setMaximumIterations (100);
+
+  Eigen::Matrix4f guess;
+  registration.setMaximumIterations (getInitialGuess(guess, MeshToPointCloud.getValue(), 100));
 
   // Register
-  registration.align (*source_registered);
+  registration.align (*source_registered, guess);
 
   Eigen::Matrix4f transformation_matrix1 = registration.getFinalTransformation();
   if (MeshToPointCloud.getValue())
@@ -501,6 +535,7 @@ double RegistrationRigid<DataTypes>::determineErrorICP ()
     registration1->setInputSource(target);
     //registration->setInputCloud(source_segmented_);
     registration1->setInputTarget (sourceSurfacePointCloud);
+    if (useSpatialHash.getValue()) registration1->setSearchMethodTarget(SpatialHashSearch::Ptr(new SpatialHashSearch));
     registration1->setMaxCorrespondenceDistance(0.10);
     registration1->setRANSACOutlierRejectionThreshold (0.1);
     registration1->setTransformationEpsilon (0.000001);
@@ -514,6 +549,42 @@ double RegistrationRigid<DataTypes>::determineErrorICP ()
 
 }
 
+template <class DataTypes>
+void RegistrationRigid<DataTypes>::benchmarkSearch(pcl::PointCloud<pcl::PointXYZ>::Ptr queries, pcl::PointCloud<pcl::PointXYZ>::Ptr points)
+{
+    unsigned int nq = queries->points.size();
+    std::vector<float> fromTree(nq, -1), fromHash(nq, -1);
+    std::vector<int> nn(1);
+    std::vector<float> nndist(1);
+
+    double time = (double)getTickCount();
+    pcl::KdTreeFLANN<pcl::PointXYZ> tree;
+    tree.setInputCloud(points);
+    double treeBuild = ((double)getTickCount() - time)/getTickFrequency();
+    time = (double)getTickCount();
+    for (unsigned int i = 0; i < nq; i++)
+        if (tree.nearestKSearch(queries->points[i],1,nn,nndist) > 0) fromTree[i] = nndist[0];
+    double treeQuery = ((double)getTickCount() - time)/getTickFrequency();
+
+    time = (double)getTickCount();
+    SpatialHashSearch hash;
+    hash.setInputCloud(points);
+    double hashBuild = ((double)getTickCount() - time)/getTickFrequency();
+    time = (double)getTickCount();
+    for (unsigned int i = 0; i < nq; i++)
+        if (hash.nearestKSearch(queries->points[i],1,nn,nndist) > 0) fromHash[i] = nndist[0];
+    double hashQuery = ((double)getTickCount() - time)/getTickFrequency();
+
+    // FLANN computes the distances in float
+    int mismatches = 0;
+    for (unsigned int i = 0; i < nq; i++)
+        if (fabs(fromTree[i] - fromHash[i]) > 1e-5*fabs(fromTree[i]) + 1e-12) mismatches++;
+
+    cout << "TIME RIGID INDEX points " << points->points.size() << " queries " << nq
+         << " flann " << treeBuild << " " << treeQuery << " hash " << hashBuild << " " << hashQuery
+         << " mismatches " << mismatches << endl;
+}
+
 template <class DataTypes>
 void RegistrationRigid<DataTypes>::handleEvent(sofa::core::objectmodel::Event *event)
 {
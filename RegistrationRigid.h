@@ -158,7 +158,7 @@ public:
     protected :
 	
     typename sofa::core::objectmodel::RGBDDataProcessing<DataTypes>::SPtr rgbddataprocessing;
-    Kalmanfilter kalman;
+    typename sofa::core::objectmodel::PosePrediction<DataTypes>::SPtr poseprediction;
 			
     // source mesh data
     Data< helper::vector< tri > > sourceTriangles;
@@ -192,6 +192,12 @@ public:
     Data<bool> useVisible;
     Data<int> stopAfter;
     Data<bool> MeshToPointCloud;
+    Data<int> predictedMaxIterations;
+    // ICP correspondences searched in a spatial hash instead of a FLANN k-d tree
+    Data<bool> useSpatialHash;
+    Data<bool> benchmarkIndex;
+
+    int getInitialGuess(Eigen::Matrix4f& guess, bool inverse, int maxiterations);
 	
     int iter_im;
 	
@@ -214,6 +220,8 @@ public:
     void determineRigidTransformation ();
     void determineRigidTransformationVisible ();
     double determineErrorICP();
+    // times the FLANN k-d tree and the spatial hash on the nearest points of queries among points
+    void benchmarkSearch(pcl::PointCloud<pcl::PointXYZ>::Ptr queries, pcl::PointCloud<pcl::PointXYZ>::Ptr points);
 };
 
 
@@ -88,6 +88,8 @@
 //#include <XnCppWrapper.h>
 #include <opencv2/opencv.hpp>
 #include <boost/thread.hpp>
+#include "RenderingManager.h"
+#include "MeshVisibility.h"
 
 using namespace std;
 using namespace cv;
@@ -183,6 +185,9 @@ public:
 	
 	cv::Mat rtd;
 
+	sofa::component::visualmodel::RenderingManager::SPtr renderingmanager;
+	typename sofa::core::objectmodel::MeshVisibility<DataTypes>::SPtr meshvisibility;
+
     ReinitializeMesh(core::behavior::MechanicalState<DataTypes> *mm = NULL);
     virtual ~ReinitializeMesh();
 
@@ -78,12 +78,14 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include <iostream>
 #include <string>
 #include <map>
 //#include <XnCppWrapper.h>
 #include "RenderingManager.h"
+#include "RGBDDataProcessing.h"
 
 using namespace std;
 using namespace cv;
@@ -132,9 +134,22 @@ public:
     Data<Vector4> cameraIntrinsicParameters;
     Eigen::Matrix3f rgbIntrinsicMatrix;
     Data<int> niterations;
+    Data<bool> useCompositeAR;
+    Data<bool> displayAR;
 
     typename sofa::component::visualmodel::RenderingManager::SPtr renderingmanager;
     typename sofa::core::objectmodel::DataIO<defaulttype::Vec3dTypes>::SPtr dataio;
+    typename sofa::core::objectmodel::RGBDDataProcessing<DataTypes>::SPtr rgbddataprocessing;
+
+    // rendering resized to the camera frame, reused from frame to frame
+    cv::Mat overlay;
+
+    // the AR output is shown by a viewer thread, which only displays the latest posted frame
+    boost::thread viewerThread;
+    boost::mutex viewerMutex;
+    boost::condition_variable viewerCondition;
+    cv::Mat viewerFrame, viewerShown;
+    bool viewerRunning, viewerFrameReady, viewerStop;
 
     RenderTextureAR();
     virtual ~RenderTextureAR();
@@ -145,6 +160,11 @@ public:
     void renderToTextureD(cv::Mat &_rtt,cv::Mat &color_1);
     void renderToTextureDepth(cv::Mat &_rtt, cv::Mat &_rttdepth);
 
+    // composites the rendering (RGB, bottom-up rows) with the camera frame (BGR) into output (RGB, top-down rows)
+    void compositeAR(const cv::Mat &rendered, const cv::Mat &color, cv::Mat &output);
+    void postToViewer(const cv::Mat &frame);
+    void runViewer();
+
 };
 
 
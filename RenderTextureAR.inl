@@ -60,19 +60,101 @@ namespace objectmodel
 using namespace sofa::defaulttype;
 using namespace helper;
 
+// row kernel of compositeAR: the rendered rows are read bottom-up, so the flip is fused with the blend.
+// Where the rendering is not background (one channel at zero), the rendered color is kept,
+// elsewhere the camera color is copied with red and blue swapped.
+class RenderTextureARCompositeBody : public cv::ParallelLoopBody
+{
+public:
+    RenderTextureARCompositeBody(const cv::Mat &_overlay, const cv::Mat &_color, cv::Mat &_output)
+        : overlay(_overlay), color(_color), output(_output) {}
+
+    void operator()(const cv::Range &range) const
+    {
+        const int hght = output.rows;
+        const int n = 3*output.cols;
+        for (int i = range.start; i < range.end; i++)
+        {
+            const uchar *o = overlay.ptr<uchar>(hght - i - 1);
+            const uchar *c = color.ptr<uchar>(i);
+            uchar *d = output.ptr<uchar>(i);
+            // branch-free select, so the loop vectorizes; all reads of a pixel happen before its writes,
+            // which allows output to be the camera frame itself
+            for (int j = 0; j < n; j += 3)
+            {
+                const uchar m = (uchar)-(uchar)((o[j] > 0) & (o[j+1] > 0) & (o[j+2] > 0));
+                const uchar c0 = c[j], c1 = c[j+1], c2 = c[j+2];
+                d[j] = (uchar)((c2 & m) | (o[j] & ~m));
+                d[j+1] = (uchar)((c1 & m) | (o[j+1] & ~m));
+                d[j+2] = (uchar)((c0 & m) | (o[j+2] & ~m));
+            }
+        }
+    }
+
+private:
+    const cv::Mat &overlay;
+    const cv::Mat &color;
+    cv::Mat &output;
+};
+
+// row kernel of renderToTextureDepth: OpenGL depths (bottom-up rows) to metric depths, 0 on the background
+class RenderTextureARDepthBody : public cv::ParallelLoopBody
+{
+public:
+    RenderTextureARDepthBody(const cv::Mat &_depths, cv::Mat &_output, double znear, double zfar)
+        : depths(_depths), output(_output)
+    {
+        a = (float)(-2*znear*zfar);
+        b = (float)(zfar - znear);
+        c = (float)(zfar + znear);
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        const int hght = output.rows;
+        const int wdth = output.cols;
+        for (int i = range.start; i < range.end; i++)
+        {
+            const float *z = depths.ptr<float>(hght - i - 1);
+            float *d = output.ptr<float>(i);
+            for (int j = 0; j < wdth; j++)
+            {
+                const float clip_z = (z[j] - 0.5f)*2.0f;
+                const float zl = a/(clip_z*b - c);
+                d[j] = z[j] < 1 ? zl : 0.f;
+            }
+        }
+    }
+
+private:
+    const cv::Mat &depths;
+    cv::Mat &output;
+    float a, b, c;
+};
+
 template <class DataTypes>
 RenderTextureAR<DataTypes>::RenderTextureAR()
  : Inherit()
  , niterations(initData(&niterations,1,"niterations","Number of images"))
+ , useCompositeAR(initData(&useCompositeAR,false,"useCompositeAR","Record the rendering composited with the camera frame instead of the raw rendering"))
+ , displayAR(initData(&displayAR,false,"displayAR","Show the AR output in a window, from a viewer thread"))
 {
     this->f_listening.setValue(true);
-
+    viewerRunning = false;
+    viewerFrameReady = false;
+    viewerStop = false;
 }
 
 
 template <class DataTypes>
 RenderTextureAR<DataTypes>::~RenderTextureAR()
 {
+    {
+        boost::mutex::scoped_lock lock(viewerMutex);
+        viewerStop = true;
+    }
+    viewerCondition.notify_one();
+    if (viewerThread.joinable()) viewerThread.join();
 }
 
 template <class DataTypes>
@@ -81,6 +163,7 @@ void RenderTextureAR<DataTypes>::init()
     sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
     root->get(renderingmanager);
     root->get(dataio);
+    root->get(rgbddataprocessing);
 
 }
 
@@ -101,75 +184,97 @@ void RenderTextureAR<DataTypes>::handleEvent(sofa::core::objectmodel::Event *eve
 
         if (t%niterations.getValue()==0 )
         {
+    double timeAR = (double)getTickCount();
     cv::Mat* irtt = new cv::Mat;
-    *irtt = _rtt.clone();
+    // the composite is written straight into the recorded image, no intermediate copy of the camera frame
+    if (useCompositeAR.getValue() && rgbddataprocessing)
+        compositeAR(_rtt, rgbddataprocessing->color, *irtt);
+    else *irtt = _rtt.clone();
     dataio->listrtt.push_back(irtt);
+
+    if (displayAR.getValue() && !irtt->empty()) postToViewer(*irtt);
+    timeAR = ((double)getTickCount() - timeAR)/getTickFrequency();
+    cout << "TIME AR " << timeAR << endl;
         }
     }
 
 }
 
+template<class DataTypes>
+void RenderTextureAR<DataTypes>::compositeAR(const cv::Mat &rendered, const cv::Mat &color, cv::Mat &output)
+{
+    if (rendered.empty())
+    {
+        output.release();
+        return;
+    }
+
+    if (color.empty() || color.type() != CV_8UC3)
+    {
+        cv::flip(rendered, output, 0);
+        return;
+    }
+
+    if (rendered.size() == color.size()) overlay = rendered;
+    else cv::resize(rendered, overlay, color.size());
+
+    // output may be the camera frame itself, create does not reallocate it then;
+    // it must not share the buffer of the RenderingManager though
+    if (output.data == rendered.data) output.release();
+    output.create(color.rows, color.cols, CV_8UC3);
+    cv::parallel_for_(cv::Range(0, color.rows), RenderTextureARCompositeBody(overlay, color, output));
+}
 
 template<class DataTypes>
-void RenderTextureAR<DataTypes>::renderToTextureD(cv::Mat &_rtt, cv::Mat &color_1)
+void RenderTextureAR<DataTypes>::postToViewer(const cv::Mat &frame)
 {
-    renderingmanager->getTexture(_rtt);
-    int hght = color_1.rows;
-    int wdth = color_1.cols;
-    cv::Mat _rttd,_dd,_rttd_;
-
-    _rttd.create(hght,wdth, CV_8UC3);
-
-    cv::resize(_rtt, _rttd_,_rttd.size());
-    cv::flip( _rttd_,_rttd,0);
-
-    cv::Mat _rtd, _rtd0, depthmat, depthm;
-    _rtd.create(hght, wdth, CV_32F);
-    _rtd0.create(hght,wdth, CV_8UC1);
-
-    renderingmanager->getTexture(depthm);
-    cv::resize(depthm, depthmat,_rttd.size());
-
-        for (int j = 0; j < wdth; j++)
-                for (int i = 0; i< hght; i++)
-                {
-                        if ((double)depthmat.at<uchar>(i,j)< 1)
-                        {
-                        _rtd0.at<uchar>(i,j) = 255;
-                        }
-                        else _rtd0.at<uchar>(i,j) = 0;
-                }
-        cv::Mat col1 = color_1.clone();
-
-        for (int j = 0; j < wdth; j++)
-                for (int i = 0; i< hght; i++)
-                {
-                        if (color_1.at<Vec3b>(i,j)[0] == 0 && color_1.at<Vec3b>(i,j)[1] == 0 && color_1.at<Vec3b>(i,j)[2] == 0)
-                        {
-                                /*col1.at<Vec3b>(i,j)[0] = 255;
-                                col1.at<Vec3b>(i,j)[2] = 255;
-                                col1.at<Vec3b>(i,j)[1] = 255;*/
-                                /*_rttd.at<Vec3b>(i,j)[0] = 255;
-                                _rttd.at<Vec3b>(i,j)[2] = 255;
-                                _rttd.at<Vec3b>(i,j)[1] = 255;*/
-                        }
-
-
-                        if (/*_rtd0.at<uchar>(i,j) == 0 ||*/ (_rttd.at<Vec3b>(i,j)[0] > 0 && _rttd.at<Vec3b>(i,j)[1] > 0 && _rttd.at<Vec3b>(i,j)[2] > 0))
-                        {
-                                _rttd.at<Vec3b>(i,j)[0] = col1.at<Vec3b>(i,j)[2];
-                                _rttd.at<Vec3b>(i,j)[2] = col1.at<Vec3b>(i,j)[0];
-                                _rttd.at<Vec3b>(i,j)[1] = col1.at<Vec3b>(i,j)[1];
-                        }
-
-
-
-                }
-
-        cv::namedWindow("dd");
-        cv::imshow("dd",_rttd);
-        _rtt = _rttd.clone();
+    {
+        boost::mutex::scoped_lock lock(viewerMutex);
+        if (!viewerRunning)
+        {
+            viewerRunning = true;
+            viewerThread = boost::thread(boost::bind(&RenderTextureAR<DataTypes>::runViewer, this));
+        }
+        // a frame not displayed yet is overwritten, the simulation never waits for the GUI
+        frame.copyTo(viewerFrame);
+        viewerFrameReady = true;
+    }
+    viewerCondition.notify_one();
+}
+
+template<class DataTypes>
+void RenderTextureAR<DataTypes>::runViewer()
+{
+    cv::namedWindow("dd");
+    while (true)
+    {
+        {
+            boost::mutex::scoped_lock lock(viewerMutex);
+            while (!viewerFrameReady && !viewerStop)
+                viewerCondition.wait(lock);
+            if (viewerStop) break;
+            if (viewerFrameReady)
+            {
+                // the two buffers are swapped, the next posted frame is copied into the one just shown
+                cv::swap(viewerFrame, viewerShown);
+                viewerFrameReady = false;
+            }
+        }
+        cv::imshow("dd", viewerShown);
         cv::waitKey(1);
+    }
+    cv::destroyWindow("dd");
+}
+
+
+template<class DataTypes>
+void RenderTextureAR<DataTypes>::renderToTextureD(cv::Mat &_rtt, cv::Mat &color_1)
+{
+    cv::Mat rendered;
+    renderingmanager->getTexture(rendered);
+    compositeAR(rendered, color_1, _rtt);
+
+    if (displayAR.getValue() && !_rtt.empty()) postToViewer(_rtt);
 }
 
 
@@ -177,36 +282,19 @@ template<class DataTypes>
 void RenderTextureAR<DataTypes>::renderToTextureDepth(cv::Mat &_rtt, cv::Mat &_rttdepth)
 {
     renderingmanager->getTexture(_rtt);
-    int hght = _rtt.rows;
-    int wdth = _rtt.cols;
 
-    cv::Mat _dd;
-	
-    _rttdepth.create(hght,wdth,CV_32F);
-    _dd.create(hght,wdth,CV_32F);
-	
-    renderingmanager->getDepths(_rttdepth);
+    cv::Mat depths;
+    renderingmanager->getDepths(depths);
+    if (depths.empty()) return;
 
     double znear = renderingmanager->getZNear();
     double zfar = renderingmanager->getZFar();
-	
-	for (int j = 0; j < wdth; j++)
-		for (int i = 0; i< hght; i++)
-		{
-                        if (_rttdepth.at<float>(hght-i-1,j)<1)
-			{
-                                double clip_z = (_rttdepth.at<float>(hght-i-1,j) - 0.5) * 2.0;
-                        _dd.at<float>(i,j) = -2*znear*zfar/(clip_z*(zfar-znear)-(zfar+znear));
-			//double clip_z = (depths1[j-rectRtt.x+(i-rectRtt.y)*(rectRtt.width)] - 0.5) * 2.0;
-                        //std::cout << " depth " << znear << " " << zfar << " " << -2*znear*zfar/(clip_z*(zfar-znear)-(zfar+znear)) << std::endl;
-
-			}
-
-
-		}
-        _rttdepth = _dd.clone();
-}
 
+    // the depths of the RenderingManager are kept for the other components, the linear depths go to a separate buffer
+    if (_rttdepth.data == depths.data) _rttdepth.release();
+    _rttdepth.create(depths.rows, depths.cols, CV_32F);
+    cv::parallel_for_(cv::Range(0, depths.rows), RenderTextureARDepthBody(depths, _rttdepth, znear, zfar));
+}
 
 }
 }
@@ -0,0 +1,432 @@
+/*
+ * SpatialHash.cpp
+ *
+ *  Uniform grid index of a point cloud, with exact nearest, k nearest and radius queries.
+ */
+
+#include "SpatialHash.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace
+{
+
+// cells per axis above which the cell size is enlarged, the cell keys stay within 63 bits
+const double maxCells = 1 << 20;
+
+inline int clampCell(double f, int n)
+{
+    // also catches NaN coordinates
+    if (!(f >= 0)) return 0;
+    if (f >= n) return n - 1;
+    return (int)f;
+}
+
+// cells per axis of the blocks visited by the queries far from the points
+const int blockBits = 3;
+// cells always visited by shells (radius 2) before the blocks
+const long long minShellCells = 125;
+
+// squared distance from x to the cube [c, c + 1]*size along each axis
+inline double boxDistance2(const cv::Point3d &x, int cx, int cy, int cz, double size)
+{
+    double dx = std::max(std::max(cx*size - x.x, x.x - (cx + 1)*size), 0.);
+    double dy = std::max(std::max(cy*size - x.y, x.y - (cy + 1)*size), 0.);
+    double dz = std::max(std::max(cz*size - x.z, x.z - (cz + 1)*size), 0.);
+    return dx*dx + dy*dy + dz*dz;
+}
+
+// number of cells of the block of half size r around c along an axis of n cells
+inline long long span(int c, int r, int n)
+{
+    return std::min(c + r, n - 1) - std::max(c - r, 0) + 1;
+}
+
+struct CellKeys
+{
+    const std::vector<cv::Point3d> *points;
+    std::vector<long long> *keys;
+    cv::Point3d origin;
+    double cell;
+    int nx, ny, nz;
+
+    void operator()(int begin, int end) const
+    {
+        for (int i = begin; i < end; i++)
+        {
+            const cv::Point3d &p = (*points)[i];
+            int ix = clampCell((p.x - origin.x)/cell, nx);
+            int iy = clampCell((p.y - origin.y)/cell, ny);
+            int iz = clampCell((p.z - origin.z)/cell, nz);
+            (*keys)[i] = ((long long)iz*ny + iy)*nx + ix;
+        }
+    }
+};
+
+}
+
+SpatialHash::SpatialHash() {
+cellSize = 0;
+pointsPerCell = 4;
+cell = 1;
+nx = ny = nz = 1;
+direct = true;
+nbuckets = 0;
+bucketBits = 0;
+}
+
+SpatialHash::~SpatialHash() {
+}
+
+void SpatialHash::index()
+{
+    int n = (int)points.size();
+    sorted.resize(n);
+    order.resize(n);
+    sortedCells.resize(n);
+    keys.resize(n);
+    if (n == 0)
+    {
+        nbuckets = 0;
+        bucketStart.assign(1, 0);
+        return;
+    }
+
+    cv::Point3d lo = points[0], hi = points[0];
+    for (int i = 1; i < n; i++)
+    {
+        const cv::Point3d &p = points[i];
+        lo.x = std::min(lo.x, p.x); hi.x = std::max(hi.x, p.x);
+        lo.y = std::min(lo.y, p.y); hi.y = std::max(hi.y, p.y);
+        lo.z = std::min(lo.z, p.z); hi.z = std::max(hi.z, p.z);
+    }
+    origin = lo;
+    double e[3] = {hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+    std::sort(e, e + 3);
+
+    cell = cellSize;
+    if (!(cell > 0))
+    {
+        // spacing of the points of a surface: squared, its area over the number of points
+        if (e[1] > 1e-3*e[2]) cell = std::sqrt(pointsPerCell*e[2]*e[1]/n);
+        else cell = pointsPerCell*e[2]/n;
+    }
+    if (!(cell > 0)) cell = 1;
+    if (e[2]/cell > maxCells) cell = e[2]/maxCells;
+
+    nx = (int)((hi.x - lo.x)/cell) + 1;
+    ny = (int)((hi.y - lo.y)/cell) + 1;
+    nz = (int)((hi.z - lo.z)/cell) + 1;
+
+    // a bounded cloud often fits a grid of a few cells per point, a thin oblique one does not
+    long long ncells = (long long)nx*ny*nz;
+    direct = ncells <= 2*(long long)n;
+    if (direct)
+    {
+        nbuckets = (int)ncells;
+        bucketBits = 0;
+    }
+    else
+    {
+        bucketBits = 1;
+        while ((1 << bucketBits) < 2*n) bucketBits++;
+        nbuckets = 1 << bucketBits;
+    }
+
+    CellKeys cellKeys;
+    cellKeys.points = &points;
+    cellKeys.keys = &keys;
+    cellKeys.origin = origin;
+    cellKeys.cell = cell;
+    cellKeys.nx = nx; cellKeys.ny = ny; cellKeys.nz = nz;
+    TaskPool::instance().parallelFor(0, n, cellKeys);
+
+    // counting sort by bucket, the points of a bucket keep their order
+    bucketStart.assign(nbuckets + 1, 0);
+    for (int i = 0; i < n; i++) bucketStart[bucketOf(keys[i]) + 1]++;
+    for (int b = 0; b < nbuckets; b++) bucketStart[b + 1] += bucketStart[b];
+    for (int i = 0; i < n; i++)
+    {
+        int j = bucketStart[bucketOf(keys[i])]++;
+        sorted[j] = points[i];
+        order[j] = i;
+        sortedCells[j] = keys[i];
+    }
+    for (int b = nbuckets; b > 0; b--) bucketStart[b] = bucketStart[b - 1];
+    bucketStart[0] = 0;
+
+    // the cells hashed into the same bucket are made contiguous, a bucket holds a few points
+    if (!direct)
+        for (int b = 0; b < nbuckets; b++)
+            for (int j = bucketStart[b] + 1; j < bucketStart[b + 1]; j++)
+                for (int l = j; l > bucketStart[b] && sortedCells[l - 1] > sortedCells[l]; l--)
+                {
+                    std::swap(sortedCells[l - 1], sortedCells[l]);
+                    std::swap(sorted[l - 1], sorted[l]);
+                    std::swap(order[l - 1], order[l]);
+                }
+
+    runs.clear();
+    for (int j = 0; j < n; j++)
+    {
+        if (j > 0 && sortedCells[j] == sortedCells[j - 1]) continue;
+        if (!runs.empty()) runs.back().end = j;
+        long long c = sortedCells[j];
+        Run run;
+        run.start = j;
+        run.end = n;
+        run.x = (int)(c % nx);
+        run.y = (int)((c/nx) % ny);
+        run.z = (int)(c/((long long)nx*ny));
+        runs.push_back(run);
+    }
+
+    // the cells grouped by block, a sort of the non empty cells only
+    std::vector< std::pair<long long, int> > blockKeys(runs.size());
+    int bnx = (nx >> blockBits) + 1, bny = (ny >> blockBits) + 1;
+    for (unsigned int i = 0; i < runs.size(); i++)
+    {
+        const Run &run = runs[i];
+        blockKeys[i] = std::make_pair(((long long)(run.z >> blockBits)*bny + (run.y >> blockBits))*bnx + (run.x >> blockBits), (int)i);
+    }
+    std::sort(blockKeys.begin(), blockKeys.end());
+
+    blocks.clear();
+    blockRuns.resize(runs.size());
+    for (unsigned int i = 0; i < blockKeys.size(); i++)
+    {
+        blockRuns[i] = blockKeys[i].second;
+        if (i > 0 && blockKeys[i].first == blockKeys[i - 1].first) continue;
+        if (!blocks.empty()) blocks.back().end = i;
+        const Run &run = runs[blockKeys[i].second];
+        Block block;
+        block.start = i;
+        block.end = (int)blockKeys.size();
+        block.x = run.x >> blockBits;
+        block.y = run.y >> blockBits;
+        block.z = run.z >> blockBits;
+        blocks.push_back(block);
+    }
+}
+
+int SpatialHash::bucketOf(long long c) const
+{
+    if (direct) return (int)c;
+    return (int)(((unsigned long long)c*0x9E3779B97F4A7C15ULL) >> (64 - bucketBits));
+}
+
+void SpatialHash::cellOf(const cv::Point3d &q, int &ix, int &iy, int &iz) const
+{
+    ix = clampCell((q.x - origin.x)/cell, nx);
+    iy = clampCell((q.y - origin.y)/cell, ny);
+    iz = clampCell((q.z - origin.z)/cell, nz);
+}
+
+double SpatialHash::outsideBound(const cv::Point3d &q, int ix, int iy, int iz, int r) const
+{
+    const int c[3] = {ix, iy, iz};
+    const int n[3] = {nx, ny, nz};
+    const double x[3] = {q.x - origin.x, q.y - origin.y, q.z - origin.z};
+
+    double bound = std::numeric_limits<double>::max();
+    bool inside = false;
+    for (int a = 0; a < 3; a++)
+    {
+        // faces of the block with cells beyond them
+        if (c[a] - r > 0)
+        {
+            inside = true;
+            bound = std::min(bound, std::max(x[a] - (c[a] - r)*cell, 0.));
+        }
+        if (c[a] + r < n[a] - 1)
+        {
+            inside = true;
+            bound = std::min(bound, std::max((c[a] + r + 1)*cell - x[a], 0.));
+        }
+    }
+    return inside ? bound : -1;
+}
+
+void SpatialHash::Neighbours::insert(int i, double d2)
+{
+    int j = count < k ? count++ : k - 1;
+    while (j > 0 && dist2[j - 1] > d2)
+    {
+        indices[j] = indices[j - 1];
+        dist2[j] = dist2[j - 1];
+        j--;
+    }
+    indices[j] = i;
+    dist2[j] = d2;
+}
+
+void SpatialHash::visitCell(const cv::Point3d &q, int x, int y, int z, Neighbours &neighbours) const
+{
+    long long c = ((long long)z*ny + y)*nx + x;
+    int b = bucketOf(c);
+    for (int p = bucketStart[b]; p < bucketStart[b + 1]; p++)
+    {
+        if (!direct && sortedCells[p] != c) continue;
+        cv::Point3d d = sorted[p] - q;
+        double d2 = d.dot(d);
+        if (neighbours.count < neighbours.k || d2 < neighbours.dist2[neighbours.count - 1])
+            neighbours.insert(order[p], d2);
+    }
+}
+
+int SpatialHash::visitShell(const cv::Point3d &q, int ix, int iy, int iz, int r, Neighbours &neighbours) const
+{
+    int visited = 0;
+    int x0 = std::max(ix - r, 0), x1 = std::min(ix + r, nx - 1);
+    int y0 = std::max(iy - r, 0), y1 = std::min(iy + r, ny - 1);
+    int z0 = std::max(iz - r, 0), z1 = std::min(iz + r, nz - 1);
+    for (int z = z0; z <= z1; z++)
+        for (int y = y0; y <= y1; y++)
+        {
+            if (abs(z - iz) == r || abs(y - iy) == r)
+            {
+                for (int x = x0; x <= x1; x++) visitCell(q, x, y, z, neighbours);
+                visited += x1 - x0 + 1;
+            }
+            else
+            {
+                // inside the shell only the two ends of the row
+                if (ix - r >= 0) { visitCell(q, ix - r, y, z, neighbours); visited++; }
+                if (ix + r < nx) { visitCell(q, ix + r, y, z, neighbours); visited++; }
+            }
+        }
+    return visited;
+}
+
+void SpatialHash::visitBlocks(const cv::Point3d &q, int ix, int iy, int iz, int r, Neighbours &neighbours) const
+{
+    cv::Point3d x = q - origin;
+    double blockCell = (1 << blockBits)*cell;
+
+    std::vector< std::pair<double, int> > candidates;
+    for (unsigned int i = 0; i < blocks.size(); i++)
+    {
+        double d2 = boxDistance2(x, blocks[i].x, blocks[i].y, blocks[i].z, blockCell);
+        if (neighbours.count == neighbours.k && d2 >= neighbours.dist2[neighbours.k - 1]) continue;
+        candidates.push_back(std::make_pair(d2, (int)i));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (unsigned int i = 0; i < candidates.size(); i++)
+    {
+        if (neighbours.count == neighbours.k && candidates[i].first >= neighbours.dist2[neighbours.k - 1]) break;
+        const Block &block = blocks[candidates[i].second];
+        for (int j = block.start; j < block.end; j++)
+        {
+            const Run &run = runs[blockRuns[j]];
+            if (abs(run.x - ix) <= r && abs(run.y - iy) <= r && abs(run.z - iz) <= r) continue;
+            if (neighbours.count == neighbours.k && boxDistance2(x, run.x, run.y, run.z, cell) >= neighbours.dist2[neighbours.k - 1]) continue;
+            for (int p = run.start; p < run.end; p++)
+            {
+                cv::Point3d d = sorted[p] - q;
+                double d2 = d.dot(d);
+                if (neighbours.count < neighbours.k || d2 < neighbours.dist2[neighbours.count - 1])
+                    neighbours.insert(order[p], d2);
+            }
+        }
+    }
+}
+
+void SpatialHash::search(const cv::Point3d &q, Neighbours &neighbours) const
+{
+    int ix, iy, iz;
+    cellOf(q, ix, iy, iz);
+    long long visited = 0;
+    for (int r = 0; ; r++)
+    {
+        visited += visitShell(q, ix, iy, iz, r, neighbours);
+        double bound = outsideBound(q, ix, iy, iz, r);
+        if (bound < 0) break;
+        if (neighbours.count == neighbours.k && neighbours.dist2[neighbours.k - 1] <= bound*bound) break;
+
+        long long next = span(ix, r + 1, nx)*span(iy, r + 1, ny)*span(iz, r + 1, nz) - span(ix, r, nx)*span(iy, r, ny)*span(iz, r, nz);
+        if (visited + next > minShellCells + (long long)blocks.size())
+        {
+            visitBlocks(q, ix, iy, iz, r, neighbours);
+            break;
+        }
+    }
+}
+
+int SpatialHash::nearest(const cv::Point3d &q, double &dist2) const
+{
+    int index = -1;
+    dist2 = 0;
+    if (points.empty()) return -1;
+
+    Neighbours neighbours;
+    neighbours.k = 1;
+    neighbours.count = 0;
+    neighbours.indices = &index;
+    neighbours.dist2 = &dist2;
+    search(q, neighbours);
+    return index;
+}
+
+int SpatialHash::nearestK(const cv::Point3d &q, int k, std::vector<int> &indices, std::vector<double> &dist2) const
+{
+    k = std::min(k, (int)points.size());
+    if (k <= 0)
+    {
+        indices.clear();
+        dist2.clear();
+        return 0;
+    }
+
+    indices.resize(k);
+    dist2.resize(k);
+    Neighbours neighbours;
+    neighbours.k = k;
+    neighbours.count = 0;
+    neighbours.indices = &indices[0];
+    neighbours.dist2 = &dist2[0];
+    search(q, neighbours);
+    return k;
+}
+
+int SpatialHash::radius(const cv::Point3d &q, double r, std::vector<int> &indices, std::vector<double> &dist2) const
+{
+    indices.clear();
+    dist2.clear();
+    if (points.empty() || !(r >= 0)) return 0;
+
+    int x0, y0, z0, x1, y1, z1;
+    cellOf(q - cv::Point3d(r, r, r), x0, y0, z0);
+    cellOf(q + cv::Point3d(r, r, r), x1, y1, z1);
+
+    double r2 = r*r;
+    std::vector< std::pair<double, int> > found;
+    for (int z = z0; z <= z1; z++)
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+            {
+                long long c = ((long long)z*ny + y)*nx + x;
+                int b = bucketOf(c);
+                for (int p = bucketStart[b]; p < bucketStart[b + 1]; p++)
+                {
+                    if (!direct && sortedCells[p] != c) continue;
+                    cv::Point3d d = sorted[p] - q;
+                    double d2 = d.dot(d);
+                    if (d2 <= r2) found.push_back(std::make_pair(d2, order[p]));
+                }
+            }
+
+    std::sort(found.begin(), found.end());
+    indices.resize(found.size());
+    dist2.resize(found.size());
+    for (unsigned int i = 0; i < found.size(); i++)
+    {
+        dist2[i] = found[i].first;
+        indices[i] = found[i].second;
+    }
+    return (int)found.size();
+}
@@ -0,0 +1,126 @@
+/*
+ * SpatialHash.h
+ *
+ *  Nearest neighbour index of a bounded point cloud (the target cloud of a depth image) on a
+ *  uniform grid. The points are sorted into cells by a counting sort, in O(n) and with the cell
+ *  keys computed on the task pool; the cells are addressed directly when the grid is small
+ *  enough, through a hash table of about 2n buckets otherwise. A query visits the cells by
+ *  growing shells around the cell of the query point and stops once the nearest face of the
+ *  visited block is farther than the k-th neighbour found, so the results are exact, in near
+ *  constant time when the query lies within a few cells of the points. Farther away, where
+ *  the shells would be mostly empty, the non empty blocks of 8^3 cells are visited by
+ *  increasing distance instead. By default the cell size follows the extent and the number
+ *  of points, as for a surface seen by the camera: its area over the number of points is the
+ *  squared spacing, i.e. the footprint of a pixel at that depth times the sampling step.
+ */
+
+#ifndef SPATIALHASH_H_
+#define SPATIALHASH_H_
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+class SpatialHash {
+
+public :
+
+SpatialHash();
+virtual ~SpatialHash();
+
+// edge of the cells, 0: derived from the extent and the number of points at each build
+void setCellSize(double _cellSize){cellSize = _cellSize;}
+// expected number of points in a cell for the derived cell size
+void setPointsPerCell(double _pointsPerCell){pointsPerCell = _pointsPerCell;}
+
+// positions: any vector of coordinates indexable by [0], [1], [2]
+template<class VecCoord> void build(const VecCoord &positions)
+{
+    points.resize(positions.size());
+    for (unsigned int i = 0; i < positions.size(); i++)
+        points[i] = cv::Point3d(positions[i][0], positions[i][1], positions[i][2]);
+    index();
+}
+
+// cloud: PCL point cloud or any container of points with x, y, z members
+template<class Cloud> void buildCloud(const Cloud &cloud)
+{
+    points.resize(cloud.points.size());
+    for (unsigned int i = 0; i < cloud.points.size(); i++)
+        points[i] = cv::Point3d(cloud.points[i].x, cloud.points[i].y, cloud.points[i].z);
+    index();
+}
+
+int size() const {return (int)points.size();}
+double getCell() const {return cell;}
+
+// index of the nearest point and its squared distance, -1 when the index is empty
+int nearest(const cv::Point3d &q, double &dist2) const;
+// the k nearest points by increasing distance, returns their number
+int nearestK(const cv::Point3d &q, int k, std::vector<int> &indices, std::vector<double> &dist2) const;
+// the points closer than r by increasing distance, returns their number
+int radius(const cv::Point3d &q, double r, std::vector<int> &indices, std::vector<double> &dist2) const;
+
+private :
+
+double cellSize;
+double pointsPerCell;
+
+std::vector<cv::Point3d> points;
+
+double cell;
+cv::Point3d origin;
+int nx, ny, nz;
+// cells addressed directly, or hashed into 2^bucketBits buckets
+bool direct;
+int nbuckets;
+int bucketBits;
+
+// points sorted by bucket then by cell, with their index in points and their cell
+std::vector<cv::Point3d> sorted;
+std::vector<int> order;
+std::vector<long long> sortedCells;
+std::vector<int> bucketStart;
+// non empty cells, in the order of the sorted points
+struct Run
+{
+    int start, end;
+    int x, y, z;
+};
+std::vector<Run> runs;
+// non empty blocks of blockSize^3 cells, with their cells in blockRuns
+struct Block
+{
+    int start, end;
+    int x, y, z;
+};
+std::vector<Block> blocks;
+std::vector<int> blockRuns;
+// cell of each point during the build
+std::vector<long long> keys;
+
+void index();
+int bucketOf(long long c) const;
+void cellOf(const cv::Point3d &q, int &ix, int &iy, int &iz) const;
+// lower bound of the distance from q to the points outside the block of half size r around (ix, iy, iz),
+// negative when the block covers the grid
+double outsideBound(const cv::Point3d &q, int ix, int iy, int iz, int r) const;
+
+// candidates kept sorted by increasing distance, at most k of them
+struct Neighbours
+{
+    int k, count;
+    int *indices;
+    double *dist2;
+    void insert(int i, double d2);
+};
+void search(const cv::Point3d &q, Neighbours &neighbours) const;
+// returns the number of cells visited
+int visitShell(const cv::Point3d &q, int ix, int iy, int iz, int r, Neighbours &neighbours) const;
+void visitCell(const cv::Point3d &q, int x, int y, int z, Neighbours &neighbours) const;
+// far from the points the shells are mostly empty: the non empty blocks are visited by increasing
+// distance instead, skipping the cells of the block of half size r and those farther than the k-th neighbour
+void visitBlocks(const cv::Point3d &q, int ix, int iy, int iz, int r, Neighbours &neighbours) const;
+};
+
+#endif /* SPATIALHASH_H_ */
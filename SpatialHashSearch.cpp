@@ -0,0 +1,59 @@
+/*
+ * SpatialHashSearch.cpp
+ *
+ *  PCL search on the spatial hash.
+ */
+
+#include "SpatialHashSearch.h"
+
+SpatialHashSearch::SpatialHashSearch() {
+}
+
+SpatialHashSearch::~SpatialHashSearch() {
+}
+
+void SpatialHashSearch::setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices)
+{
+    input_ = cloud;
+    indices_ = indices;
+    subset.clear();
+    if (indices && !indices->empty())
+    {
+        subset = *indices;
+        pcl::PointCloud<pcl::PointXYZ> selected;
+        selected.points.resize(subset.size());
+        for (unsigned int i = 0; i < subset.size(); i++) selected.points[i] = cloud->points[subset[i]];
+        index.buildCloud(selected);
+    }
+    else index.buildCloud(*cloud);
+}
+
+void SpatialHashSearch::output(const std::vector<int> &found, const std::vector<double> &dist2, int n, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const
+{
+    k_indices.resize(n);
+    k_sqr_distances.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        k_indices[i] = subset.empty() ? found[i] : subset[found[i]];
+        k_sqr_distances[i] = (float)dist2[i];
+    }
+}
+
+int SpatialHashSearch::nearestKSearch(const pcl::PointXYZ &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const
+{
+    std::vector<int> found;
+    std::vector<double> dist2;
+    int n = index.nearestK(cv::Point3d(point.x, point.y, point.z), k, found, dist2);
+    output(found, dist2, n, k_indices, k_sqr_distances);
+    return n;
+}
+
+int SpatialHashSearch::radiusSearch(const pcl::PointXYZ &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn) const
+{
+    std::vector<int> found;
+    std::vector<double> dist2;
+    int n = index.radius(cv::Point3d(point.x, point.y, point.z), radius, found, dist2);
+    if (max_nn > 0 && n > (int)max_nn) n = (int)max_nn;
+    output(found, dist2, n, k_indices, k_sqr_distances);
+    return n;
+}
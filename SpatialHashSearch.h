@@ -0,0 +1,48 @@
+/*
+ * SpatialHashSearch.h
+ *
+ *  SpatialHash behind the search interface of PCL, so that the ICP of RegistrationRigid and the
+ *  normal and descriptor estimations of FeatureMatchingForceField query it instead of building
+ *  FLANN k-d trees. The results are exact and sorted by increasing distance.
+ */
+
+#ifndef SPATIALHASHSEARCH_H_
+#define SPATIALHASHSEARCH_H_
+
+#include "SpatialHash.h"
+
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+
+#include <vector>
+
+class SpatialHashSearch : public pcl::search::KdTree<pcl::PointXYZ> {
+
+public :
+
+typedef boost::shared_ptr<SpatialHashSearch> Ptr;
+
+using pcl::search::Search<pcl::PointXYZ>::nearestKSearch;
+using pcl::search::Search<pcl::PointXYZ>::radiusSearch;
+
+SpatialHashSearch();
+virtual ~SpatialHashSearch();
+
+// edge of the cells, 0: derived from the cloud
+void setCellSize(double _cellSize){index.setCellSize(_cellSize);}
+const SpatialHash &getIndex() const {return index;}
+
+void setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr());
+int nearestKSearch(const pcl::PointXYZ &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const;
+int radiusSearch(const pcl::PointXYZ &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const;
+
+private :
+
+SpatialHash index;
+// indices in the input cloud of the indexed points, empty when the whole cloud is indexed
+std::vector<int> subset;
+
+void output(const std::vector<int> &found, const std::vector<double> &dist2, int n, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const;
+};
+
+#endif /* SPATIALHASHSEARCH_H_ */
@@ -0,0 +1,128 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_SYNTHETICDATAGENERATOR_H
+#define SOFA_RGBDTRACKING_SYNTHETICDATAGENERATOR_H
+
+#include <RGBDTracking/config.h>
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/core/objectmodel/Event.h>
+#include <sofa/core/behavior/MechanicalState.h>
+#include <sofa/simulation/AnimateEndEvent.h>
+#include <sofa/defaulttype/VecTypes.h>
+#include <sofa/helper/vector.h>
+#include <sofa/helper/fixed_array.h>
+
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+
+#include "SyntheticRenderer.h"
+#include "SyntheticDatasetWriter.h"
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Headless synthetic data generation: at the end of each frame the deformed mesh is rendered
+ * on the CPU (SyntheticRenderer) and its depth, silhouette, ground truth positions and
+ * vertex visibility are streamed to <outputPath>/<sequenceName>.bin with a manifest
+ * (SyntheticDatasetWriter). It needs no OpenGL context, so scenes run with the batch GUI
+ * on CPU-only machines, several scenarios in parallel processes
+ * (see examples/generate_synthetic_dataset.sh).
+ */
+template<class DataTypes>
+class SyntheticDataGenerator : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(SyntheticDataGenerator,DataTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+    typedef typename DataTypes::Real Real;
+    typedef typename DataTypes::Coord Coord;
+    typedef typename DataTypes::VecCoord VecCoord;
+    typedef sofa::defaulttype::Vector4 Vector4;
+    typedef helper::fixed_array <unsigned int,3> tri;
+
+    SyntheticDataGenerator();
+    virtual ~SyntheticDataGenerator();
+
+    void init();
+    void cleanup();
+    void handleEvent(sofa::core::objectmodel::Event *event);
+
+    Data<int> niterations;
+    Data<int> nimages;
+    Data<Vector4> cameraIntrinsicParameters;
+    Data<int> imagewidth;
+    Data<int> imageheight;
+    Data< helper::vector< tri > > sourceTriangles;
+    Data<Real> visibilityThreshold;
+    Data<std::string> outputPath;
+    Data<std::string> sequenceName;
+    Data<int> maxQueuedFrames;
+
+    // outputs
+    Data<int> framesGenerated;
+
+protected:
+    typename core::behavior::MechanicalState<DataTypes> *mstate;
+    SyntheticRenderer renderer;
+    SyntheticDatasetWriter writer;
+
+    std::vector<cv::Point3f> vertices;
+    std::vector<cv::Vec3i> triangles;
+
+    void generateFrame(int frame);
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(SyntheticDataGenerator_CPP)
+#ifndef SOFA_FLOAT
+extern template class SOFA_RGBDTRACKING_API SyntheticDataGenerator<defaulttype::Vec3dTypes>;
+#endif
+#ifndef SOFA_DOUBLE
+extern template class SOFA_RGBDTRACKING_API SyntheticDataGenerator<defaulttype::Vec3fTypes>;
+#endif
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
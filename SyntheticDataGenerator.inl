@@ -0,0 +1,154 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+#define SOFA_RGBDTRACKING_SYNTHETICDATAGENERATOR_INL
+
+#include "SyntheticDataGenerator.h"
+#include <sofa/core/objectmodel/BaseContext.h>
+#include <sofa/core/topology/BaseMeshTopology.h>
+#include <sofa/helper/accessor.h>
+
+#include <iostream>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+template <class DataTypes>
+SyntheticDataGenerator<DataTypes>::SyntheticDataGenerator()
+    : Inherit()
+    , niterations(initData(&niterations,1,"niterations","Number of simulation steps between two generated frames"))
+    , nimages(initData(&nimages,0,"nimages","Number of frames to generate, 0 for no limit"))
+    , cameraIntrinsicParameters(initData(&cameraIntrinsicParameters,Vector4(1,1,1,1),"cameraIntrinsicParameters","camera parameters"))
+    , imagewidth(initData(&imagewidth,640,"imagewidth","Width of the generated images"))
+    , imageheight(initData(&imageheight,480,"imageheight","Height of the generated images"))
+    , sourceTriangles(initData(&sourceTriangles,"sourceTriangles","Triangles of the rendered surface, the topology of the context if empty"))
+    , visibilityThreshold(initData(&visibilityThreshold,(Real)0.003,"visibilityThreshold","Maximum distance between a vertex and the rendered depth for the vertex to be visible"))
+    , outputPath(initData(&outputPath,std::string("out"),"outputPath","Directory of the generated sequence"))
+    , sequenceName(initData(&sequenceName,std::string("sequence"),"sequenceName","Name of the generated .bin and .manifest files"))
+    , maxQueuedFrames(initData(&maxQueuedFrames,8,"maxQueuedFrames","Frames waiting to be written before the simulation waits for the writer thread"))
+    , framesGenerated(initData(&framesGenerated,0,"framesGenerated","Number of frames generated so far"))
+{
+    this->f_listening.setValue(true);
+    framesGenerated.setReadOnly(true);
+    mstate = NULL;
+}
+
+template <class DataTypes>
+SyntheticDataGenerator<DataTypes>::~SyntheticDataGenerator()
+{
+}
+
+template <class DataTypes>
+void SyntheticDataGenerator<DataTypes>::init()
+{
+    this->Inherit::init();
+    core::objectmodel::BaseContext* context = this->getContext();
+    mstate = dynamic_cast<sofa::core::behavior::MechanicalState<DataTypes> *>(context->getMechanicalState());
+
+    const helper::vector< tri >& tris = sourceTriangles.getValue();
+    triangles.clear();
+    if (tris.size() > 0)
+    {
+        for (unsigned int i = 0; i < tris.size(); i++)
+            triangles.push_back(cv::Vec3i(tris[i][0], tris[i][1], tris[i][2]));
+    }
+    else if (context->getMeshTopology())
+    {
+        const core::topology::BaseMeshTopology::SeqTriangles& ctris = context->getMeshTopology()->getTriangles();
+        for (unsigned int i = 0; i < ctris.size(); i++)
+            triangles.push_back(cv::Vec3i(ctris[i][0], ctris[i][1], ctris[i][2]));
+    }
+    if (triangles.size() == 0) serr << "no triangles to render" << sendl;
+
+    Vector4 camParam = cameraIntrinsicParameters.getValue();
+    renderer.setCamera(camParam[0], camParam[1], camParam[2], camParam[3], imagewidth.getValue(), imageheight.getValue());
+
+    writer.setMaxQueuedFrames(maxQueuedFrames.getValue());
+    if (!writer.open(outputPath.getValue(), sequenceName.getValue(), cv::Vec4f(camParam[0], camParam[1], camParam[2], camParam[3])))
+        serr << "cannot open " << outputPath.getValue() << "/" << sequenceName.getValue() << ".bin" << sendl;
+}
+
+template <class DataTypes>
+void SyntheticDataGenerator<DataTypes>::cleanup()
+{
+    // flushes the frames still queued
+    writer.close();
+    this->Inherit::cleanup();
+}
+
+template <class DataTypes>
+void SyntheticDataGenerator<DataTypes>::handleEvent(sofa::core::objectmodel::Event *event)
+{
+    if (dynamic_cast<simulation::AnimateEndEvent*>(event))
+    {
+        int t = (int)this->getContext()->getTime();
+        if (t%niterations.getValue() != 0) return;
+
+        if (nimages.getValue() > 0 && framesGenerated.getValue() >= nimages.getValue())
+        {
+            writer.close();
+            return;
+        }
+
+        generateFrame(t/niterations.getValue());
+    }
+}
+
+template <class DataTypes>
+void SyntheticDataGenerator<DataTypes>::generateFrame(int frame)
+{
+    if (!mstate || !writer.isOpen()) return;
+
+    double timeGeneration = (double)cv::getTickCount();
+
+    const VecCoord& x = mstate->read(core::ConstVecCoordId::position())->getValue();
+    vertices.resize(x.size());
+    for (unsigned int i = 0; i < x.size(); i++)
+        vertices[i] = cv::Point3f((float)x[i][0], (float)x[i][1], (float)x[i][2]);
+
+    renderer.render(vertices, triangles);
+
+    // the buffers are handed over to the writer thread, fresh ones are given to the next frame
+    std::vector<unsigned char> visible;
+    renderer.visibleVertices(vertices, (float)visibilityThreshold.getValue(), visible);
+    cv::Mat depth = renderer.getDepth().clone();
+    cv::Mat mask = renderer.getMask().clone();
+    std::vector<cv::Point3f> points(vertices);
+    writer.write(frame, depth, mask, points, visible);
+
+    framesGenerated.setValue(framesGenerated.getValue() + 1);
+
+    timeGeneration = ((double)cv::getTickCount() - timeGeneration)/cv::getTickFrequency();
+    std::cout << "TIME SYNTHETIC FRAME " << timeGeneration << std::endl;
+}
+
+}
+}
+} // namespace sofa
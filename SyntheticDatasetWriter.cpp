@@ -0,0 +1,139 @@
+/*
+ * SyntheticDatasetWriter.cpp
+ *
+ *  Streams synthetic frames (depth, silhouette, ground truth points and their visibility)
+ *  to one binary file per sequence, from a writer thread, with a text manifest indexing the frames.
+ */
+
+#include "SyntheticDatasetWriter.h"
+
+#include <boost/bind.hpp>
+#include <stdint.h>
+
+SyntheticDatasetWriter::SyntheticDatasetWriter() {
+maxQueued = 8;
+framesWritten = 0;
+running = false;
+stopping = false;
+}
+
+SyntheticDatasetWriter::~SyntheticDatasetWriter() {
+close();
+}
+
+bool SyntheticDatasetWriter::open(const std::string &path, const std::string &sequence, const cv::Vec4f &camera)
+{
+    close();
+
+    std::string base = path.empty() ? sequence : path + "/" + sequence;
+    data.open((base + ".bin").c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    manifest.open((base + ".manifest").c_str(), std::ios::out | std::ios::trunc);
+    if (!data.is_open() || !manifest.is_open())
+    {
+        data.close();
+        manifest.close();
+        return false;
+    }
+
+    data.write("RGBDSYN1", 8);
+    manifest << "sequence " << sequence << " camera " << camera[0] << " " << camera[1] << " " << camera[2] << " " << camera[3] << std::endl;
+
+    framesWritten = 0;
+    stopping = false;
+    running = true;
+    writerThread = boost::thread(boost::bind(&SyntheticDatasetWriter::run, this));
+    return true;
+}
+
+void SyntheticDatasetWriter::write(int frame, cv::Mat &depth, cv::Mat &mask, std::vector<cv::Point3f> &points, std::vector<unsigned char> &visible)
+{
+    if (!running) return;
+
+    boost::mutex::scoped_lock lock(queueMutex);
+    // bounded queue: the simulation slows down to the disk speed rather than holding the whole sequence in memory
+    while ((int)queue.size() >= maxQueued)
+        queueCondition.wait(lock);
+
+    queue.push_back(Frame());
+    Frame &f = queue.back();
+    f.index = frame;
+    f.depth = depth;
+    f.mask = mask;
+    f.points.swap(points);
+    f.visible.swap(visible);
+    depth.release();
+    mask.release();
+
+    queueCondition.notify_all();
+}
+
+void SyntheticDatasetWriter::close()
+{
+    if (!running) return;
+
+    {
+        boost::mutex::scoped_lock lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+    if (writerThread.joinable()) writerThread.join();
+
+    data.close();
+    manifest.close();
+    running = false;
+}
+
+void SyntheticDatasetWriter::run()
+{
+    while (true)
+    {
+        Frame f;
+        {
+            boost::mutex::scoped_lock lock(queueMutex);
+            while (queue.empty() && !stopping)
+                queueCondition.wait(lock);
+            if (queue.empty()) break;
+            f = queue.front();
+            queue.pop_front();
+        }
+        queueCondition.notify_all();
+        writeFrame(f);
+    }
+}
+
+static void writeInt(std::ofstream &out, int32_t v)
+{
+    out.write((const char*)&v, sizeof(v));
+}
+
+static void writeRows(std::ofstream &out, const cv::Mat &m)
+{
+    size_t rowSize = m.cols * m.elemSize();
+    if (m.isContinuous()) out.write((const char*)m.data, rowSize * m.rows);
+    else for (int i = 0; i < m.rows; i++) out.write((const char*)m.ptr(i), rowSize);
+}
+
+void SyntheticDatasetWriter::writeFrame(const Frame &f)
+{
+    std::streamoff offset = data.tellp();
+
+    writeInt(data, f.index);
+    writeInt(data, f.depth.cols);
+    writeInt(data, f.depth.rows);
+    writeRows(data, f.depth);
+    writeRows(data, f.mask);
+
+    writeInt(data, (int32_t)f.points.size());
+    if (f.points.size() > 0)
+        data.write((const char*)&f.points[0], f.points.size() * sizeof(cv::Point3f));
+    if (f.visible.size() > 0)
+        data.write((const char*)&f.visible[0], f.visible.size());
+
+    int nvisible = 0;
+    for (unsigned int i = 0; i < f.visible.size(); i++)
+        nvisible += f.visible[i] ? 1 : 0;
+
+    std::streamoff size = (std::streamoff)data.tellp() - offset;
+    manifest << "frame " << f.index << " offset " << offset << " size " << size << " points " << f.points.size() << " visible " << nvisible << std::endl;
+    framesWritten++;
+}
@@ -0,0 +1,69 @@
+/*
+ * SyntheticDatasetWriter.h
+ *
+ *  Streams synthetic frames (depth, silhouette, ground truth points and their visibility)
+ *  to one binary file per sequence, from a writer thread, with a text manifest indexing the frames.
+ *
+ *  <sequence>.bin : "RGBDSYN1", then for each frame
+ *      int32 frame, int32 width, int32 height, float32 depth[height*width], uint8 mask[height*width],
+ *      int32 npoints, float32 xyz[3*npoints], uint8 visible[npoints]
+ *  <sequence>.manifest : one header line, then one line per frame
+ *      frame <index> offset <bytes> size <bytes> points <npoints> visible <nvisible>
+ */
+
+#ifndef SYNTHETICDATASETWRITER_H_
+#define SYNTHETICDATASETWRITER_H_
+
+#include <opencv2/core.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class SyntheticDatasetWriter {
+
+public :
+
+SyntheticDatasetWriter();
+virtual ~SyntheticDatasetWriter();
+
+// frames queued and not yet written, the producer waits above this
+void setMaxQueuedFrames(int _maxQueued){maxQueued = _maxQueued;}
+
+bool open(const std::string &path, const std::string &sequence, const cv::Vec4f &camera);
+// the frame is moved to the writer thread: depth and mask must not be reused by the caller
+void write(int frame, cv::Mat &depth, cv::Mat &mask, std::vector<cv::Point3f> &points, std::vector<unsigned char> &visible);
+// writes the queued frames and closes the files
+void close();
+
+bool isOpen() const {return running;}
+int getFramesWritten() const {return framesWritten;}
+
+private :
+
+struct Frame
+{
+    int index;
+    cv::Mat depth, mask;
+    std::vector<cv::Point3f> points;
+    std::vector<unsigned char> visible;
+};
+
+std::ofstream data, manifest;
+int maxQueued;
+int framesWritten;
+
+boost::thread writerThread;
+boost::mutex queueMutex;
+boost::condition_variable queueCondition;
+std::deque<Frame> queue;
+bool running, stopping;
+
+void run();
+void writeFrame(const Frame &f);
+};
+
+#endif /* SYNTHETICDATASETWRITER_H_ */
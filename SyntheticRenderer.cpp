@@ -0,0 +1,127 @@
+/*
+ * SyntheticRenderer.cpp
+ *
+ *  CPU z-buffer rendering of a triangle mesh through a pinhole camera,
+ *  giving the depth, silhouette and visible vertices of synthetic frames without OpenGL.
+ */
+
+#include "SyntheticRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+
+SyntheticRenderer::SyntheticRenderer() {
+fx = fy = 1;
+cx = cy = 0;
+znear = 0.001f;
+width = height = 0;
+}
+
+SyntheticRenderer::~SyntheticRenderer() {
+}
+
+void SyntheticRenderer::setCamera(float _fx, float _fy, float _cx, float _cy, int _width, int _height)
+{
+    fx = _fx;
+    fy = _fy;
+    cx = _cx;
+    cy = _cy;
+    width = _width;
+    height = _height;
+}
+
+void SyntheticRenderer::render(const std::vector<cv::Point3f> &vertices, const std::vector<cv::Vec3i> &triangles)
+{
+    invDepth.create(height, width, CV_32F);
+    invDepth.setTo(0);
+
+    // image coordinates and 1/z of the vertices, z = 0 for the ones behind the near plane
+    projected.resize(vertices.size());
+    for (unsigned int i = 0; i < vertices.size(); i++)
+    {
+        const cv::Point3f &v = vertices[i];
+        if (v.z > znear) projected[i] = cv::Point3f(fx*v.x/v.z + cx, fy*v.y/v.z + cy, 1.f/v.z);
+        else projected[i] = cv::Point3f(0, 0, 0);
+    }
+
+    const int nv = (int)vertices.size();
+    for (unsigned int t = 0; t < triangles.size(); t++)
+    {
+        const cv::Vec3i &tr = triangles[t];
+        if (tr[0] < 0 || tr[1] < 0 || tr[2] < 0 || tr[0] >= nv || tr[1] >= nv || tr[2] >= nv) continue;
+        const cv::Point3f &p0 = projected[tr[0]], &p1 = projected[tr[1]], &p2 = projected[tr[2]];
+        if (p0.z <= 0 || p1.z <= 0 || p2.z <= 0) continue;
+        rasterizeTriangle(p0, p1, p2);
+    }
+
+    depth.create(height, width, CV_32F);
+    mask.create(height, width, CV_8UC1);
+    for (int i = 0; i < height; i++)
+    {
+        const float *iz = invDepth.ptr<float>(i);
+        float *d = depth.ptr<float>(i);
+        unsigned char *m = mask.ptr<unsigned char>(i);
+        for (int j = 0; j < width; j++)
+        {
+            d[j] = iz[j] > 0 ? 1.f/iz[j] : 0.f;
+            m[j] = iz[j] > 0 ? 255 : 0;
+        }
+    }
+}
+
+void SyntheticRenderer::rasterizeTriangle(const cv::Point3f &p0, const cv::Point3f &p1, const cv::Point3f &p2)
+{
+    const float area = (p1.x - p0.x)*(p2.y - p0.y) - (p1.y - p0.y)*(p2.x - p0.x);
+    if (std::fabs(area) < 1e-8f) return;
+
+    // both faces are rendered, the sign of the area only orients the edge functions
+    const float s = area > 0 ? 1.f : -1.f;
+    const float inv = 1.f/std::fabs(area);
+
+    int xmin = std::max(0, (int)std::floor(std::min(p0.x, std::min(p1.x, p2.x))));
+    int xmax = std::min(width - 1, (int)std::ceil(std::max(p0.x, std::max(p1.x, p2.x))));
+    int ymin = std::max(0, (int)std::floor(std::min(p0.y, std::min(p1.y, p2.y))));
+    int ymax = std::min(height - 1, (int)std::ceil(std::max(p0.y, std::max(p1.y, p2.y))));
+    if (xmin > xmax || ymin > ymax) return;
+
+    // edge functions are affine in x, they are stepped along each row
+    const float a0 = s*(p1.y - p2.y);
+    const float a1 = s*(p2.y - p0.y);
+    const float a2 = s*(p0.y - p1.y);
+
+    for (int y = ymin; y <= ymax; y++)
+    {
+        float *iz = invDepth.ptr<float>(y);
+        float w0 = s*((p2.x - p1.x)*(y - p1.y) - (p2.y - p1.y)*(xmin - p1.x));
+        float w1 = s*((p0.x - p2.x)*(y - p2.y) - (p0.y - p2.y)*(xmin - p2.x));
+        float w2 = s*((p1.x - p0.x)*(y - p0.y) - (p1.y - p0.y)*(xmin - p0.x));
+        for (int x = xmin; x <= xmax; x++)
+        {
+            if (w0 >= 0 && w1 >= 0 && w2 >= 0)
+            {
+                float z = (w0*p0.z + w1*p1.z + w2*p2.z)*inv;
+                if (z > iz[x]) iz[x] = z;
+            }
+            w0 += a0;
+            w1 += a1;
+            w2 += a2;
+        }
+    }
+}
+
+void SyntheticRenderer::visibleVertices(const std::vector<cv::Point3f> &vertices, float threshold, std::vector<unsigned char> &visible) const
+{
+    visible.assign(vertices.size(), 0);
+    if (depth.empty()) return;
+
+    for (unsigned int i = 0; i < vertices.size(); i++)
+    {
+        const cv::Point3f &v = vertices[i];
+        if (v.z <= znear) continue;
+        int x = (int)std::floor(fx*v.x/v.z + cx + 0.5f);
+        int y = (int)std::floor(fy*v.y/v.z + cy + 0.5f);
+        if (x < 0 || y < 0 || x >= width || y >= height) continue;
+        float d = depth.at<float>(y, x);
+        if (d > 0 && std::fabs(v.z - d) < threshold) visible[i] = 1;
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * SyntheticRenderer.h
+ *
+ *  CPU z-buffer rendering of a triangle mesh through a pinhole camera,
+ *  giving the depth, silhouette and visible vertices of synthetic frames without OpenGL.
+ */
+
+#ifndef SYNTHETICRENDERER_H_
+#define SYNTHETICRENDERER_H_
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+
+class SyntheticRenderer {
+
+public :
+
+SyntheticRenderer();
+virtual ~SyntheticRenderer();
+
+void setCamera(float _fx, float _fy, float _cx, float _cy, int _width, int _height);
+void setZNear(float _znear){znear = _znear;}
+
+// vertices are in the camera frame, in meters, image rows going down
+void render(const std::vector<cv::Point3f> &vertices, const std::vector<cv::Vec3i> &triangles);
+// vertices of the last rendered mesh whose depth is within threshold of the rendered depth
+void visibleVertices(const std::vector<cv::Point3f> &vertices, float threshold, std::vector<unsigned char> &visible) const;
+
+// metric depth, 0 on the background
+const cv::Mat& getDepth() const {return depth;}
+// 255 on the mesh, 0 on the background
+const cv::Mat& getMask() const {return mask;}
+
+private :
+
+float fx, fy, cx, cy;
+float znear;
+int width, height;
+
+cv::Mat depth, mask;
+// 1/z of the closest surface, interpolated linearly in image space
+cv::Mat invDepth;
+std::vector<cv::Point3f> projected;
+
+void rasterizeTriangle(const cv::Point3f &p0, const cv::Point3f &p1, const cv::Point3f &p2);
+};
+
+#endif /* SYNTHETICRENDERER_H_ */
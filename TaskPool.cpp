@@ -0,0 +1,290 @@
+/*
+ * TaskPool.cpp
+ *
+ *  Work-stealing pool of the parallel loops.
+ */
+
+#include "TaskPool.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/once.hpp>
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+
+TaskPool *pool = NULL;
+boost::once_flag poolOnce = BOOST_ONCE_INIT;
+
+void createPool()
+{
+    pool = new TaskPool;
+    pool->configure(0, false);
+}
+
+// the index pointed to belongs to the worker, it is not deleted with the thread
+void keepIndex(int *)
+{
+}
+
+double now()
+{
+    return (double)cv::getTickCount()/cv::getTickFrequency();
+}
+
+}
+
+TaskPool &TaskPool::instance()
+{
+    // the pool lives until the end of the process, its threads may still run static destructors
+    boost::call_once(&createPool, poolOnce);
+    return *pool;
+}
+
+TaskPool::TaskPool() : workerIndex(&keepIndex) {
+nthreads = 0;
+pinned = false;
+pending = 0;
+stopping = false;
+resetTime = now();
+loops = 0;
+}
+
+TaskPool::~TaskPool() {
+stop();
+}
+
+void TaskPool::configure(int _nthreads, bool pin)
+{
+    int n = _nthreads > 0 ? _nthreads : (int)boost::thread::hardware_concurrency();
+    if (n < 1) n = 1;
+    if (n == nthreads && pin == pinned) return;
+
+    stop();
+    start(n, pin);
+}
+
+void TaskPool::start(int n, bool pin)
+{
+    nthreads = n;
+    pinned = pin;
+    for (int k = 0; k < n; k++)
+    {
+        workers.push_back(new Worker);
+        workers[k]->index = k;
+    }
+    resetStatistics();
+
+    threads.reset(new boost::thread_group);
+    int ncores = (int)boost::thread::hardware_concurrency();
+    for (int k = 1; k < n; k++)
+    {
+        boost::thread *thread = threads->create_thread(boost::bind(&TaskPool::run, this, k));
+#ifdef __linux__
+        // worker k takes core k, the threads calling parallelFor are not pinned
+        if (pin && ncores > 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(k % ncores, &set);
+            pthread_setaffinity_np(thread->native_handle(), sizeof(cpu_set_t), &set);
+        }
+#else
+        (void)thread;
+        (void)ncores;
+#endif
+    }
+}
+
+void TaskPool::stop()
+{
+    if (threads)
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        threads->join_all();
+        threads.reset();
+        stopping = false;
+    }
+
+    for (unsigned int k = 0; k < workers.size(); k++) delete workers[k];
+    workers.clear();
+    nthreads = 0;
+}
+
+void TaskPool::parallelFor(int begin, int end, const RangeTask &task, int grain)
+{
+    int n = end - begin;
+    if (n <= 0) return;
+    // a loop inside a chunk runs on the thread of the chunk
+    if (nthreads <= 1 || n < 2 || workerIndex.get())
+    {
+        task(begin, end);
+        return;
+    }
+
+    if (grain <= 0) grain = std::max(1, n/(4*nthreads));
+    int nchunks = (n + grain - 1)/grain;
+
+    Loop loop;
+    loop.task = &task;
+    loop.remaining = nchunks;
+
+    // consecutive chunks on the same worker, which takes them back in reverse order
+    for (int k = 0; k < nthreads; k++)
+    {
+        int first = k*nchunks/nthreads, last = (k+1)*nchunks/nthreads;
+        if (first == last) continue;
+        boost::mutex::scoped_lock lock(workers[k]->mutex);
+        for (int c = first; c < last; c++)
+        {
+            Chunk chunk;
+            chunk.loop = &loop;
+            chunk.begin = begin + c*grain;
+            chunk.end = std::min(end, chunk.begin + grain);
+            workers[k]->chunks.push_back(chunk);
+        }
+    }
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        pending += nchunks;
+    }
+    workAvailable.notify_all();
+
+    workerIndex.reset(&workers[0]->index);
+    Chunk chunk;
+    bool stolen;
+    while (true)
+    {
+        if (take(0, chunk, stolen))
+        {
+            execute(0, chunk, stolen);
+            continue;
+        }
+        boost::mutex::scoped_lock lock(mutex);
+        while (loop.remaining > 0 && pending == 0)
+            loopDone.wait(lock);
+        if (loop.remaining == 0) break;
+    }
+    workerIndex.reset();
+
+    boost::mutex::scoped_lock lock(statsMutex);
+    loops++;
+}
+
+bool TaskPool::take(int index, Chunk &chunk, bool &stolen)
+{
+    stolen = false;
+    bool found = false;
+    {
+        Worker &w = *workers[index];
+        boost::mutex::scoped_lock lock(w.mutex);
+        if (!w.chunks.empty())
+        {
+            chunk = w.chunks.back();
+            w.chunks.pop_back();
+            found = true;
+        }
+    }
+    for (int k = 1; k < nthreads && !found; k++)
+    {
+        Worker &v = *workers[(index + k) % nthreads];
+        boost::mutex::scoped_lock lock(v.mutex);
+        if (!v.chunks.empty())
+        {
+            chunk = v.chunks.front();
+            v.chunks.pop_front();
+            found = stolen = true;
+        }
+    }
+    if (found)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        pending--;
+    }
+    return found;
+}
+
+void TaskPool::execute(int index, const Chunk &chunk, bool stolen)
+{
+    double t = now();
+    (*chunk.loop->task)(chunk.begin, chunk.end);
+    t = now() - t;
+
+    {
+        boost::mutex::scoped_lock lock(statsMutex);
+        Worker &w = index == 0 ? callers : *workers[index];
+        w.busy += t;
+        w.tasks++;
+        if (stolen) w.steals++;
+    }
+
+    // the loop may be gone as soon as its last chunk is counted
+    boost::mutex::scoped_lock lock(mutex);
+    if (--chunk.loop->remaining == 0) loopDone.notify_all();
+}
+
+void TaskPool::run(int index)
+{
+    workerIndex.reset(&workers[index]->index);
+    Chunk chunk;
+    bool stolen;
+    while (true)
+    {
+        if (take(index, chunk, stolen))
+        {
+            execute(index, chunk, stolen);
+            continue;
+        }
+        boost::mutex::scoped_lock lock(mutex);
+        while (pending == 0 && !stopping)
+            workAvailable.wait(lock);
+        if (pending == 0 && stopping) break;
+    }
+}
+
+TaskPool::Statistics TaskPool::statistics()
+{
+    Statistics s;
+    boost::mutex::scoped_lock lock(statsMutex);
+    s.wall = now() - resetTime;
+    s.busy = 0;
+    s.callerBusy = callers.busy;
+    s.threads = nthreads - 1;
+    s.loops = loops;
+    s.tasks = callers.tasks;
+    s.steals = callers.steals;
+    for (unsigned int k = 1; k < workers.size(); k++)
+    {
+        s.busy += workers[k]->busy;
+        s.tasks += workers[k]->tasks;
+        s.steals += workers[k]->steals;
+    }
+    return s;
+}
+
+void TaskPool::resetStatistics()
+{
+    boost::mutex::scoped_lock lock(statsMutex);
+    resetTime = now();
+    loops = 0;
+    callers.busy = 0;
+    callers.tasks = 0;
+    callers.steals = 0;
+    for (unsigned int k = 0; k < workers.size(); k++)
+    {
+        workers[k]->busy = 0;
+        workers[k]->tasks = 0;
+        workers[k]->steals = 0;
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * TaskPool.h
+ *
+ *  Threads shared by all the parallel loops of the plugin, instead of one OpenMP team per loop.
+ *  A loop is split into chunks of iterations which are pushed onto the deques of the workers;
+ *  a worker takes its own chunks from the back and, once its deque is empty, steals the oldest
+ *  chunks of the others from the front, so that unequal chunks (visibility, contour pixels) are
+ *  balanced without a central queue. The thread calling parallelFor works on the chunks until
+ *  its loop is done, several threads (animation loops, pipeline stages) may run loops at once,
+ *  and a loop started from inside a chunk runs serially. The busy time of the worker threads gives
+ *  the utilization of the pool; the time the calling threads spend in chunks is counted apart.
+ */
+
+#ifndef TASKPOOL_H_
+#define TASKPOOL_H_
+
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <deque>
+#include <vector>
+
+class TaskPool {
+
+public :
+
+// iterations [begin, end) of a loop
+typedef boost::function<void (int, int)> RangeTask;
+
+struct Statistics
+{
+    double wall;        // seconds since the reset
+    double busy;        // seconds spent in chunks, summed over the worker threads
+    double callerBusy;  // seconds spent in chunks by the threads calling parallelFor, several at once possibly
+    int threads;        // worker threads, the calling ones excluded
+    int loops, tasks, steals;
+    double utilization() const {return (wall > 0 && threads > 0) ? busy/(wall*threads) : 0;}
+};
+
+// pool of the plugin, started with one thread per core on its first loop
+static TaskPool &instance();
+
+TaskPool();
+virtual ~TaskPool();
+
+// threads: total number of threads working on the loops, the calling one included (0: one per core);
+// pin: each worker thread is bound to one core (Linux), the calling threads are left to the scheduler
+void configure(int threads, bool pin);
+int getThreads() const {return nthreads;}
+
+// returns once all the chunks of grain iterations are done (grain 0: four chunks per thread)
+void parallelFor(int begin, int end, const RangeTask &task, int grain = 0);
+
+Statistics statistics();
+void resetStatistics();
+
+private :
+
+struct Loop
+{
+    const RangeTask *task;
+    int remaining;
+};
+
+struct Chunk
+{
+    Loop *loop;
+    int begin, end;
+};
+
+struct Worker
+{
+    int index;
+    boost::mutex mutex;
+    std::deque<Chunk> chunks;
+    double busy;
+    int tasks, steals;
+};
+
+int nthreads;
+bool pinned;
+// workers[0] is shared by the threads calling parallelFor, its statistics are kept in callers
+std::vector<Worker *> workers;
+boost::scoped_ptr<boost::thread_group> threads;
+boost::thread_specific_ptr<int> workerIndex;
+
+boost::mutex mutex;
+boost::condition_variable workAvailable, loopDone;
+int pending;
+bool stopping;
+
+boost::mutex statsMutex;
+double resetTime;
+int loops;
+Worker callers;
+
+void start(int threads, bool pin);
+void stop();
+void run(int index);
+// own chunks from the back, then the oldest chunks of the other workers
+bool take(int index, Chunk &chunk, bool &stolen);
+void execute(int index, const Chunk &chunk, bool stolen);
+};
+
+#endif /* TASKPOOL_H_ */
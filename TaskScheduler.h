@@ -0,0 +1,98 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_TASKSCHEDULER_H
+#define SOFA_RGBDTRACKING_TASKSCHEDULER_H
+
+#include <RGBDTracking/config.h>
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/core/objectmodel/Event.h>
+#include <sofa/simulation/AnimateEndEvent.h>
+#include <sofa/defaulttype/VecTypes.h>
+
+#include "TaskPool.h"
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Configuration of the thread pool shared by the parallel loops of the plugin (correspondences,
+ * back-projection, normals, segmentation statistics, sampling, depth coding), in place of one
+ * OpenMP team per loop which oversubscribes the cores next to the threads of the animation loops.
+ * One component per process is enough, the last one initialized sets the pool. At the end of each
+ * frame the utilization of the pool (busy time of its worker threads over their wall time), the number of
+ * chunks run and stolen are reported.
+ */
+template<class DataTypes>
+class TaskScheduler : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(TaskScheduler,DataTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+
+    TaskScheduler();
+    virtual ~TaskScheduler();
+
+    void init();
+    void handleEvent(sofa::core::objectmodel::Event *event);
+
+    Data<int> niterations;
+    Data<int> nbThreads;
+    Data<bool> pinThreads;
+
+    // outputs, over the last frame
+    Data<double> utilization;
+    Data<int> tasks;
+    Data<int> steals;
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(TaskScheduler_CPP)
+#ifndef SOFA_FLOAT
+extern template class SOFA_RGBDTRACKING_API TaskScheduler<defaulttype::Vec3dTypes>;
+#endif
+#ifndef SOFA_DOUBLE
+extern template class SOFA_RGBDTRACKING_API TaskScheduler<defaulttype::Vec3fTypes>;
+#endif
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
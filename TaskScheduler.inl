@@ -0,0 +1,92 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_TASKSCHEDULER_INL
+
+#include "TaskScheduler.h"
+#include <sofa/core/objectmodel/BaseContext.h>
+
+#include <iostream>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+template <class DataTypes>
+TaskScheduler<DataTypes>::TaskScheduler()
+    : Inherit()
+    , niterations(initData(&niterations,1,"niterations","Number of iterations in the tracking process"))
+    , nbThreads(initData(&nbThreads,0,"nbThreads","Number of threads running the parallel loops, the calling one included (0: one per core)"))
+    , pinThreads(initData(&pinThreads,false,"pinThreads","Bind each thread of the pool to one core"))
+    , utilization(initData(&utilization,0.0,"utilization","Busy time of the worker threads of the pool over their wall time, during the last frame (the threads calling the loops are not counted)"))
+    , tasks(initData(&tasks,0,"tasks","Number of chunks of loops run during the last frame"))
+    , steals(initData(&steals,0,"steals","Number of chunks run by another thread than the one they were given to, during the last frame"))
+{
+    this->f_listening.setValue(true);
+    utilization.setReadOnly(true);
+    tasks.setReadOnly(true);
+    steals.setReadOnly(true);
+}
+
+template <class DataTypes>
+TaskScheduler<DataTypes>::~TaskScheduler()
+{
+}
+
+template <class DataTypes>
+void TaskScheduler<DataTypes>::init()
+{
+    this->Inherit::init();
+    TaskPool &pool = TaskPool::instance();
+    pool.configure(nbThreads.getValue(), pinThreads.getValue());
+    std::cout << "TASK POOL threads " << pool.getThreads() << (pinThreads.getValue() ? " pinned" : "") << std::endl;
+}
+
+template <class DataTypes>
+void TaskScheduler<DataTypes>::handleEvent(sofa::core::objectmodel::Event *event)
+{
+    if (!dynamic_cast<simulation::AnimateEndEvent*>(event)) return;
+
+    int t = (int)this->getContext()->getTime();
+    if (t%niterations.getValue() != niterations.getValue() - 1) return;
+
+    TaskPool &pool = TaskPool::instance();
+    TaskPool::Statistics stats = pool.statistics();
+    pool.resetStatistics();
+
+    utilization.setValue(stats.utilization());
+    tasks.setValue(stats.tasks);
+    steals.setValue(stats.steals);
+    std::cout << "TIME TASK POOL " << stats.wall << " utilization " << stats.utilization() << " callers busy " << stats.callerBusy << " loops " << stats.loops << " tasks " << stats.tasks << " steals " << stats.steals << std::endl;
+}
+
+}
+}
+} // namespace sofa
@@ -0,0 +1,155 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#ifndef SOFA_RGBDTRACKING_TRACKINGMONITOR_H
+#define SOFA_RGBDTRACKING_TRACKINGMONITOR_H
+
+#include <RGBDTracking/config.h>
+#include <sofa/core/core.h>
+#include <sofa/core/objectmodel/BaseObject.h>
+#include <sofa/core/objectmodel/Event.h>
+#include <sofa/core/behavior/MechanicalState.h>
+#include <sofa/simulation/AnimateEndEvent.h>
+#include <sofa/defaulttype/VecTypes.h>
+#include <sofa/helper/vector.h>
+#include <sofa/helper/kdTree.inl>
+
+#include "FrameState.h"
+#include "PosePrediction.h"
+#include "RGBDDataProcessing.h"
+
+#include <Eigen/Core>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+using namespace sofa::defaulttype;
+
+/**
+ * Health of the tracking, evaluated at the end of each frame once the mesh has been solved.
+ * The confidence combines three scores in [0,1]: the residual of the target points to the
+ * visible mesh (the fitness score of determineErrorICP, without realigning first), the ratio of
+ * target points with a close mesh point (and the feature inlier ratio when it is linked), and the
+ * change of the segmentation area w.r.t. its average over the confident frames.
+ * The mesh positions of the last confident frame are kept. When the confidence stays below
+ * confidenceThreshold for lossFrames frames, the tracking is lost: at each lost frame the mesh is
+ * relocalized from the last confident positions by an ICP bounded in time, started from a few
+ * hypotheses, and the headless initialization of the segmentation is requested once.
+ * The recovery latency (frames and seconds from the loss to the next confident frame) is reported.
+ */
+template<class DataTypes>
+class TrackingMonitor : public sofa::core::objectmodel::BaseObject
+{
+public:
+    SOFA_CLASS(SOFA_TEMPLATE(TrackingMonitor,DataTypes),sofa::core::objectmodel::BaseObject);
+
+    typedef sofa::core::objectmodel::BaseObject Inherit;
+    typedef typename DataTypes::Real Real;
+    typedef typename DataTypes::Coord Coord;
+    typedef typename DataTypes::VecCoord VecCoord;
+    typedef typename DataTypes::VecDeriv VecDeriv;
+    typedef helper::kdTree<Coord> KDT;
+    typedef typename KDT::distanceSet distanceSet;
+
+    TrackingMonitor();
+    virtual ~TrackingMonitor();
+
+    void init();
+    void handleEvent(sofa::core::objectmodel::Event *event);
+
+    Data<int> niterations;
+    Data<int> startFrame;
+    Data<double> confidenceThreshold;
+    Data<int> lossFrames;
+    Data<double> residualWeight;
+    Data<double> inlierWeight;
+    Data<double> areaWeight;
+    Data<double> residualScale;
+    Data<double> inlierDistance;
+    Data<double> maxCorrespondenceDistance;
+    Data<double> areaTolerance;
+    Data<Real> featureInlierRatio;
+    Data<bool> relocalize;
+    Data<double> relocalizationTime;
+    Data<int> relocalizationIterations;
+    Data<bool> reinitSegmentation;
+
+    // outputs
+    Data<double> confidence;
+    Data<double> residual;
+    Data<double> inlierRatio;
+    Data<double> areaChange;
+    Data<bool> trackingLost;
+    Data<int> recoveryFrames;
+    Data<double> recoveryLatency;
+
+protected:
+    typename core::behavior::MechanicalState<DataTypes> *mstate;
+    typename sofa::core::objectmodel::RGBDDataProcessing<DataTypes>::SPtr rgbddataprocessing;
+    typename sofa::core::objectmodel::PosePrediction<DataTypes>::SPtr poseprediction;
+    typename sofa::core::objectmodel::FrameState<DataTypes>::SPtr framestate;
+
+    VecCoord lastGoodPositions;
+    helper::vector< bool > lastGoodVisible;
+    double areaReference;
+    int lowFrames;
+    int lossFrame;
+    double lossTime;
+
+    KDT sourceKdTree;
+    VecCoord sourcePoints;
+
+    // fitness (mean squared distance of the target points with a mesh point closer than
+    // maxCorrespondenceDistance) and ratio of the target points closer than inlierDistance
+    void evaluateResidual(const VecCoord& source, const VecCoord& target, double& fitness, double& ratio);
+    void visiblePoints(const VecCoord& x, const helper::vector< bool >& visible, VecCoord& points);
+    // returns true when the mesh was moved to a pose better than the current one
+    bool relocalizeMesh(double currentFitness);
+};
+
+
+#if defined(SOFA_EXTERN_TEMPLATE) && !defined(TrackingMonitor_CPP)
+#ifndef SOFA_FLOAT
+extern template class SOFA_RGBDTRACKING_API TrackingMonitor<defaulttype::Vec3dTypes>;
+#endif
+#ifndef SOFA_DOUBLE
+extern template class SOFA_RGBDTRACKING_API TrackingMonitor<defaulttype::Vec3fTypes>;
+#endif
+#endif
+
+
+} //
+
+} //
+
+} // namespace sofa
+
+#endif
@@ -0,0 +1,329 @@
+/******************************************************************************
+*       SOFA, Simulation Open-Framework Architecture, version 1.0 RC 1        *
+*                (c) 2006-2011 MGH, INRIA, USTL, UJF, CNRS                    *
+*                                                                             *
+* This library is free software; you can redistribute it and/or modify it     *
+* under the terms of the GNU Lesser General Public License as published by    *
+* the Free Software Foundation; either version 2.1 of the License, or (at     *
+* your option) any later version.                                             *
+*                                                                             *
+* This library is distributed in the hope that it will be useful, but WITHOUT *
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or       *
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License *
+* for more details.                                                           *
+*                                                                             *
+* You should have received a copy of the GNU Lesser General Public License    *
+* along with this library; if not, write to the Free Software Foundation,     *
+* Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA.          *
+*******************************************************************************
+*                               SOFA :: Modules                               *
+*                                                                             *
+* Authors: The SOFA Team and external contributors (see Authors.txt)          *
+*                                                                             *
+* Contact information: contact@sofa-framework.org                             *
+******************************************************************************/
+
+#define SOFA_RGBDTRACKING_TRACKINGMONITOR_INL
+
+#include "TrackingMonitor.h"
+#include <sofa/core/objectmodel/BaseContext.h>
+#include <sofa/simulation/Node.h>
+#include <sofa/helper/accessor.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/registration/icp.h>
+
+#include <opencv2/core.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace sofa
+{
+
+namespace core
+{
+
+namespace objectmodel
+{
+
+template <class DataTypes>
+TrackingMonitor<DataTypes>::TrackingMonitor()
+    : Inherit()
+    , niterations(initData(&niterations,1,"niterations","Number of iterations in the tracking process"))
+    , startFrame(initData(&startFrame,10,"startFrame","Frame index from which the tracking is monitored"))
+    , confidenceThreshold(initData(&confidenceThreshold,0.5,"confidenceThreshold","Confidence below which the tracking is not trusted"))
+    , lossFrames(initData(&lossFrames,3,"lossFrames","Number of consecutive frames below the threshold before the tracking is declared lost"))
+    , residualWeight(initData(&residualWeight,1.0,"residualWeight","Weight of the residual score in the confidence"))
+    , inlierWeight(initData(&inlierWeight,1.0,"inlierWeight","Weight of the inlier ratio in the confidence"))
+    , areaWeight(initData(&areaWeight,1.0,"areaWeight","Weight of the segmentation area score in the confidence"))
+    , residualScale(initData(&residualScale,0.01,"residualScale","RMS residual (m) for which the residual score is exp(-1)"))
+    , inlierDistance(initData(&inlierDistance,0.01,"inlierDistance","Distance (m) under which a target point has a correspondence on the mesh"))
+    , maxCorrespondenceDistance(initData(&maxCorrespondenceDistance,0.10,"maxCorrespondenceDistance","Distance (m) beyond which the target points are left out of the residual, as in determineErrorICP"))
+    , areaTolerance(initData(&areaTolerance,0.5,"areaTolerance","Relative change of the segmentation area for which the area score is 0"))
+    , featureInlierRatio(initData(&featureInlierRatio,(Real)-1,"featureInlierRatio","Inlier ratio of the feature matches (link to FeatureMatchingForceField), negative when not available"))
+    , relocalize(initData(&relocalize,true,"relocalize","Relocalize the mesh from the last confident positions when the tracking is lost"))
+    , relocalizationTime(initData(&relocalizationTime,0.05,"relocalizationTime","Time budget (s) of the relocalization at each lost frame"))
+    , relocalizationIterations(initData(&relocalizationIterations,50,"relocalizationIterations","Maximum number of ICP iterations of each relocalization hypothesis"))
+    , reinitSegmentation(initData(&reinitSegmentation,true,"reinitSegmentation","Initialize the segmentation again on a loss, when RGBDDataProcessing does it without user interaction (initMode > 0)"))
+    , confidence(initData(&confidence,1.0,"confidence","Confidence of the tracking at the last frame"))
+    , residual(initData(&residual,0.0,"residual","RMS distance (m) of the target points to the visible mesh at the last frame"))
+    , inlierRatio(initData(&inlierRatio,1.0,"inlierRatio","Ratio of target points with a correspondence on the mesh at the last frame"))
+    , areaChange(initData(&areaChange,0.0,"areaChange","Relative change of the segmentation area at the last frame"))
+    , trackingLost(initData(&trackingLost,false,"trackingLost","True while the tracking is lost"))
+    , recoveryFrames(initData(&recoveryFrames,0,"recoveryFrames","Number of frames of the last recovery"))
+    , recoveryLatency(initData(&recoveryLatency,0.0,"recoveryLatency","Duration (s) of the last recovery"))
+{
+    this->f_listening.setValue(true);
+    confidence.setReadOnly(true);
+    residual.setReadOnly(true);
+    inlierRatio.setReadOnly(true);
+    areaChange.setReadOnly(true);
+    trackingLost.setReadOnly(true);
+    recoveryFrames.setReadOnly(true);
+    recoveryLatency.setReadOnly(true);
+    mstate = NULL;
+    areaReference = 0;
+    lowFrames = 0;
+    lossFrame = -1;
+    lossTime = 0;
+}
+
+template <class DataTypes>
+TrackingMonitor<DataTypes>::~TrackingMonitor()
+{
+}
+
+template <class DataTypes>
+void TrackingMonitor<DataTypes>::init()
+{
+    this->Inherit::init();
+    core::objectmodel::BaseContext* context = this->getContext();
+    mstate = dynamic_cast<sofa::core::behavior::MechanicalState<DataTypes> *>(context->getMechanicalState());
+    if (!mstate) serr << "no mechanical state found, the tracking is not monitored" << sendl;
+
+    sofa::simulation::Node::SPtr root = dynamic_cast<simulation::Node*>(this->getContext());
+    root->get(rgbddataprocessing);
+    root->get(poseprediction);
+    root->get(framestate);
+    if (!rgbddataprocessing) serr << "RGBDDataProcessing not found, the tracking is not monitored" << sendl;
+}
+
+template <class DataTypes>
+void TrackingMonitor<DataTypes>::visiblePoints(const VecCoord& x, const helper::vector< bool >& visible, VecCoord& points)
+{
+    // without visibility, all the vertices are candidates: the nearest ones are on the visible side anyway
+    points.clear();
+    if (visible.size() != x.size()) { points = x; return; }
+    for (unsigned int i = 0; i < x.size(); i++)
+        if (visible[i]) points.push_back(x[i]);
+}
+
+template <class DataTypes>
+void TrackingMonitor<DataTypes>::evaluateResidual(const VecCoord& source, const VecCoord& target, double& fitness, double& ratio)
+{
+    fitness = 0;
+    ratio = 0;
+    if (source.size() == 0 || target.size() == 0) return;
+
+    sourceKdTree.build(source);
+    double maxd = maxCorrespondenceDistance.getValue(), ind = inlierDistance.getValue();
+    double sum = 0;
+    int ncorr = 0, ninliers = 0;
+    distanceSet closest;
+    for (unsigned int i = 0; i < target.size(); i++)
+    {
+        sourceKdTree.getNClosest(closest, target[i], source, 1);
+        if (closest.empty()) continue;
+        double d = (target[i] - source[closest.begin()->second]).norm();
+        if (d <= maxd) { sum += d*d; ncorr++; }
+        if (d <= ind) ninliers++;
+    }
+    // no correspondence at all is as bad as every point at the maximum distance
+    fitness = ncorr > 0 ? sum/ncorr : maxd*maxd;
+    ratio = (double)ninliers/(double)target.size();
+}
+
+template <class DataTypes>
+bool TrackingMonitor<DataTypes>::relocalizeMesh(double currentFitness)
+{
+    const VecCoord& tp = rgbddataprocessing->targetPositions.getValue();
+    VecCoord good;
+    visiblePoints(lastGoodPositions, lastGoodVisible, good);
+    if (good.size() < 3 || tp.size() < 3) return false;
+
+    double timeReloc = (double)cv::getTickCount();
+    double budget = relocalizationTime.getValue()*cv::getTickFrequency();
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr source(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr target(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointXYZ> registered;
+    Eigen::Vector3f cs(0,0,0), ct(0,0,0);
+    for (unsigned int i = 0; i < good.size(); i++)
+    {
+        source->points.push_back(pcl::PointXYZ(good[i][0], good[i][1], good[i][2]));
+        cs += source->points.back().getVector3fMap();
+    }
+    for (unsigned int i = 0; i < tp.size(); i++)
+    {
+        target->points.push_back(pcl::PointXYZ(tp[i][0], tp[i][1], tp[i][2]));
+        ct += target->points.back().getVector3fMap();
+    }
+    cs /= (float)good.size();
+    ct /= (float)tp.size();
+
+    // as in RegistrationRigid, the target is registered to the mesh: the mesh motion is the inverse
+    pcl::IterativeClosestPoint<pcl::PointXYZ, pcl::PointXYZ> registration;
+    registration.setInputSource(target);
+    registration.setInputTarget(source);
+    registration.setMaxCorrespondenceDistance(maxCorrespondenceDistance.getValue());
+    registration.setTransformationEpsilon(0.000001);
+
+    // hypotheses: the last confident pose, and the same pose moved onto the centroid of the target
+    std::vector<Eigen::Matrix4f> hypotheses(2, Eigen::Matrix4f::Identity());
+    hypotheses[1].block<3,1>(0,3) = cs - ct;
+
+    // the iterations are run by chunks, the time budget is checked between them
+    const int chunk = 5;
+    double bestFitness = std::numeric_limits<double>::max();
+    Eigen::Matrix4f best = Eigen::Matrix4f::Identity();
+    for (unsigned int h = 0; h < hypotheses.size(); h++)
+    {
+        if ((double)cv::getTickCount() - timeReloc > budget) break;
+        Eigen::Matrix4f guess = hypotheses[h];
+        for (int it = 0; it < relocalizationIterations.getValue(); it += chunk)
+        {
+            Eigen::Matrix4f previous = guess;
+            registration.setMaximumIterations(chunk);
+            registration.align(registered, guess);
+            guess = registration.getFinalTransformation();
+            if ((guess - previous).norm() < 1e-5) break;
+            if ((double)cv::getTickCount() - timeReloc > budget) break;
+        }
+        double fitness = registration.getFitnessScore(maxCorrespondenceDistance.getValue());
+        if (fitness < bestFitness) { bestFitness = fitness; best = guess; }
+    }
+
+    std::cout << "TIME RELOCALIZATION " << ((double)cv::getTickCount() - timeReloc)/cv::getTickFrequency() << std::endl;
+    if (!(bestFitness < currentFitness)) return false;
+
+    Eigen::Matrix4f motion = best.inverse();
+    helper::WriteAccessor< Data<VecCoord> > x = *mstate->write(core::VecCoordId::position());
+    helper::WriteAccessor< Data<VecDeriv> > v = *mstate->write(core::VecDerivId::velocity());
+    if (x.size() != lastGoodPositions.size()) return false;
+    for (unsigned int i = 0; i < x.size(); i++)
+    {
+        const Coord& p = lastGoodPositions[i];
+        for (unsigned int j = 0; j < 3; j++)
+            x[i][j] = motion(j,0)*p[0] + motion(j,1)*p[1] + motion(j,2)*p[2] + motion(j,3);
+    }
+    for (unsigned int i = 0; i < v.size(); i++) v[i].clear();
+    if (poseprediction) poseprediction->resetHistory();
+    return true;
+}
+
+template <class DataTypes>
+void TrackingMonitor<DataTypes>::handleEvent(sofa::core::objectmodel::Event *event)
+{
+    if (!dynamic_cast<simulation::AnimateEndEvent*>(event)) return;
+    if (!mstate || !rgbddataprocessing) return;
+
+    int t = (int)this->getContext()->getTime();
+    if (t%niterations.getValue() != 0) return;
+    int frame = t/niterations.getValue();
+
+    double timeMonitor = (double)cv::getTickCount();
+
+    const VecCoord& x = mstate->read(core::ConstVecCoordId::position())->getValue();
+    helper::vector< bool > visible;
+    if (framestate) visible = framestate->sourceVisible.getValue();
+
+    if (frame < startFrame.getValue())
+    {
+        lastGoodPositions = x;
+        lastGoodVisible = visible;
+        int area = rgbddataprocessing->segmentationArea.getValue();
+        if (area > 0) areaReference = areaReference > 0 ? 0.9*areaReference + 0.1*area : area;
+        return;
+    }
+
+    visiblePoints(x, visible, sourcePoints);
+    double fitness, ratio;
+    evaluateResidual(sourcePoints, rgbddataprocessing->targetPositions.getValue(), fitness, ratio);
+    double rms = sqrt(fitness);
+
+    // each score is in [0,1], the terms without data are left out of the weighted mean
+    double wsum = 0, csum = 0;
+    double sresidual = exp(-rms/residualScale.getValue());
+    wsum += residualWeight.getValue();
+    csum += residualWeight.getValue()*sresidual;
+
+    double sinlier = ratio;
+    if (featureInlierRatio.getValue() >= 0) sinlier = 0.5*(ratio + featureInlierRatio.getValue());
+    wsum += inlierWeight.getValue();
+    csum += inlierWeight.getValue()*sinlier;
+
+    int area = rgbddataprocessing->segmentationArea.getValue();
+    double change = 0;
+    if (area > 0 && areaReference > 0)
+    {
+        change = fabs(area - areaReference)/areaReference;
+        double sarea = std::max(0.0, 1 - change/areaTolerance.getValue());
+        wsum += areaWeight.getValue();
+        csum += areaWeight.getValue()*sarea;
+    }
+
+    double conf = wsum > 0 ? csum/wsum : 1;
+    bool confident = conf >= confidenceThreshold.getValue();
+
+    confidence.setValue(conf);
+    residual.setValue(rms);
+    inlierRatio.setValue(ratio);
+    areaChange.setValue(change);
+
+    if (this->f_printLog.getValue())
+        this->sout << "tracking confidence " << conf << " residual " << rms << " inliers " << ratio << " area change " << change << this->sendl;
+
+    if (confident)
+    {
+        lowFrames = 0;
+        lastGoodPositions = x;
+        lastGoodVisible = visible;
+        if (area > 0) areaReference = areaReference > 0 ? 0.9*areaReference + 0.1*area : area;
+
+        if (trackingLost.getValue())
+        {
+            double latency = ((double)cv::getTickCount() - lossTime)/cv::getTickFrequency();
+            recoveryFrames.setValue(frame - lossFrame);
+            recoveryLatency.setValue(latency);
+            trackingLost.setValue(false);
+            std::cout << "TIME RECOVERY " << latency << " frames " << frame - lossFrame << std::endl;
+        }
+    }
+    else
+    {
+        lowFrames++;
+        if (!trackingLost.getValue() && lowFrames >= lossFrames.getValue())
+        {
+            trackingLost.setValue(true);
+            lossFrame = frame;
+            lossTime = timeMonitor;
+            serr << "tracking lost at frame " << frame << ", confidence " << conf << sendl;
+
+            // without user interaction only: the mouse initialization would block the tracking
+            if (reinitSegmentation.getValue() && rgbddataprocessing->initMode.getValue() > 0)
+                rgbddataprocessing->requestInitialization();
+        }
+        if (trackingLost.getValue() && relocalize.getValue())
+            relocalizeMesh(fitness);
+    }
+
+    std::cout << "TIME TRACKING MONITOR " << ((double)cv::getTickCount() - timeMonitor)/cv::getTickFrequency() << std::endl;
+}
+
+}
+}
+} // namespace sofa
@@ -0,0 +1,85 @@
+/*
+ * SerializationBenchmark.cpp
+ *
+ *  Round trip of 640x480 color and depth frames, and of ROIs of them, through the binary boost
+ *  archives of serialization.h. Prints the throughput of each direction and fails if a frame
+ *  does not come back identical.
+ */
+
+#include "serialization.h"
+
+#include <opencv2/core.hpp>
+
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+
+bool sameMat(const cv::Mat &a, const cv::Mat &b)
+{
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type()) return false;
+    size_t rowSize = a.cols * a.elemSize();
+    for (int i = 0; i < a.rows; i++)
+        if (memcmp(a.ptr(i), b.ptr(i), rowSize) != 0) return false;
+    return true;
+}
+
+// serializes m iterations times, then deserializes the last archive as many times into the same matrix
+bool roundTrip(const char *name, const cv::Mat &m, int iterations)
+{
+    std::string buffer;
+    double t = (double)cv::getTickCount();
+    for (int it = 0; it < iterations; it++)
+    {
+        std::ostringstream os;
+        boost::archive::binary_oarchive oa(os);
+        oa << m;
+        if (it == iterations - 1) buffer = os.str();
+    }
+    double saveTime = ((double)cv::getTickCount() - t)/cv::getTickFrequency();
+
+    cv::Mat loaded;
+    t = (double)cv::getTickCount();
+    for (int it = 0; it < iterations; it++)
+    {
+        std::istringstream is(buffer);
+        boost::archive::binary_iarchive ia(is);
+        ia >> loaded;
+    }
+    double loadTime = ((double)cv::getTickCount() - t)/cv::getTickFrequency();
+
+    double megabytes = (double)(m.rows * m.cols * m.elemSize()) * iterations / (1024.*1024.);
+    bool ok = sameMat(m, loaded) && loaded.isContinuous();
+    std::cout << name << " " << m.cols << "x" << m.rows << " archive " << buffer.size() << " bytes"
+              << " save " << megabytes/saveTime << " MB/s (" << saveTime*1000./iterations << " ms)"
+              << " load " << megabytes/loadTime << " MB/s (" << loadTime*1000./iterations << " ms)"
+              << (ok ? "" : " MISMATCH") << std::endl;
+    return ok;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    if (iterations < 1) iterations = 1;
+
+    cv::Mat color(480, 640, CV_8UC3);
+    cv::Mat depth(480, 640, CV_32FC1);
+    cv::randu(color, cv::Scalar::all(0), cv::Scalar::all(255));
+    cv::randu(depth, cv::Scalar::all(0.3), cv::Scalar::all(2.0));
+
+    // the ROIs are not continuous and go through the row by row path
+    cv::Rect roi(80, 60, 480, 360);
+
+    bool ok = true;
+    ok = roundTrip("color", color, iterations) && ok;
+    ok = roundTrip("depth", depth, iterations) && ok;
+    ok = roundTrip("color roi", color(roi), iterations) && ok;
+    ok = roundTrip("depth roi", depth(roi), iterations) && ok;
+
+    return ok ? 0 : 1;
+}
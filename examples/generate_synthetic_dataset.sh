@@ -0,0 +1,40 @@
+#!/bin/sh
+# Generates a synthetic dataset from the SyntheticData_Cube.scn scenario with several loads,
+# one runSofa batch process per load, JOBS of them in parallel. Each sequence is written to
+# OUT/<name>.bin and OUT/<name>.manifest, and OUT/dataset.manifest lists the sequences.
+#
+# usage: generate_synthetic_dataset.sh [OUT] [JOBS] [NIMAGES]
+
+OUT=${1:-out/synthetic}
+JOBS=${2:-4}
+NIMAGES=${3:-100}
+RUNSOFA=${RUNSOFA:-runSofa}
+SCENE=$(dirname "$0")/SyntheticData_Cube.scn
+DIR=$(cd "$(dirname "$0")" && pwd)
+
+mkdir -p "$OUT"
+OUT=$(cd "$OUT" && pwd)
+
+# one scenario per line: name and total force applied to the cube
+SCENARIOS="cube_x 0.02 0 0
+cube_y 0 0.02 0
+cube_z 0 0 0.02
+cube_xy 0.014 0.014 0
+cube_xz 0.014 0 0.014
+cube_yz 0 0.014 0.014
+cube_xyz 0.012 0.012 0.012
+cube_push 0 0 -0.02"
+
+echo "$SCENARIOS" | while read NAME FX FY FZ; do
+    sed -e "s|totalForce=\"[^\"]*\"|totalForce=\"$FX $FY $FZ\"|" \
+        -e "s|sequenceName = \"[^\"]*\"|sequenceName = \"$NAME\"|" \
+        -e "s|outputPath = \"[^\"]*\"|outputPath = \"$OUT\"|" \
+        -e "s|nimages = \"[^\"]*\"|nimages = \"$NIMAGES\"|" \
+        -e "s|filename=\"mesh/|filename=\"$DIR/mesh/|g" \
+        "$SCENE" > "$OUT/$NAME.scn"
+    echo "$NAME"
+done | xargs -P "$JOBS" -I{} sh -c "$RUNSOFA -g batch -n $((NIMAGES + 1)) \"$OUT/{}.scn\" > \"$OUT/{}.log\" 2>&1"
+
+echo "$SCENARIOS" | while read NAME FX FY FZ; do
+    echo "$NAME.bin $NAME.manifest force $FX $FY $FZ"
+done > "$OUT/dataset.manifest"
@@ -212,40 +212,27 @@ void segmentation::updateMask(cv::Mat &foreground)
         switch(mskt){
         case BBOX:
         {
-            Point pt;
-                std::vector<cv::Point> ptfgd;
-                ptfgd.resize(0);
-
                 switch(type){
                 case CVGRAPHCUT:
                 {
-            for(int x = 0; x<mask.cols; x++)
-                for(int y = 0; y<mask.rows; y++)
-                        if (mask.at<uchar>(y,x) == 1 || mask.at<uchar>(y,x) == 3)
-                        {
-                                pt.x = x;
-                                pt.y = y;
-                                ptfgd.push_back(pt);
-                        }
-                        else if(mask.at<uchar>(y,x) == 0)
-                                mask.at<uchar>(y,x) = 2;
+            // foreground labels are GC_FGD (1) and GC_PR_FGD (3), the background ones become probable
+            cv::Mat fgd;
+            cv::bitwise_and(mask, cv::Scalar(1), fgd);
+            maskStats.compute(fgd);
+            mask.setTo(cv::Scalar(GC_PR_BGD), mask == GC_BGD);
             break;
                 }
                 case CUDAGRAPHCUT:
                 {
-            for(int x = 0; x<mask.cols; x++)
-                for(int y = 0; y<mask.rows; y++)
-                        if (foreground.at<cv::Vec4b>(y,x)[0] > 0 || foreground.at<cv::Vec4b>(y,x)[1] > 0 || foreground.at<cv::Vec4b>(y,x)[2] > 0)
-                        {
-                                pt.x = x;
-                                pt.y = y;
-                                ptfgd.push_back(pt);
-                        }
+            // the background pixels are black
+            cv::Mat bgd;
+            cv::inRange(foreground, cv::Scalar(0,0,0,0), cv::Scalar(0,0,0,255), bgd);
+            maskStats.compute(bgd, 0);
             break;
                 }
                 }
 
-            rectangle = cv::boundingRect(ptfgd);
+            rectangle = maskStats.boundingBox;
             //std::cout << " ptfgd " << frame_count << " rect1 " << rectangle.x << " " << rectangle.y << " rect2 " << rectangle.width << " " << rectangle.height << std::endl;
 
             rectangle.x -= 10;
@@ -253,6 +240,11 @@ void segmentation::updateMask(cv::Mat &foreground)
             rectangle.height += 20;
             rectangle.width += 20;
 
+            // the predicted box only extends the previous one: a wrong prediction (drifted mesh)
+            // cannot clip the segmentation away from the object
+            if (predictedRectangle.area() > 0) rectangle |= predictedRectangle;
+            rectangle &= cv::Rect(0,0,mask.cols,mask.rows);
+
             std::cout << " rect1 " << rectangle.x << " " << rectangle.y << std::endl;
 
             for(int x = 0; x<mask.cols; x++)
@@ -1027,9 +1019,6 @@ void segmentation::trimapFromDt(cv::Mat &_dt,cv::Mat &dot)
 {
 
 mask = cv::Mat::zeros(_dt.size(),CV_8U);
-Point pt;
-std::vector<cv::Point> ptfgd;
-ptfgd.resize(0);
 cv::Mat strip = dot.clone();
 int band = 10;
 for(int x = 0; x<_dt.cols; x++)
@@ -1043,25 +1032,21 @@ for(int x = 0; x<_dt.cols; x++)
                 else if (_dt.at<uchar>(y,x) > band && dot.at<uchar>(y,x) == 0)
                 {
                 mask.at<uchar>(y,x) = 2;
-                pt.x = x;
-                pt.y = y;
-                ptfgd.push_back(pt);
                 strip.at<uchar>(y,x) = 255;
 
                 }
                 else
                 {
                 mask.at<uchar>(y,x) = 1;
-                pt.x = x;
-                pt.y = y;
-                ptfgd.push_back(pt);
                 strip.at<uchar>(y,x) = 127;
                 }
         }
 
-std::cout << " ok bd rect 0 " << ptfgd.size() <<  std::endl;
-if (ptfgd.size() >= 200)
-rectangle = cv::boundingRect(ptfgd);
+// the foreground and probable foreground pixels are the non zero ones
+maskStats.compute(mask);
+std::cout << " ok bd rect 0 " << maskStats.area <<  std::endl;
+if (maskStats.area >= 200)
+rectangle = maskStats.boundingBox;
 
 //cv::imwrite("strip.png",strip);
 //cv::imwrite("dot.png",dot);
@@ -1071,7 +1056,7 @@ rectangle = cv::boundingRect(ptfgd);
 //std::cout << " ok bd rect 1 " << rectangle.x << " " << rectangle.y << std::endl;
 
 
-if (ptfgd.size() < 200)
+if (maskStats.area < 200)
 {
         std::cout << " fail " << std::endl;
         for(int x = 0; x<_dt.cols; x++)
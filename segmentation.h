@@ -23,6 +23,8 @@
 
 #include <RGBDTracking/config.h>
 
+#include "MaskStatistics.h"
+
 #include <cstdio>
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,8 +105,10 @@ masktype mskt;
 //segmentationParameters segParam;
 
 cv::Rect rectangle;
+cv::Rect predictedRectangle; // when not empty, extends the bounding box of the previous foreground
 cv::Mat mask, maskimg;
 cv::Mat distImage, dotImage;
+MaskStatistics maskStats; // foreground statistics of the last mask update
 
 
 
@@ -113,6 +117,7 @@ virtual ~segmentation();
 
 void init(int nghb, int impl, int msk);
 void setRectangle(cv::Rect _rectangle){rectangle = _rectangle;}
+void setPredictedRectangle(cv::Rect _rectangle){predictedRectangle = _rectangle;}
 void segmentationFromRect(cv::Mat &image, cv::Mat &foreground);
 void clear();
 //void setSegmentationParameters(segmentationParameters &_segParam){segParam = _segParam;}
@@ -1,12 +1,20 @@
+#ifndef RGBDTRACKING_SERIALIZATION_H
+#define RGBDTRACKING_SERIALIZATION_H
+
 #include <iostream>
 #include <fstream>
+#include <opencv2/core.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/serialization/split_free.hpp>
+#include <boost/serialization/binary_object.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/serialization/vector.hpp>
 
 
 BOOST_SERIALIZATION_SPLIT_FREE(cv::Mat)
+// version 0: one archive item per byte, version 1: the data as binary blocks
+BOOST_CLASS_VERSION(cv::Mat, 1)
 namespace boost {
     namespace serialization {
 
@@ -20,11 +28,20 @@ namespace boost {
             ar & m.rows;
             ar & elemSize;
             ar & elemType; // element type.
-            size_t dataSize = m.cols * m.rows * m.elemSize();
 
+            // a continuous matrix is written as a single block, a ROI row by row
+            int blocks = m.isContinuous() ? 1 : m.rows;
+            ar & blocks;
 
-            for (size_t dc = 0; dc < dataSize; ++dc) {
-                ar & m.data[dc];
+            size_t rowSize = m.cols * elemSize;
+            if (blocks == 1)
+            {
+                ar & make_binary_object((void*)m.data, rowSize * m.rows);
+            }
+            else
+            {
+                for (int i = 0; i < m.rows; i++)
+                    ar & make_binary_object((void*)m.ptr(i), rowSize);
             }
         }
 
@@ -39,15 +56,41 @@ namespace boost {
             ar & elemSize;
             ar & elemType;
 
+            // the blocks are read straight into the matrix, reused if it already has this size and type
             m.create(rows, cols, elemType);
-            size_t dataSize = m.cols * m.rows * elemSize;
+            size_t rowSize = m.cols * elemSize;
+
+            int blocks = 1;
+            if (version > 0) ar & blocks;
+
+            // a single block needs continuous storage, which a ROI passed in does not have
+            if (blocks == 1 && !m.isContinuous())
+            {
+                m.release();
+                m.create(rows, cols, elemType);
+            }
 
-            std::cout << "reading matrix data rows, cols, elemSize, type, datasize: (" << m.rows << "," << m.cols << "," << m.elemSize() << "," << m.type() << "," << dataSize << ")" << std::endl;
+            if (version == 0)
+            {
+                size_t dataSize = rowSize * m.rows;
+                for (size_t dc = 0; dc < dataSize; ++dc) {
+                    ar & m.data[dc];
+                }
+                return;
+            }
 
-            for (size_t dc = 0; dc < dataSize; ++dc) {
-                ar & m.data[dc];
+            if (blocks == 1)
+            {
+                ar & make_binary_object((void*)m.data, rowSize * m.rows);
+            }
+            else
+            {
+                for (int i = 0; i < m.rows; i++)
+                    ar & make_binary_object((void*)m.ptr(i), rowSize);
             }
         }
 
     }
 }
+
+#endif
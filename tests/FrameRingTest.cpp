@@ -0,0 +1,120 @@
+/*
+ * FrameRingTest.cpp
+ *
+ *  Producer / consumer test of FrameRing: a producer thread publishes numbered frames, saturated
+ *  then paced, while the consumer polls the latest one. Every frame acquired must carry the data
+ *  of its own sequence number (no torn frame), sequence numbers must increase (no reordering),
+ *  the previously acquired frame must stay intact, and acquired + skipped must equal published.
+ *  Prints the throughput and the latency of each run.
+ */
+
+#include "FrameRing.h"
+
+#include <opencv2/core.hpp>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include <iostream>
+#include <cstdlib>
+
+namespace
+{
+
+// the sequence number is stamped on the first and the last element of both images
+void stamp(RGBDFrame &frame, uint32_t sequence)
+{
+    frame.color.create(48, 64, CV_8UC3);
+    frame.depth.create(48, 64, CV_32FC1);
+    uint32_t *c = (uint32_t*)frame.color.data;
+    c[0] = sequence;
+    c[frame.color.total()*3/4 - 1] = sequence;
+    float *d = (float*)frame.depth.data;
+    d[0] = (float)sequence;
+    d[frame.depth.total() - 1] = (float)sequence;
+}
+
+bool intact(const RGBDFrame &frame)
+{
+    const uint32_t *c = (const uint32_t*)frame.color.data;
+    const float *d = (const float*)frame.depth.data;
+    uint32_t sequence = (uint32_t)frame.sequence;
+    return c[0] == sequence && c[frame.color.total()*3/4 - 1] == sequence
+        && d[0] == (float)sequence && d[frame.depth.total() - 1] == (float)sequence;
+}
+
+struct Producer
+{
+    FrameRing *ring;
+    int frames, periodUs;
+    boost::atomic<bool> *done;
+
+    void operator()() const
+    {
+        for (int i = 0; i < frames; i++)
+        {
+            stamp(ring->writeSlot(), (uint32_t)(ring->getPublished() + 1));
+            ring->publish((double)cv::getTickCount());
+            if (periodUs > 0) boost::this_thread::sleep(boost::posix_time::microseconds(periodUs));
+        }
+        done->store(true);
+    }
+};
+
+bool run(const char *name, int frames, int periodUs)
+{
+    FrameRing ring(2);
+    boost::atomic<bool> done(false);
+    Producer producer = {&ring, frames, periodUs, &done};
+
+    double t = (double)cv::getTickCount();
+    boost::thread thread(producer);
+
+    long errors = 0;
+    uint64_t lastSequence = 0;
+    const RGBDFrame *previous = NULL;
+    double latency = 0, maxLatency = 0;
+    for (;;)
+    {
+        bool finished = done.load();
+        const RGBDFrame *frame = ring.acquireLatest();
+        if (!frame)
+        {
+            if (finished) break;
+            continue;
+        }
+        double l = ((double)cv::getTickCount() - frame->timestamp)/cv::getTickFrequency();
+        latency += l;
+        if (l > maxLatency) maxLatency = l;
+
+        if (frame->sequence <= lastSequence || !intact(*frame)) errors++;
+        if (previous && !intact(*previous)) errors++;
+        lastSequence = frame->sequence;
+        previous = frame;
+    }
+    thread.join();
+    t = ((double)cv::getTickCount() - t)/cv::getTickFrequency();
+
+    bool ok = errors == 0 && lastSequence == (uint64_t)frames && ring.getPublished() == (uint64_t)frames
+        && ring.getAcquired() + ring.getSkipped() == ring.getPublished();
+    std::cout << name << " published " << ring.getPublished() << " acquired " << ring.getAcquired()
+              << " skipped " << ring.getSkipped() << " errors " << errors
+              << " throughput " << frames/t << " frames/s"
+              << " latency mean " << latency/ring.getAcquired()*1e6 << " us max " << maxLatency*1e6 << " us"
+              << (ok ? "" : " FAILED") << std::endl;
+    return ok;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 200000;
+    if (frames < 1) frames = 1;
+
+    bool ok = true;
+    ok = run("saturated", frames, 0) && ok;
+    ok = run("paced 200us", frames/100 + 1, 200) && ok;
+
+    return ok ? 0 : 1;
+}